@@ -0,0 +1,326 @@
+//Host board for the Pinata simulator
+//
+//Stands in for everything main.c normally does to the STM32F4 peripherals: the command bytes arrive over a
+//pseudo-terminal or a TCP socket instead of USART3/USB, the TRNG draws from getrandom() and the trigger pin
+//becomes a pair of event hooks. The command dispatcher itself (main.c) and the software crypto run unmodified.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stm32f4xx.h"
+#include "stm32f4xx_gpio.h"
+#include "stm32f4xx_rcc.h"
+#include "stm32f4xx_rng.h"
+#include "io.h"
+#include "support.h"
+#include "trigger.h"
+
+//The firmware entry point; main.c is compiled with main renamed to this
+int pinata_main(void);
+
+//Peripheral state that main.c and the crypto modules write to
+GPIO_TypeDef simulatorGPIO[8];
+SysTick_Type simulatorSysTick;
+const uint32_t simulatorChipID[3] = { 0x50494e41, 0x54415349, 0x4d554c00 }; //"PINATASIMUL"
+
+//Command line options
+static const char *ptyLinkPath = NULL;
+static int tcpPort = 0;
+static int traceTriggers = 0;
+
+//I/O: ioFd is the descriptor the firmware talks over
+static int ioFd = -1;
+static int listenFd = -1;
+
+//Trigger hooks
+static unsigned long triggerCount = 0;
+static struct timespec triggerStart;
+extern volatile uint8_t clockspeed; //MHz, from main.c
+
+//TRNG: refilled from getrandom() in batches, not one syscall per word
+static uint32_t rngPool[64];
+static unsigned rngAvailable = 0;
+
+static void usage(const char *program) {
+	fprintf(stderr,
+			"Usage: %s [--pty [LINK]] [--tcp PORT] [--trace-triggers]\n"
+			"\n"
+			"  --pty [LINK]      serve the Pinata protocol on a new pseudo-terminal (default);\n"
+			"                    LINK is created as a symbolic link to its slave side\n"
+			"  --tcp PORT        serve the Pinata protocol on TCP PORT, one client at a time\n"
+			"  --trace-triggers  log every trigger window and its duration to stderr\n",
+			program);
+}
+
+static void fatal(const char *what) {
+	perror(what);
+	exit(EXIT_FAILURE);
+}
+
+static void openPseudoTerminal(void) {
+	struct termios attributes;
+	const char *slavePath;
+	int keepAliveFd;
+
+	ioFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (ioFd < 0 || grantpt(ioFd) != 0 || unlockpt(ioFd) != 0) {
+		fatal("posix_openpt");
+	}
+	slavePath = ptsname(ioFd);
+	//The line discipline must pass the binary protocol through untouched, whatever the client does
+	if (tcgetattr(ioFd, &attributes) == 0) {
+		cfmakeraw(&attributes);
+		tcsetattr(ioFd, TCSANOW, &attributes);
+	}
+	//Keep the slave side open ourselves, so that reads on the master do not fail with EIO between clients
+	keepAliveFd = open(slavePath, O_RDWR | O_NOCTTY);
+	if (keepAliveFd < 0) {
+		fatal(slavePath);
+	}
+	if (ptyLinkPath) {
+		unlink(ptyLinkPath);
+		if (symlink(slavePath, ptyLinkPath) != 0) {
+			fatal(ptyLinkPath);
+		}
+	}
+	printf("Pinata simulator listening on pty://%s\n", ptyLinkPath ? ptyLinkPath : slavePath);
+	fflush(stdout);
+}
+
+static void acceptClient(void) {
+	const int enable = 1;
+
+	ioFd = accept(listenFd, NULL, NULL);
+	if (ioFd < 0) {
+		fatal("accept");
+	}
+	//Replies are a handful of bytes; do not let Nagle's algorithm hold them back
+	setsockopt(ioFd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+}
+
+static void openListeningSocket(void) {
+	struct sockaddr_in address;
+	const int enable = 1;
+
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenFd < 0) {
+		fatal("socket");
+	}
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(tcpPort);
+	if (bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, 1) != 0) {
+		fatal("bind");
+	}
+	printf("Pinata simulator listening on tcp://localhost:%d\n", tcpPort);
+	fflush(stdout);
+	acceptClient();
+}
+
+//A TCP client went away: wait for the next one. The firmware simply keeps waiting for its next byte.
+static void reconnect(void) {
+	if (listenFd < 0) {
+		fprintf(stderr, "pinata simulator: I/O error on the pseudo-terminal\n");
+		exit(EXIT_FAILURE);
+	}
+	close(ioFd);
+	acceptClient();
+}
+
+int main(int argc, char **argv) {
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--pty") == 0) {
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				ptyLinkPath = argv[++i];
+			}
+		} else if (strcmp(argv[i], "--tcp") == 0 && i + 1 < argc) {
+			tcpPort = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--trace-triggers") == 0) {
+			traceTriggers = 1;
+		} else {
+			usage(argv[0]);
+			return strcmp(argv[i], "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	//A client hanging up mid-reply must not kill the simulator
+	signal(SIGPIPE, SIG_IGN);
+	return pinata_main();
+}
+
+//////Board bring-up (replaces the versions in main.c)//////
+
+void SystemInit(void) {
+}
+
+void init(void) {
+	if (tcpPort) {
+		openListeningSocket();
+	} else {
+		openPseudoTerminal();
+	}
+}
+
+void usart_init(void) {
+}
+
+//A pty or a socket has no line speed: every baud rate is generated exactly, and switching does nothing
+uint32_t usart_achievable_baud_rate(uint32_t baudRate) {
+	return baudRate;
+}
+
+void usart_set_baud_rate(uint32_t baudRate) {
+	(void)baudRate;
+}
+
+void oled_init(void) {
+}
+
+void oled_clear(void) {
+}
+
+void oled_sendchar(const char c) {
+	(void)c;
+}
+
+void oled_sendchars(int nchars, const char *str) {
+	(void)nchars;
+	(void)str;
+}
+
+void send_OLEDcmd_SPI(uint8_t data) {
+	(void)data;
+}
+
+//There is no clock tree to reconfigure; the firmware keeps track of the requested speed itself
+void setClockSpeed(uint8_t speed) {
+	(void)speed;
+}
+
+void setExternalClock(uint8_t source) {
+	(void)source;
+}
+
+void disable_clocks(void) {
+}
+
+void enable_clocks(void) {
+}
+
+//////I/O over the pty/socket//////
+
+void link_get_bytes(uint32_t nbytes, uint8_t *ba) {
+	uint32_t received = 0;
+	ssize_t n;
+
+	while (received < nbytes) {
+		n = read(ioFd, ba + received, nbytes - received);
+		if (n > 0) {
+			received += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			reconnect();
+		}
+	}
+}
+
+void link_send_bytes(uint32_t nbytes, const uint8_t *ba) {
+	uint32_t sent = 0;
+	ssize_t n;
+
+	while (sent < nbytes) {
+		n = write(ioFd, ba + sent, nbytes - sent);
+		if (n > 0) {
+			sent += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			//Nobody is listening any more: drop the reply, the next read picks up the new client
+			return;
+		}
+	}
+}
+
+void link_flush(void) {
+	//link_send_bytes writes straight to the file descriptor
+}
+
+int link_get_char_timeout(uint8_t *ch, uint32_t timeoutMs) {
+	struct pollfd pollFd = { .fd = ioFd, .events = POLLIN };
+	int ready;
+
+	do {
+		ready = poll(&pollFd, 1, (int)timeoutMs);
+	} while (ready < 0 && errno == EINTR);
+	if (ready <= 0) {
+		return 0;
+	}
+	link_get_bytes(1, ch);
+	return 1;
+}
+
+//////TRNG//////
+
+void RCC_AHB2PeriphClockCmd(uint32_t RCC_AHB2Periph, FunctionalState NewState) {
+	(void)RCC_AHB2Periph;
+	(void)NewState;
+}
+
+void RNG_Cmd(FunctionalState NewState) {
+	(void)NewState;
+}
+
+FlagStatus RNG_GetFlagStatus(uint8_t RNG_FLAG) {
+	(void)RNG_FLAG;
+	return SET;
+}
+
+uint32_t RNG_GetRandomNumber(void) {
+	if (rngAvailable == 0) {
+		if (getrandom(rngPool, sizeof(rngPool), 0) != sizeof(rngPool)) {
+			fatal("getrandom");
+		}
+		rngAvailable = sizeof(rngPool) / sizeof(rngPool[0]);
+	}
+	return rngPool[--rngAvailable];
+}
+
+//////Trigger hooks//////
+
+void simulator_trigger_begin(void) {
+	triggerCount++;
+	GPIOC->ODR |= GPIO_Pin_2;
+	clock_gettime(CLOCK_MONOTONIC, &triggerStart);
+}
+
+void simulator_trigger_end(void) {
+	struct timespec triggerEnd;
+	long long duration;
+
+	clock_gettime(CLOCK_MONOTONIC, &triggerEnd);
+	GPIOC->ODR &= ~GPIO_Pin_2;
+	duration = (triggerEnd.tv_sec - triggerStart.tv_sec) * 1000000000LL + (triggerEnd.tv_nsec - triggerStart.tv_nsec);
+	//There is no DWT here: report the host time as cycles at the simulated clock speed
+	triggerCycles = (uint32_t)(duration * clockspeed / 1000);
+	if (traceTriggers) {
+		fprintf(stderr, "trigger %lu: %lld ns\n", triggerCount, duration);
+	}
+}
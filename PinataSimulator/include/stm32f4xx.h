@@ -0,0 +1,58 @@
+#ifndef PINATA_SIMULATOR_STM32F4XX_H
+#define PINATA_SIMULATOR_STM32F4XX_H
+
+//Host stand-in for the CMSIS/StdPeriph STM32F4 headers.
+//Only declares what the command dispatcher and the software crypto modules touch; everything that programs real
+//peripherals is compiled out of main.c with PINATA_HOST_SIMULATOR and replaced by board.c.
+
+#include <stdint.h>
+
+#define __IO volatile
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+typedef enum {ERROR = 0, SUCCESS = !ERROR} ErrorStatus;
+
+//GPIO ports: writes land in plain memory
+typedef struct {
+	__IO uint32_t MODER;
+	__IO uint32_t OTYPER;
+	__IO uint32_t OSPEEDR;
+	__IO uint32_t PUPDR;
+	__IO uint32_t IDR;
+	__IO uint32_t ODR;
+	__IO uint16_t BSRRL;
+	__IO uint16_t BSRRH;
+	__IO uint32_t LCKR;
+	__IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef simulatorGPIO[8];
+
+#define GPIOA (&simulatorGPIO[0])
+#define GPIOB (&simulatorGPIO[1])
+#define GPIOC (&simulatorGPIO[2])
+#define GPIOD (&simulatorGPIO[3])
+#define GPIOE (&simulatorGPIO[4])
+#define GPIOF (&simulatorGPIO[5])
+#define GPIOG (&simulatorGPIO[6])
+#define GPIOH (&simulatorGPIO[7])
+
+//SysTick: main() programs it once at boot
+typedef struct {
+	__IO uint32_t CTRL;
+	__IO uint32_t LOAD;
+	__IO uint32_t VAL;
+	__IO uint32_t CALIB;
+} SysTick_Type;
+
+extern SysTick_Type simulatorSysTick;
+
+#define SysTick (&simulatorSysTick)
+#define SysTick_CTRL_ENABLE_Msk (1UL << 0)
+#define SysTick_CTRL_TICKINT_Msk (1UL << 1)
+#define SysTick_CTRL_CLKSOURCE_Msk (1UL << 2)
+
+void SystemInit(void);
+
+#endif //PINATA_SIMULATOR_STM32F4XX_H
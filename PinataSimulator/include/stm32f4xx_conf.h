@@ -0,0 +1,8 @@
+#ifndef PINATA_SIMULATOR_STM32F4XX_CONF_H
+#define PINATA_SIMULATOR_STM32F4XX_CONF_H
+
+#include "stm32f4xx_gpio.h"
+#include "stm32f4xx_rcc.h"
+#include "stm32f4xx_rng.h"
+
+#endif //PINATA_SIMULATOR_STM32F4XX_CONF_H
@@ -0,0 +1,7 @@
+#ifndef PINATA_SIMULATOR_STM32F4XX_EXTI_H
+#define PINATA_SIMULATOR_STM32F4XX_EXTI_H
+
+//Nothing from this peripheral is used outside the code compiled out for the simulator.
+#include "stm32f4xx.h"
+
+#endif //PINATA_SIMULATOR_STM32F4XX_EXTI_H
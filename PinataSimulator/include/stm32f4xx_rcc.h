@@ -0,0 +1,10 @@
+#ifndef PINATA_SIMULATOR_STM32F4XX_RCC_H
+#define PINATA_SIMULATOR_STM32F4XX_RCC_H
+
+#include "stm32f4xx.h"
+
+#define RCC_AHB2Periph_RNG ((uint32_t)0x00000040)
+
+void RCC_AHB2PeriphClockCmd(uint32_t RCC_AHB2Periph, FunctionalState NewState);
+
+#endif //PINATA_SIMULATOR_STM32F4XX_RCC_H
@@ -0,0 +1,13 @@
+#ifndef PINATA_SIMULATOR_STM32F4XX_RNG_H
+#define PINATA_SIMULATOR_STM32F4XX_RNG_H
+
+#include "stm32f4xx.h"
+
+//The simulated TRNG is always ready and draws from the host's getrandom()
+#define RNG_FLAG_DRDY ((uint8_t)0x0001)
+
+void RNG_Cmd(FunctionalState NewState);
+FlagStatus RNG_GetFlagStatus(uint8_t RNG_FLAG);
+uint32_t RNG_GetRandomNumber(void);
+
+#endif //PINATA_SIMULATOR_STM32F4XX_RNG_H
@@ -0,0 +1,335 @@
+#include "common.hpp"
+#include <benchmark/benchmark.h>
+#include <exception>
+#include <memory>
+#include <openssl/rand.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "crypto_kem/ml-kem-512/clean/api.h"
+#include "crypto_sign/ml-dsa-65/clean/api.h"
+}
+
+namespace {
+
+/// Blocks sent per iteration of a symmetric cipher benchmark.
+constexpr const size_t batchSize = 64;
+
+/// A scripted peer that answers every symmetric cipher request with its own payload: a board with an identity
+/// cipher that takes no time. What remains is the overhead of the client and the transport.
+class EchoBoard {
+  public:
+    void operator()(const uint8_t *data, size_t size, std::vector<uint8_t> &reply) {
+        for (size_t i = 0; i != size; ++i) {
+            if (m_remaining == 0) {
+                m_remaining = getBlockSize(data[i]);
+            } else {
+                reply.push_back(data[i]);
+                --m_remaining;
+            }
+        }
+    }
+
+    static size_t getBlockSize(uint8_t cmd) noexcept {
+        switch (cmd) {
+        case CMD_SWDES_ENC:
+        case CMD_SWDES_DEC:
+        case CMD_SWTDES_ENC:
+        case CMD_SWTDES_DEC:
+            return 8;
+        case CMD_SWAES128FIXSLICED_ENC:
+        case CMD_SWAES128FIXSLICED_DEC:
+            return 32;
+        default:
+            return 16;
+        }
+    }
+
+  private:
+    size_t m_remaining = 0;
+};
+
+/// The board in SERIAL_PORT, opened by the first benchmark that needs it.
+PinataClient *getBoard(benchmark::State &state) {
+    static std::unique_ptr<PinataClient> board;
+    static std::string error;
+    if (!board && error.empty()) {
+        try {
+            board = std::make_unique<PinataClient>();
+            board->getVersion();
+        } catch (const std::exception &ex) {
+            board.reset();
+            error = ex.what();
+        }
+    }
+    if (!board) {
+        state.SkipWithError(error.c_str());
+    }
+    return board.get();
+}
+
+/// Run operation once per iteration, and skip the benchmark when the firmware does not know the command.
+template <class Operation> void run(benchmark::State &state, Operation &&operation) {
+    for (auto _ : state) {
+        try {
+            operation();
+        } catch (const ResponseError &ex) {
+            state.SkipWithError(ex.what());
+            break;
+        }
+    }
+}
+
+/// Encrypt or decrypt batchSize blocks per iteration, with the pipeline depth given by the benchmark argument.
+void symmetricCipher(benchmark::State &state, PinataClient &client, uint8_t cmd) {
+    const size_t blockSize = EchoBoard::getBlockSize(cmd);
+    std::vector<uint8_t> input(batchSize * blockSize);
+    std::vector<uint8_t> output(input.size());
+    RAND_bytes(input.data(), input.size());
+    client.setPipelineDepth(state.range(0));
+    run(state, [&] {
+        client.doSymmetricCipherRequests(cmd, input.data(), blockSize, output.data(), blockSize, batchSize);
+        benchmark::DoNotOptimize(output.data());
+    });
+    client.setPipelineDepth(1);
+    state.SetItemsProcessed(state.iterations() * batchSize);
+    state.SetBytesProcessed(state.iterations() * batchSize * (1 + 2 * blockSize));
+}
+
+void boardSymmetricCipher(benchmark::State &state, uint8_t cmd) {
+    if (PinataClient *board = getBoard(state)) {
+        symmetricCipher(state, *board, cmd);
+    }
+}
+
+void echoSymmetricCipher(benchmark::State &state, uint8_t cmd) {
+    PinataClient client(std::make_unique<LoopbackTransport>(EchoBoard()));
+    symmetricCipher(state, client, cmd);
+}
+
+/// Encrypt or decrypt batchSize blocks per iteration with inputs generated on the board, and read back their hash
+/// only: the throughput of the cipher and the triggers without the link.
+void boardSeededBatchHash(benchmark::State &state, uint8_t cmd) {
+    if (PinataClient *board = getBoard(state)) {
+        BatchSeed seed;
+        RAND_bytes(seed.data(), seed.size());
+        run(state, [&] { benchmark::DoNotOptimize(board->doSeededBatchHash(cmd, seed, batchSize)); });
+        state.SetItemsProcessed(state.iterations() * batchSize);
+        state.SetBytesProcessed(state.iterations() * (7 + seed.size() + 4));
+    }
+}
+
+/// Count one operation per iteration that moves the given number of bytes over the link.
+void setProcessed(benchmark::State &state, size_t bytes) {
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void rsaCrt1024Decrypt(benchmark::State &state) {
+    PinataClient *board = getBoard(state);
+    if (board == nullptr) {
+        return;
+    }
+    // One byte short of the modulus, so that the ciphertext is always smaller than it.
+    std::vector<uint8_t> ciphertext(1024 / 8 - 1);
+    RAND_bytes(ciphertext.data(), ciphertext.size());
+    run(state, [&] { benchmark::DoNotOptimize(board->rsaCrt1024Decrypt(ciphertext.data(), ciphertext.size())); });
+    setProcessed(state, 3 + ciphertext.size() + 2 + 1024 / 8);
+}
+
+void rsaSfmDecrypt(benchmark::State &state) {
+    PinataClient *board = getBoard(state);
+    if (board == nullptr) {
+        return;
+    }
+    std::vector<uint8_t> ciphertext(512 / 8 - 1);
+    RAND_bytes(ciphertext.data(), ciphertext.size());
+    run(state, [&] { benchmark::DoNotOptimize(board->rsaSfmDecrypt(ciphertext.data(), ciphertext.size())); });
+    setProcessed(state, 3 + ciphertext.size() + 2 + 512 / 8);
+}
+
+void ecc25519ScalarMult(benchmark::State &state) {
+    PinataClient *board = getBoard(state);
+    if (board == nullptr) {
+        return;
+    }
+    std::array<uint8_t, 32> seed;
+    Curve25519Bytes scalar;
+    // The base point u = 9.
+    Curve25519Bytes point{9};
+    RAND_bytes(seed.data(), seed.size());
+    RAND_bytes(scalar.data(), scalar.size());
+    run(state, [&] { benchmark::DoNotOptimize(board->ecc25519ScalarMult(seed, scalar, point)); });
+    setProcessed(state, 1 + seed.size() + scalar.size() + point.size() + 32);
+}
+
+void trng(benchmark::State &state) {
+    PinataClient *board = getBoard(state);
+    if (board == nullptr) {
+        return;
+    }
+    run(state, [&] { benchmark::DoNotOptimize(board->getRandomFromTrng()); });
+    setProcessed(state, 1 + sizeof(uint32_t));
+}
+
+/// The board in SERIAL_PORT when it runs the post-quantum firmware.
+PinataClient *getPqcBoard(benchmark::State &state) {
+    static std::optional<FirmwareVariant> variant;
+    PinataClient *board = getBoard(state);
+    if (board == nullptr) {
+        return nullptr;
+    }
+    try {
+        if (!variant) {
+            variant = board->determineFirmwareVariant();
+        }
+    } catch (const std::exception &ex) {
+        state.SkipWithError(ex.what());
+        return nullptr;
+    }
+    if (*variant != FirmwareVariant::PostQuantum) {
+        state.SkipWithError("the board does not run the post-quantum firmware");
+        return nullptr;
+    }
+    return board;
+}
+
+void mldsaSign(benchmark::State &state) {
+    PinataClient *board = getPqcBoard(state);
+    if (board == nullptr) {
+        return;
+    }
+    std::vector<uint8_t> publicKey(PQCLEAN_MLDSA65_CLEAN_CRYPTO_PUBLICKEYBYTES);
+    std::vector<uint8_t> privateKey(PQCLEAN_MLDSA65_CLEAN_CRYPTO_SECRETKEYBYTES);
+    PQCLEAN_MLDSA65_CLEAN_crypto_sign_keypair(publicKey.data(), privateKey.data());
+    board->mldsaSetPublicPrivateKeyPair(publicKey.data(), publicKey.size(), privateKey.data(), privateKey.size());
+    std::array<uint8_t, 16> message;
+    std::vector<uint8_t> signature(PQCLEAN_MLDSA65_CLEAN_CRYPTO_BYTES);
+    RAND_bytes(message.data(), message.size());
+    run(state, [&] { board->mldsaSign(message.data(), message.size(), signature.data(), signature.size()); });
+    setProcessed(state, 1 + message.size() + 1 + signature.size());
+}
+
+void mldsaVerify(benchmark::State &state) {
+    PinataClient *board = getPqcBoard(state);
+    if (board == nullptr) {
+        return;
+    }
+    std::vector<uint8_t> publicKey(PQCLEAN_MLDSA65_CLEAN_CRYPTO_PUBLICKEYBYTES);
+    std::vector<uint8_t> privateKey(PQCLEAN_MLDSA65_CLEAN_CRYPTO_SECRETKEYBYTES);
+    PQCLEAN_MLDSA65_CLEAN_crypto_sign_keypair(publicKey.data(), privateKey.data());
+    board->mldsaSetPublicPrivateKeyPair(publicKey.data(), publicKey.size(), privateKey.data(), privateKey.size());
+    std::array<uint8_t, 16> message;
+    RAND_bytes(message.data(), message.size());
+    std::vector<uint8_t> signedMessage(PQCLEAN_MLDSA65_CLEAN_CRYPTO_BYTES + message.size());
+    size_t signedMessageSize = signedMessage.size();
+    PQCLEAN_MLDSA65_CLEAN_crypto_sign(signedMessage.data(), &signedMessageSize, message.data(), message.size(),
+                                      privateKey.data());
+    run(state, [&] {
+        if (!board->mldsaVerify(signedMessage.data(), signedMessage.size())) {
+            throw std::runtime_error("the board rejected a valid signature");
+        }
+    });
+    setProcessed(state, 1 + signedMessage.size() + 1);
+}
+
+void mlkemGenerate(benchmark::State &state) {
+    PinataClient *board = getPqcBoard(state);
+    if (board == nullptr) {
+        return;
+    }
+    std::vector<uint8_t> publicKey(PQCLEAN_MLKEM512_CLEAN_CRYPTO_PUBLICKEYBYTES);
+    std::vector<uint8_t> privateKey(PQCLEAN_MLKEM512_CLEAN_CRYPTO_SECRETKEYBYTES);
+    PQCLEAN_MLKEM512_CLEAN_crypto_kem_keypair(publicKey.data(), privateKey.data());
+    board->mlkemSetPublicPrivateKeyPair(publicKey.data(), publicKey.size(), privateKey.data(), privateKey.size());
+    std::array<uint8_t, PQCLEAN_MLKEM512_CLEAN_CRYPTO_BYTES> sharedSecret;
+    std::array<uint8_t, PQCLEAN_MLKEM512_CLEAN_CRYPTO_CIPHERTEXTBYTES> ciphertext;
+    run(state, [&] {
+        board->mlkemGenerate(sharedSecret.data(), sharedSecret.size(), ciphertext.data(), ciphertext.size());
+    });
+    setProcessed(state, 1 + 1 + sharedSecret.size() + ciphertext.size());
+}
+
+void mlkemDecode(benchmark::State &state) {
+    PinataClient *board = getPqcBoard(state);
+    if (board == nullptr) {
+        return;
+    }
+    std::vector<uint8_t> publicKey(PQCLEAN_MLKEM512_CLEAN_CRYPTO_PUBLICKEYBYTES);
+    std::vector<uint8_t> privateKey(PQCLEAN_MLKEM512_CLEAN_CRYPTO_SECRETKEYBYTES);
+    PQCLEAN_MLKEM512_CLEAN_crypto_kem_keypair(publicKey.data(), privateKey.data());
+    board->mlkemSetPublicPrivateKeyPair(publicKey.data(), publicKey.size(), privateKey.data(), privateKey.size());
+    std::array<uint8_t, PQCLEAN_MLKEM512_CLEAN_CRYPTO_BYTES> sharedSecret;
+    std::array<uint8_t, PQCLEAN_MLKEM512_CLEAN_CRYPTO_CIPHERTEXTBYTES> ciphertext;
+    PQCLEAN_MLKEM512_CLEAN_crypto_kem_enc(ciphertext.data(), sharedSecret.data(), publicKey.data());
+    run(state, [&] {
+        board->mlkemDecode(ciphertext.data(), ciphertext.size(), sharedSecret.data(), sharedSecret.size());
+    });
+    setProcessed(state, 1 + ciphertext.size() + 1 + sharedSecret.size());
+}
+
+struct SymmetricCipher {
+    const char *name;
+    uint8_t cmd;
+};
+
+constexpr const SymmetricCipher symmetricCiphers[] = {
+    {"SWDESEncrypt", CMD_SWDES_ENC},
+    {"SWDESDecrypt", CMD_SWDES_DEC},
+    {"SWTDESEncrypt", CMD_SWTDES_ENC},
+    {"SWTDESDecrypt", CMD_SWTDES_DEC},
+    {"AES128SWEncrypt", CMD_SWAES128_ENC},
+    {"AES128SWDecrypt", CMD_SWAES128_DEC},
+    {"AES128SWEncryptNoTrigger", CMD_SWAES128SPI_ENC},
+    {"AES128TTablesSWEncrypt", CMD_SWAES128TTABLES_ENC},
+    {"AES128TTablesSWDecrypt", CMD_SWAES128TTABLES_DEC},
+    {"AES128TTablesAsmSWEncrypt", CMD_SWAES128TTABLESASM_ENC},
+    {"AES128TTablesAsmSRAMSWEncrypt", CMD_SWAES128TTABLESASM_SRAM_ENC},
+    {"AES128TTablesAsmSWDecrypt", CMD_SWAES128TTABLESASM_DEC},
+    {"AES128TTablesAsmSRAMSWDecrypt", CMD_SWAES128TTABLESASM_SRAM_DEC},
+    {"AES128FixslicedSWEncrypt", CMD_SWAES128FIXSLICED_ENC},
+    {"AES128FixslicedSWDecrypt", CMD_SWAES128FIXSLICED_DEC},
+    {"AES256SWEncrypt", CMD_SWAES256_ENC},
+    {"AES256SWDecrypt", CMD_SWAES256_DEC},
+    {"AES128MaskingSWEncrypt", CMD_SWAES128_ENC_MASKED},
+    {"AES128MaskingSWDecrypt", CMD_SWAES128_DEC_MASKED},
+    {"AES128SWRndDelaysEncrypt", CMD_SWAES128_ENC_RNDDELAYS},
+    {"AES128SWRndSBoxEncrypt", CMD_SWAES128_ENC_RNDSBOX},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+    benchmark::Initialize(&argc, argv);
+    // The argument of the symmetric cipher benchmarks is the pipeline depth; 7 requests of 17 bytes still fit in
+    // the receive buffer of the USB interface.
+    for (const SymmetricCipher &cipher : symmetricCiphers) {
+        benchmark::RegisterBenchmark((std::string("Board/") + cipher.name).c_str(), boardSymmetricCipher, cipher.cmd)
+            ->Arg(1)
+            ->Arg(7)
+            ->UseRealTime();
+    }
+    for (const SymmetricCipher &cipher : symmetricCiphers) {
+        benchmark::RegisterBenchmark((std::string("Echo/") + cipher.name).c_str(), echoSymmetricCipher, cipher.cmd)
+            ->Arg(1)
+            ->Arg(7)
+            ->UseRealTime();
+    }
+    benchmark::RegisterBenchmark("Board/AES128SWEncryptSeededHash", boardSeededBatchHash, CMD_SWAES128_ENC)
+        ->UseRealTime();
+    benchmark::RegisterBenchmark("Board/SWDESEncryptSeededHash", boardSeededBatchHash, CMD_SWDES_ENC)->UseRealTime();
+    benchmark::RegisterBenchmark("Board/RSACRT1024Decrypt", rsaCrt1024Decrypt)->UseRealTime();
+    benchmark::RegisterBenchmark("Board/RSASFMDecrypt", rsaSfmDecrypt)->UseRealTime();
+    benchmark::RegisterBenchmark("Board/ECC25519ScalarMult", ecc25519ScalarMult)->UseRealTime();
+    benchmark::RegisterBenchmark("Board/TRNG", trng)->UseRealTime();
+    benchmark::RegisterBenchmark("Board/MLDSASign", mldsaSign)->UseRealTime();
+    benchmark::RegisterBenchmark("Board/MLDSAVerify", mldsaVerify)->UseRealTime();
+    benchmark::RegisterBenchmark("Board/MLKEMGenerate", mlkemGenerate)->UseRealTime();
+    benchmark::RegisterBenchmark("Board/MLKEMDecode", mlkemDecode)->UseRealTime();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
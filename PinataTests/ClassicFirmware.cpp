@@ -1,16 +1,22 @@
 #include "TestBase.hpp"
+#include <algorithm>
+#include <bitset>
 #include <array>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/use_future.hpp>
 #include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <gtest/gtest.h>
 #include <openssl/des.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <optional>
+#include <sstream>
 #include <stdexcept>
+#include <vector>
 
 using EVP_CIPHER_CTX_ptr = std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)>;
-using AesBlock = std::array<uint8_t, 16>;
-using DesBlock = std::array<uint8_t, 8>;
 
 class ClassicFirmware : public TestBase {
 
@@ -175,6 +181,57 @@ TEST_F(ClassicFirmware, test128AESTTablesDecrypt) {
     EXPECT_EQ(pt_ref, pt_pinata);
 }
 
+TEST_F(ClassicFirmware, test128AESTTablesAsmEncrypt) {
+    const AesBlock ct_ref = AES128_ecb_encrypt(pt_16bytes, defaultKeyAES);
+    for (bool sramTable : {false, true}) {
+        AesBlock ct_pinata;
+        mClient.AES128TTablesAsmSWEncrypt(pt_16bytes, ct_pinata.data(), sramTable);
+        EXPECT_EQ(ct_ref, ct_pinata) << "sramTable=" << sramTable;
+    }
+}
+
+TEST_F(ClassicFirmware, test128AESTTablesAsmDecrypt) {
+    const AesBlock pt_ref = AES128_ecb_decrypt(ct_16bytes, defaultKeyAES);
+    for (bool sramTable : {false, true}) {
+        AesBlock pt_pinata;
+        mClient.AES128TTablesAsmSWDecrypt(ct_16bytes, pt_pinata.data(), sramTable);
+        EXPECT_EQ(pt_ref, pt_pinata) << "sramTable=" << sramTable;
+    }
+}
+
+TEST_F(ClassicFirmware, test128AESFixsliced) {
+    // Two different blocks in one request, each checked on its own.
+    AesBlockPair pt, ct, pt_pinata;
+    RAND_bytes(pt.data(), pt.size());
+    mClient.AES128FixslicedSWEncrypt(pt.data(), ct.data());
+    for (const size_t offset : {0u, 16u}) {
+        const AesBlock ct_ref = AES128_ecb_encrypt(pt.data() + offset, defaultKeyAES);
+        EXPECT_TRUE(std::equal(ct_ref.begin(), ct_ref.end(), ct.begin() + offset));
+    }
+    mClient.AES128FixslicedSWDecrypt(ct.data(), pt_pinata.data());
+    EXPECT_EQ(pt, pt_pinata);
+}
+
+TEST_F(ClassicFirmware, test128AESFixslicedBatch) {
+    // Every batch block is a pair of AES blocks, encrypted in one trigger window.
+    constexpr size_t pairCount = 100;
+    std::vector<AesBlockPair> plaintexts(pairCount);
+    std::vector<AesBlockPair> ciphertexts(pairCount);
+    std::vector<AesBlockPair> decrypted(pairCount);
+    for (AesBlockPair &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    mClient.doBatchRequests<AesBlockPair>(CMD_SWAES128FIXSLICED_ENC, plaintexts, ciphertexts);
+    for (size_t i = 0; i != pairCount; ++i) {
+        for (const size_t offset : {0u, 16u}) {
+            const AesBlock ct_ref = AES128_ecb_encrypt(plaintexts[i].data() + offset, defaultKeyAES);
+            EXPECT_TRUE(std::equal(ct_ref.begin(), ct_ref.end(), ciphertexts[i].begin() + offset));
+        }
+    }
+    mClient.AES128FixslicedSWDecrypt(ciphertexts, decrypted);
+    EXPECT_EQ(plaintexts, decrypted);
+}
+
 TEST_F(ClassicFirmware, testAES256SWEncrypt) {
     AesBlock ct_ref;
     ct_ref = AES256_ecb_encrypt(pt_16bytes, defaultKeyAES256);
@@ -207,6 +264,29 @@ TEST_F(ClassicFirmware, testAES128MaskingDecrypt) {
     EXPECT_EQ(pt_ref, pt_pinata);
 }
 
+TEST_F(ClassicFirmware, testAES128MaskRefresh) {
+    // Masks kept for several blocks, across the switch between the two mask sets, then back to new masks per block.
+    EXPECT_EQ(mClient.setAES128MaskRefresh(0), 1);
+    constexpr size_t blockCount = 20;
+    std::vector<AesBlock> plaintexts(blockCount);
+    std::vector<AesBlock> ciphertexts(blockCount);
+    std::vector<AesBlock> decrypted(blockCount);
+    for (AesBlock &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    for (const uint16_t interval : {3, 1}) {
+        SCOPED_TRACE(interval);
+        EXPECT_EQ(mClient.setAES128MaskRefresh(interval), interval);
+        mClient.doBatchRequests<AesBlock>(CMD_SWAES128_ENC_MASKED, plaintexts, ciphertexts);
+        mClient.AES128MaskingSWDecrypt(ciphertexts, decrypted);
+        for (size_t i = 0; i != blockCount; ++i) {
+            EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+        }
+        EXPECT_EQ(plaintexts, decrypted);
+    }
+    EXPECT_EQ(mClient.setAES128MaskRefresh(0), 1);
+}
+
 TEST_F(ClassicFirmware, testAES128SWRndDelaysEncrypt) {
     AesBlock ct_ref;
     ct_ref = AES128_ecb_encrypt(pt_16bytes, defaultKeyAES);
@@ -246,3 +326,695 @@ TEST_F(ClassicFirmware, testTDESSWEncrypt) {
     mClient.SWTDESDecrypt(ct_8bytes, pt_pinata.data());
     EXPECT_EQ(pt_ref, pt_pinata);
 }
+
+TEST_F(ClassicFirmware, test128AESSWEncryptPipelined) {
+    constexpr size_t blockCount = 32;
+    std::array<AesBlock, blockCount> plaintexts;
+    std::array<AesBlock, blockCount> ciphertexts;
+    size_t completed = 0;
+    for (AesBlock &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    mClient.setPipelineDepth(4);
+    for (size_t i = 0; i != blockCount; ++i) {
+        mClient.submit(CMD_SWAES128_ENC, plaintexts[i].data(), plaintexts[i].size(), ciphertexts[i].data(), ciphertexts[i].size(),
+                       [&completed, i](const uint8_t *, size_t) { EXPECT_EQ(completed++, i); });
+        EXPECT_LE(mClient.getRequestsInFlight(), 4u);
+    }
+    mClient.flush();
+    mClient.setPipelineDepth(1);
+    EXPECT_EQ(completed, blockCount);
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+    }
+}
+
+TEST_F(ClassicFirmware, testPipelineFitsReceiveRing) {
+    const size_t ringSize = mClient.getCapabilities().usartReceiveRingSize;
+    constexpr size_t blockCount = 128;
+    std::array<AesBlock, blockCount> plaintexts;
+    std::array<AesBlock, blockCount> ciphertexts;
+    for (AesBlock &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    // 128 requests of 17 bytes would lap the 1024-byte ring: the client keeps no more than 60 in flight.
+    mClient.setPipelineDepth(blockCount);
+    for (size_t i = 0; i != blockCount; ++i) {
+        mClient.submit(CMD_SWAES128_ENC, plaintexts[i].data(), plaintexts[i].size(), ciphertexts[i].data(),
+                       ciphertexts[i].size());
+        EXPECT_LE(mClient.getRequestsInFlight() * (1 + AesBlock().size()), ringSize);
+    }
+    mClient.flush();
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+    }
+    std::fill(ciphertexts.begin(), ciphertexts.end(), AesBlock{});
+    mClient.AES128SWEncrypt(plaintexts, ciphertexts);
+    mClient.setPipelineDepth(1);
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+    }
+}
+
+TEST_F(ClassicFirmware, test128AESSWEncryptAwaitable) {
+    if (mClient.getFramedMode()) {
+        GTEST_SKIP() << "awaitable requests are not available in framed mode";
+    }
+    AesBlock pt;
+    std::copy(std::begin(pt_16bytes), std::end(pt_16bytes), pt.begin());
+    boost::asio::io_context &context = mClient.getContext();
+    std::future<AesBlock> ct_pinata =
+        boost::asio::co_spawn(context, mClient.asyncAES128SWEncrypt(pt), boost::asio::use_future);
+    context.run();
+    context.restart();
+    EXPECT_EQ(AES128_ecb_encrypt(pt_16bytes, defaultKeyAES), ct_pinata.get());
+}
+
+TEST_F(ClassicFirmware, test128AESSWEncryptDevicePool) {
+    constexpr size_t blockCount = 64;
+    std::vector<AesBlock> plaintexts(blockCount);
+    for (AesBlock &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    DevicePool &pool = Environment::getInstance().getDevicePool();
+    const std::vector<AesBlock> ciphertexts = pool.map<AesBlock>(
+        Environment::getInstance().getFirmwareVariant(), blockCount, [&plaintexts](PinataClient &client, size_t i) {
+            AesBlock ct;
+            client.AES128SWEncrypt(plaintexts[i].data(), ct.data());
+            return ct;
+        });
+    ASSERT_EQ(ciphertexts.size(), blockCount);
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+    }
+}
+
+TEST_F(ClassicFirmware, testResyncAfterBrokenResponse) {
+    // A scripted board: it answers the version probe, but replies to an encryption with whatever `failure` says.
+    std::vector<uint8_t> failure;
+    PinataClient client(std::make_unique<LoopbackTransport>(
+        [&failure](const uint8_t *data, size_t, std::vector<uint8_t> &reply) {
+            if (data[0] == CMD_GET_CODE_REV) {
+                const char version[] = "Ver 4.0";
+                reply.insert(reply.end(), std::begin(version), std::end(version));
+            } else {
+                reply.insert(reply.end(), failure.begin(), failure.end());
+            }
+        }));
+    const auto reasonFor = [&client, this]() -> std::optional<ResponseError::Reason> {
+        AesBlock ct;
+        try {
+            client.AES128SWEncrypt(pt_16bytes, ct.data());
+        } catch (const ResponseError &ex) {
+            EXPECT_EQ(ex.getCommand(), CMD_SWAES128_ENC);
+            return ex.getReason();
+        }
+        return std::nullopt;
+    };
+
+    // Glitched out of the command loop: 0xFA 0xCC forever.
+    for (size_t i = 0; i != 16; ++i) {
+        failure.push_back(i % 2 == 0 ? 0xFA : 0xCC);
+    }
+    EXPECT_EQ(reasonFor(), ResponseError::Reason::Glitched);
+    EXPECT_EQ(client.getVersion(), std::make_pair(4, 0));
+
+    // Unknown command, followed by a few stray bytes that resync() has to drop.
+    failure = {'B', 'a', 'd', 'C', 'm', 'd', '\n', 0, 'B', 'a', 'd', 'C', 'm', 'd', '\n', 0, 0x12, 0x34};
+    EXPECT_EQ(reasonFor(), ResponseError::Reason::BadCommand);
+    EXPECT_EQ(client.getVersion(), std::make_pair(4, 0));
+
+    // Silence.
+    failure.clear();
+    EXPECT_EQ(reasonFor(), ResponseError::Reason::Timeout);
+    EXPECT_EQ(client.getVersion(), std::make_pair(4, 0));
+}
+
+TEST_F(ClassicFirmware, testResyncCompletesStalledRequest) {
+    if (mClient.getFramedMode()) {
+        GTEST_SKIP() << "Framed mode drops a stalled frame without padding";
+    }
+    mClient.getCapabilities();
+    // A key change that lost most of its payload: the padding becomes the rest of the key.
+    const uint8_t stalledKeyChange[] = {CMD_AES128_KEYCHANGE, 0x01, 0x02, 0x03};
+    mClient.getTransport().write(stalledKeyChange, sizeof(stalledKeyChange));
+    ASSERT_TRUE(mClient.resync());
+    EXPECT_TRUE(mClient.getResyncPadded());
+    uint8_t paddedKey[16];
+    std::fill(std::begin(paddedKey), std::end(paddedKey), CMD_GET_CODE_REV);
+    std::copy(stalledKeyChange + 1, std::end(stalledKeyChange), paddedKey);
+    AesBlock ct{};
+    mClient.AES128SWEncrypt(pt_16bytes, ct.data());
+    EXPECT_EQ(AES128_ecb_encrypt(pt_16bytes, paddedKey), ct);
+    mClient.AES128KeyChange(defaultKeyAES);
+
+    // A batch of 500 DES blocks without its 4000 bytes of payload, more padding than the receive ring holds.
+    const uint8_t stalledBatch[] = {CMD_BATCH, CMD_SWDES_ENC, 0x01, 0xF4, 0, 0};
+    mClient.getTransport().write(stalledBatch, sizeof(stalledBatch));
+    ASSERT_TRUE(mClient.resync());
+    EXPECT_TRUE(mClient.getResyncPadded());
+    EXPECT_EQ(mClient.getVersion(), std::make_pair(4, 0));
+
+    ASSERT_TRUE(mClient.resync());
+    EXPECT_FALSE(mClient.getResyncPadded());
+}
+
+TEST_F(ClassicFirmware, testResyncSilentBoard) {
+    // A board that never answers: resync() probes before and after the padding, and once more in framed mode.
+    size_t probes = 0;
+    size_t padding = 0;
+    PinataClient client(std::make_unique<LoopbackTransport>(
+        [&probes, &padding](const uint8_t *data, size_t size, std::vector<uint8_t> &) {
+            if (size == 1 && data[0] == CMD_GET_CODE_REV) {
+                ++probes;
+            } else if (data[0] == CMD_GET_CODE_REV) {
+                padding += size;
+            }
+        }));
+    EXPECT_FALSE(client.resync());
+    EXPECT_EQ(probes, 3u);
+    EXPECT_EQ(padding, 6144u);
+}
+
+TEST_F(ClassicFirmware, test128AESSWEncryptBulk) {
+    constexpr size_t blockCount = 37;
+    std::vector<AesBlock> plaintexts(blockCount);
+    std::vector<AesBlock> ciphertexts(blockCount);
+    for (AesBlock &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    // Not a multiple of the depth, so the last window is a partial one.
+    mClient.setPipelineDepth(4);
+    mClient.AES128SWEncrypt(plaintexts, ciphertexts);
+    mClient.setPipelineDepth(1);
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+    }
+}
+
+TEST_F(ClassicFirmware, test128AESSWEncryptBatch) {
+    // More than the 256 AES blocks that fit in the firmware's batch buffer, so this takes two requests.
+    constexpr size_t blockCount = 300;
+    std::vector<AesBlock> plaintexts(blockCount);
+    std::vector<AesBlock> ciphertexts(blockCount);
+    for (AesBlock &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    mClient.doBatchRequests<AesBlock>(CMD_SWAES128_ENC, plaintexts, ciphertexts, 100);
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+    }
+}
+
+TEST_F(ClassicFirmware, testDESSWDecryptBatch) {
+    constexpr size_t blockCount = 20;
+    std::vector<DesBlock> ciphertexts(blockCount);
+    std::vector<DesBlock> plaintexts(blockCount);
+    for (DesBlock &ct : ciphertexts) {
+        RAND_bytes(ct.data(), ct.size());
+    }
+    mClient.doBatchRequests<DesBlock>(CMD_SWDES_DEC, ciphertexts, plaintexts);
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(DES_ecb_ref_decrypt(ciphertexts[i].data(), defaultKeyDES), plaintexts[i]);
+    }
+    // The board must still be in sync after a batch.
+    EXPECT_EQ(mClient.getVersion(), std::make_pair(4, 0));
+}
+
+TEST_F(ClassicFirmware, testNegotiateBaudRate) {
+    if (mClient.getFramedMode()) {
+        GTEST_SKIP() << "the baud rate cannot be negotiated in framed mode";
+    }
+    // A rate the board cannot generate: it refuses and stays where it is.
+    EXPECT_EQ(mClient.negotiateBaudRate(0), mClient.getBaudRate());
+    const uint32_t baudRate = mClient.getBaudRate();
+    EXPECT_EQ(mClient.negotiateBaudRate(230400), 230400u);
+    EXPECT_EQ(mClient.getVersion(), std::make_pair(4, 0));
+    EXPECT_EQ(mClient.negotiateBaudRate(baudRate), baudRate);
+    EXPECT_EQ(mClient.getVersion(), std::make_pair(4, 0));
+}
+
+TEST_F(ClassicFirmware, testBaudRateFallback) {
+    // A scripted board that acknowledges the new baud rate, but never hears the confirmation.
+    PinataClient client(std::make_unique<LoopbackTransport>(
+        [](const uint8_t *data, size_t, std::vector<uint8_t> &reply) {
+            if (data[0] == CMD_GET_CODE_REV) {
+                const char version[] = "Ver 4.0";
+                reply.insert(reply.end(), std::begin(version), std::end(version));
+            } else if (data[0] == CMD_SET_BAUD_RATE) {
+                reply.insert(reply.end(), data + 1, data + 5);
+            }
+        }));
+    EXPECT_EQ(client.negotiateBaudRate(921600), PinataDefaultBaudRate);
+    EXPECT_EQ(client.getBaudRate(), PinataDefaultBaudRate);
+    EXPECT_EQ(client.getStatistics()[CMD_SET_BAUD_RATE].errors, 1u);
+}
+
+TEST_F(ClassicFirmware, testBatchInputGenerator) {
+    // The first outputs of xoshiro128** from the state {1, 2, 3, 4}, as published with the reference implementation.
+    const BatchSeed seed = {1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 4, 0, 0, 0};
+    const std::array<uint32_t, 6> expected = {11520, 0, 5927040, 70819200, 2031721883, 1637235492};
+    BatchInputGenerator generator(seed);
+    std::array<uint8_t, 4 * expected.size()> bytes;
+    generator.generate(bytes.data(), bytes.size());
+    for (size_t i = 0; i != expected.size(); ++i) {
+        EXPECT_EQ(boost::endian::load_little_u32(bytes.data() + 4 * i), expected[i]);
+    }
+    // Skipping bytes leaves the generator where generating them would.
+    BatchInputGenerator skipping(seed);
+    skipping.discard(bytes.size());
+    EXPECT_EQ(skipping.getState(), generator.getState());
+}
+
+TEST_F(ClassicFirmware, test128AESSWEncryptSeededBatch) {
+    constexpr size_t blockCount = 300;
+    BatchSeed seed;
+    RAND_bytes(seed.data(), seed.size());
+    std::vector<AesBlock> ciphertexts(blockCount);
+    mClient.doSeededBatchRequests<AesBlock>(CMD_SWAES128_ENC, seed, ciphertexts);
+    BatchInputGenerator generator(seed);
+    for (size_t i = 0; i != blockCount; ++i) {
+        AesBlock pt;
+        generator.generate(pt.data(), pt.size());
+        EXPECT_EQ(AES128_ecb_encrypt(pt.data(), defaultKeyAES), ciphertexts[i]);
+    }
+}
+
+TEST_F(ClassicFirmware, testDESSWEncryptSeededBatchHash) {
+    // Far more blocks than the batch buffer holds: only the hash comes back.
+    constexpr size_t blockCount = 2000;
+    BatchSeed seed;
+    RAND_bytes(seed.data(), seed.size());
+    BatchInputGenerator generator(seed);
+    uint32_t hash = fnv1aHash(nullptr, 0);
+    for (size_t i = 0; i != blockCount; ++i) {
+        DesBlock pt;
+        generator.generate(pt.data(), pt.size());
+        const DesBlock ct = DES_ecb_ref_encrypt(pt.data(), defaultKeyDES);
+        hash = fnv1aHash(ct.data(), ct.size(), hash);
+    }
+    EXPECT_EQ(mClient.doSeededBatchHash(CMD_SWDES_ENC, seed, blockCount), hash);
+}
+
+TEST_F(ClassicFirmware, testCommandRegistry) {
+    const std::vector<CommandDescriptor> commands = mClient.getCommands();
+    ASSERT_FALSE(commands.empty());
+    const auto find = [&](uint8_t cmd) {
+        return std::find_if(commands.begin(), commands.end(), [&](const CommandDescriptor &c) { return c.cmd == cmd; });
+    };
+    ASSERT_NE(find(CMD_GET_CODE_REV), commands.end());
+    EXPECT_EQ(find(CMD_GET_CODE_REV)->inputSize, 0);
+    EXPECT_EQ(find(CMD_GET_CODE_REV)->outputSize, 8);
+    ASSERT_NE(find(CMD_SWAES128_ENC), commands.end());
+    EXPECT_EQ(find(CMD_SWAES128_ENC)->inputSize, 16);
+    EXPECT_EQ(find(CMD_SWAES128_ENC)->outputSize, 16);
+    EXPECT_EQ(find(CMD_SWAES128_ENC)->flags, CommandDescriptor::Trigger | CommandDescriptor::Batchable);
+    EXPECT_EQ(find(CMD_SWAES128SPI_ENC)->flags & CommandDescriptor::Trigger, 0);
+    EXPECT_EQ(find(CMD_GET_COMMANDS)->outputSize, CommandDescriptor::VariableSize);
+    EXPECT_EQ(find(0x00), commands.end());
+
+    // Every batchable command gives the same output in a batch as on its own, with the block size the client uses.
+    for (const CommandDescriptor &c : commands) {
+        if (!(c.flags & CommandDescriptor::Batchable)) {
+            continue;
+        }
+        SCOPED_TRACE(testing::Message() << "command 0x" << std::hex << int(c.cmd));
+        std::vector<uint8_t> input(c.inputSize), single(c.outputSize), batched(c.outputSize);
+        RAND_bytes(input.data(), input.size());
+        mClient.doSymmetricCipherRequest(c.cmd, input.data(), input.size(), single.data(), single.size());
+        mClient.doBatchRequests(c.cmd, input.data(), batched.data(), c.inputSize, 1);
+        EXPECT_EQ(single, batched);
+    }
+}
+
+TEST_F(ClassicFirmware, testTrngDump) {
+    // More than one response frame, and not a whole number of words
+    const std::vector<uint8_t> dump = mClient.dumpTrng(5001);
+    ASSERT_EQ(dump.size(), 5001u);
+    // A monobit test: 1.25% off half of the 40008 bits is five standard deviations
+    size_t ones = 0;
+    for (uint8_t b : dump) {
+        ones += std::bitset<8>(b).count();
+    }
+    EXPECT_NEAR(double(ones) / (dump.size() * 8), 0.5, 0.0125);
+    EXPECT_NE(mClient.dumpTrng(16), mClient.dumpTrng(16));
+}
+
+TEST_F(ClassicFirmware, testCycleCount) {
+    const std::vector<CommandDescriptor> commands = mClient.getCommands();
+    if (std::none_of(commands.begin(), commands.end(),
+                     [](const CommandDescriptor &c) { return c.cmd == CMD_GET_LAST_CYCLES; })) {
+        GTEST_SKIP() << "Firmware built without CYCLE_COUNT";
+    }
+    AesBlock plaintext{}, ciphertext{};
+    mClient.AES128SWEncrypt(plaintext.data(), ciphertext.data());
+    const CycleCount count = mClient.getLastCycles();
+    EXPECT_GT(count.cycles, 0u);
+    EXPECT_GT(count.clockMHz, 0);
+    // Reading the count is no triggered operation: it stays until the next one.
+    EXPECT_EQ(mClient.getLastCycles().cycles, count.cycles);
+}
+
+TEST_F(ClassicFirmware, testCapabilities) {
+    const Capabilities capabilities = mClient.getCapabilities();
+    EXPECT_EQ(capabilities.version, mClient.getVersion());
+    EXPECT_EQ(capabilities.getFirmwareVariant(), FirmwareVariant::Classic);
+    EXPECT_EQ(capabilities.usartReceiveRingSize, 1024);
+    EXPECT_EQ(capabilities.maxFramePayloadSize, 6144);
+    EXPECT_EQ(capabilities.batchBufferSize, 4096);
+    // The bitmap is the command registry.
+    std::bitset<256> registry;
+    for (const CommandDescriptor &c : mClient.getCommands()) {
+        registry.set(c.cmd);
+    }
+    EXPECT_EQ(capabilities.commands, registry);
+    EXPECT_EQ(capabilities.supports(CMD_GET_LAST_CYCLES), bool(capabilities.flags & Capabilities::CycleCount));
+    const auto aesKey = std::find_if(capabilities.keySizes.begin(), capabilities.keySizes.end(),
+                                     [](const Capabilities::KeySize &k) { return k.cmd == CMD_AES128_KEYCHANGE; });
+    ASSERT_NE(aesKey, capabilities.keySizes.end());
+    EXPECT_EQ(aesKey->keySize, 16);
+    EXPECT_EQ(aesKey->privateKeySize, 0);
+
+    // Now that the client knows them, it refuses unknown commands without sending them.
+    ASSERT_FALSE(mClient.supports(0x00));
+    AesBlock block{};
+    EXPECT_THROW(mClient.doSymmetricCipherRequest(0x00, block.data(), block.size(), block.data(), block.size()),
+                 std::invalid_argument);
+    EXPECT_EQ(mClient.getStatistics()[0x00].requests, 0);
+    EXPECT_EQ(mClient.determineFirmwareVariant(), FirmwareVariant::Classic);
+}
+
+TEST_F(ClassicFirmware, testBatchSplitsByReportedBuffer) {
+    // A scripted board with a CMD_BATCH buffer of 1024 bytes that echoes the blocks of every batch.
+    std::vector<size_t> batches;
+    PinataClient client(std::make_unique<LoopbackTransport>(
+        [&batches](const uint8_t *data, size_t size, std::vector<uint8_t> &reply) {
+            if (data[0] == CMD_GET_CAPABILITIES) {
+                std::array<uint8_t, 43> header{4, 0};
+                boost::endian::store_big_u16(header.data() + 8, 1024);
+                std::fill(header.begin() + 10, header.begin() + 42, 0xFF);
+                header[42] = 1;
+                reply.insert(reply.end(), header.begin(), header.end());
+                reply.insert(reply.end(), {CMD_AES128_KEYCHANGE, 0x00, 0x10, 0x00, 0x00});
+            } else if (data[0] == CMD_GET_COMMANDS) {
+                reply.insert(reply.end(), {0x00, 0x01, CMD_SWAES128_ENC, CommandDescriptor::Trigger |
+                                           CommandDescriptor::Batchable, 0x00, 0x10, 0x00, 0x10});
+            } else if (data[0] == CMD_BATCH) {
+                batches.push_back(boost::endian::load_big_u16(data + 2));
+                reply.insert(reply.end(), data + 6, data + size);
+            }
+        }));
+    client.getCapabilities();
+    std::vector<AesBlock> plaintexts(100);
+    for (AesBlock &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    std::vector<AesBlock> ciphertexts(plaintexts.size());
+    client.doBatchRequests<AesBlock>(CMD_SWAES128_ENC, plaintexts, ciphertexts);
+    EXPECT_EQ(batches, std::vector<size_t>({64, 36}));
+    EXPECT_EQ(ciphertexts, plaintexts);
+}
+
+TEST_F(ClassicFirmware, testDetermineLegacyFirmwareVariant) {
+    // A scripted board with classic firmware from before CMD_GET_CAPABILITIES: the client falls back to probing.
+    PinataClient client(std::make_unique<LoopbackTransport>([](const uint8_t *data, size_t size,
+                                                               std::vector<uint8_t> &reply) {
+        const char version[] = "Ver 4.0";
+        const char badCommand[] = "BadCmd\n";
+        if (size != 1) {
+            return; // The payload of CMD_HWAES128_ENC.
+        } else if (data[0] == CMD_GET_CODE_REV) {
+            reply.insert(reply.end(), std::begin(version), std::end(version));
+        } else if (data[0] == CMD_HWAES128_ENC) {
+            reply.insert(reply.end(), 16, '0');
+        } else {
+            reply.insert(reply.end(), std::begin(badCommand), std::end(badCommand));
+        }
+    }));
+    EXPECT_EQ(client.determineFirmwareVariant(), FirmwareVariant::Classic);
+    EXPECT_FALSE(client.getKnownCapabilities());
+    EXPECT_TRUE(client.supports(CMD_GET_CAPABILITIES));
+}
+
+TEST_F(ClassicFirmware, test128AESSWKeyExpansion) {
+    // Both key expansion modes, across a key change and back to the default key for the other tests.
+    AesBlock key;
+    RAND_bytes(key.data(), key.size());
+    for (const bool perCall : {false, true}) {
+        SCOPED_TRACE(perCall ? "per-call key expansion" : "cached round keys");
+        mClient.setAES128SWKeyExpansionPerCall(perCall);
+        for (const uint8_t *k : std::array<const uint8_t *, 2>{key.data(), defaultKeyAES}) {
+            mClient.AES128KeyChange(k);
+            AesBlock ct, pt;
+            mClient.AES128SWEncrypt(pt_16bytes, ct.data());
+            EXPECT_EQ(AES128_ecb_encrypt(pt_16bytes, k), ct);
+            mClient.AES128SWDecrypt(ct.data(), pt.data());
+            EXPECT_TRUE(std::equal(pt.begin(), pt.end(), pt_16bytes));
+        }
+    }
+    mClient.setAES128SWKeyExpansionPerCall(false);
+}
+
+TEST_F(ClassicFirmware, test128AESTTablesKeyChange) {
+    // The T-table and fixsliced key schedules are cached per key: they must follow a key change, and the default key
+    // after it.
+    AesBlock key;
+    RAND_bytes(key.data(), key.size());
+    for (const uint8_t *k : std::array<const uint8_t *, 2>{key.data(), defaultKeyAES}) {
+        mClient.AES128KeyChange(k);
+        const AesBlock ct_ref = AES128_ecb_encrypt(pt_16bytes, k);
+        AesBlock ct, pt;
+        mClient.AES128TTablesSWEncrypt(pt_16bytes, ct.data());
+        EXPECT_EQ(ct_ref, ct);
+        mClient.AES128TTablesSWDecrypt(ct.data(), pt.data());
+        EXPECT_TRUE(std::equal(pt.begin(), pt.end(), pt_16bytes));
+        mClient.AES128TTablesAsmSWEncrypt(pt_16bytes, ct.data(), true);
+        EXPECT_EQ(ct_ref, ct);
+        mClient.AES128TTablesAsmSWDecrypt(ct.data(), pt.data(), true);
+        EXPECT_TRUE(std::equal(pt.begin(), pt.end(), pt_16bytes));
+        AesBlockPair pair, pair_ct;
+        std::copy(pt_16bytes, pt_16bytes + 16, pair.begin());
+        std::copy(pt_16bytes, pt_16bytes + 16, pair.begin() + 16);
+        mClient.AES128FixslicedSWEncrypt(pair.data(), pair_ct.data());
+        EXPECT_TRUE(std::equal(ct_ref.begin(), ct_ref.end(), pair_ct.begin()));
+    }
+}
+
+TEST_F(ClassicFirmware, testFramedMode) {
+    const bool framed = mClient.getFramedMode();
+    mClient.setFramedMode(true);
+    EXPECT_EQ(mClient.getVersion(), std::make_pair(4, 0));
+    constexpr size_t blockCount = 300;
+    std::vector<AesBlock> plaintexts(blockCount);
+    std::vector<AesBlock> ciphertexts(blockCount);
+    for (AesBlock &pt : plaintexts) {
+        RAND_bytes(pt.data(), pt.size());
+    }
+    // Single, bulk and batched requests; the batch responses are longer than a frame.
+    mClient.AES128SWEncrypt(plaintexts[0].data(), ciphertexts[0].data());
+    EXPECT_EQ(AES128_ecb_encrypt(plaintexts[0].data(), defaultKeyAES), ciphertexts[0]);
+    mClient.setPipelineDepth(16);
+    mClient.AES128SWEncrypt(plaintexts, ciphertexts);
+    mClient.setPipelineDepth(1);
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+    }
+    std::fill(ciphertexts.begin(), ciphertexts.end(), AesBlock{});
+    mClient.doBatchRequests<AesBlock>(CMD_SWAES128_ENC, plaintexts, ciphertexts);
+    for (size_t i = 0; i != blockCount; ++i) {
+        EXPECT_EQ(AES128_ecb_encrypt(plaintexts[i].data(), defaultKeyAES), ciphertexts[i]);
+    }
+    mClient.setFramedMode(framed);
+    EXPECT_EQ(mClient.getVersion(), std::make_pair(4, 0));
+}
+
+/// A scripted board in framed mode that echoes payloads and damages as many responses as `damage` says. Like the
+/// firmware, it answers a repeated frame of the last request it ran from its response, without running it again.
+struct FramedEchoBoard {
+    size_t frames = 0;
+    size_t runs = 0;
+    size_t damage = 0;
+    bool framed = false;
+    std::vector<uint8_t> lastRequest;
+    std::vector<uint8_t> lastResponse;
+
+    void operator()(const uint8_t *data, size_t size, std::vector<uint8_t> &reply) {
+        // The legacy CMD_SET_PROTOCOL comes in two writes: the command byte, then the protocol.
+        if (!framed) {
+            if (data[0] != CMD_SET_PROTOCOL) {
+                reply.push_back(data[0]);
+                framed = true;
+            }
+            return;
+        }
+        while (size != 0) {
+            ASSERT_GE(size, 9u);
+            const size_t frameSize = 9 + boost::endian::load_big_u16(data + 3);
+            ASSERT_GE(size, frameSize);
+            ASSERT_EQ(boost::endian::load_big_u32(data + frameSize - 4), frameCrc32(data, frameSize - 4));
+            ++frames;
+            const std::vector<uint8_t> request(data, data + frameSize);
+            if (request != lastRequest) {
+                ++runs;
+                lastRequest = request;
+                lastResponse = {0x5A, data[1], 0x00};
+                if (data[2] == CMD_SET_PROTOCOL) {
+                    lastResponse.insert(lastResponse.end(), {0x00, 0x01, data[5]});
+                } else {
+                    lastResponse.insert(lastResponse.end(), data + 3, data + frameSize - 4);
+                }
+                lastResponse.resize(lastResponse.size() + 4);
+                boost::endian::store_big_u32(lastResponse.data() + lastResponse.size() - 4,
+                                             frameCrc32(lastResponse.data(), lastResponse.size() - 4));
+            }
+            const size_t start = reply.size();
+            reply.insert(reply.end(), lastResponse.begin(), lastResponse.end());
+            if (damage != 0) {
+                reply[start + 5] ^= 0x01;
+                --damage;
+            }
+            data += frameSize;
+            size -= frameSize;
+        }
+    }
+};
+
+TEST_F(ClassicFirmware, testFramedModeRetry) {
+    // The first response is damaged: the request is sent again, and answered without running twice.
+    FramedEchoBoard board;
+    PinataClient client(std::make_unique<LoopbackTransport>(std::ref(board)));
+    client.setFramedMode(true);
+    EXPECT_TRUE(client.getFramedMode());
+    board.damage = 1;
+    AesBlock pt;
+    std::copy(std::begin(pt_16bytes), std::end(pt_16bytes), pt.begin());
+    AesBlock ct;
+    const size_t frames = board.frames;
+    const size_t runs = board.runs;
+    client.AES128SWEncrypt(pt.data(), ct.data());
+    EXPECT_EQ(ct, pt);
+    EXPECT_EQ(board.frames - frames, 2u);
+    EXPECT_EQ(board.runs - runs, 1u);
+    client.setFramedMode(false);
+    EXPECT_FALSE(client.getFramedMode());
+}
+
+TEST_F(ClassicFirmware, testFramedModeNoRetryInPipeline) {
+    // The first of two pipelined responses is damaged: the second request ran already, so neither is sent again.
+    FramedEchoBoard board;
+    PinataClient client(std::make_unique<LoopbackTransport>(std::ref(board)));
+    client.setAutoResync(false);
+    client.setFramedMode(true);
+    client.setPipelineDepth(2);
+    board.damage = 1;
+    std::array<AesBlock, 2> plaintexts{};
+    std::array<AesBlock, 2> ciphertexts{};
+    const size_t frames = board.frames;
+    const size_t runs = board.runs;
+    try {
+        client.AES128SWEncrypt(plaintexts, ciphertexts);
+        ADD_FAILURE() << "a damaged response in a pipeline must fail the request";
+    } catch (const ResponseError &ex) {
+        EXPECT_EQ(ex.getReason(), ResponseError::Reason::CorruptFrame);
+    }
+    EXPECT_EQ(board.frames - frames, 2u);
+    EXPECT_EQ(board.runs - runs, 2u);
+    client.setPipelineDepth(1);
+    client.setFramedMode(false);
+    EXPECT_FALSE(client.getFramedMode());
+}
+
+TEST_F(ClassicFirmware, testLatencyHistogramBuckets) {
+    // Exact below 128 µs; above, 64 buckets per power of two: 128 and 129 share a bucket, 255 ends one, 256 starts one.
+    LatencyHistogram histogram;
+    for (const int value : {127, 128, 129, 255, 256}) {
+        histogram.record(std::chrono::microseconds(value));
+    }
+    std::ostringstream json;
+    histogram.writeJson(json);
+    EXPECT_NE(json.str().find("\"buckets\": [[127, 1], [129, 2], [255, 1], [259, 1]]"), std::string::npos)
+        << json.str();
+    EXPECT_EQ(histogram.getCount(), 5u);
+    EXPECT_EQ(histogram.getTotal(), 127u + 128u + 129u + 255u + 256u);
+    EXPECT_EQ(histogram.getMin(), 127u);
+    EXPECT_EQ(histogram.getMax(), 256u);
+    // A percentile is the highest value of its bucket, but never above the largest value recorded.
+    EXPECT_EQ(histogram.getPercentile(20), 127u);
+    EXPECT_EQ(histogram.getPercentile(40), 129u);
+    EXPECT_EQ(histogram.getPercentile(60), 129u);
+    EXPECT_EQ(histogram.getPercentile(80), 255u);
+    EXPECT_EQ(histogram.getPercentile(100), 256u);
+}
+
+TEST_F(ClassicFirmware, testLatencyHistogramPercentiles) {
+    // 1 to 1000 µs, each once: percentile p is p * 10 µs, to within the resolution of its bucket.
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.getPercentile(50), 0u);
+    for (int value = 1000; value != 0; --value) {
+        histogram.record(std::chrono::microseconds(value));
+    }
+    EXPECT_EQ(histogram.getPercentile(0), 1u);
+    EXPECT_EQ(histogram.getPercentile(10), 100u);
+    EXPECT_EQ(histogram.getPercentile(50), 503u);
+    EXPECT_EQ(histogram.getPercentile(99), 991u);
+    EXPECT_EQ(histogram.getPercentile(100), 1000u);
+    for (const double percentile : {50.0, 90.0, 99.0, 99.9}) {
+        const double exact = percentile * 10;
+        EXPECT_GE(double(histogram.getPercentile(percentile)), exact);
+        EXPECT_LE(double(histogram.getPercentile(percentile)), exact * 1.016);
+    }
+    EXPECT_DOUBLE_EQ(histogram.getMean(), 500.5);
+}
+
+TEST_F(ClassicFirmware, testLatencyHistogramMerge) {
+    // The shorter histogram grows to the buckets of the longer one; merging the other way leaves its buckets alone.
+    LatencyHistogram shorter;
+    shorter.record(std::chrono::microseconds(10));
+    LatencyHistogram longer;
+    longer.record(std::chrono::microseconds(10));
+    longer.record(std::chrono::microseconds(5000));
+    LatencyHistogram empty;
+    shorter.merge(longer);
+    shorter.merge(empty);
+    EXPECT_EQ(shorter.getCount(), 3u);
+    EXPECT_EQ(shorter.getTotal(), 5020u);
+    EXPECT_EQ(shorter.getMin(), 10u);
+    EXPECT_EQ(shorter.getMax(), 5000u);
+    EXPECT_EQ(shorter.getPercentile(60), 10u);
+    EXPECT_EQ(shorter.getPercentile(100), 5000u);
+    std::ostringstream json;
+    shorter.writeJson(json);
+    EXPECT_NE(json.str().find("\"buckets\": [[10, 2], [5055, 1]]"), std::string::npos) << json.str();
+
+    longer.merge(shorter);
+    std::ostringstream longerJson;
+    longer.writeJson(longerJson);
+    EXPECT_NE(longerJson.str().find("\"buckets\": [[10, 3], [5055, 2]]"), std::string::npos) << longerJson.str();
+}
+
+TEST_F(ClassicFirmware, testStatisticsJson) {
+    Statistics statistics;
+    CommandStatistics &command = statistics[CMD_SWAES128_ENC];
+    command.requests = 2;
+    command.errors = 1;
+    command.bytesWritten = 34;
+    command.bytesRead = 16;
+    command.writeLatency.record(std::chrono::microseconds(3));
+    command.readLatency.record(std::chrono::microseconds(200));
+    command.readLatency.record(std::chrono::microseconds(300));
+    std::ostringstream json;
+    statistics.writeJson(json);
+
+    // The wall time depends on the clock; everything after it does not.
+    const std::string output = json.str();
+    ASSERT_EQ(output.rfind("{\"wallTimeUs\": ", 0), 0u) << output;
+    const size_t rest = output.find(", \"writeTimeUs\"");
+    ASSERT_NE(rest, std::string::npos) << output;
+    EXPECT_EQ(output.substr(rest),
+              ", \"writeTimeUs\": 3, \"readTimeUs\": 500, \"commands\": {\n"
+              "    \"0xae\": {\"requests\": 2, \"errors\": 1, \"bytesWritten\": 34, \"bytesRead\": 16,\n"
+              "        \"write\": {\"count\": 1, \"totalUs\": 3, \"minUs\": 3, \"meanUs\": 3.0, \"p50Us\": 3, "
+              "\"p90Us\": 3, \"p99Us\": 3, \"p999Us\": 3, \"maxUs\": 3, \"buckets\": [[3, 1]]},\n"
+              "        \"read\": {\"count\": 2, \"totalUs\": 500, \"minUs\": 200, \"meanUs\": 250.0, \"p50Us\": 201, "
+              "\"p90Us\": 300, \"p99Us\": 300, \"p999Us\": 300, \"maxUs\": 300, \"buckets\": [[201, 1], [303, 1]]}}}}");
+}
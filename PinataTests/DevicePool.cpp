@@ -0,0 +1,122 @@
+#include "DevicePool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+Device::Device(const std::string &uri) : m_uri(uri), m_client(uri.c_str()) {
+    m_firmwareVariant = m_client.determineFirmwareVariant();
+    // One round trip less on firmware that reports its capabilities.
+    if (const std::optional<Capabilities> &capabilities = m_client.getKnownCapabilities()) {
+        std::tie(m_versionMajor, m_versionMinor) = capabilities->version;
+    } else {
+        std::tie(m_versionMajor, m_versionMinor) = m_client.getVersion();
+    }
+    m_roundTripTimes = m_client.measureRoundTrip();
+}
+
+std::vector<std::string> DevicePool::getSerialPorts() {
+    const char *serialPorts = std::getenv("SERIAL_PORTS");
+    if (serialPorts == nullptr) {
+        return {getSerialPortFilePath()};
+    }
+    std::vector<std::string> result;
+    std::string port;
+    for (const char *c = serialPorts;; ++c) {
+        if (*c == '\0' || *c == ',' || std::isspace(static_cast<unsigned char>(*c))) {
+            if (!port.empty()) {
+                result.push_back(std::move(port));
+                port.clear();
+            }
+            if (*c == '\0') {
+                break;
+            }
+        } else {
+            port.push_back(*c);
+        }
+    }
+    if (result.empty()) {
+        throw std::logic_error("SERIAL_PORTS environment variable does not list any serial port");
+    }
+    return result;
+}
+
+DevicePool::DevicePool() : DevicePool(getSerialPorts()) {}
+
+DevicePool::DevicePool(const std::vector<std::string> &uris) {
+    m_devices.reserve(uris.size());
+    for (const std::string &uri : uris) {
+        m_devices.push_back(std::make_unique<Device>(uri));
+    }
+}
+
+size_t DevicePool::countDevices(FirmwareVariant variant) const noexcept {
+    return std::count_if(m_devices.begin(), m_devices.end(), [variant](const std::unique_ptr<Device> &device) {
+        return device->getFirmwareVariant() == variant;
+    });
+}
+
+std::vector<Device *> DevicePool::acquire(FirmwareVariant variant) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Device *> result;
+    for (const std::unique_ptr<Device> &device : m_devices) {
+        if (device->m_firmwareVariant == variant && !device->m_busy) {
+            device->m_busy = true;
+            result.push_back(device.get());
+        }
+    }
+    return result;
+}
+
+void DevicePool::release(const std::vector<Device *> &devices) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Device *device : devices) {
+        device->m_busy = false;
+    }
+}
+
+void DevicePool::forEach(FirmwareVariant variant, size_t count, const Operation &operation) {
+    if (count == 0) {
+        return;
+    }
+    const std::vector<Device *> devices = acquire(variant);
+    if (devices.empty()) {
+        throw std::runtime_error("no idle Pinata with the requested firmware variant");
+    }
+
+    std::atomic<size_t> next{0};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    auto work = [&](Device *device) {
+        for (size_t index = next++; index < count; index = next++) {
+            try {
+                operation(device->getClient(), index);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                // Make the other boards stop after their current operation.
+                next = count;
+                return;
+            }
+        }
+    };
+
+    {
+        std::vector<std::jthread> threads;
+        threads.reserve(devices.size() - 1);
+        for (size_t i = 1; i != devices.size(); ++i) {
+            threads.emplace_back(work, devices[i]);
+        }
+        // The calling thread drives the first board itself.
+        work(devices.front());
+    }
+    release(devices);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common.hpp"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// One Pinata of a DevicePool, with the version and firmware variant it reported when it was opened.
+class Device {
+  public:
+    /// Connect to the Pinata at uri, ask for its version and firmware variant and measure the round trip time.
+    explicit Device(const std::string &uri);
+
+    const std::string &getUri() const noexcept { return m_uri; }
+    PinataClient &getClient() noexcept { return m_client; }
+    int getVersionMajor() const noexcept { return m_versionMajor; }
+    int getVersionMinor() const noexcept { return m_versionMinor; }
+    FirmwareVariant getFirmwareVariant() const noexcept { return m_firmwareVariant; }
+    const RoundTripTimes &getRoundTripTimes() const noexcept { return m_roundTripTimes; }
+
+  private:
+    friend class DevicePool;
+
+    std::string m_uri;
+    PinataClient m_client;
+    int m_versionMajor = 0;
+    int m_versionMinor = 0;
+    FirmwareVariant m_firmwareVariant = FirmwareVariant::Classic;
+    RoundTripTimes m_roundTripTimes;
+    /// Set while a DevicePool::forEach call is using the device; guarded by the pool's mutex.
+    bool m_busy = false;
+};
+
+/// A rack of Pinatas that a batch of operations can be spread over.
+///
+/// Every board of the requested firmware variant that is not busy with another batch gets its own thread. Each thread
+/// takes the next operation as soon as its board finishes the previous one, so faster links do more of the work and
+/// the throughput grows with the number of boards.
+class DevicePool {
+  public:
+    using Operation = std::function<void(PinataClient &client, size_t index)>;
+
+    /// The ports listed in the SERIAL_PORTS environment variable, separated by commas or whitespace. Falls back to
+    /// the single SERIAL_PORT when SERIAL_PORTS is not defined.
+    static std::vector<std::string> getSerialPorts();
+
+    /// Open every port returned by getSerialPorts().
+    DevicePool();
+
+    /// Open every port in uris. Throws when any of them does not answer.
+    explicit DevicePool(const std::vector<std::string> &uris);
+
+    DevicePool(const DevicePool &) = delete;
+    DevicePool &operator=(const DevicePool &) = delete;
+
+    size_t size() const noexcept { return m_devices.size(); }
+    Device &getDevice(size_t index) noexcept { return *m_devices[index]; }
+
+    /// The number of boards running the given firmware variant, busy or not.
+    size_t countDevices(FirmwareVariant variant) const noexcept;
+
+    /// Call operation for every index in [0, count) on the idle boards running the given firmware variant, and
+    /// return once all calls are done. The order in which indices are handed out is not the order in which they
+    /// complete. When an operation throws, no new operations are started and the first exception is rethrown.
+    /// Throws std::runtime_error when there is no idle board of the given variant.
+    void forEach(FirmwareVariant variant, size_t count, const Operation &operation);
+
+    /// Like forEach, but collect the value returned by every call. The results are in index order, whichever board
+    /// produced them.
+    template <class Result>
+    std::vector<Result> map(FirmwareVariant variant, size_t count,
+                            const std::function<Result(PinataClient &client, size_t index)> &operation) {
+        std::vector<Result> results(count);
+        forEach(variant, count,
+                [&results, &operation](PinataClient &client, size_t index) { results[index] = operation(client, index); });
+        return results;
+    }
+
+  private:
+    std::vector<Device *> acquire(FirmwareVariant variant);
+    void release(const std::vector<Device *> &devices);
+
+    std::vector<std::unique_ptr<Device>> m_devices;
+    std::mutex m_mutex;
+};
@@ -1,6 +1,7 @@
 #include "Environment.hpp"
 #include <boost/system/system_error.hpp>
 #include <cassert>
+#include <fstream>
 #include <iostream>
 
 Environment *Environment::gInstance = nullptr;
@@ -21,10 +22,9 @@ Environment &Environment::getInstance() noexcept {
 }
 
 void Environment::SetUp() {
-    assert(!mClient.has_value());
-    mClient.emplace();
+    assert(!mDevicePool.has_value());
     try {
-        std::tie(mClientVersionMajor, mClientVersionMinor) = mClient->getVersion();
+        mDevicePool.emplace();
     } catch (const boost::system::system_error &ex) {
         std::cerr
             << "Unable to retrieve the version information from the device. This is a sanity check to see "
@@ -32,15 +32,75 @@ void Environment::SetUp() {
                "will start failing. So we stop here.\n";
         throw;
     }
-    mFirmwareVariant = mClient->determineFirmwareVariant();
+    for (size_t i = 0; i != mDevicePool->size(); ++i) {
+        printLinkReport(mDevicePool->getDevice(i));
+        if (mBaudRate != 0) {
+            PinataClient &client = mDevicePool->getDevice(i).getClient();
+            const uint32_t baudRate = client.negotiateBaudRate(mBaudRate);
+            std::cout << "  baud rate: " << baudRate << (baudRate == mBaudRate ? "" : " (switch refused or failed)")
+                      << ", round trip " << client.measureRoundTrip().median.count() << " us median\n";
+        }
+        if (mFramed) {
+            PinataClient &client = mDevicePool->getDevice(i).getClient();
+            client.setFramedMode(true);
+            std::cout << "  framed mode, round trip " << client.measureRoundTrip().median.count() << " us median\n";
+        }
+    }
+    Device &device = mDevicePool->getDevice(0);
+    mClientVersionMajor = device.getVersionMajor();
+    mClientVersionMinor = device.getVersionMinor();
+    mFirmwareVariant = device.getFirmwareVariant();
+}
+
+void Environment::printLinkReport(Device &device) {
+    const RoundTripTimes &times = device.getRoundTripTimes();
+    std::cout << "Pinata " << device.getVersionMajor() << '.' << device.getVersionMinor() << " at "
+              << device.getUri() << ": round trip " << times.median.count() << " us median, " << times.min.count()
+              << ".." << times.max.count() << " us\n";
+    const LinkTuning &tuning = device.getClient().getLinkTuning();
+    for (const std::string &setting : tuning.applied) {
+        std::cout << "  tuned: " << setting << '\n';
+    }
+    for (const std::string &setting : tuning.skipped) {
+        std::cout << "  not tuned: " << setting << '\n';
+    }
 }
 
 void Environment::TearDown() {
-    assert(mClient.has_value());
-    mClient.reset();
+    assert(mDevicePool.has_value());
+    if (!mStatisticsPath.empty()) {
+        writeStatistics();
+    }
+    mDevicePool.reset();
+}
+
+void Environment::writeStatistics() {
+    std::ofstream file(mStatisticsPath);
+    if (!file) {
+        std::cerr << "Unable to write the statistics to " << mStatisticsPath << '\n';
+        return;
+    }
+    Statistics total;
+    file << "{\"devices\": [";
+    for (size_t i = 0; i != mDevicePool->size(); ++i) {
+        Device &device = mDevicePool->getDevice(i);
+        const Statistics &statistics = device.getClient().getStatistics();
+        total.merge(statistics);
+        file << (i == 0 ? "" : ",") << "\n  {\"uri\": \"" << device.getUri() << "\", \"statistics\": ";
+        statistics.writeJson(file);
+        file << '}';
+    }
+    file << "],\n\"total\": ";
+    total.writeJson(file);
+    file << "}\n";
 }
 
 PinataClient &Environment::getClient() noexcept {
-    assert(mClient.has_value());
-    return *mClient;
+    assert(mDevicePool.has_value());
+    return mDevicePool->getDevice(0).getClient();
+}
+
+DevicePool &Environment::getDevicePool() noexcept {
+    assert(mDevicePool.has_value());
+    return *mDevicePool;
 }
@@ -1,18 +1,25 @@
 #pragma once
 
-#include "common.hpp"
+#include "DevicePool.hpp"
 #include <gtest/gtest.h>
 #include <optional>
+#include <string>
 
-/// Global gtest environment to maintain a connection to a Pinata device.
+/// Global gtest environment to maintain the connections to the Pinata devices.
 class Environment : public ::testing::Environment {
   private:
-    std::optional<PinataClient> mClient;
+    std::optional<DevicePool> mDevicePool;
     int mClientVersionMajor = 0;
     int mClientVersionMinor = 0;
     FirmwareVariant mFirmwareVariant = FirmwareVariant::Classic;
+    std::string mStatisticsPath;
+    uint32_t mBaudRate = 0;
+    bool mFramed = false;
     static Environment *gInstance;
 
+    void writeStatistics();
+    static void printLinkReport(Device &device);
+
   public:
     Environment() noexcept;
     Environment(const Environment &) = delete;
@@ -21,18 +28,30 @@ class Environment : public ::testing::Environment {
     Environment &operator=(Environment &&) = delete;
     ~Environment() noexcept;
 
-    /// Set up a connection to the Pinata device.
+    /// Set up a connection to every Pinata device in SERIAL_PORTS (or the one in SERIAL_PORT).
     void SetUp() override;
 
-    /// Tear down the connection to the Pinata device.
+    /// Tear down the connections to the Pinata devices, after writing their statistics if requested.
     void TearDown() override;
 
+    /// Write the statistics of every device as JSON to path when the devices are torn down.
+    void setStatisticsPath(const std::string &path) { mStatisticsPath = path; }
+
+    /// Switch every device to baudRate with PinataClient::negotiateBaudRate() once it is connected.
+    void setBaudRate(uint32_t baudRate) { mBaudRate = baudRate; }
+
+    /// Switch every device to framed mode with PinataClient::setFramedMode(), after the baud rate.
+    void setFramedMode(bool framed) { mFramed = framed; }
+
     /// Get a reference to the global instance of this class.
     static Environment &getInstance() noexcept;
 
-    /// Get a reference to the connection.
+    /// Get a reference to the connection to the first device.
     PinataClient &getClient() noexcept;
 
+    /// Get a reference to all devices, for spreading work over them.
+    DevicePool &getDevicePool() noexcept;
+
     /// Get the client's major version number.
     int getClientVersionMajor() const noexcept { return mClientVersionMajor; }
 
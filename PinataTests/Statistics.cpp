@@ -0,0 +1,144 @@
+#include "Statistics.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iomanip>
+
+namespace {
+
+/// Values below this are counted exactly.
+constexpr const uint64_t linearLimit = 128;
+/// Buckets per power of two above linearLimit.
+constexpr const uint64_t subBuckets = 64;
+
+} // namespace
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) noexcept {
+    if (value < linearLimit) {
+        return value;
+    }
+    // Shift the value down until it lies in [subBuckets, 2 * subBuckets).
+    const unsigned shift = std::bit_width(value) - std::bit_width(2 * subBuckets - 1);
+    return linearLimit + (shift - 1) * subBuckets + ((value >> shift) - subBuckets);
+}
+
+uint64_t LatencyHistogram::bucketHighestValue(size_t index) noexcept {
+    if (index < linearLimit) {
+        return index;
+    }
+    const unsigned shift = (index - linearLimit) / subBuckets + 1;
+    const uint64_t subBucket = (index - linearLimit) % subBuckets + subBuckets;
+    return ((subBucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(std::chrono::microseconds latency) {
+    const uint64_t value = latency.count() < 0 ? 0 : latency.count();
+    const size_t index = bucketIndex(value);
+    if (index >= m_buckets.size()) {
+        m_buckets.resize(index + 1);
+    }
+    ++m_buckets[index];
+    ++m_count;
+    m_total += value;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+    if (other.m_buckets.size() > m_buckets.size()) {
+        m_buckets.resize(other.m_buckets.size());
+    }
+    std::transform(other.m_buckets.begin(), other.m_buckets.end(), m_buckets.begin(), m_buckets.begin(),
+                   std::plus<uint64_t>());
+    m_count += other.m_count;
+    m_total += other.m_total;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const noexcept {
+    if (m_count == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, std::ceil(percentile / 100.0 * double(m_count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i != m_buckets.size(); ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank) {
+            return std::min(bucketHighestValue(i), m_max);
+        }
+    }
+    return m_max;
+}
+
+void LatencyHistogram::writeJson(std::ostream &os) const {
+    os << "{\"count\": " << m_count << ", \"totalUs\": " << m_total << ", \"minUs\": " << getMin()
+       << ", \"meanUs\": " << std::fixed << std::setprecision(1) << getMean() << std::defaultfloat
+       << ", \"p50Us\": " << getPercentile(50) << ", \"p90Us\": " << getPercentile(90)
+       << ", \"p99Us\": " << getPercentile(99) << ", \"p999Us\": " << getPercentile(99.9) << ", \"maxUs\": " << m_max
+       << ", \"buckets\": [";
+    // Only the non-empty buckets, as [highest value in µs, count] pairs.
+    const char *separator = "";
+    for (size_t i = 0; i != m_buckets.size(); ++i) {
+        if (m_buckets[i] != 0) {
+            os << separator << '[' << bucketHighestValue(i) << ", " << m_buckets[i] << ']';
+            separator = ", ";
+        }
+    }
+    os << "]}";
+}
+
+void CommandStatistics::merge(const CommandStatistics &other) {
+    requests += other.requests;
+    errors += other.errors;
+    bytesWritten += other.bytesWritten;
+    bytesRead += other.bytesRead;
+    writeLatency.merge(other.writeLatency);
+    readLatency.merge(other.readLatency);
+}
+
+Statistics::Statistics() noexcept : m_start(std::chrono::steady_clock::now()) {}
+
+std::chrono::microseconds Statistics::getWallTime() const noexcept {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start);
+}
+
+void Statistics::reset() noexcept {
+    m_start = std::chrono::steady_clock::now();
+    m_commands = {};
+}
+
+void Statistics::merge(const Statistics &other) {
+    m_start = std::min(m_start, other.m_start);
+    for (size_t cmd = 0; cmd != m_commands.size(); ++cmd) {
+        m_commands[cmd].merge(other.m_commands[cmd]);
+    }
+}
+
+void Statistics::writeJson(std::ostream &os) const {
+    uint64_t writeTime = 0;
+    uint64_t readTime = 0;
+    for (const CommandStatistics &command : m_commands) {
+        writeTime += command.writeLatency.getTotal();
+        readTime += command.readLatency.getTotal();
+    }
+    os << "{\"wallTimeUs\": " << getWallTime().count() << ", \"writeTimeUs\": " << writeTime
+       << ", \"readTimeUs\": " << readTime << ", \"commands\": {";
+    const char *separator = "";
+    for (size_t cmd = 0; cmd != m_commands.size(); ++cmd) {
+        const CommandStatistics &command = m_commands[cmd];
+        if (command.requests == 0 && command.bytesWritten == 0 && command.bytesRead == 0) {
+            continue;
+        }
+        os << separator << "\n    \"0x" << std::hex << std::setw(2) << std::setfill('0') << cmd << std::dec
+           << "\": {\"requests\": " << command.requests << ", \"errors\": " << command.errors
+           << ", \"bytesWritten\": " << command.bytesWritten << ", \"bytesRead\": " << command.bytesRead
+           << ",\n        \"write\": ";
+        command.writeLatency.writeJson(os);
+        os << ",\n        \"read\": ";
+        command.readLatency.writeJson(os);
+        os << '}';
+        separator = ",";
+    }
+    os << "}}";
+}
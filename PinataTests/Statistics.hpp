@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+/// A latency histogram with microsecond resolution in the style of HdrHistogram: exact below 128 µs, and above that
+/// 64 buckets per power of two, so every recorded value is known to within 1.6%. Buckets are only allocated up to
+/// the largest value recorded.
+class LatencyHistogram {
+  public:
+    void record(std::chrono::microseconds latency);
+
+    /// Add all values recorded by other.
+    void merge(const LatencyHistogram &other);
+
+    uint64_t getCount() const noexcept { return m_count; }
+    uint64_t getTotal() const noexcept { return m_total; }
+    uint64_t getMin() const noexcept { return m_count == 0 ? 0 : m_min; }
+    uint64_t getMax() const noexcept { return m_max; }
+    double getMean() const noexcept { return m_count == 0 ? 0.0 : double(m_total) / double(m_count); }
+
+    /// The value (in µs) that percentile percent of the recorded values do not exceed.
+    uint64_t getPercentile(double percentile) const noexcept;
+
+    /// Write the summary and the non-empty buckets as a JSON object.
+    void writeJson(std::ostream &os) const;
+
+  private:
+    static size_t bucketIndex(uint64_t value) noexcept;
+    static uint64_t bucketHighestValue(size_t index) noexcept;
+
+    std::vector<uint64_t> m_buckets;
+    uint64_t m_count = 0;
+    uint64_t m_total = 0;
+    uint64_t m_min = std::numeric_limits<uint64_t>::max();
+    uint64_t m_max = 0;
+};
+
+/// What a PinataClient did with one command byte.
+struct CommandStatistics {
+    uint64_t requests = 0;
+    /// Responses that timed out or were not a response at all (see ResponseError).
+    uint64_t errors = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t bytesRead = 0;
+    /// Time spent in each write to the transport.
+    LatencyHistogram writeLatency;
+    /// Time spent waiting for each read from the transport, i.e. for the board to answer.
+    LatencyHistogram readLatency;
+
+    void merge(const CommandStatistics &other);
+};
+
+/// Counters and latency histograms of a PinataClient, per command byte.
+///
+/// The time a client spends outside write and read is the host's own overhead: when it dominates the wall time,
+/// a campaign is host-bound; when reads dominate, it waits for the link and the board.
+class Statistics {
+  public:
+    Statistics() noexcept;
+
+    CommandStatistics &operator[](uint8_t cmd) noexcept { return m_commands[cmd]; }
+    const CommandStatistics &operator[](uint8_t cmd) const noexcept { return m_commands[cmd]; }
+
+    /// Time since construction or the last reset().
+    std::chrono::microseconds getWallTime() const noexcept;
+
+    void reset() noexcept;
+    void merge(const Statistics &other);
+
+    /// Write all commands that were used as a JSON object, together with the wall time and the time spent in
+    /// writes and reads.
+    void writeJson(std::ostream &os) const;
+
+  private:
+    std::chrono::steady_clock::time_point m_start;
+    std::array<CommandStatistics, 256> m_commands;
+};
@@ -0,0 +1,333 @@
+#include "Transport.hpp"
+#include <algorithm>
+#include <array>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/serial_port.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/system/system_error.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <termios.h>
+#include <type_traits>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace {
+
+std::string describeErrno(const char *setting) { return std::string(setting) + ": " + std::strerror(errno); }
+
+/// Apply the low-latency profile to an open serial port: raw mode that wakes up the reader for every byte, the
+/// driver's low_latency flag and, for FTDI and other usb-serial adapters, a latency timer of 1 ms.
+LinkTuning tuneSerialPort(int fd) {
+    LinkTuning tuning;
+    termios attributes;
+    if (::tcgetattr(fd, &attributes) != 0) {
+        tuning.skipped.push_back(describeErrno("raw mode"));
+    } else {
+        // cfmakeraw() keeps the line speed and character size set by configureSerialPort().
+        ::cfmakeraw(&attributes);
+        attributes.c_cflag |= CLOCAL | CREAD;
+        // Return from a read as soon as one byte is there, instead of waiting for a count or an inter-byte timer.
+        attributes.c_cc[VMIN] = 1;
+        attributes.c_cc[VTIME] = 0;
+        if (::tcsetattr(fd, TCSANOW, &attributes) == 0) {
+            tuning.applied.push_back("raw mode, VMIN=1 VTIME=0");
+        } else {
+            tuning.skipped.push_back(describeErrno("raw mode"));
+        }
+    }
+#ifdef __linux__
+    serial_struct serial;
+    if (::ioctl(fd, TIOCGSERIAL, &serial) != 0) {
+        tuning.skipped.push_back(describeErrno("low_latency"));
+    } else if ((serial.flags & ASYNC_LOW_LATENCY) != 0) {
+        tuning.applied.push_back("low_latency");
+    } else {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if (::ioctl(fd, TIOCSSERIAL, &serial) == 0) {
+            tuning.applied.push_back("low_latency");
+        } else {
+            tuning.skipped.push_back(describeErrno("low_latency"));
+        }
+    }
+    // USB serial adapters such as the FTDI hold received bytes back for up to latency_timer milliseconds (16 by
+    // default) to fill a USB packet; a 16-byte response would wait for the timer every time.
+    std::error_code ec;
+    const std::filesystem::path device = std::filesystem::canonical("/proc/self/fd/" + std::to_string(fd), ec);
+    const std::filesystem::path latencyTimer =
+        std::filesystem::path("/sys/bus/usb-serial/devices") / device.filename() / "latency_timer";
+    int milliseconds = 0;
+    if (!ec && std::ifstream(latencyTimer) >> milliseconds) {
+        if (milliseconds > 1) {
+            std::ofstream(latencyTimer) << 1;
+            std::ifstream(latencyTimer) >> milliseconds;
+        }
+        if (milliseconds <= 1) {
+            tuning.applied.push_back("latency_timer=1ms");
+        } else {
+            tuning.skipped.push_back("latency_timer: not writable, stays at " + std::to_string(milliseconds) + "ms");
+        }
+    }
+#endif
+    return tuning;
+}
+
+/// A transport on top of any Boost.Asio stream (serial port, socket, file descriptor).
+template <class Stream> class StreamTransport : public Transport {
+  public:
+    template <class... Args>
+    StreamTransport(boost::asio::io_context &context, Args &&...args)
+        : Transport(context), m_stream(context, std::forward<Args>(args)...) {}
+
+    template <class... Args>
+    StreamTransport(std::unique_ptr<boost::asio::io_context> ownedContext, Args &&...args)
+        : Transport(std::move(ownedContext)), m_stream(getContext(), std::forward<Args>(args)...) {}
+
+    Stream &getStream() noexcept { return m_stream; }
+
+    void write(const uint8_t *data, size_t size) override {
+        boost::asio::write(m_stream, boost::asio::buffer(data, size), boost::asio::transfer_exactly(size));
+    }
+
+    void read(uint8_t *data, size_t size, std::chrono::milliseconds timeout) override {
+        boost::asio::io_context &context = getContext();
+        boost::system::error_code ec;
+        bool timedOut = false;
+        boost::asio::steady_timer timer(context);
+        timer.expires_after(timeout);
+        timer.async_wait([this, &timedOut](const boost::system::error_code &error) {
+            if (error != boost::asio::error::operation_aborted) {
+                timedOut = true;
+                m_stream.cancel();
+            }
+        });
+        boost::asio::async_read(m_stream, boost::asio::mutable_buffer(data, size),
+                                [&timer, &ec](const boost::system::error_code &error, std::size_t) {
+                                    timer.cancel();
+                                    ec = error;
+                                });
+        context.run();
+        context.restart();
+        if (timedOut) {
+            throw boost::system::system_error(boost::asio::error::timed_out);
+        }
+        if (ec) {
+            throw boost::system::system_error(ec);
+        }
+    }
+
+    bool drain(std::chrono::milliseconds quietTime, std::chrono::milliseconds limit) override {
+        boost::asio::io_context &context = getContext();
+        const auto giveUp = std::chrono::steady_clock::now() + limit;
+        std::array<uint8_t, 256> discarded;
+        while (std::chrono::steady_clock::now() < giveUp) {
+            bool quiet = false;
+            boost::asio::steady_timer timer(context);
+            timer.expires_after(quietTime);
+            timer.async_wait([this, &quiet](const boost::system::error_code &error) {
+                if (error != boost::asio::error::operation_aborted) {
+                    quiet = true;
+                    m_stream.cancel();
+                }
+            });
+            boost::system::error_code ec;
+            m_stream.async_read_some(boost::asio::buffer(discarded),
+                                     [&timer, &ec](const boost::system::error_code &error, std::size_t) {
+                                         timer.cancel();
+                                         ec = error;
+                                     });
+            context.run();
+            context.restart();
+            if (quiet) {
+                return true;
+            }
+            if (ec) {
+                // The link itself is gone; no amount of draining will bring the board back.
+                return false;
+            }
+        }
+        return false;
+    }
+
+    LinkTuning tuneForLatency() override {
+        if constexpr (std::is_same_v<Stream, boost::asio::serial_port>) {
+            return tuneSerialPort(m_stream.native_handle());
+        } else {
+            return {};
+        }
+    }
+
+    bool setBaudRate(uint32_t baudRate) override {
+        if constexpr (std::is_same_v<Stream, boost::asio::serial_port>) {
+            m_stream.set_option(boost::asio::serial_port::baud_rate(baudRate));
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    boost::asio::awaitable<void> asyncWrite(const uint8_t *data, size_t size) override {
+        co_await boost::asio::async_write(m_stream, boost::asio::buffer(data, size), boost::asio::use_awaitable);
+    }
+
+    boost::asio::awaitable<void> asyncRead(uint8_t *data, size_t size, std::chrono::milliseconds timeout) override {
+        bool timedOut = false;
+        boost::asio::steady_timer timer(m_stream.get_executor());
+        timer.expires_after(timeout);
+        timer.async_wait([this, &timedOut](const boost::system::error_code &error) {
+            if (error != boost::asio::error::operation_aborted) {
+                timedOut = true;
+                m_stream.cancel();
+            }
+        });
+        boost::system::error_code ec;
+        co_await boost::asio::async_read(m_stream, boost::asio::mutable_buffer(data, size),
+                                         boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        timer.cancel();
+        if (timedOut) {
+            throw boost::system::system_error(boost::asio::error::timed_out);
+        }
+        if (ec) {
+            throw boost::system::system_error(ec);
+        }
+    }
+
+  private:
+    Stream m_stream;
+};
+
+using SerialTransport = StreamTransport<boost::asio::serial_port>;
+using DescriptorTransport = StreamTransport<boost::asio::posix::stream_descriptor>;
+using TcpTransport = StreamTransport<boost::asio::ip::tcp::socket>;
+
+void configureSerialPort(boost::asio::serial_port &port) {
+    port.set_option(boost::asio::serial_port::baud_rate(115200));
+    port.set_option(boost::asio::serial_port::character_size(boost::asio::serial_port::character_size(8)));
+    port.set_option(boost::asio::serial_port::parity(boost::asio::serial_port::parity::none));
+    port.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one));
+    port.set_option(boost::asio::serial_port::flow_control(boost::asio::serial_port::flow_control::none));
+}
+
+/// Open a pseudo-terminal (or any other tty) in raw mode without touching its line speed.
+int openRawTerminal(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        throw boost::system::system_error(errno, boost::system::system_category(), "unable to open " + path);
+    }
+    termios attributes;
+    if (::tcgetattr(fd, &attributes) == 0) {
+        ::cfmakeraw(&attributes);
+        ::tcsetattr(fd, TCSANOW, &attributes);
+    }
+    return fd;
+}
+
+template <class Context> std::unique_ptr<Transport> openTransport(Context &&context, const std::string &uri) {
+    const size_t separator = uri.find("://");
+    const std::string scheme = separator == std::string::npos ? "serial" : uri.substr(0, separator);
+    const std::string rest = separator == std::string::npos ? uri : uri.substr(separator + 3);
+
+    if (scheme == "serial") {
+        auto transport = std::make_unique<SerialTransport>(std::forward<Context>(context), rest);
+        configureSerialPort(transport->getStream());
+        return transport;
+    }
+    if (scheme == "pty") {
+        return std::make_unique<DescriptorTransport>(std::forward<Context>(context), openRawTerminal(rest));
+    }
+    if (scheme == "tcp") {
+        const size_t colon = rest.rfind(':');
+        if (colon == std::string::npos) {
+            throw std::invalid_argument("missing port number in " + uri);
+        }
+        auto transport = std::make_unique<TcpTransport>(std::forward<Context>(context));
+        boost::asio::ip::tcp::resolver resolver(transport->getContext());
+        boost::asio::connect(transport->getStream(), resolver.resolve(rest.substr(0, colon), rest.substr(colon + 1)));
+        // Requests are tiny; do not let Nagle's algorithm hold them back.
+        transport->getStream().set_option(boost::asio::ip::tcp::no_delay(true));
+        return transport;
+    }
+    if (scheme == "loop") {
+        if constexpr (std::is_same_v<std::decay_t<Context>, boost::asio::io_context>) {
+            return std::make_unique<LoopbackTransport>(context);
+        } else {
+            return std::make_unique<LoopbackTransport>();
+        }
+    }
+    throw std::invalid_argument("unsupported transport: " + uri);
+}
+
+} // namespace
+
+Transport::Transport(boost::asio::io_context &context) noexcept : m_context(context) {}
+
+Transport::Transport(std::unique_ptr<boost::asio::io_context> ownedContext) noexcept
+    : m_ownedContext(std::move(ownedContext)), m_context(*m_ownedContext) {}
+
+Transport::~Transport() = default;
+
+LinkTuning Transport::tuneForLatency() { return {}; }
+
+bool Transport::setBaudRate(uint32_t) { return false; }
+
+std::unique_ptr<Transport> Transport::open(const std::string &uri) {
+    return openTransport(std::make_unique<boost::asio::io_context>(), uri);
+}
+
+std::unique_ptr<Transport> Transport::open(boost::asio::io_context &context, const std::string &uri) {
+    return openTransport(context, uri);
+}
+
+void LoopbackTransport::echo(const uint8_t *data, size_t size, std::vector<uint8_t> &reply) {
+    reply.insert(reply.end(), data, data + size);
+}
+
+LoopbackTransport::LoopbackTransport(Peer peer)
+    : Transport(std::make_unique<boost::asio::io_context>()), m_peer(std::move(peer)) {}
+
+LoopbackTransport::LoopbackTransport(boost::asio::io_context &context, Peer peer)
+    : Transport(context), m_peer(std::move(peer)) {}
+
+void LoopbackTransport::write(const uint8_t *data, size_t size) {
+    m_reply.clear();
+    m_peer(data, size, m_reply);
+    m_received.insert(m_received.end(), m_reply.begin(), m_reply.end());
+}
+
+void LoopbackTransport::read(uint8_t *data, size_t size, std::chrono::milliseconds) {
+    if (m_received.size() < size) {
+        // Nothing else can produce the missing bytes, so waiting for them is pointless.
+        throw boost::system::system_error(boost::asio::error::timed_out);
+    }
+    std::copy_n(m_received.begin(), size, data);
+    m_received.erase(m_received.begin(), m_received.begin() + size);
+}
+
+bool LoopbackTransport::drain(std::chrono::milliseconds, std::chrono::milliseconds) {
+    m_received.clear();
+    return true;
+}
+
+boost::asio::awaitable<void> LoopbackTransport::asyncWrite(const uint8_t *data, size_t size) {
+    write(data, size);
+    co_return;
+}
+
+boost::asio::awaitable<void> LoopbackTransport::asyncRead(uint8_t *data, size_t size,
+                                                          std::chrono::milliseconds timeout) {
+    read(data, size, timeout);
+    co_return;
+}
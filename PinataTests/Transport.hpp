@@ -0,0 +1,102 @@
+#pragma once
+
+// Boost 1.74's awaitable.hpp uses std::exchange without including <utility> itself.
+#include <utility>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// What Transport::tuneForLatency() did, one entry per setting.
+struct LinkTuning {
+    /// The settings that are now in effect, e.g. "low_latency".
+    std::vector<std::string> applied;
+    /// The settings that could not be changed, with the reason.
+    std::vector<std::string> skipped;
+};
+
+/// A byte stream to a Pinata (or something that behaves like one).
+///
+/// Transports are selected by URI:
+///
+/// - `serial:///dev/ttyUSB0` or just `/dev/ttyUSB0`: a serial port, configured for 115200 baud 8N1;
+/// - `pty:///dev/pts/3`: a pseudo-terminal, e.g. one served by a simulator; only put in raw mode;
+/// - `tcp://localhost:5555`: a TCP connection to a remote acquisition host or simulator;
+/// - `loop://`: an in-memory peer that echoes everything; see LoopbackTransport for scripted peers.
+class Transport {
+  public:
+    Transport(const Transport &) = delete;
+    Transport &operator=(const Transport &) = delete;
+    virtual ~Transport();
+
+    /// Open the transport described by uri, performing its I/O on an I/O context owned by the transport.
+    static std::unique_ptr<Transport> open(const std::string &uri);
+
+    /// Open the transport described by uri, performing its I/O on a context owned and run by the caller.
+    static std::unique_ptr<Transport> open(boost::asio::io_context &context, const std::string &uri);
+
+    /// The I/O context on which the asynchronous operations complete.
+    boost::asio::io_context &getContext() noexcept { return m_context; }
+
+    /// Write all bytes.
+    virtual void write(const uint8_t *data, size_t size) = 0;
+
+    /// Read exactly size bytes. Throws boost::system::system_error with error::timed_out when the bytes did not
+    /// arrive within the timeout.
+    virtual void read(uint8_t *data, size_t size, std::chrono::milliseconds timeout) = 0;
+
+    /// Discard incoming bytes until nothing has arrived for quietTime. Returns false when the peer was still
+    /// sending after limit, e.g. a board stuck in a loop that keeps transmitting.
+    virtual bool drain(std::chrono::milliseconds quietTime, std::chrono::milliseconds limit) = 0;
+
+    /// Make the link hand over every byte as soon as it arrives: the small requests and responses of the Pinata
+    /// protocol otherwise wait for buffers and timers of the kernel and the USB serial adapter. Settings that are
+    /// not permitted are skipped. Does nothing for transports without such buffering.
+    virtual LinkTuning tuneForLatency();
+
+    /// Change the line speed. Returns false for transports without one, such as pseudo-terminals and TCP, whose peer
+    /// takes whatever is sent at any speed.
+    virtual bool setBaudRate(uint32_t baudRate);
+
+    virtual boost::asio::awaitable<void> asyncWrite(const uint8_t *data, size_t size) = 0;
+    virtual boost::asio::awaitable<void> asyncRead(uint8_t *data, size_t size, std::chrono::milliseconds timeout) = 0;
+
+  protected:
+    explicit Transport(boost::asio::io_context &context) noexcept;
+    explicit Transport(std::unique_ptr<boost::asio::io_context> ownedContext) noexcept;
+
+  private:
+    std::unique_ptr<boost::asio::io_context> m_ownedContext;
+    boost::asio::io_context &m_context;
+};
+
+/// An in-memory transport. Every write is handed to the peer, which appends its reply to the receive queue.
+/// Reads never block: when the peer did not produce enough bytes, they fail with error::timed_out at once.
+class LoopbackTransport : public Transport {
+  public:
+    using Peer = std::function<void(const uint8_t *data, size_t size, std::vector<uint8_t> &reply)>;
+
+    /// A peer that sends every byte straight back.
+    static void echo(const uint8_t *data, size_t size, std::vector<uint8_t> &reply);
+
+    explicit LoopbackTransport(Peer peer = &LoopbackTransport::echo);
+    LoopbackTransport(boost::asio::io_context &context, Peer peer = &LoopbackTransport::echo);
+
+    void write(const uint8_t *data, size_t size) override;
+    void read(uint8_t *data, size_t size, std::chrono::milliseconds timeout) override;
+    bool drain(std::chrono::milliseconds quietTime, std::chrono::milliseconds limit) override;
+    boost::asio::awaitable<void> asyncWrite(const uint8_t *data, size_t size) override;
+    boost::asio::awaitable<void> asyncRead(uint8_t *data, size_t size, std::chrono::milliseconds timeout) override;
+
+  private:
+    Peer m_peer;
+    std::vector<uint8_t> m_reply;
+    std::deque<uint8_t> m_received;
+};
@@ -1,53 +1,21 @@
 #include "common.hpp"
-#include <boost/asio/deadline_timer.hpp>
+#include <algorithm>
+#include <bit>
 #include <boost/asio/error.hpp>
-#include <boost/asio/impl/read.hpp>
-#include <boost/asio/serial_port.hpp>
-#include <boost/date_time/posix_time/posix_time_duration.hpp>
-#include <boost/date_time/time_defs.hpp>
-#include <boost/system/error_code.hpp>
 #include <boost/system/system_error.hpp>
+#include <chrono>
 #include <cstring>
+#include <iomanip>
+#include <limits>
 #include <numeric>
-#include <openssl/bio.h>
+#include <optional>
+#include <sstream>
 #include <stdexcept>
-#include <termios.h>
-#include <unistd.h>
+#include <thread>
 
 constexpr const size_t PINATA_MLDSA_MESSAGE_LENGTH = 16;
 constexpr const size_t PINATA_MLKEM_SHARED_SECRET_LENGTH = 32;
 
-const uint8_t CMD_GET_CODE_REV = 0xF1;
-const uint8_t CMD_HWAES128_ENC = 0xCA;
-
-const uint8_t CMD_SW_MLDSA_GET_VARIANT = 0x90;
-const uint8_t CMD_SW_MLDSA_SET_PUBLIC_AND_PRIVATE_KEY = 0x91;
-const uint8_t CMD_SW_MLDSA_VERIFY = 0x92;
-const uint8_t CMD_SW_MLDSA_SIGN = 0x93;
-const uint8_t CMD_SW_MLDSA_GET_KEY_SIZES = 0x94;
-
-const uint8_t CMD_SW_MLKEM_SET_PUBLIC_AND_PRIVATE_KEY = 0x02;
-const uint8_t CMD_SW_MLKEM_GET_KEY_SIZES = 0x03;
-const uint8_t CMD_SW_MLKEM_GENERATE = 0x04;
-const uint8_t CMD_SW_MLKEM_DEC = 0x05;
-
-const uint8_t CMD_SWDES_ENC = 0x44;
-const uint8_t CMD_SWDES_DEC = 0x45;
-const uint8_t CMD_SWTDES_ENC = 0x46;
-const uint8_t CMD_SWTDES_DEC = 0x47;
-const uint8_t CMD_SWAES128_ENC = 0xAE;
-const uint8_t CMD_SWAES128_DEC = 0xEA;
-const uint8_t CMD_SWAES128SPI_ENC = 0xCE;
-const uint8_t CMD_SWAES128TTABLES_ENC = 0x41;
-const uint8_t CMD_SWAES128TTABLES_DEC = 0x50;
-const uint8_t CMD_SWAES256_ENC = 0x60;
-const uint8_t CMD_SWAES256_DEC = 0x61;
-const uint8_t CMD_SWDES_ENC_RND_SBOX = 0x4B;
-const uint8_t CMD_SWAES128_ENC_MASKED = 0x73;
-const uint8_t CMD_SWAES128_DEC_MASKED = 0x83;
-const uint8_t CMD_SWAES128_ENC_RNDDELAYS = 0x75;
-const uint8_t CMD_SWAES128_ENC_RNDSBOX = 0x85;
-
 const uint8_t DESLENGTHINBYTES = 8; // 64 bit == 8byte
 const uint8_t AESBLOCKSIZE = 16;    // 128 bit == 16byte
 
@@ -61,6 +29,192 @@ const uint8_t defaultKeyAES256[32] = {0xca, 0xfe, 0xba, 0xbe, 0xde, 0xad, 0xbe,
                                       0x03, 0x04, 0x05, 0x06, 0x07, 0xda, 0xba, 0xda, 0xba, 0xd0, 0x00,
                                       0x00, 0xc0, 0x00, 0x01, 0xc0, 0xff, 0xee, 0x55, 0xde, 0xad};
 
+namespace {
+
+/// Sent by the firmware for an unknown command byte (8 bytes including the terminating zero).
+constexpr const uint8_t badCommandResponse[] = {'B', 'a', 'd', 'C', 'm', 'd', '\n'};
+
+/// Size of the firmware's CMD_BATCH buffer (BATCHBUFFERLENGTH) when the firmware does not report it.
+constexpr const size_t defaultBatchBufferSize = 4096;
+
+/// Sent by both sides at the new baud rate to complete CMD_SET_BAUD_RATE.
+constexpr const uint8_t baudConfirm = 0x55;
+/// How long the board waits for baudConfirm before it falls back to PinataDefaultBaudRate.
+constexpr const std::chrono::milliseconds baudConfirmTimeout(500);
+
+/// Modes of CMD_BATCH_SEEDED: reply with all output blocks, or with their hash only.
+constexpr const uint8_t batchModeOutputs = 0x00;
+constexpr const uint8_t batchModeHash = 0x01;
+
+/// Protocols of CMD_SET_PROTOCOL, see src/frame.h.
+constexpr const uint8_t protocolLegacy = 0x01;
+constexpr const uint8_t protocolFramed = 0x02;
+
+/// The frames of framed mode: magic, sequence number, command or status, payload length, payload and CRC32.
+constexpr const uint8_t frameMagic = 0x5A;
+constexpr const size_t frameHeaderSize = 5;
+constexpr const size_t frameCrcSize = 4;
+/// FRAME_REQUEST_PAYLOAD_LENGTH and FRAME_RESPONSE_PAYLOAD_LENGTH of the firmware.
+constexpr const size_t frameRequestPayloadSize = 6144;
+constexpr const size_t frameResponsePayloadSize = 4096;
+constexpr const uint8_t frameStatusOk = 0x00;
+constexpr const uint8_t frameStatusMore = 0x01;
+constexpr const uint8_t frameStatusBadCrc = 0x02;
+constexpr const uint8_t frameStatusTooLong = 0x03;
+constexpr const uint8_t frameStatusShortPayload = 0x04;
+constexpr const uint8_t frameStatusDuplicate = 0x05;
+/// Sequence numbers are a byte: keeping no more than half of them in flight leaves no doubt which request a late
+/// response belongs to.
+constexpr const size_t maxFramesInFlight = 128;
+/// How often a request is sent again before framed mode gives up on it.
+constexpr const unsigned maxFrameRetries = 3;
+
+/// Append the frame of a request to out.
+void encodeFrame(std::vector<uint8_t> &out, uint8_t sequence, uint8_t cmd, const uint8_t *payload, size_t size) {
+    const size_t start = out.size();
+    out.insert(out.end(), {frameMagic, sequence, cmd, uint8_t(size >> 8), uint8_t(size)});
+    out.insert(out.end(), payload, payload + size);
+    out.resize(out.size() + frameCrcSize);
+    boost::endian::store_big_u32(out.data() + out.size() - frameCrcSize,
+                                 frameCrc32(out.data() + start, frameHeaderSize + size));
+}
+
+/// How long the line must stay quiet before resync() considers the board drained.
+constexpr const std::chrono::milliseconds resyncQuietTime(20);
+/// How long resync() keeps draining a board that does not stop sending.
+constexpr const std::chrono::milliseconds resyncDrainLimit(500);
+/// How long resync() waits for the answer to CMD_GET_CODE_REV.
+constexpr const std::chrono::milliseconds resyncProbeDeadline(250);
+/// Number of CMD_GET_CODE_REV bytes resync() sends at a time to complete a command that is still waiting for its
+/// payload, when the firmware did not report the size of its receive ring.
+constexpr const size_t resyncPaddingSize = 256;
+/// Bytes of the answer to CMD_GET_CODE_REV in the legacy protocol.
+constexpr const size_t versionSize = 8;
+
+const char *describe(ResponseError::Reason reason) {
+    switch (reason) {
+    case ResponseError::Reason::Timeout:
+        return "no response before the deadline";
+    case ResponseError::Reason::Glitched:
+        return "board glitched out of its command loop";
+    case ResponseError::Reason::BadCommand:
+        return "board did not recognise the command";
+    case ResponseError::Reason::CorruptFrame:
+        return "frames kept failing their CRC check";
+    case ResponseError::Reason::ShortPayload:
+        return "board read more payload than the request frame had";
+    case ResponseError::Reason::LostResponse:
+        return "response of a request that had already run got lost";
+    }
+    return "unexpected response";
+}
+
+std::string describe(ResponseError::Reason reason, uint8_t cmd) {
+    std::ostringstream message;
+    message << describe(reason) << " (command 0x" << std::hex << std::setw(2) << std::setfill('0') << int(cmd)
+            << ")";
+    return message.str();
+}
+
+/// Recognise the byte patterns a board sends instead of a response. Short responses are never flagged: two bytes
+/// of ciphertext are 0xFA 0xCC far too often.
+std::optional<ResponseError::Reason> classifyResponse(const uint8_t *data, size_t size) {
+    if (size >= std::size(badCommandResponse) &&
+        std::equal(std::begin(badCommandResponse), std::end(badCommandResponse), data)) {
+        return ResponseError::Reason::BadCommand;
+    }
+    // The firmware repeats 0xFA 0xCC forever, so the response may start at either byte.
+    if (size >= 4 && ((data[0] == 0xFA && data[1] == 0xCC) || (data[0] == 0xCC && data[1] == 0xFA))) {
+        bool glitched = true;
+        for (size_t i = 2; i != size && glitched; ++i) {
+            glitched = data[i] == data[i % 2];
+        }
+        if (glitched) {
+            return ResponseError::Reason::Glitched;
+        }
+    }
+    return std::nullopt;
+}
+
+/// Whether a 4-byte response is the start of "BadCmd": too short for classifyResponse() to tell.
+bool isTruncatedBadCommand(const std::array<uint8_t, 4> &response) {
+    return std::equal(response.begin(), response.end(), std::begin(badCommandResponse));
+}
+
+std::chrono::microseconds elapsedSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+}
+
+} // namespace
+
+BatchInputGenerator::BatchInputGenerator(const BatchSeed &seed) noexcept {
+    for (size_t i = 0; i != m_state.size(); ++i) {
+        m_state[i] = boost::endian::load_little_u32(seed.data() + 4 * i);
+    }
+    // Like the firmware: the all-zero state would only ever produce zeros.
+    if (m_state == std::array<uint32_t, 4>{}) {
+        m_state[0] = 1;
+    }
+}
+
+void BatchInputGenerator::generate(uint8_t *output, size_t size) noexcept {
+    for (size_t offset = 0; offset < size; offset += 4) {
+        boost::endian::store_little_u32(output + offset, next());
+    }
+}
+
+void BatchInputGenerator::discard(size_t size) noexcept {
+    for (size_t offset = 0; offset < size; offset += 4) {
+        next();
+    }
+}
+
+BatchSeed BatchInputGenerator::getState() const noexcept {
+    BatchSeed seed;
+    for (size_t i = 0; i != m_state.size(); ++i) {
+        boost::endian::store_little_u32(seed.data() + 4 * i, m_state[i]);
+    }
+    return seed;
+}
+
+uint32_t BatchInputGenerator::next() noexcept {
+    std::array<uint32_t, 4> &s = m_state;
+    const uint32_t result = std::rotl(s[1] * 5, 7) * 9;
+    const uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = std::rotl(s[3], 11);
+    return result;
+}
+
+uint32_t fnv1aHash(const uint8_t *data, size_t size, uint32_t hash) noexcept {
+    for (size_t i = 0; i != size; ++i) {
+        hash = (hash ^ data[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+uint32_t frameCrc32(const uint8_t *data, size_t size) noexcept {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i != size; ++i) {
+        crc ^= uint32_t(data[i]) << 24;
+        for (int bit = 0; bit != 8; ++bit) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+ResponseError::ResponseError(Reason reason, uint8_t cmd)
+    : boost::system::system_error(reason == Reason::Timeout
+                                      ? boost::system::error_code(boost::asio::error::timed_out)
+                                      : boost::system::errc::make_error_code(boost::system::errc::bad_message),
+                                  describe(reason, cmd)),
+      m_reason(reason), m_command(cmd) {}
+
 const char *getSerialPortFilePath() {
     const char *serialPortFilePath = std::getenv("SERIAL_PORT");
     if (serialPortFilePath == nullptr) {
@@ -72,12 +226,22 @@ const char *getSerialPortFilePath() {
 
 PinataClient::PinataClient() : PinataClient(getSerialPortFilePath()) {}
 
-PinataClient::PinataClient(const char *serialPortFile) : m_port(m_context, serialPortFile) {
-    m_port.set_option(boost::asio::serial_port::baud_rate(115200));
-    m_port.set_option(boost::asio::serial_port::character_size(boost::asio::serial_port::character_size(8)));
-    m_port.set_option(boost::asio::serial_port::parity(boost::asio::serial_port::parity::none));
-    m_port.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one));
-    m_port.set_option(boost::asio::serial_port::flow_control(boost::asio::serial_port::flow_control::none));
+PinataClient::PinataClient(const char *uri)
+    : m_transport(Transport::open(uri)), m_linkTuning(m_transport->tuneForLatency()) {}
+
+PinataClient::PinataClient(boost::asio::io_context &context, const char *uri)
+    : m_transport(Transport::open(context, uri)), m_linkTuning(m_transport->tuneForLatency()) {}
+
+PinataClient::PinataClient(std::unique_ptr<Transport> transport) : m_transport(std::move(transport)) {}
+
+PinataClient::~PinataClient() {
+    if (m_framed) {
+        // Leave the board the way the next client expects to find it.
+        try {
+            setFramedMode(false);
+        } catch (const std::exception &) {
+        }
+    }
 }
 
 std::pair<int, int> PinataClient::getVersion() {
@@ -87,7 +251,37 @@ std::pair<int, int> PinataClient::getVersion() {
     return std::make_pair(result[4] - '0', result[6] - '0');
 }
 
+RoundTripTimes PinataClient::measureRoundTrip(size_t count) {
+    if (count == 0) {
+        throw std::invalid_argument("need at least one round trip to measure");
+    }
+    getVersion();
+    std::vector<std::chrono::microseconds> times(count);
+    for (std::chrono::microseconds &time : times) {
+        const auto start = std::chrono::steady_clock::now();
+        getVersion();
+        time = elapsedSince(start);
+    }
+    std::sort(times.begin(), times.end());
+    return RoundTripTimes{times.front(), times[count / 2], times.back()};
+}
+
 FirmwareVariant PinataClient::determineFirmwareVariant() {
+    try {
+        return getCapabilities().getFirmwareVariant();
+    } catch (const ResponseError &ex) {
+        if (ex.getReason() != ResponseError::Reason::BadCommand) {
+            throw;
+        }
+    }
+    // Firmware from before CMD_GET_CAPABILITIES; fail() has drained "BadCmd" unless resync is up to the caller.
+    if (!m_autoResync && !resync()) {
+        throw ResponseError(ResponseError::Reason::BadCommand, CMD_GET_CAPABILITIES);
+    }
+    return probeFirmwareVariant();
+}
+
+FirmwareVariant PinataClient::probeFirmwareVariant() {
     // Detect it via this command. It will return "BadCmd\n" when dealing with a classic or hw variant.
     command(CMD_SW_MLDSA_GET_VARIANT);
     uint8_t byte;
@@ -197,11 +391,435 @@ void PinataClient::mlkemDecode(const uint8_t *keyEncapsulationMessageBuffer, siz
     read(sharedSecretBuffer, sharedSecretBufferSize);
 }
 
+void PinataClient::setPipelineDepth(size_t depth) {
+    if (depth == 0) {
+        throw std::invalid_argument("pipeline depth must be at least 1");
+    }
+    m_pipelineDepth = depth;
+    while (m_inFlight.size() > getWindow()) {
+        completeOldest();
+    }
+}
+
+size_t PinataClient::getWindow() const noexcept {
+    return m_framed ? std::min(m_pipelineDepth, maxFramesInFlight) : m_pipelineDepth;
+}
+
+size_t PinataClient::getByteWindow() const noexcept {
+    if (!m_capabilities || m_capabilities->usartReceiveRingSize == 0) {
+        return std::numeric_limits<size_t>::max();
+    }
+    return m_capabilities->usartReceiveRingSize;
+}
+
+size_t PinataClient::getBatchBufferSize() const noexcept {
+    if (!m_capabilities || m_capabilities->batchBufferSize == 0) {
+        return defaultBatchBufferSize;
+    }
+    return m_capabilities->batchBufferSize;
+}
+
+size_t PinataClient::getRequestSize(size_t inputSize) const noexcept {
+    return m_framed ? frameHeaderSize + inputSize + frameCrcSize : 1 + inputSize;
+}
+
+void PinataClient::submit(uint8_t cmd, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize,
+                          Completion completion) {
+    checkSupported(cmd);
+    const size_t requestSize = getRequestSize(inputSize);
+    // A request that does not fit in the receive ring on its own is fine: the board reads it while it arrives.
+    while (!m_inFlight.empty() &&
+           (m_inFlight.size() >= getWindow() || m_bytesInFlight + requestSize > getByteWindow())) {
+        completeOldest();
+    }
+    // Send the command byte and its payload in one go; this halves the number of system calls per request.
+    m_requestBuffer.resize(1 + inputSize);
+    m_requestBuffer[0] = cmd;
+    std::copy(input, input + inputSize, m_requestBuffer.begin() + 1);
+    m_command = cmd;
+    ++m_statistics[cmd].requests;
+    sendRequest(m_requestBuffer.data(), m_requestBuffer.size());
+    m_inFlight.push_back(PendingRequest{cmd, output, outputSize, std::move(completion), requestSize});
+    m_bytesInFlight += requestSize;
+}
+
+void PinataClient::flush() {
+    while (!m_inFlight.empty()) {
+        completeOldest();
+    }
+}
+
+void PinataClient::completeOldest() {
+    PendingRequest request = std::move(m_inFlight.front());
+    m_inFlight.pop_front();
+    m_bytesInFlight -= request.requestSize;
+    try {
+        readResponse(request.cmd, request.output, request.outputSize);
+    } catch (...) {
+        // The responses of the remaining requests can no longer be matched to their requests.
+        m_inFlight.clear();
+        m_bytesInFlight = 0;
+        throw;
+    }
+    if (request.completion) {
+        request.completion(request.output, request.outputSize);
+    }
+}
+
+std::vector<uint8_t> PinataClient::rsaCrt1024Decrypt(const uint8_t *ciphertext, size_t ciphertextSize) {
+    return doRsaDecrypt(CMD_RSACRT1024_DEC, ciphertext, ciphertextSize, 1024 / 8);
+}
+
+std::vector<uint8_t> PinataClient::rsaSfmDecrypt(const uint8_t *ciphertext, size_t ciphertextSize) {
+    return doRsaDecrypt(CMD_RSASFM_DEC, ciphertext, ciphertextSize, 512 / 8);
+}
+
+std::vector<uint8_t> PinataClient::doRsaDecrypt(uint8_t cmd, const uint8_t *ciphertext, size_t ciphertextSize,
+                                                size_t modulusSize) {
+    if (ciphertextSize > modulusSize) {
+        throw std::invalid_argument("RSA ciphertext is larger than the modulus");
+    }
+    command(cmd);
+    const std::array<uint8_t, 2> length = {uint8_t(ciphertextSize >> 8), uint8_t(ciphertextSize)};
+    write(length.data(), length.size());
+    write(ciphertext, ciphertextSize);
+    // The plaintext is preceded by its length, most significant byte first. A zero plaintext is sent as four
+    // bytes of 0x00 (CRT) or 0xFF (SFM) without a length.
+    std::array<uint8_t, 2> plaintextLength;
+    read(plaintextLength.data(), plaintextLength.size());
+    const size_t plaintextSize = (size_t(plaintextLength[0]) << 8) | plaintextLength[1];
+    if (plaintextSize == 0 || plaintextSize == 0xFFFF) {
+        read(plaintextLength.data(), plaintextLength.size());
+        return {};
+    }
+    if (plaintextSize > modulusSize) {
+        throw std::runtime_error("RSA plaintext is larger than the modulus");
+    }
+    std::vector<uint8_t> plaintext(plaintextSize);
+    read(plaintext.data(), plaintext.size());
+    return plaintext;
+}
+
+Curve25519Bytes PinataClient::ecc25519ScalarMult(const std::array<uint8_t, 32> &prngSeed, const Curve25519Bytes &scalar,
+                                                 const Curve25519Bytes &point) {
+    command(CMD_ECC25519_SCALAR_MULT);
+    write(prngSeed.data(), prngSeed.size());
+    write(scalar.data(), scalar.size());
+    write(point.data(), point.size());
+    Curve25519Bytes result;
+    read(result.data(), result.size());
+    return result;
+}
+
+uint32_t PinataClient::getRandomFromTrng() {
+    command(CMD_GET_RANDOM_FROM_TRNG);
+    uint32_t result;
+    read(reinterpret_cast<uint8_t *>(&result), sizeof(result));
+    return boost::endian::big_to_native(result);
+}
+
+std::vector<uint8_t> PinataClient::dumpTrng(uint16_t size) {
+    command(CMD_DUMP_TRNG);
+    const uint8_t request[2] = {uint8_t(size >> 8), uint8_t(size)};
+    write(request, sizeof(request));
+    std::vector<uint8_t> result(size);
+    read(result.data(), result.size());
+    return result;
+}
+
+std::vector<CommandDescriptor> PinataClient::getCommands() {
+    command(CMD_GET_COMMANDS);
+    std::array<uint8_t, 2> count;
+    read(count.data(), count.size());
+    std::vector<uint8_t> entries(((size_t(count[0]) << 8) | count[1]) * 6);
+    read(entries.data(), entries.size());
+    std::vector<CommandDescriptor> commands;
+    for (size_t i = 0; i < entries.size(); i += 6) {
+        commands.push_back({entries[i], entries[i + 1], uint16_t((entries[i + 2] << 8) | entries[i + 3]),
+                            uint16_t((entries[i + 4] << 8) | entries[i + 5])});
+    }
+    m_batchBlockSizes.emplace();
+    for (const CommandDescriptor &descriptor : commands) {
+        if (descriptor.flags & CommandDescriptor::Batchable) {
+            (*m_batchBlockSizes)[descriptor.cmd] = descriptor.inputSize;
+        }
+    }
+    return commands;
+}
+
+size_t PinataClient::getBatchBlockSize(uint8_t cmd) {
+    if (!m_batchBlockSizes) {
+        getCommands();
+    }
+    return (*m_batchBlockSizes)[cmd];
+}
+
+FirmwareVariant Capabilities::getFirmwareVariant() const noexcept {
+    if (flags & VariantPqc) {
+        return FirmwareVariant::PostQuantum;
+    }
+    return (flags & HwCrypto) ? FirmwareVariant::Hardware : FirmwareVariant::Classic;
+}
+
+Capabilities PinataClient::getCapabilities() {
+    command(CMD_GET_CAPABILITIES);
+    std::array<uint8_t, 43> header;
+    // Firmware without the command answers "BadCmd": look at the first bytes before waiting for the rest.
+    read(header.data(), 4);
+    if (isTruncatedBadCommand({header[0], header[1], header[2], header[3]})) {
+        fail(ResponseError::Reason::BadCommand, CMD_GET_CAPABILITIES);
+    }
+    read(header.data() + 4, header.size() - 4);
+    Capabilities capabilities;
+    capabilities.version = std::make_pair(header[0], header[1]);
+    capabilities.flags = boost::endian::load_big_u16(header.data() + 2);
+    capabilities.usartReceiveRingSize = boost::endian::load_big_u16(header.data() + 4);
+    capabilities.maxFramePayloadSize = boost::endian::load_big_u16(header.data() + 6);
+    capabilities.batchBufferSize = boost::endian::load_big_u16(header.data() + 8);
+    for (size_t cmd = 0; cmd != capabilities.commands.size(); ++cmd) {
+        capabilities.commands[cmd] = (header[10 + cmd / 8] >> (cmd % 8)) & 1;
+    }
+    std::vector<uint8_t> entries(header[42] * 5);
+    read(entries.data(), entries.size());
+    for (size_t i = 0; i < entries.size(); i += 5) {
+        capabilities.keySizes.push_back({entries[i], boost::endian::load_big_u16(entries.data() + i + 1),
+                                         boost::endian::load_big_u16(entries.data() + i + 3)});
+    }
+    m_capabilities = capabilities;
+    return capabilities;
+}
+
+CycleCount PinataClient::getLastCycles() {
+    command(CMD_GET_LAST_CYCLES);
+    std::array<uint8_t, 5> reply;
+    read(reply.data(), reply.size());
+    return {(uint32_t(reply[0]) << 24) | (uint32_t(reply[1]) << 16) | (uint32_t(reply[2]) << 8) | reply[3], reply[4]};
+}
+
 void PinataClient::doSymmetricCipherRequest(const uint8_t cmd, const uint8_t *input, const size_t inputSize,
                                             uint8_t *output, const size_t outputSize) {
-    command(cmd);
-    write(input, inputSize);
-    read(output, outputSize);
+    submit(cmd, input, inputSize, output, outputSize);
+    flush();
+}
+
+void PinataClient::doSymmetricCipherRequests(uint8_t cmd, const uint8_t *input, size_t inputSize, uint8_t *output,
+                                             size_t outputSize, size_t count) {
+    checkSupported(cmd);
+    flush();
+    while (count != 0) {
+        // No more requests at once than the board can buffer, just like the pipeline.
+        const size_t window =
+            std::min({count, getWindow(), std::max<size_t>(1, getByteWindow() / getRequestSize(inputSize))});
+        if (m_framed) {
+            m_requestBuffer.clear();
+            for (size_t i = 0; i != window; ++i) {
+                appendFrame(m_requestBuffer, cmd, input + i * inputSize, inputSize);
+            }
+        } else {
+            m_requestBuffer.resize(window * (1 + inputSize));
+            for (size_t i = 0; i != window; ++i) {
+                uint8_t *request = m_requestBuffer.data() + i * (1 + inputSize);
+                request[0] = cmd;
+                std::copy(input + i * inputSize, input + (i + 1) * inputSize, request + 1);
+            }
+        }
+        m_command = cmd;
+        m_statistics[cmd].requests += window;
+        write(m_requestBuffer.data(), m_requestBuffer.size());
+        readResponse(cmd, output, window * outputSize, outputSize);
+        input += window * inputSize;
+        output += window * outputSize;
+        count -= window;
+    }
+}
+
+void PinataClient::doBatchRequests(uint8_t cmd, const uint8_t *input, uint8_t *output, size_t blockSize, size_t count,
+                                   uint16_t gap) {
+    flush();
+    if (getBatchBlockSize(cmd) == 0) {
+        throw std::invalid_argument("command cannot be batched");
+    }
+    if (getBatchBlockSize(cmd) != blockSize) {
+        throw std::invalid_argument("wrong block size for the batched command");
+    }
+    const size_t headerSize = 6;
+    while (count != 0) {
+        const size_t blocks = std::min(count, getBatchBufferSize() / blockSize);
+        m_requestBuffer.resize(headerSize + blocks * blockSize);
+        m_requestBuffer[0] = CMD_BATCH;
+        m_requestBuffer[1] = cmd;
+        m_requestBuffer[2] = uint8_t(blocks >> 8);
+        m_requestBuffer[3] = uint8_t(blocks);
+        m_requestBuffer[4] = uint8_t(gap >> 8);
+        m_requestBuffer[5] = uint8_t(gap);
+        std::copy(input, input + blocks * blockSize, m_requestBuffer.begin() + headerSize);
+        m_command = CMD_BATCH;
+        ++m_statistics[CMD_BATCH].requests;
+        sendRequest(m_requestBuffer.data(), m_requestBuffer.size());
+        // Every block has the deadline of a single request of its own.
+        readResponse(CMD_BATCH, output, blocks * blockSize, blockSize);
+        input += blocks * blockSize;
+        output += blocks * blockSize;
+        count -= blocks;
+    }
+}
+
+void PinataClient::doSeededBatchRequests(uint8_t cmd, const BatchSeed &seed, uint8_t *output, size_t blockSize,
+                                         size_t count, uint16_t gap) {
+    flush();
+    if (getBatchBlockSize(cmd) == 0) {
+        throw std::invalid_argument("command cannot be batched");
+    }
+    if (getBatchBlockSize(cmd) != blockSize) {
+        throw std::invalid_argument("wrong block size for the batched command");
+    }
+    // The firmware reseeds for every request, so each batch starts where the generator of the previous one left off.
+    BatchInputGenerator generator(seed);
+    while (count != 0) {
+        const size_t blocks = std::min(count, getBatchBufferSize() / blockSize);
+        writeSeededBatchRequest(cmd, generator.getState(), blocks, gap, batchModeOutputs);
+        readResponse(CMD_BATCH_SEEDED, output, blocks * blockSize, blockSize);
+        generator.discard(blocks * blockSize);
+        output += blocks * blockSize;
+        count -= blocks;
+    }
+}
+
+uint32_t PinataClient::doSeededBatchHash(uint8_t cmd, const BatchSeed &seed, size_t count, uint16_t gap) {
+    if (count > 0xFFFF) {
+        throw std::invalid_argument("too many blocks for a single hashed batch");
+    }
+    flush();
+    if (getBatchBlockSize(cmd) == 0) {
+        throw std::invalid_argument("command cannot be batched");
+    }
+    writeSeededBatchRequest(cmd, seed, count, gap, batchModeHash);
+    std::array<uint8_t, 4> hash;
+    // Every block has the deadline of a single request of its own.
+    readResponse(CMD_BATCH_SEEDED, hash.data(), hash.size(), hash.size(), std::max<size_t>(count, 1));
+    // resync() drains the rest of "BadCmd".
+    if (isTruncatedBadCommand(hash)) {
+        fail(ResponseError::Reason::BadCommand, CMD_BATCH_SEEDED);
+    }
+    return boost::endian::load_big_u32(hash.data());
+}
+
+void PinataClient::writeSeededBatchRequest(uint8_t cmd, const BatchSeed &seed, size_t count, uint16_t gap,
+                                           uint8_t mode) {
+    m_requestBuffer = {CMD_BATCH_SEEDED, cmd, uint8_t(count >> 8), uint8_t(count), uint8_t(gap >> 8), uint8_t(gap),
+                       mode};
+    m_requestBuffer.insert(m_requestBuffer.end(), seed.begin(), seed.end());
+    m_command = CMD_BATCH_SEEDED;
+    ++m_statistics[CMD_BATCH_SEEDED].requests;
+    sendRequest(m_requestBuffer.data(), m_requestBuffer.size());
+}
+
+void PinataClient::checkSupported(uint8_t cmd) const {
+    if (!supports(cmd)) {
+        throw std::invalid_argument("the firmware does not implement this command");
+    }
+}
+
+void PinataClient::sendRequest(const uint8_t *request, size_t size) {
+    if (!m_framed) {
+        writeBytes(request, size);
+        return;
+    }
+    std::vector<uint8_t> frame;
+    appendFrame(frame, request[0], request + 1, size - 1);
+    writeBytes(frame.data(), frame.size());
+}
+
+void PinataClient::appendFrame(std::vector<uint8_t> &out, uint8_t cmd, const uint8_t *payload, size_t size) {
+    if (size > frameRequestPayloadSize) {
+        throw std::invalid_argument("request payload does not fit in a frame");
+    }
+    FramedRequest request{m_nextSequence++, cmd};
+    encodeFrame(request.frame, request.sequence, cmd, payload, size);
+    out.insert(out.end(), request.frame.begin(), request.frame.end());
+    m_frames.push_back(std::move(request));
+}
+
+void PinataClient::SWDESEncrypt(std::span<const DesBlock> plaintexts, std::span<DesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWDES_ENC, plaintexts, ciphertexts);
+}
+
+void PinataClient::SWDESDecrypt(std::span<const DesBlock> ciphertexts, std::span<DesBlock> plaintexts) {
+    doSymmetricCipherRequests(CMD_SWDES_DEC, ciphertexts, plaintexts);
+}
+
+void PinataClient::SWTDESEncrypt(std::span<const DesBlock> plaintexts, std::span<DesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWTDES_ENC, plaintexts, ciphertexts);
+}
+
+void PinataClient::SWTDESDecrypt(std::span<const DesBlock> ciphertexts, std::span<DesBlock> plaintexts) {
+    doSymmetricCipherRequests(CMD_SWTDES_DEC, ciphertexts, plaintexts);
+}
+
+void PinataClient::AES128SWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWAES128_ENC, plaintexts, ciphertexts);
+}
+
+void PinataClient::AES128SWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts) {
+    doSymmetricCipherRequests(CMD_SWAES128_DEC, ciphertexts, plaintexts);
+}
+
+void PinataClient::AES128SWEncryptNoTrigger(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWAES128SPI_ENC, plaintexts, ciphertexts);
+}
+
+void PinataClient::AES128TTablesSWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWAES128TTABLES_ENC, plaintexts, ciphertexts);
+}
+
+void PinataClient::AES128TTablesSWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts) {
+    doSymmetricCipherRequests(CMD_SWAES128TTABLES_DEC, ciphertexts, plaintexts);
+}
+
+void PinataClient::AES128TTablesAsmSWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts,
+                                             bool sramTable) {
+    doSymmetricCipherRequests(sramTable ? CMD_SWAES128TTABLESASM_SRAM_ENC : CMD_SWAES128TTABLESASM_ENC, plaintexts,
+                              ciphertexts);
+}
+
+void PinataClient::AES128TTablesAsmSWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts,
+                                             bool sramTable) {
+    doSymmetricCipherRequests(sramTable ? CMD_SWAES128TTABLESASM_SRAM_DEC : CMD_SWAES128TTABLESASM_DEC, ciphertexts,
+                              plaintexts);
+}
+
+void PinataClient::AES128FixslicedSWEncrypt(std::span<const AesBlockPair> plaintexts,
+                                            std::span<AesBlockPair> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWAES128FIXSLICED_ENC, plaintexts, ciphertexts);
+}
+
+void PinataClient::AES128FixslicedSWDecrypt(std::span<const AesBlockPair> ciphertexts,
+                                            std::span<AesBlockPair> plaintexts) {
+    doSymmetricCipherRequests(CMD_SWAES128FIXSLICED_DEC, ciphertexts, plaintexts);
+}
+
+void PinataClient::AES256SWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWAES256_ENC, plaintexts, ciphertexts);
+}
+
+void PinataClient::AES256SWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts) {
+    doSymmetricCipherRequests(CMD_SWAES256_DEC, ciphertexts, plaintexts);
+}
+
+void PinataClient::AES128MaskingSWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWAES128_ENC_MASKED, plaintexts, ciphertexts);
+}
+
+void PinataClient::AES128MaskingSWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts) {
+    doSymmetricCipherRequests(CMD_SWAES128_DEC_MASKED, ciphertexts, plaintexts);
+}
+
+void PinataClient::AES128SWRndDelaysEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWAES128_ENC_RNDDELAYS, plaintexts, ciphertexts);
+}
+
+void PinataClient::AES128SWRndSBoxEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts) {
+    doSymmetricCipherRequests(CMD_SWAES128_ENC_RNDSBOX, plaintexts, ciphertexts);
 }
 
 void PinataClient::AES128SWEncrypt(const uint8_t *plaintext, uint8_t *ciphertext) {
@@ -216,6 +834,34 @@ void PinataClient::AES128SWEncryptNoTrigger(const uint8_t *plaintext, uint8_t *c
     doSymmetricCipherRequest(CMD_SWAES128SPI_ENC, plaintext, AESBLOCKSIZE, ciphertext, AESBLOCKSIZE);
 }
 
+void PinataClient::AES128KeyChange(const uint8_t *key) {
+    AesBlock echo;
+    doSymmetricCipherRequest(CMD_AES128_KEYCHANGE, key, AESBLOCKSIZE, echo.data(), echo.size());
+    if (!std::equal(echo.begin(), echo.end(), key)) {
+        throw std::runtime_error("unexpected return value");
+    }
+}
+
+void PinataClient::setAES128SWKeyExpansionPerCall(bool perCall) {
+    const uint8_t mode = perCall ? 0x01 : 0x00;
+    uint8_t answer;
+    doSymmetricCipherRequest(CMD_SWAES128_SET_KEY_EXPANSION, &mode, 1, &answer, 1);
+    if (answer != mode) {
+        throw std::runtime_error("unexpected return value");
+    }
+}
+
+uint16_t PinataClient::setAES128MaskRefresh(uint16_t blocks) {
+    const uint8_t request[2] = {uint8_t(blocks >> 8), uint8_t(blocks)};
+    uint8_t answer[2];
+    doSymmetricCipherRequest(CMD_SWAES128_SET_MASK_REFRESH, request, sizeof(request), answer, sizeof(answer));
+    const uint16_t interval = uint16_t(answer[0] << 8 | answer[1]);
+    if (blocks != 0 && interval != blocks) {
+        throw std::runtime_error("unexpected return value");
+    }
+    return interval;
+}
+
 void PinataClient::AES128TTablesSWEncrypt(const uint8_t *plaintext, uint8_t *ciphertext) {
     doSymmetricCipherRequest(CMD_SWAES128TTABLES_ENC, plaintext, AESBLOCKSIZE, ciphertext, AESBLOCKSIZE);
 }
@@ -224,6 +870,24 @@ void PinataClient::AES128TTablesSWDecrypt(const uint8_t *ciphertext, uint8_t *pl
     doSymmetricCipherRequest(CMD_SWAES128TTABLES_DEC, ciphertext, AESBLOCKSIZE, plaintext, AESBLOCKSIZE);
 }
 
+void PinataClient::AES128TTablesAsmSWEncrypt(const uint8_t *plaintext, uint8_t *ciphertext, bool sramTable) {
+    doSymmetricCipherRequest(sramTable ? CMD_SWAES128TTABLESASM_SRAM_ENC : CMD_SWAES128TTABLESASM_ENC, plaintext,
+                             AESBLOCKSIZE, ciphertext, AESBLOCKSIZE);
+}
+
+void PinataClient::AES128TTablesAsmSWDecrypt(const uint8_t *ciphertext, uint8_t *plaintext, bool sramTable) {
+    doSymmetricCipherRequest(sramTable ? CMD_SWAES128TTABLESASM_SRAM_DEC : CMD_SWAES128TTABLESASM_DEC, ciphertext,
+                             AESBLOCKSIZE, plaintext, AESBLOCKSIZE);
+}
+
+void PinataClient::AES128FixslicedSWEncrypt(const uint8_t *plaintexts, uint8_t *ciphertexts) {
+    doSymmetricCipherRequest(CMD_SWAES128FIXSLICED_ENC, plaintexts, 2 * AESBLOCKSIZE, ciphertexts, 2 * AESBLOCKSIZE);
+}
+
+void PinataClient::AES128FixslicedSWDecrypt(const uint8_t *ciphertexts, uint8_t *plaintexts) {
+    doSymmetricCipherRequest(CMD_SWAES128FIXSLICED_DEC, ciphertexts, 2 * AESBLOCKSIZE, plaintexts, 2 * AESBLOCKSIZE);
+}
+
 void PinataClient::AES256SWEncrypt(const uint8_t *plaintext, uint8_t *ciphertext) {
     doSymmetricCipherRequest(CMD_SWAES256_ENC, plaintext, AESBLOCKSIZE, ciphertext, AESBLOCKSIZE);
 }
@@ -248,6 +912,140 @@ void PinataClient::AES128SWRndSBoxEncrypt(const uint8_t *plaintext, uint8_t *cip
     doSymmetricCipherRequest(CMD_SWAES128_ENC_RNDSBOX, plaintext, AESBLOCKSIZE, ciphertext, AESBLOCKSIZE);
 }
 
+boost::asio::awaitable<void> PinataClient::asyncSymmetricCipherRequest(uint8_t cmd, const uint8_t *input,
+                                                                       size_t inputSize, uint8_t *output,
+                                                                       size_t outputSize) {
+    checkSupported(cmd);
+    if (!m_inFlight.empty()) {
+        throw std::logic_error("awaitable requests cannot be mixed with pipelined requests");
+    }
+    if (m_framed) {
+        throw std::logic_error("awaitable requests are not available in framed mode");
+    }
+    // Not m_requestBuffer: that buffer belongs to the synchronous path, which may be used by another thread.
+    std::vector<uint8_t> request(1 + inputSize);
+    request[0] = cmd;
+    std::copy(input, input + inputSize, request.begin() + 1);
+    CommandStatistics &statistics = m_statistics[cmd];
+    ++statistics.requests;
+    auto start = std::chrono::steady_clock::now();
+    co_await m_transport->asyncWrite(request.data(), request.size());
+    statistics.writeLatency.record(elapsedSince(start));
+    statistics.bytesWritten += request.size();
+    bool timedOut = false;
+    start = std::chrono::steady_clock::now();
+    try {
+        co_await m_transport->asyncRead(output, outputSize, getDeadline(cmd));
+    } catch (const boost::system::system_error &ex) {
+        if (ex.code() != boost::asio::error::timed_out) {
+            throw;
+        }
+        timedOut = true;
+    }
+    statistics.readLatency.record(elapsedSince(start));
+    if (timedOut) {
+        ++statistics.errors;
+        throw ResponseError(ResponseError::Reason::Timeout, cmd);
+    }
+    if (const std::optional<ResponseError::Reason> reason = classifyResponse(output, outputSize)) {
+        throw ResponseError(*reason, cmd);
+    }
+}
+
+boost::asio::awaitable<DesBlock> PinataClient::asyncSWDESEncrypt(DesBlock plaintext) {
+    DesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWDES_ENC, plaintext.data(), plaintext.size(), ciphertext.data(),
+                                         ciphertext.size());
+    co_return ciphertext;
+}
+
+boost::asio::awaitable<DesBlock> PinataClient::asyncSWDESDecrypt(DesBlock ciphertext) {
+    DesBlock plaintext;
+    co_await asyncSymmetricCipherRequest(CMD_SWDES_DEC, ciphertext.data(), ciphertext.size(), plaintext.data(),
+                                         plaintext.size());
+    co_return plaintext;
+}
+
+boost::asio::awaitable<DesBlock> PinataClient::asyncSWTDESEncrypt(DesBlock plaintext) {
+    DesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWTDES_ENC, plaintext.data(), plaintext.size(), ciphertext.data(),
+                                         ciphertext.size());
+    co_return ciphertext;
+}
+
+boost::asio::awaitable<DesBlock> PinataClient::asyncSWTDESDecrypt(DesBlock ciphertext) {
+    DesBlock plaintext;
+    co_await asyncSymmetricCipherRequest(CMD_SWTDES_DEC, ciphertext.data(), ciphertext.size(), plaintext.data(),
+                                         plaintext.size());
+    co_return plaintext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128SWEncrypt(AesBlock plaintext) {
+    AesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128_ENC, plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+    co_return ciphertext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128SWDecrypt(AesBlock ciphertext) {
+    AesBlock plaintext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128_DEC, ciphertext.data(), ciphertext.size(), plaintext.data(), plaintext.size());
+    co_return plaintext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128SWEncryptNoTrigger(AesBlock plaintext) {
+    AesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128SPI_ENC, plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+    co_return ciphertext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128TTablesSWEncrypt(AesBlock plaintext) {
+    AesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128TTABLES_ENC, plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+    co_return ciphertext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128TTablesSWDecrypt(AesBlock ciphertext) {
+    AesBlock plaintext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128TTABLES_DEC, ciphertext.data(), ciphertext.size(), plaintext.data(), plaintext.size());
+    co_return plaintext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES256SWEncrypt(AesBlock plaintext) {
+    AesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES256_ENC, plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+    co_return ciphertext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES256SWDecrypt(AesBlock ciphertext) {
+    AesBlock plaintext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES256_DEC, ciphertext.data(), ciphertext.size(), plaintext.data(), plaintext.size());
+    co_return plaintext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128MaskingSWEncrypt(AesBlock plaintext) {
+    AesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128_ENC_MASKED, plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+    co_return ciphertext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128MaskingSWDecrypt(AesBlock ciphertext) {
+    AesBlock plaintext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128_DEC_MASKED, ciphertext.data(), ciphertext.size(), plaintext.data(), plaintext.size());
+    co_return plaintext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128SWRndDelaysEncrypt(AesBlock plaintext) {
+    AesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128_ENC_RNDDELAYS, plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+    co_return ciphertext;
+}
+
+boost::asio::awaitable<AesBlock> PinataClient::asyncAES128SWRndSBoxEncrypt(AesBlock plaintext) {
+    AesBlock ciphertext;
+    co_await asyncSymmetricCipherRequest(CMD_SWAES128_ENC_RNDSBOX, plaintext.data(), plaintext.size(), ciphertext.data(), ciphertext.size());
+    co_return ciphertext;
+}
+
 void PinataClient::SWDESEncrypt(const uint8_t *plaintext, uint8_t *ciphertext) {
     doSymmetricCipherRequest(CMD_SWDES_ENC, plaintext, DESLENGTHINBYTES, ciphertext, DESLENGTHINBYTES);
 }
@@ -265,31 +1063,359 @@ void PinataClient::SWTDESDecrypt(const uint8_t *ciphertext, uint8_t *plaintext)
 }
 
 void PinataClient::command(uint8_t cmd) {
-    boost::asio::write(m_port, boost::asio::buffer(&cmd, sizeof(cmd)), boost::asio::transfer_at_least(sizeof(cmd)));
+    checkSupported(cmd);
+    // Commands that are not pipelined must not interleave with responses of pipelined requests.
+    flush();
+    m_command = cmd;
+    ++m_statistics[cmd].requests;
+    if (m_framed) {
+        m_frameOpen = true;
+        m_framePayload.clear();
+        return;
+    }
+    writeBytes(&cmd, sizeof(cmd));
 }
 
-void PinataClient::read(uint8_t *data, size_t size) {
-    boost::system::error_code ec;
-    // set up a deadline timer for a 3-second timeout
-    boost::asio::deadline_timer timeout(m_context);
-    timeout.expires_from_now(boost::posix_time::seconds(3));
-    timeout.async_wait([this](const boost::system::error_code &error) {
-        if (error != boost::asio::error::operation_aborted) {
-            m_port.cancel();
+void PinataClient::writeBytes(const uint8_t *data, size_t size) {
+    if (m_frameOpen) {
+        m_framePayload.insert(m_framePayload.end(), data, data + size);
+        return;
+    }
+    CommandStatistics &statistics = m_statistics[m_command];
+    const auto start = std::chrono::steady_clock::now();
+    m_transport->write(data, size);
+    statistics.writeLatency.record(elapsedSince(start));
+    statistics.bytesWritten += size;
+}
+
+void PinataClient::read(uint8_t *data, size_t size) { readResponse(m_command, data, size); }
+
+void PinataClient::readResponse(uint8_t cmd, uint8_t *data, size_t size, size_t responseSize, size_t deadlines) {
+    if (responseSize == 0) {
+        responseSize = size;
+    }
+    if (deadlines == 0) {
+        deadlines = size / responseSize;
+    }
+    if (m_frameOpen) {
+        // The request written since command() is complete.
+        m_frameOpen = false;
+        std::vector<uint8_t> frame;
+        appendFrame(frame, m_command, m_framePayload.data(), m_framePayload.size());
+        writeBytes(frame.data(), frame.size());
+    }
+    CommandStatistics &statistics = m_statistics[cmd];
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        if (m_framed) {
+            readFrames(data, size, getDeadline(cmd) * deadlines);
+        } else {
+            m_transport->read(data, size, getDeadline(cmd) * deadlines);
+        }
+    } catch (const ResponseError &) {
+        // Framed mode gave up on the request, after a resync().
+        statistics.readLatency.record(elapsedSince(start));
+        throw;
+    } catch (const boost::system::system_error &ex) {
+        statistics.readLatency.record(elapsedSince(start));
+        if (ex.code() != boost::asio::error::timed_out) {
+            throw;
+        }
+        fail(ResponseError::Reason::Timeout, cmd);
+    }
+    statistics.readLatency.record(elapsedSince(start));
+    statistics.bytesRead += size;
+    for (size_t offset = 0; offset < size; offset += responseSize) {
+        if (const std::optional<ResponseError::Reason> reason =
+                classifyResponse(data + offset, std::min(responseSize, size - offset))) {
+            fail(*reason, cmd);
+        }
+    }
+}
+
+void PinataClient::readFrames(uint8_t *data, size_t size, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (size != 0) {
+        if (m_frames.empty()) {
+            // Everything that was asked for has been answered, and read.
+            throw boost::system::system_error(boost::asio::error::timed_out);
+        }
+        FramedRequest &request = m_frames.front();
+        if (request.response.size() > request.consumed) {
+            const size_t chunk = std::min(size, request.response.size() - request.consumed);
+            std::copy_n(request.response.begin() + request.consumed, chunk, data);
+            request.consumed += chunk;
+            data += chunk;
+            size -= chunk;
+        } else if (request.complete) {
+            m_frames.pop_front();
+        } else if (const std::optional<ResponseError::Reason> reason = receiveFrame(deadline)) {
+            retransmitFrames(*reason);
+            // The requests that were sent again get a fresh deadline.
+            deadline = std::chrono::steady_clock::now() + timeout;
+        }
+    }
+}
+
+std::optional<ResponseError::Reason> PinataClient::receiveFrame(std::chrono::steady_clock::time_point deadline) {
+    const auto readBefore = [this, deadline](uint8_t *data, size_t size) {
+        const auto remaining =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining <= std::chrono::milliseconds::zero()) {
+            throw boost::system::system_error(boost::asio::error::timed_out);
+        }
+        m_transport->read(data, size, remaining);
+    };
+    std::vector<uint8_t> frame(frameHeaderSize);
+    try {
+        // Skip whatever is left of a damaged frame.
+        do {
+            readBefore(frame.data(), 1);
+        } while (frame[0] != frameMagic);
+        readBefore(frame.data() + 1, frameHeaderSize - 1);
+        const size_t payloadSize = boost::endian::load_big_u16(frame.data() + 3);
+        if (payloadSize > frameResponsePayloadSize) {
+            return ResponseError::Reason::CorruptFrame;
+        }
+        frame.resize(frameHeaderSize + payloadSize + frameCrcSize);
+        readBefore(frame.data() + frameHeaderSize, payloadSize + frameCrcSize);
+    } catch (const boost::system::system_error &ex) {
+        if (ex.code() != boost::asio::error::timed_out) {
+            throw;
         }
+        // Either the request or its response lost a byte, or the board is gone.
+        return ResponseError::Reason::Timeout;
+    }
+    const size_t payloadSize = frame.size() - frameHeaderSize - frameCrcSize;
+    if (boost::endian::load_big_u32(frame.data() + frameHeaderSize + payloadSize) !=
+        frameCrc32(frame.data(), frameHeaderSize + payloadSize)) {
+        return ResponseError::Reason::CorruptFrame;
+    }
+    const uint8_t sequence = frame[1];
+    const auto request = std::find_if(m_frames.begin(), m_frames.end(), [sequence](const FramedRequest &request) {
+        return !request.complete && request.sequence == sequence;
     });
+    if (request == m_frames.end()) {
+        // A late answer to a request that has been sent again and answered since.
+        return std::nullopt;
+    }
+    const uint8_t status = frame[2];
+    if (status == frameStatusOk || status == frameStatusMore || status == frameStatusShortPayload) {
+        request->response.insert(request->response.end(), frame.begin() + frameHeaderSize,
+                                 frame.begin() + frameHeaderSize + payloadSize);
+        request->complete = status != frameStatusMore;
+        if (status == frameStatusShortPayload) {
+            fail(ResponseError::Reason::ShortPayload, request->cmd);
+        }
+        return std::nullopt;
+    }
+    if (status == frameStatusDuplicate) {
+        // The board ran the request already, and its response took more than one frame: it cannot be sent again.
+        fail(ResponseError::Reason::LostResponse, request->cmd);
+    }
+    if (status != frameStatusBadCrc && status != frameStatusTooLong) {
+        fail(ResponseError::Reason::CorruptFrame, request->cmd);
+    }
+    // The board rejected the request frame without running it: send that one again.
+    if (++request->retries > maxFrameRetries) {
+        fail(ResponseError::Reason::CorruptFrame, request->cmd);
+    }
+    request->response.clear();
+    writeBytes(request->frame.data(), request->frame.size());
+    return std::nullopt;
+}
+
+void PinataClient::retransmitFrames(ResponseError::Reason reason) {
+    // The rest of the damaged frame, and answers that may be incomplete, go.
+    m_transport->drain(resyncQuietTime, resyncDrainLimit);
+    // The board only recognises the last request it ran, and answers it again from the single frame of its response.
+    // Any other request that is still unanswered may have run already: sending it again could run the command, and
+    // raise the trigger, a second time. Responses arrive in order, so the only unanswered request is the last one.
+    const auto incomplete = std::find_if(m_frames.begin(), m_frames.end(),
+                                         [](const FramedRequest &request) { return !request.complete; });
+    if (std::next(incomplete) != m_frames.end() || !incomplete->response.empty() ||
+        ++incomplete->retries > maxFrameRetries) {
+        fail(reason, incomplete->cmd);
+    }
+    writeBytes(incomplete->frame.data(), incomplete->frame.size());
+}
+
+void PinataClient::fail(ResponseError::Reason reason, uint8_t cmd) {
+    ++m_statistics[cmd].errors;
+    m_inFlight.clear();
+    m_bytesInFlight = 0;
+    m_frames.clear();
+    if (m_autoResync) {
+        resync();
+    }
+    throw ResponseError(reason, cmd);
+}
+
+void PinataClient::setFramedMode(bool framed) {
+    if (framed == m_framed) {
+        return;
+    }
+    const uint8_t protocol = framed ? protocolFramed : protocolLegacy;
+    command(CMD_SET_PROTOCOL);
+    write(&protocol, 1);
+    // The board answers in the protocol of the request, then switches.
+    uint8_t answer;
+    read(&answer, 1);
+    if (answer == 'B') {
+        // resync() drains the rest of "BadCmd".
+        fail(ResponseError::Reason::BadCommand, CMD_SET_PROTOCOL);
+    }
+    if (answer != protocol) {
+        throw std::runtime_error("unexpected return value");
+    }
+    m_framed = framed;
+    m_frames.clear();
+}
 
-    boost::asio::async_read(m_port, boost::asio::mutable_buffer(data, size),
-                            [&timeout, &ec](const boost::system::error_code &error, std::size_t bytes_transferred) {
-                                if (!error) {
-                                    timeout.cancel();
-                                } else {
-                                    ec = error;
-                                }
-                            });
-    m_context.run();
-    m_context.restart();
-    if (ec) {
-        throw boost::system::system_error(ec);
+uint32_t PinataClient::negotiateBaudRate(uint32_t baudRate) {
+    if (m_framed) {
+        throw std::logic_error("the baud rate cannot be negotiated in framed mode");
+    }
+    flush();
+    std::array<uint8_t, 5> request = {CMD_SET_BAUD_RATE};
+    boost::endian::store_big_u32(request.data() + 1, baudRate);
+    m_command = CMD_SET_BAUD_RATE;
+    ++m_statistics[CMD_SET_BAUD_RATE].requests;
+    write(request.data(), request.size());
+    std::array<uint8_t, 4> achieved;
+    readResponse(CMD_SET_BAUD_RATE, achieved.data(), achieved.size());
+    if (isTruncatedBadCommand(achieved)) {
+        fail(ResponseError::Reason::BadCommand, CMD_SET_BAUD_RATE);
+    }
+    if (boost::endian::load_big_u32(achieved.data()) == 0) {
+        // The board cannot generate baudRate from its clock and stays where it is.
+        return m_baudRate;
+    }
+    // The board now listens at baudRate, until baudConfirmTimeout has passed without a confirmation.
+    m_transport->setBaudRate(baudRate);
+    write(&baudConfirm, 1);
+    uint8_t confirmation = 0;
+    try {
+        m_transport->read(&confirmation, 1, baudConfirmTimeout);
+    } catch (const boost::system::system_error &ex) {
+        if (ex.code() != boost::asio::error::timed_out) {
+            throw;
+        }
+    }
+    if (confirmation == baudConfirm) {
+        m_baudRate = baudRate;
+        return m_baudRate;
+    }
+    // Either the board did not get the confirmation and goes back to the default, or only its answer got lost and
+    // it stays at baudRate: try both, after the board has given up waiting.
+    ++m_statistics[CMD_SET_BAUD_RATE].errors;
+    std::this_thread::sleep_for(baudConfirmTimeout);
+    for (const uint32_t candidate : {PinataDefaultBaudRate, baudRate}) {
+        m_transport->setBaudRate(candidate);
+        if (resync()) {
+            m_baudRate = candidate;
+            return m_baudRate;
+        }
+    }
+    throw ResponseError(ResponseError::Reason::Timeout, CMD_SET_BAUD_RATE);
+}
+
+bool PinataClient::resync() {
+    // Whatever is still on its way belongs to requests that can no longer be matched.
+    m_inFlight.clear();
+    m_bytesInFlight = 0;
+    m_frames.clear();
+    m_frameOpen = false;
+    m_command = CMD_GET_CODE_REV;
+    m_resyncPadded = false;
+    // Framed mode: a CMD_GET_CODE_REV frame, answered by a frame with the version string.
+    const auto probeFramed = [this] {
+        std::vector<uint8_t> probe;
+        encodeFrame(probe, m_nextSequence++, CMD_GET_CODE_REV, nullptr, 0);
+        m_transport->write(probe.data(), probe.size());
+        std::array<uint8_t, frameHeaderSize + 8 + frameCrcSize> response;
+        try {
+            m_transport->read(response.data(), response.size(), resyncProbeDeadline);
+        } catch (const boost::system::system_error &ex) {
+            if (ex.code() == boost::asio::error::timed_out) {
+                return false;
+            }
+            throw;
+        }
+        return response[0] == frameMagic && response[1] == probe[1] &&
+               boost::endian::load_big_u32(response.data() + frameHeaderSize + 8) ==
+                   frameCrc32(response.data(), frameHeaderSize + 8) &&
+               std::equal(response.begin() + frameHeaderSize, response.begin() + frameHeaderSize + 4, "Ver ");
+    };
+    try {
+        if (m_framed) {
+            // The board drops a frame that stalls and looks for the next magic byte, so no padding is needed.
+            for (int attempt = 0; attempt != 2; ++attempt) {
+                if (!m_transport->drain(resyncQuietTime, resyncDrainLimit)) {
+                    return false;
+                }
+                if (probeFramed()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Legacy mode: the version string, or nothing when the board did not answer.
+        const auto probeLegacy = [this]() -> std::optional<bool> {
+            m_transport->write(&CMD_GET_CODE_REV, sizeof(CMD_GET_CODE_REV));
+            std::array<uint8_t, versionSize> version;
+            try {
+                m_transport->read(version.data(), version.size(), resyncProbeDeadline);
+            } catch (const boost::system::system_error &ex) {
+                if (ex.code() == boost::asio::error::timed_out) {
+                    return std::nullopt;
+                }
+                throw;
+            }
+            return std::equal(version.begin(), version.begin() + 4, "Ver ");
+        };
+        if (!m_transport->drain(resyncQuietTime, resyncDrainLimit)) {
+            return false;
+        }
+        if (const std::optional<bool> answered = probeLegacy()) {
+            return *answered;
+        }
+        // The board swallowed the probe as payload of an earlier command. CMD_GET_CODE_REV takes no payload, so a run
+        // of them completes that command, and the surplus is answered. The padding covers the largest request payload
+        // of the board, e.g. an ML-DSA key upload of the PQC firmware. It goes out a receive ring at a time, each
+        // drained before the next so that the board never overwrites unread bytes, and is probed once at the end.
+        const size_t maxPayloadSize =
+            m_capabilities && m_capabilities->maxFramePayloadSize != 0 ? m_capabilities->maxFramePayloadSize
+                                                                        : frameRequestPayloadSize;
+        const size_t chunkSize = m_capabilities && m_capabilities->usartReceiveRingSize != 0
+                                     ? m_capabilities->usartReceiveRingSize
+                                     : resyncPaddingSize;
+        // Long enough for the answers to a whole chunk, at 10 bits per byte.
+        const std::chrono::milliseconds chunkDrainLimit =
+            resyncDrainLimit + std::chrono::milliseconds(chunkSize * versionSize * 10 * 1000 / m_baudRate);
+        const std::vector<uint8_t> padding(chunkSize, CMD_GET_CODE_REV);
+        for (size_t sent = 0; sent < maxPayloadSize; sent += chunkSize) {
+            m_transport->write(padding.data(), padding.size());
+            if (!m_transport->drain(resyncQuietTime, chunkDrainLimit)) {
+                return false;
+            }
+        }
+        if (const std::optional<bool> answered = probeLegacy()) {
+            m_resyncPadded = true;
+            return *answered;
+        }
+        // No answer at all: the board may still be in framed mode, e.g. after a client that did not switch it back.
+        std::vector<uint8_t> request;
+        encodeFrame(request, m_nextSequence++, CMD_SET_PROTOCOL, &protocolLegacy, 1);
+        m_transport->write(request.data(), request.size());
+        if (!m_transport->drain(resyncQuietTime, resyncDrainLimit)) {
+            return false;
+        }
+        m_transport->write(&CMD_GET_CODE_REV, sizeof(CMD_GET_CODE_REV));
+        std::array<uint8_t, 8> version;
+        m_transport->read(version.data(), version.size(), resyncProbeDeadline);
+        return std::equal(version.begin(), version.begin() + 4, "Ver ");
+    } catch (const boost::system::system_error &) {
     }
+    return false;
 }
@@ -1,25 +1,93 @@
 #pragma once
 
-#include <boost/asio/io_context.hpp>
-#include <boost/asio/serial_port.hpp>
-#include <boost/asio/buffer.hpp>
-#include <boost/asio/read.hpp>
-#include <boost/asio/write.hpp>
+#include "Statistics.hpp"
+#include "Transport.hpp"
 #include <boost/endian/conversion.hpp>
+#include <boost/system/system_error.hpp>
 
 #include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <iomanip>
 #include <array>
+#include <bitset>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
 #include <stdint.h>
 
 const char* getSerialPortFilePath();
 
 constexpr const uint8_t PinataVersionMajor = 3;
 constexpr const uint8_t PinataVersionMinor = 2;
+/// The baud rate of USART3 after a reset, and after a failed CMD_SET_BAUD_RATE.
+constexpr const uint32_t PinataDefaultBaudRate = 115200;
+
+/// Command bytes understood by the firmware.
+constexpr const uint8_t CMD_GET_CODE_REV = 0xF1;
+constexpr const uint8_t CMD_HWAES128_ENC = 0xCA;
+
+constexpr const uint8_t CMD_SW_MLDSA_GET_VARIANT = 0x90;
+constexpr const uint8_t CMD_SW_MLDSA_SET_PUBLIC_AND_PRIVATE_KEY = 0x91;
+constexpr const uint8_t CMD_SW_MLDSA_VERIFY = 0x92;
+constexpr const uint8_t CMD_SW_MLDSA_SIGN = 0x93;
+constexpr const uint8_t CMD_SW_MLDSA_GET_KEY_SIZES = 0x94;
+
+constexpr const uint8_t CMD_SW_MLKEM_SET_PUBLIC_AND_PRIVATE_KEY = 0x02;
+constexpr const uint8_t CMD_SW_MLKEM_GET_KEY_SIZES = 0x03;
+constexpr const uint8_t CMD_SW_MLKEM_GENERATE = 0x04;
+constexpr const uint8_t CMD_SW_MLKEM_DEC = 0x05;
+
+constexpr const uint8_t CMD_SWDES_ENC = 0x44;
+constexpr const uint8_t CMD_SWDES_DEC = 0x45;
+constexpr const uint8_t CMD_SWTDES_ENC = 0x46;
+constexpr const uint8_t CMD_SWTDES_DEC = 0x47;
+constexpr const uint8_t CMD_SWAES128_ENC = 0xAE;
+constexpr const uint8_t CMD_SWAES128_DEC = 0xEA;
+constexpr const uint8_t CMD_SWAES128SPI_ENC = 0xCE;
+constexpr const uint8_t CMD_SWAES128TTABLES_ENC = 0x41;
+constexpr const uint8_t CMD_SWAES128TTABLES_DEC = 0x50;
+constexpr const uint8_t CMD_SWAES128TTABLESASM_ENC = 0x42;
+constexpr const uint8_t CMD_SWAES128TTABLESASM_SRAM_ENC = 0x43;
+constexpr const uint8_t CMD_SWAES128TTABLESASM_DEC = 0x51;
+constexpr const uint8_t CMD_SWAES128TTABLESASM_SRAM_DEC = 0x52;
+constexpr const uint8_t CMD_SWAES128FIXSLICED_ENC = 0x62;
+constexpr const uint8_t CMD_SWAES128FIXSLICED_DEC = 0x63;
+constexpr const uint8_t CMD_SWAES256_ENC = 0x60;
+constexpr const uint8_t CMD_SWAES256_DEC = 0x61;
+constexpr const uint8_t CMD_SWDES_ENC_RND_SBOX = 0x4B;
+constexpr const uint8_t CMD_SWAES128_ENC_MASKED = 0x73;
+constexpr const uint8_t CMD_SWAES128_DEC_MASKED = 0x83;
+constexpr const uint8_t CMD_SWAES128_SET_MASK_REFRESH = 0xE9;
+constexpr const uint8_t CMD_SWAES128_ENC_RNDDELAYS = 0x75;
+constexpr const uint8_t CMD_SWAES128_ENC_RNDSBOX = 0x85;
+constexpr const uint8_t CMD_SWSM4_ENC = 0x54;
+constexpr const uint8_t CMD_SWSM4_DEC = 0x55;
+constexpr const uint8_t CMD_PRESENT80_ENC = 0x95;
+constexpr const uint8_t CMD_PRESENT80_DEC = 0x96;
+constexpr const uint8_t CMD_PRESENT128_ENC = 0x97;
+constexpr const uint8_t CMD_PRESENT128_DEC = 0x98;
+constexpr const uint8_t CMD_BATCH = 0xB0;
+constexpr const uint8_t CMD_BATCH_SEEDED = 0xB2;
+constexpr const uint8_t CMD_RSACRT1024_DEC = 0xAA;
+constexpr const uint8_t CMD_RSASFM_DEC = 0xDF;
+constexpr const uint8_t CMD_ECC25519_SCALAR_MULT = 0xEC;
+constexpr const uint8_t CMD_GET_RANDOM_FROM_TRNG = 0x11;
+constexpr const uint8_t CMD_DUMP_TRNG = 0x12;
+constexpr const uint8_t CMD_AES128_KEYCHANGE = 0xE7;
+constexpr const uint8_t CMD_SWAES128_SET_KEY_EXPANSION = 0xE8;
+constexpr const uint8_t CMD_SET_BAUD_RATE = 0xF4;
+constexpr const uint8_t CMD_SET_PROTOCOL = 0xF5;
+constexpr const uint8_t CMD_GET_COMMANDS = 0xF6;
+constexpr const uint8_t CMD_GET_LAST_CYCLES = 0xF8;
+constexpr const uint8_t CMD_GET_CAPABILITIES = 0xF9;
 
 extern const uint8_t defaultKeyDES[8];
 extern const uint8_t defaultKeyAES[16];
@@ -30,15 +98,235 @@ extern const uint8_t defaultKeySM4[16];
 extern const uint8_t defaultKeyPRESENT80[10];
 extern const uint8_t defaultKeyPRESENT128[16];
 
+using AesBlock = std::array<uint8_t, 16>;
+/// Two AES blocks, for the fixsliced AES-128 commands that always take two.
+using AesBlockPair = std::array<uint8_t, 32>;
+using DesBlock = std::array<uint8_t, 8>;
+using Curve25519Bytes = std::array<uint8_t, 32>;
+using BatchSeed = std::array<uint8_t, 16>;
+
+/// The generator behind the inputs of CMD_BATCH_SEEDED: xoshiro128** seeded with four little-endian words, of which
+/// every output word is used least significant byte first (see src/prng/xoshiro.c). Regenerates on the host the
+/// inputs the board derived from the same seed.
+class BatchInputGenerator {
+  public:
+    explicit BatchInputGenerator(const BatchSeed& seed) noexcept;
+
+    /// The next size bytes of the sequence; size must be a multiple of 4.
+    void generate(uint8_t* output, size_t size) noexcept;
+
+    /// Skip the next size bytes of the sequence without writing them anywhere; size must be a multiple of 4.
+    void discard(size_t size) noexcept;
+
+    /// The seed that continues the sequence from here.
+    BatchSeed getState() const noexcept;
+
+  private:
+    uint32_t next() noexcept;
+
+    std::array<uint32_t, 4> m_state;
+};
+
+/// The 32-bit FNV-1a hash of data, continuing from hash; CMD_BATCH_SEEDED uses it to sum up its outputs.
+uint32_t fnv1aHash(const uint8_t* data, size_t size, uint32_t hash = 0x811C9DC5) noexcept;
+
+/// The CRC32 of framed mode, as computed by the STM32F4 CRC unit: polynomial 0x04C11DB7, initial value 0xFFFFFFFF,
+/// bytes processed most significant bit first and no final XOR (CRC-32/MPEG-2).
+uint32_t frameCrc32(const uint8_t* data, size_t size) noexcept;
+
 /// The variant of the firmware we are dealing with.
 enum class FirmwareVariant { Classic, Hardware, PostQuantum };
 
+/// Thrown when the response to a command did not arrive before its deadline, or is not a response to the command.
+class ResponseError : public boost::system::system_error {
+  public:
+    enum class Reason {
+        /// Nothing (or not enough) arrived before the deadline.
+        Timeout,
+        /// The board sends 0xFA 0xCC over and over: it was glitched out of its command loop.
+        Glitched,
+        /// The board answered "BadCmd": it did not recognise the command byte, e.g. because it was out of sync.
+        BadCommand,
+        /// Framed mode: the frames of a request or its response kept failing their CRC check.
+        CorruptFrame,
+        /// Framed mode: the command read more payload than its request frame had.
+        ShortPayload,
+        /// Framed mode: the response of a request that had already run got lost, and could not be sent again.
+        LostResponse,
+    };
+
+    ResponseError(Reason reason, uint8_t cmd);
+
+    Reason getReason() const noexcept { return m_reason; }
+    uint8_t getCommand() const noexcept { return m_command; }
+
+  private:
+    Reason m_reason;
+    uint8_t m_command;
+};
+
+/// A command of the firmware's command registry, see PinataClient::getCommands().
+struct CommandDescriptor {
+    /// The command raises the trigger around its operation.
+    static constexpr uint8_t Trigger = 0x01;
+    /// The command can be the sub-command of CMD_BATCH and CMD_BATCH_SEEDED; its input size is the block size.
+    static constexpr uint8_t Batchable = 0x02;
+    /// The size of inputs and outputs that depend on the request.
+    static constexpr uint16_t VariableSize = 0xFFFF;
+
+    uint8_t cmd;
+    uint8_t flags;
+    /// Bytes the command reads after its command byte, and bytes it sends back.
+    uint16_t inputSize;
+    uint16_t outputSize;
+};
+
+/// The CPU cycles of the last trigger window, see PinataClient::getLastCycles().
+struct CycleCount {
+    uint32_t cycles;
+    /// The clock speed the cycles were counted at.
+    uint8_t clockMHz;
+};
+
+/// What a firmware build implements, see PinataClient::getCapabilities().
+struct Capabilities {
+    /// Build flags.
+    static constexpr uint16_t VariantPqc = 0x0001;
+    static constexpr uint16_t HwCrypto = 0x0002;
+    static constexpr uint16_t RandomSigning = 0x0004;
+    static constexpr uint16_t CycleCount = 0x0008;
+    static constexpr uint16_t HostSimulator = 0x0010;
+
+    /// A key the host can set: the command that sets it and its size. For key pairs, keySize is the size of the
+    /// public key; privateKeySize is 0 for symmetric keys.
+    struct KeySize {
+        uint8_t cmd;
+        uint16_t keySize;
+        uint16_t privateKeySize;
+    };
+
+    std::pair<int, int> version;
+    uint16_t flags = 0;
+    /// How far the client may send ahead over USART3, the largest request frame payload and the CMD_BATCH buffer
+    /// (0 without CMD_BATCH), in bytes.
+    uint16_t usartReceiveRingSize = 0;
+    uint16_t maxFramePayloadSize = 0;
+    uint16_t batchBufferSize = 0;
+    std::bitset<256> commands;
+    std::vector<KeySize> keySizes;
+
+    FirmwareVariant getFirmwareVariant() const noexcept;
+    bool supports(uint8_t cmd) const noexcept { return commands.test(cmd); }
+};
+
+/// Round trip times of CMD_GET_CODE_REV, see PinataClient::measureRoundTrip().
+struct RoundTripTimes {
+    std::chrono::microseconds min{};
+    std::chrono::microseconds median{};
+    std::chrono::microseconds max{};
+};
+
 class PinataClient {
 public:
+    /// Invoked once the response of a pipelined request has been read into its output buffer.
+    using Completion = std::function<void(const uint8_t* output, size_t outputSize)>;
+
     PinataClient();
-    PinataClient(const char* serialPortFile);
+
+    /// Connect to a Pinata through the transport described by uri; see Transport for the supported URIs.
+    PinataClient(const char* uri);
+
+    /// Connect to a Pinata through an I/O context that is owned and run by the caller. One thread running
+    /// that context can then drive several boards through the awaitable API. The synchronous methods run the
+    /// I/O context themselves, so do not call them while the context is being run elsewhere.
+    PinataClient(boost::asio::io_context& context, const char* uri);
+
+    /// Talk to a Pinata through an already opened transport, e.g. a LoopbackTransport with a scripted peer.
+    explicit PinataClient(std::unique_ptr<Transport> transport);
+
+    /// Switches the board back to the legacy protocol if it is in framed mode.
+    ~PinataClient();
+
+    /// The I/O context on which this client performs its I/O.
+    boost::asio::io_context& getContext() noexcept { return m_transport->getContext(); }
+
+    Transport& getTransport() noexcept { return *m_transport; }
+
+    /// The low-latency settings applied to the link when the client connected; see Transport::tuneForLatency().
+    const LinkTuning& getLinkTuning() const noexcept { return m_linkTuning; }
+
+    /// Send count CMD_GET_CODE_REV requests back to back, after one to wake the link up, and time their round trips.
+    RoundTripTimes measureRoundTrip(size_t count = 16);
+
+    /// Switch the link to baudRate with CMD_SET_BAUD_RATE: the board acknowledges at the current rate, both sides
+    /// switch, and the switch only sticks when the board receives the confirmation at the new rate. Returns the baud
+    /// rate in use afterwards: baudRate, the current rate when the board cannot generate baudRate, or
+    /// PinataDefaultBaudRate when the handshake failed. Over USB and to the simulator, only the handshake is done.
+    uint32_t negotiateBaudRate(uint32_t baudRate);
+
+    /// The baud rate last agreed on with negotiateBaudRate().
+    uint32_t getBaudRate() const noexcept { return m_baudRate; }
+
+    /// Switch the board and the client to framed mode with CMD_SET_PROTOCOL, or back to the legacy protocol. In
+    /// framed mode every request and response is a frame with a sequence number, a length and a CRC32 (see
+    /// src/frame.h), so a damaged or lost byte costs a retry instead of a resync(). A request the board rejected is
+    /// sent again. So is the last request in flight when its response is lost: the board recognises it and answers it
+    /// again without running it twice. Awaitable requests and negotiateBaudRate() are only available in the legacy
+    /// protocol.
+    void setFramedMode(bool framed);
+    bool getFramedMode() const noexcept { return m_framed; }
+
+    /// Set the maximum number of requests that may be in flight at the same time. The firmware handles
+    /// commands strictly in order, so responses are matched to requests first-in first-out. A depth of 1
+    /// (the default) gives the classic one-request-one-response behaviour. All in-flight requests must fit
+    /// in the receive buffer of the device; see the README for the limits per I/O interface. Once getCapabilities()
+    /// has told the size of the USART3 receive ring, the requests in flight never take more bytes than that, as the
+    /// board would silently overwrite the oldest ones. The client cannot tell USART3 from USB, so this holds for both.
+    void setPipelineDepth(size_t depth);
+    size_t getPipelineDepth() const noexcept { return m_pipelineDepth; }
+
+    /// Send a request without waiting for its response. When the pipeline is full, this first completes the
+    /// oldest in-flight request. The output buffer must stay valid until the request has completed.
+    void submit(uint8_t cmd, const uint8_t* input, size_t inputSize, uint8_t* output, size_t outputSize,
+                Completion completion = {});
+
+    /// Complete all in-flight requests.
+    void flush();
+
+    /// Number of requests that have been sent but whose response has not been read yet.
+    size_t getRequestsInFlight() const noexcept { return m_inFlight.size(); }
+
+    /// Set how long to wait for the response to any command without a deadline of its own (3 seconds by default).
+    void setDefaultDeadline(std::chrono::milliseconds deadline) noexcept { m_defaultDeadline = deadline; }
+
+    /// Set how long to wait for the response to cmd, e.g. more for RSA than for AES. Zero restores the default.
+    void setDeadline(uint8_t cmd, std::chrono::milliseconds deadline) noexcept { m_deadlines[cmd] = deadline; }
+
+    std::chrono::milliseconds getDeadline(uint8_t cmd) const noexcept {
+        return m_deadlines[cmd] != std::chrono::milliseconds::zero() ? m_deadlines[cmd] : m_defaultDeadline;
+    }
+
+    /// Get the board and the client back in step after a failed response: drop the in-flight requests, discard
+    /// whatever the board is still sending and check that it answers CMD_GET_CODE_REV. Returns false when the
+    /// board keeps sending or stays silent; it then needs a reset.
+    bool resync();
+    /// Whether the last resync() had to send padding to complete a command that was waiting for its payload. That
+    /// command then ran with CMD_GET_CODE_REV bytes as its payload: a key or password change (CMD_AES128_KEYCHANGE,
+    /// CMD_PWD_CHANGE, ...) may have installed them, so set again the keys that later requests rely on.
+    bool getResyncPadded() const noexcept { return m_resyncPadded; }
+
+    /// Whether a ResponseError is preceded by an automatic resync() (the default), so that the next request can
+    /// be sent right away.
+    void setAutoResync(bool enabled) noexcept { m_autoResync = enabled; }
+    bool getAutoResync() const noexcept { return m_autoResync; }
+
+    /// Requests, bytes and the latency of every write and read so far, per command byte.
+    const Statistics& getStatistics() const noexcept { return m_statistics; }
+    void resetStatistics() noexcept { m_statistics.reset(); }
 
     std::pair<int, int> getVersion();
+    /// The firmware variant, from getCapabilities(). Firmware without CMD_GET_CAPABILITIES is probed with
+    /// CMD_SW_MLDSA_GET_VARIANT and CMD_HWAES128_ENC instead.
     FirmwareVariant determineFirmwareVariant();
     std::pair<int, int> mldsaGetKeySizes();
     uint8_t mldsaGetSecurityLevel();
@@ -49,7 +337,37 @@ public:
     void mlkemSetPublicPrivateKeyPair(const uint8_t* publicKey, size_t publicKeySize, const uint8_t* privateKey, size_t privateKeySize);
     void mlkemGenerate(uint8_t* sharedSecretBuffer, size_t sharedSecretBufferSize, uint8_t* keyEncapsulationMessageBuffer, size_t keyEncapsulationMessageBufferSize);
     void mlkemDecode(const uint8_t* keyEncapsulationMessageBuffer, size_t keyEncapsulationMessageBufferSize, uint8_t* sharedSecretBuffer, size_t sharedSecretBufferSize);
-    
+
+    /// RSA-1024 CRT and RSA-512 square-and-multiply decryption with the key in the firmware. The ciphertext and the
+    /// returned plaintext are big-endian; the plaintext has no leading zero words and is empty when it is zero.
+    std::vector<uint8_t> rsaCrt1024Decrypt(const uint8_t* ciphertext, size_t ciphertextSize);
+    std::vector<uint8_t> rsaSfmDecrypt(const uint8_t* ciphertext, size_t ciphertextSize);
+
+    /// Curve25519 scalar multiplication [scalar] point, with projective coordinates re-randomised by a PRNG that
+    /// is seeded with prngSeed (AES-CTR key and IV).
+    Curve25519Bytes ecc25519ScalarMult(const std::array<uint8_t, 32>& prngSeed, const Curve25519Bytes& scalar,
+                                       const Curve25519Bytes& point);
+
+    /// One 32-bit word from the true random number generator.
+    uint32_t getRandomFromTrng();
+    /// size bytes of raw true random number generator output, for statistical tests, with CMD_DUMP_TRNG.
+    std::vector<uint8_t> dumpTrng(uint16_t size);
+
+    /// The commands this firmware build implements, in command byte order, with CMD_GET_COMMANDS. The client takes
+    /// the sub-commands of CMD_BATCH and their block sizes from the last answer.
+    std::vector<CommandDescriptor> getCommands();
+    /// The cycles of the last triggered operation, with CMD_GET_LAST_CYCLES. Only firmware built with CYCLE_COUNT
+    /// implements it, see getCommands().
+    CycleCount getLastCycles();
+    /// Version, build flags, receive limits, commands and key sizes of the firmware, with CMD_GET_CAPABILITIES.
+    /// Once known, the client refuses commands the firmware does not implement with std::invalid_argument instead of
+    /// sending them. Throws a ResponseError (BadCommand) on firmware that predates the command.
+    Capabilities getCapabilities();
+    /// The result of the last getCapabilities(), if any.
+    const std::optional<Capabilities>& getKnownCapabilities() const noexcept { return m_capabilities; }
+    /// Whether the firmware implements cmd; true as long as its capabilities are not known.
+    bool supports(uint8_t cmd) const noexcept { return !m_capabilities || m_capabilities->supports(cmd); }
+
     void doSymmetricCipherRequest(const uint8_t cmd, const uint8_t* input, const size_t inputSize, uint8_t* output,const size_t outputSize);
     void SWDESEncrypt(const uint8_t* plaintext, uint8_t* ciphertext);
     void SWDESDecrypt(const uint8_t* ciphertext, uint8_t* plaintext);
@@ -59,27 +377,215 @@ public:
     void AES128SWEncrypt(const uint8_t* plaintext, uint8_t* ciphertext);
     void AES128SWDecrypt(const uint8_t* plaintext, uint8_t* ciphertext);
     void AES128SWEncryptNoTrigger(const uint8_t* plaintext, uint8_t* ciphertext);
+    /// Set the AES-128 key of the firmware; the board keeps it until the next key change or reset.
+    void AES128KeyChange(const uint8_t* key);
+    /// Whether the software AES-128 commands expand the key before every block instead of reusing the round keys of
+    /// the last key change, with CMD_SWAES128_SET_KEY_EXPANSION.
+    void setAES128SWKeyExpansionPerCall(bool perCall);
     void AES128TTablesSWEncrypt(const uint8_t* plaintext, uint8_t* ciphertext);
     void AES128TTablesSWDecrypt(const uint8_t* plaintext, uint8_t* ciphertext);
+    /// The single T-table assembly AES-128; with sramTable, the table is looked up in (uncached) SRAM instead of flash.
+    void AES128TTablesAsmSWEncrypt(const uint8_t* plaintext, uint8_t* ciphertext, bool sramTable = false);
+    void AES128TTablesAsmSWDecrypt(const uint8_t* ciphertext, uint8_t* plaintext, bool sramTable = false);
+    /// The constant-time fixsliced AES-128, two blocks (32 bytes) at a time.
+    void AES128FixslicedSWEncrypt(const uint8_t* plaintexts, uint8_t* ciphertexts);
+    void AES128FixslicedSWDecrypt(const uint8_t* ciphertexts, uint8_t* plaintexts);
     
     void AES256SWEncrypt(const uint8_t* plaintext, uint8_t* ciphertext);
     void AES256SWDecrypt(const uint8_t* ciphertext, uint8_t* plaintext);
     void AES128MaskingSWEncrypt(const uint8_t* plaintext, uint8_t* ciphertext);
     void AES128MaskingSWDecrypt(const uint8_t* ciphertext, uint8_t* plaintext);
+    /// For how many blocks the masked AES-128 commands keep their masks (1, the default: new masks for every block),
+    /// with CMD_SWAES128_SET_MASK_REFRESH. Returns the interval in use; 0 only reads it.
+    uint16_t setAES128MaskRefresh(uint16_t blocks);
     void AES128SWRndDelaysEncrypt(const uint8_t* plaintext, uint8_t* ciphertext);
     void AES128SWRndSBoxEncrypt(const uint8_t* plaintext, uint8_t* ciphertext);
 
+    /// Send the same command for every block of input and read the responses into output, which must have as
+    /// many blocks. Requests are coalesced into one write per getPipelineDepth() blocks and their responses are
+    /// read in one go, so raise the pipeline depth (within the limits of the I/O interface) to benefit.
+    template <class Block>
+    void doSymmetricCipherRequests(uint8_t cmd, std::span<const Block> input, std::span<Block> output) {
+        static_assert(sizeof(Block) == std::tuple_size_v<Block>, "blocks must be plain byte arrays");
+        if (input.size() != output.size()) {
+            throw std::invalid_argument("input and output must hold the same number of blocks");
+        }
+        doSymmetricCipherRequests(cmd, reinterpret_cast<const uint8_t*>(input.data()), sizeof(Block),
+                                  reinterpret_cast<uint8_t*>(output.data()), sizeof(Block), input.size());
+    }
+    void doSymmetricCipherRequests(uint8_t cmd, const uint8_t* input, size_t inputSize, uint8_t* output,
+                                   size_t outputSize, size_t count);
+
+    /// Run the software block cipher cmd (e.g. CMD_SWAES128_ENC) on every block of input with CMD_BATCH, as few
+    /// requests as the firmware's batch buffer allows. The board runs every block in its own trigger window, gap
+    /// busy-wait iterations apart, and sends the outputs only after the last block of a request. Throws
+    /// std::invalid_argument when CMD_GET_COMMANDS does not list cmd as batchable with this block size.
+    template <class Block>
+    void doBatchRequests(uint8_t cmd, std::span<const Block> input, std::span<Block> output, uint16_t gap = 0) {
+        static_assert(sizeof(Block) == std::tuple_size_v<Block>, "blocks must be plain byte arrays");
+        if (input.size() != output.size()) {
+            throw std::invalid_argument("input and output must hold the same number of blocks");
+        }
+        doBatchRequests(cmd, reinterpret_cast<const uint8_t*>(input.data()), reinterpret_cast<uint8_t*>(output.data()),
+                        sizeof(Block), input.size(), gap);
+    }
+    void doBatchRequests(uint8_t cmd, const uint8_t* input, uint8_t* output, size_t blockSize, size_t count,
+                         uint16_t gap = 0);
+
+    /// Like doBatchRequests, but the board generates the inputs from seed with CMD_BATCH_SEEDED, so only the
+    /// outputs cross the link. BatchInputGenerator(seed) yields the same inputs on the host.
+    template <class Block>
+    void doSeededBatchRequests(uint8_t cmd, const BatchSeed& seed, std::span<Block> output, uint16_t gap = 0) {
+        static_assert(sizeof(Block) == std::tuple_size_v<Block>, "blocks must be plain byte arrays");
+        doSeededBatchRequests(cmd, seed, reinterpret_cast<uint8_t*>(output.data()), sizeof(Block), output.size(),
+                              gap);
+    }
+    void doSeededBatchRequests(uint8_t cmd, const BatchSeed& seed, uint8_t* output, size_t blockSize, size_t count,
+                               uint16_t gap = 0);
+
+    /// Run cmd on count inputs generated from seed, and return the fnv1aHash of all outputs in order instead of
+    /// the outputs themselves: the link then carries next to nothing, whatever the number of blocks (at most 65535).
+    uint32_t doSeededBatchHash(uint8_t cmd, const BatchSeed& seed, size_t count, uint16_t gap = 0);
+
+    // Bulk variants of the symmetric cipher methods, one request per block; see doSymmetricCipherRequests.
+    void SWDESEncrypt(std::span<const DesBlock> plaintexts, std::span<DesBlock> ciphertexts);
+    void SWDESDecrypt(std::span<const DesBlock> ciphertexts, std::span<DesBlock> plaintexts);
+    void SWTDESEncrypt(std::span<const DesBlock> plaintexts, std::span<DesBlock> ciphertexts);
+    void SWTDESDecrypt(std::span<const DesBlock> ciphertexts, std::span<DesBlock> plaintexts);
+
+    void AES128SWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts);
+    void AES128SWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts);
+    void AES128SWEncryptNoTrigger(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts);
+    void AES128TTablesSWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts);
+    void AES128TTablesSWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts);
+    void AES128TTablesAsmSWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts,
+                                   bool sramTable = false);
+    void AES128TTablesAsmSWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts,
+                                   bool sramTable = false);
+    void AES128FixslicedSWEncrypt(std::span<const AesBlockPair> plaintexts, std::span<AesBlockPair> ciphertexts);
+    void AES128FixslicedSWDecrypt(std::span<const AesBlockPair> ciphertexts, std::span<AesBlockPair> plaintexts);
+
+    void AES256SWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts);
+    void AES256SWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts);
+    void AES128MaskingSWEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts);
+    void AES128MaskingSWDecrypt(std::span<const AesBlock> ciphertexts, std::span<AesBlock> plaintexts);
+    void AES128SWRndDelaysEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts);
+    void AES128SWRndSBoxEncrypt(std::span<const AesBlock> plaintexts, std::span<AesBlock> ciphertexts);
+
+    // Awaitable variants of the symmetric cipher methods, e.g. `co_await client.asyncAES128SWEncrypt(pt)`.
+    // At most one awaitable request may be outstanding per client, and none while requests are pipelined.
+    // They honour the deadlines and throw ResponseError, but do not resync by themselves.
+    boost::asio::awaitable<void> asyncSymmetricCipherRequest(uint8_t cmd, const uint8_t* input, size_t inputSize,
+                                                             uint8_t* output, size_t outputSize);
+    boost::asio::awaitable<DesBlock> asyncSWDESEncrypt(DesBlock plaintext);
+    boost::asio::awaitable<DesBlock> asyncSWDESDecrypt(DesBlock ciphertext);
+    boost::asio::awaitable<DesBlock> asyncSWTDESEncrypt(DesBlock plaintext);
+    boost::asio::awaitable<DesBlock> asyncSWTDESDecrypt(DesBlock ciphertext);
+
+    boost::asio::awaitable<AesBlock> asyncAES128SWEncrypt(AesBlock plaintext);
+    boost::asio::awaitable<AesBlock> asyncAES128SWDecrypt(AesBlock ciphertext);
+    boost::asio::awaitable<AesBlock> asyncAES128SWEncryptNoTrigger(AesBlock plaintext);
+    boost::asio::awaitable<AesBlock> asyncAES128TTablesSWEncrypt(AesBlock plaintext);
+    boost::asio::awaitable<AesBlock> asyncAES128TTablesSWDecrypt(AesBlock ciphertext);
+
+    boost::asio::awaitable<AesBlock> asyncAES256SWEncrypt(AesBlock plaintext);
+    boost::asio::awaitable<AesBlock> asyncAES256SWDecrypt(AesBlock ciphertext);
+    boost::asio::awaitable<AesBlock> asyncAES128MaskingSWEncrypt(AesBlock plaintext);
+    boost::asio::awaitable<AesBlock> asyncAES128MaskingSWDecrypt(AesBlock ciphertext);
+    boost::asio::awaitable<AesBlock> asyncAES128SWRndDelaysEncrypt(AesBlock plaintext);
+    boost::asio::awaitable<AesBlock> asyncAES128SWRndSBoxEncrypt(AesBlock plaintext);
+
 
 private:
-    boost::asio::io_context m_context;
-    boost::asio::serial_port m_port;
+    struct PendingRequest {
+        uint8_t cmd;
+        uint8_t* output;
+        size_t outputSize;
+        Completion completion;
+        size_t requestSize; ///< bytes on the link, see getRequestSize()
+    };
+
+    /// A request in framed mode whose response has not been read completely.
+    struct FramedRequest {
+        uint8_t sequence;
+        uint8_t cmd;
+        /// The whole request frame, to send it again.
+        std::vector<uint8_t> frame;
+        /// The payload of the response frames received so far.
+        std::vector<uint8_t> response;
+        /// Bytes of response already handed to the caller.
+        size_t consumed = 0;
+        /// Whether the last response frame has arrived.
+        bool complete = false;
+        unsigned retries = 0;
+    };
+
+    std::unique_ptr<Transport> m_transport;
+    LinkTuning m_linkTuning;
+    size_t m_pipelineDepth = 1;
+    std::deque<PendingRequest> m_inFlight;
+    size_t m_bytesInFlight = 0;
+    std::vector<uint8_t> m_requestBuffer;
+    std::chrono::milliseconds m_defaultDeadline = std::chrono::seconds(3);
+    std::array<std::chrono::milliseconds, 256> m_deadlines{};
+    bool m_autoResync = true;
+    bool m_resyncPadded = false;
+    uint32_t m_baudRate = PinataDefaultBaudRate;
+    bool m_framed = false;
+    uint8_t m_nextSequence = 0;
+    std::deque<FramedRequest> m_frames;
+    /// In framed mode, command() opens a frame that collects the payload written after it, until the first read.
+    bool m_frameOpen = false;
+    std::vector<uint8_t> m_framePayload;
+    /// The last command byte sent; read() applies its deadline and write() and read() are counted for it.
+    uint8_t m_command = 0;
+    Statistics m_statistics;
+    std::optional<Capabilities> m_capabilities;
+    /// The block size of every sub-command of CMD_BATCH, from getCommands(); 0 for the commands it cannot batch.
+    std::optional<std::array<uint16_t, 256>> m_batchBlockSizes;
 
     void command(uint8_t cmd);
+    /// Throw std::invalid_argument when the firmware is known not to implement cmd.
+    void checkSupported(uint8_t cmd) const;
+    FirmwareVariant probeFirmwareVariant();
+    void completeOldest();
+    [[noreturn]] void fail(ResponseError::Reason reason, uint8_t cmd);
+    /// Read size bytes of responses to cmd, each responseSize bytes long (the whole buffer when 0), within the
+    /// deadline of cmd times deadlines (one per response when 0).
+    void readResponse(uint8_t cmd, uint8_t *data, size_t size, size_t responseSize = 0, size_t deadlines = 0);
+    void writeSeededBatchRequest(uint8_t cmd, const BatchSeed &seed, size_t count, uint16_t gap, uint8_t mode);
+    /// The block size of cmd as a sub-command of CMD_BATCH, or 0 when the firmware does not batch it. The first
+    /// batch request asks the firmware with getCommands().
+    size_t getBatchBlockSize(uint8_t cmd);
+    /// Send request[0] as the command and the rest as its payload, as one frame in framed mode.
+    void sendRequest(const uint8_t *request, size_t size);
+    /// Append the frame of a request to out and keep track of it until its response has been read.
+    void appendFrame(std::vector<uint8_t> &out, uint8_t cmd, const uint8_t *payload, size_t size);
+    /// Framed mode: read size bytes of the responses to the requests in m_frames, in order.
+    void readFrames(uint8_t *data, size_t size, std::chrono::milliseconds timeout);
+    /// Read the next response frame and file it with its request. Returns why there was none that passed its checks.
+    std::optional<ResponseError::Reason> receiveFrame(std::chrono::steady_clock::time_point deadline);
+    /// Send the only request in m_frames that has not been answered again, or fail with reason when more requests
+    /// are unanswered, when part of its response arrived already, or when it has been retried too often.
+    void retransmitFrames(ResponseError::Reason reason);
+    /// The most requests that may be in flight at once.
+    size_t getWindow() const noexcept;
+    /// The most bytes of requests that may be in flight at once: the USART3 receive ring, once it is known.
+    size_t getByteWindow() const noexcept;
+    /// The bytes of input blocks a CMD_BATCH request may carry: the firmware's batch buffer, once it is known.
+    size_t getBatchBufferSize() const noexcept;
+    /// The bytes a request with inputSize bytes of payload takes on the link, command byte or frame included.
+    size_t getRequestSize(size_t inputSize) const noexcept;
 
     template <class T> void write(const T* array, const size_t size) {
-        boost::asio::write(m_port, boost::asio::buffer(array, sizeof(T) * size), boost::asio::transfer_exactly(sizeof(T) * size));
+        writeBytes(reinterpret_cast<const uint8_t*>(array), sizeof(T) * size);
     }
 
+    void writeBytes(const uint8_t *data, size_t size);
+
+    std::vector<uint8_t> doRsaDecrypt(uint8_t cmd, const uint8_t *ciphertext, size_t ciphertextSize,
+                                      size_t modulusSize);
+
     void read(uint8_t *data, size_t size);
 
     template <class T> T readNumber() {
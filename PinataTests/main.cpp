@@ -1,8 +1,25 @@
 #include "Environment.hpp"
 #include <gtest/gtest.h>
+#include <string>
+#include <string_view>
 
 int main(int argc, char **argv) {
-    ::testing::AddGlobalTestEnvironment(new Environment);
+    Environment *environment = new Environment;
+    ::testing::AddGlobalTestEnvironment(environment);
     ::testing::InitGoogleTest(&argc, argv);
+    // gtest leaves the flags it does not know in argv.
+    constexpr std::string_view statisticsFlag = "--pinata-stats=";
+    constexpr std::string_view baudRateFlag = "--pinata-baud=";
+    constexpr std::string_view framedFlag = "--pinata-framed";
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view argument(argv[i]);
+        if (argument.starts_with(statisticsFlag)) {
+            environment->setStatisticsPath(std::string(argument.substr(statisticsFlag.size())));
+        } else if (argument.starts_with(baudRateFlag)) {
+            environment->setBaudRate(std::stoul(std::string(argument.substr(baudRateFlag.size()))));
+        } else if (argument == framedFlag) {
+            environment->setFramedMode(true);
+        }
+    }
     return RUN_ALL_TESTS();
 }
@@ -45,6 +45,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_cryp.h"
 #include "stm32f4xx_gpio.h"
+#include "trigger.h"
 
 /** @addtogroup STM32F4xx_StdPeriph_Driver
   * @{
@@ -176,7 +177,7 @@ ErrorStatus CRYP_AES_ECB(uint8_t Mode, uint8_t* Key, uint16_t Keysize,
     CRYP_KeyInit(&AES_CRYP_KeyInitStructure);
 
     //Trigger pin PC2 high
-	GPIOC->BSRRL = GPIO_Pin_2; //Trigger on
+    BEGIN_INTERESTING_STUFF;
     /* Enable Crypto processor */
     CRYP_Cmd(ENABLE);
 
@@ -213,8 +214,11 @@ ErrorStatus CRYP_AES_ECB(uint8_t Mode, uint8_t* Key, uint16_t Keysize,
 
   /* Flush IN/OUT FIFOs */
   CRYP_FIFOFlush();
-  //Trigger pin high
-  GPIOC->BSRRL = GPIO_Pin_2; //Trigger on
+  //Trigger pin high, unless the key preparation for decryption raised it already
+  if(Mode != MODE_DECRYPT)
+  {
+    BEGIN_INTERESTING_STUFF;
+  }
   /* Enable Crypto processor */
   CRYP_Cmd(ENABLE);
 
@@ -258,7 +262,7 @@ ErrorStatus CRYP_AES_ECB(uint8_t Mode, uint8_t* Key, uint16_t Keysize,
     }
   }
   //Trigger pin low
-  GPIOC->BSRRH = GPIO_Pin_2; //Trigger off
+  END_INTERESTING_STUFF;
 
   /* Disable Crypto */
   CRYP_Cmd(DISABLE);
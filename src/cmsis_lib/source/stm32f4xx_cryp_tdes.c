@@ -42,6 +42,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_cryp.h"
 #include "stm32f4xx_gpio.h"
+#include "trigger.h"
 
 /** @addtogroup STM32F4xx_StdPeriph_Driver
   * @{
@@ -140,7 +141,7 @@ ErrorStatus CRYP_TDES_ECB(uint8_t Mode, uint8_t Key[24], uint8_t *Input,
   CRYP_FIFOFlush();
 
   //Trigger pin high
-	GPIOC->BSRRL = GPIO_Pin_2; //Trigger on
+  BEGIN_INTERESTING_STUFF;
 
   /* Enable Crypto processor */
   CRYP_Cmd(ENABLE);
@@ -177,7 +178,7 @@ ErrorStatus CRYP_TDES_ECB(uint8_t Mode, uint8_t Key[24], uint8_t *Input,
   }
 
   //Trigger pin low
-	GPIOC->BSRRH = GPIO_Pin_2; //Trigger off
+  END_INTERESTING_STUFF;
 
   /* Disable Crypto */
   CRYP_Cmd(DISABLE);
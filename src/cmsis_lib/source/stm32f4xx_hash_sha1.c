@@ -46,6 +46,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_hash.h"
 #include "stm32f4xx_gpio.h"
+#include "trigger.h"
 
 /** @addtogroup STM32F4xx_StdPeriph_Driver
   * @{
@@ -242,7 +243,7 @@ ErrorStatus HMAC_SHA1(uint8_t *Key, uint32_t Keylen, uint8_t *Input,
       keyaddr+=4;
     }
 
-    GPIOC->BSRRL = GPIO_Pin_2; //Trigger on
+    BEGIN_INTERESTING_STUFF;
 
     /* Start the HASH processor */
     HASH_StartDigest();
@@ -313,7 +314,7 @@ ErrorStatus HMAC_SHA1(uint8_t *Key, uint32_t Keylen, uint8_t *Input,
         // }while ((counter != SHA1BUSY_TIMEOUT) && (busystatus != RESET));
         }while ((busystatus != RESET));
 
-        GPIOC->BSRRH = GPIO_Pin_2; //Trigger off
+        END_INTERESTING_STUFF;
 
         if (busystatus != RESET)
         {
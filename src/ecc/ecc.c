@@ -1,4 +1,5 @@
 #include "ecc.h"
+#include "trigger.h"
 
 void ecsm(uint8_t *rxBuffer) {
 	int t_start, t_end;
@@ -22,10 +23,10 @@ void ecsm(uint8_t *rxBuffer) {
 	// Receive ECSM input point P
 	get_bytes(CURVE25519_POINT_COMPRESSED_BYTES, P);
 
-	GPIOC->BSRRL = GPIO_Pin_2; //Trigger on
+	BEGIN_INTERESTING_STUFF; //Trigger on, once USART3 is quiet
 	// Compute ECSM: R := [k] P
 	crypto_scalarmult_curve25519_rand_proj_coords(R, k, P);
-	GPIOC->BSRRH = GPIO_Pin_2; //Trigger off
+	END_INTERESTING_STUFF; //Trigger off
 
 	// Send ECSM output point R to host PC
 	send_bytes(CURVE25519_POINT_COMPRESSED_BYTES, R);
@@ -0,0 +1,256 @@
+#include "frame.h"
+#include "io.h"
+#include <string.h>
+
+#ifndef PINATA_HOST_SIMULATOR
+#include "stm32f4xx.h"
+//The frame buffers live in the core coupled memory, next to the USB receive buffer
+#define FRAME_BUFFER_SECTION __attribute__((section(".ccmram")))
+#else
+#define FRAME_BUFFER_SECTION
+#endif
+
+#define CRC32_POLYNOMIAL 0x04C11DB7
+
+static uint8_t protocol = PROTOCOL_LEGACY;
+static uint8_t nextProtocol = PROTOCOL_LEGACY;
+
+//The request being run and the part of its response that has not been sent yet, both with room for header and CRC
+static uint8_t request[FRAME_HEADER_LENGTH + FRAME_REQUEST_PAYLOAD_LENGTH + FRAME_CRC_LENGTH] FRAME_BUFFER_SECTION;
+static uint8_t response[FRAME_HEADER_LENGTH + FRAME_RESPONSE_PAYLOAD_LENGTH + FRAME_CRC_LENGTH] FRAME_BUFFER_SECTION;
+static uint32_t requestLength, requestIndex, responseLength;
+static uint8_t responseStatus;
+//Sequence number and CRC of the last request that was run. Its response can be sent again when it took a single
+//frame, which response still holds.
+static uint8_t lastSequence;
+static uint8_t lastRequestValid, lastResponseValid;
+static uint32_t lastCrc, lastResponseLength, responseFrames;
+//The frame of a status without payload, sent without touching the last response
+static uint8_t statusFrame[FRAME_HEADER_LENGTH + FRAME_CRC_LENGTH];
+
+uint32_t frame_crc32(const uint8_t *data, uint32_t length) {
+	uint32_t crc, i, bit;
+
+#ifndef PINATA_HOST_SIMULATOR
+	//The CRC unit takes whole words, MSBit first: feed it the bytes in big-endian order
+	RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
+	CRC->CR = CRC_CR_RESET;
+	for (i = 0; i + 4 <= length; i += 4) {
+		CRC->DR = ((uint32_t)data[i] << 24) | ((uint32_t)data[i + 1] << 16) | ((uint32_t)data[i + 2] << 8) | data[i + 3];
+	}
+	crc = CRC->DR;
+#else
+	crc = 0xFFFFFFFF;
+	i = 0;
+#endif
+	//The remaining bytes, one bit at a time, the way the CRC unit would
+	for (; i < length; i++) {
+		crc ^= (uint32_t)data[i] << 24;
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80000000) ? (crc << 1) ^ CRC32_POLYNOMIAL : crc << 1;
+		}
+	}
+	return crc;
+}
+
+//send_frame: send the response payload collected so far as a frame with the sequence number of the request
+static void send_frame(uint8_t status) {
+	uint32_t crc;
+
+	response[0] = FRAME_MAGIC;
+	response[1] = request[1];
+	response[2] = status;
+	response[3] = responseLength >> 8;
+	response[4] = responseLength;
+	crc = frame_crc32(response, FRAME_HEADER_LENGTH + responseLength);
+	response[FRAME_HEADER_LENGTH + responseLength] = crc >> 24;
+	response[FRAME_HEADER_LENGTH + responseLength + 1] = crc >> 16;
+	response[FRAME_HEADER_LENGTH + responseLength + 2] = crc >> 8;
+	response[FRAME_HEADER_LENGTH + responseLength + 3] = crc;
+	link_send_bytes(FRAME_HEADER_LENGTH + responseLength + FRAME_CRC_LENGTH, response);
+	lastResponseLength = FRAME_HEADER_LENGTH + responseLength + FRAME_CRC_LENGTH;
+	responseLength = 0;
+	responseFrames++;
+}
+
+//send_status: answer the request frame that was just received with status and no payload
+static void send_status(uint8_t status) {
+	uint32_t crc;
+
+	statusFrame[0] = FRAME_MAGIC;
+	statusFrame[1] = request[1];
+	statusFrame[2] = status;
+	statusFrame[3] = 0;
+	statusFrame[4] = 0;
+	crc = frame_crc32(statusFrame, FRAME_HEADER_LENGTH);
+	statusFrame[FRAME_HEADER_LENGTH] = crc >> 24;
+	statusFrame[FRAME_HEADER_LENGTH + 1] = crc >> 16;
+	statusFrame[FRAME_HEADER_LENGTH + 2] = crc >> 8;
+	statusFrame[FRAME_HEADER_LENGTH + 3] = crc;
+	link_send_bytes(FRAME_HEADER_LENGTH + FRAME_CRC_LENGTH, statusFrame);
+	link_flush();
+}
+
+//link_get_frame_bytes: receive nbytes bytes of a frame; returns 0 when the link stalls
+static int link_get_frame_bytes(uint32_t nbytes, uint8_t *ba) {
+	uint32_t i;
+	for (i = 0; i < nbytes; i++) {
+		if (!link_get_char_timeout(&ba[i], FRAME_TIMEOUT_MS)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//receive_frame: wait for the next request frame that passes its checks, and answer the ones that do not.
+//A frame that stalls halfway lost a byte: it is dropped without an answer and the host retries after its deadline.
+//A frame that repeats the last request that was run is answered from its response, and is not run again.
+static void receive_frame(void) {
+	uint32_t length, crc;
+
+	while (1) {
+		do {
+			link_get_bytes(1, request);
+		} while (request[0] != FRAME_MAGIC);
+		if (!link_get_frame_bytes(FRAME_HEADER_LENGTH - 1, request + 1)) {
+			continue;
+		}
+		length = ((uint32_t)request[3] << 8) | request[4];
+		if (length > FRAME_REQUEST_PAYLOAD_LENGTH) {
+			send_status(FRAME_STATUS_TOO_LONG);
+			continue;
+		}
+		if (!link_get_frame_bytes(length + FRAME_CRC_LENGTH, request + FRAME_HEADER_LENGTH)) {
+			continue;
+		}
+		crc = ((uint32_t)request[FRAME_HEADER_LENGTH + length] << 24) | ((uint32_t)request[FRAME_HEADER_LENGTH + length + 1] << 16)
+				| ((uint32_t)request[FRAME_HEADER_LENGTH + length + 2] << 8) | request[FRAME_HEADER_LENGTH + length + 3];
+		if (crc != frame_crc32(request, FRAME_HEADER_LENGTH + length)) {
+			send_status(FRAME_STATUS_BAD_CRC);
+			continue;
+		}
+		if (lastRequestValid && request[1] == lastSequence && crc == lastCrc) {
+			if (lastResponseValid) {
+				link_send_bytes(lastResponseLength, response);
+				link_flush();
+			} else {
+				send_status(FRAME_STATUS_DUPLICATE);
+			}
+			continue;
+		}
+		lastSequence = request[1];
+		lastCrc = crc;
+		lastRequestValid = 1;
+		lastResponseValid = 0;
+		responseFrames = 0;
+		requestLength = length;
+		requestIndex = 0;
+		responseStatus = FRAME_STATUS_OK;
+		return;
+	}
+}
+
+int set_protocol(uint8_t newProtocol) {
+	if (newProtocol != PROTOCOL_LEGACY && newProtocol != PROTOCOL_FRAMED) {
+		return 0;
+	}
+	nextProtocol = newProtocol;
+	return 1;
+}
+
+uint8_t get_protocol(void) {
+	return nextProtocol;
+}
+
+//Command I/O: in framed mode the command reads the payload of its request frame and writes into its response frames
+
+//get_command: wait for the next command byte
+void get_command(uint8_t *cmd) {
+	if (protocol == PROTOCOL_FRAMED) {
+		receive_frame();
+		*cmd = request[2];
+	} else {
+		link_get_bytes(1, cmd);
+	}
+}
+
+//finish_response: the command is done: send the rest of its response right away and apply a protocol change
+void finish_response(void) {
+	if (protocol == PROTOCOL_FRAMED) {
+		send_frame(responseStatus);
+		lastResponseValid = responseFrames == 1;
+	}
+	link_flush();
+	if (protocol != nextProtocol) {
+		//The sequence numbers of the next framed session start over
+		lastRequestValid = 0;
+	}
+	protocol = nextProtocol;
+}
+
+//get_bytes: get an amount of nbytes bytes from IO interface into byte array ba
+void get_bytes(uint32_t nbytes, uint8_t *ba) {
+	if (protocol != PROTOCOL_FRAMED) {
+		link_get_bytes(nbytes, ba);
+		return;
+	}
+	for (; nbytes > 0; nbytes--) {
+		if (requestIndex < requestLength) {
+			*ba++ = request[FRAME_HEADER_LENGTH + requestIndex++];
+		} else {
+			*ba++ = 0;
+			responseStatus = FRAME_STATUS_SHORT_PAYLOAD;
+		}
+	}
+}
+
+//send_bytes: send an amount of nbytes bytes from byte array ba via IO interface
+void send_bytes(uint32_t nbytes, const uint8_t *ba) {
+	uint32_t chunk;
+
+	if (protocol != PROTOCOL_FRAMED) {
+		link_send_bytes(nbytes, ba);
+		return;
+	}
+	while (nbytes > 0) {
+		chunk = FRAME_RESPONSE_PAYLOAD_LENGTH - responseLength;
+		if (chunk > nbytes) {
+			chunk = nbytes;
+		}
+		memcpy(response + FRAME_HEADER_LENGTH + responseLength, ba, chunk);
+		responseLength += chunk;
+		ba += chunk;
+		nbytes -= chunk;
+		if (responseLength == FRAME_RESPONSE_PAYLOAD_LENGTH) {
+			send_frame(FRAME_STATUS_MORE);
+		}
+	}
+}
+
+//get_char: receive a byte via IO interface
+void get_char(uint8_t *ch) {
+	get_bytes(1, ch);
+}
+
+//send_char: send a byte via IO interface
+void send_char(uint8_t ch) {
+	send_bytes(1, &ch);
+}
+
+//get_char_timeout: receive a byte via IO interface, waiting at most timeoutMs milliseconds; returns 0 on timeout.
+//In framed mode, once the request payload is used up, the byte comes straight from the link (see CMD_SET_BAUD_RATE).
+int get_char_timeout(uint8_t *ch, uint32_t timeoutMs) {
+	if (protocol == PROTOCOL_FRAMED && requestIndex < requestLength) {
+		get_bytes(1, ch);
+		return 1;
+	}
+	return link_get_char_timeout(ch, timeoutMs);
+}
+
+//flush_output: send what has been written so far without waiting for the end of the command
+void flush_output(void) {
+	if (protocol == PROTOCOL_FRAMED && responseLength > 0) {
+		send_frame(FRAME_STATUS_MORE);
+	}
+	link_flush();
+}
@@ -0,0 +1,38 @@
+#ifndef PINATABOARD_FRAME_H
+#define PINATABOARD_FRAME_H
+
+#include <stdint.h>
+
+//Protocols selected with CMD_SET_PROTOCOL
+#define PROTOCOL_LEGACY 0x01 //A command byte, followed by as many payload bytes as the command reads
+#define PROTOCOL_FRAMED 0x02 //Every request and response is a frame, see below
+
+//A frame, in both directions:
+//  FRAME_MAGIC, sequence number, command (request) or FRAME_STATUS_... (response), payload length (2 bytes, MSByte
+//  first), payload, CRC32 over all preceding bytes of the frame (4 bytes, MSByte first)
+//The CRC32 is the one of the STM32F4 CRC unit: polynomial 0x04C11DB7, initial value 0xFFFFFFFF, bytes processed
+//MSBit first, no final XOR (CRC-32/MPEG-2). A response carries the sequence number of its request.
+//The board remembers the last request it ran: when the same frame (sequence number and CRC) comes again, its response
+//got lost, and the board sends the last frame of that response again instead of running the command a second time.
+#define FRAME_MAGIC 0x5A
+#define FRAME_HEADER_LENGTH 5
+#define FRAME_CRC_LENGTH 4
+#define FRAME_REQUEST_PAYLOAD_LENGTH 6144 //Largest request payload, e.g. an ML-DSA key pair (5984 bytes)
+#define FRAME_RESPONSE_PAYLOAD_LENGTH 4096 //Longer responses are split over several frames
+#define FRAME_TIMEOUT_MS 100 //A request frame is dropped when its next byte takes longer than this
+
+#define FRAME_STATUS_OK 0x00 //The last (or only) frame of the response
+#define FRAME_STATUS_MORE 0x01 //More frames of this response follow
+#define FRAME_STATUS_BAD_CRC 0x02 //The request failed its CRC check; the command was not run
+#define FRAME_STATUS_TOO_LONG 0x03 //The request payload is longer than FRAME_REQUEST_PAYLOAD_LENGTH; the command was not run
+#define FRAME_STATUS_SHORT_PAYLOAD 0x04 //The command read more than the request payload: it got zeros for the rest
+#define FRAME_STATUS_DUPLICATE 0x05 //The request was run already and its response no longer fits in one frame; not run again
+
+//frame_crc32: CRC32 of length bytes, as described above
+uint32_t frame_crc32(const uint8_t *data, uint32_t length);
+
+//set_protocol: switch to protocol once the response to the current command is out; returns 0 for unknown protocols
+int set_protocol(uint8_t protocol);
+uint8_t get_protocol(void);
+
+#endif //PINATABOARD_FRAME_H
@@ -2,10 +2,20 @@
 #define PINATABOARD_IO_H
 
 void readByteFromInputBuffer(uint8_t *ch, int* charIdx);
+//Command I/O (frame.c): the payload and response of the current command, framed or not depending on the protocol
+void get_command(uint8_t *cmd);
+void finish_response(void);
 void get_bytes(uint32_t nbytes, uint8_t *ba);
 void send_bytes(uint32_t nbytes, const uint8_t *ba);
+void flush_output(void);
 void get_char(uint8_t *ch);
+int get_char_timeout(uint8_t *ch, uint32_t timeoutMs);
 void send_char(uint8_t ch);
+//Link I/O: USART3 or serial over USB (main.c), or the simulator's pty/socket (PinataSimulator/board.c)
+void link_get_bytes(uint32_t nbytes, uint8_t *ba);
+void link_send_bytes(uint32_t nbytes, const uint8_t *ba);
+int link_get_char_timeout(uint8_t *ch, uint32_t timeoutMs);
+void link_flush(void);
 void readFromCharArray(uint8_t *ch);
 void send_char_usb(uint8_t ch);
 void get_char_usb(uint8_t *ch);
@@ -67,6 +67,7 @@
 
 #include "main.h"
 #include "io.h"
+#include "trigger.h"
 
 #ifdef VARIANT_PQC
 #include "mldsa/wrapper.h"
@@ -104,69 +105,1812 @@ const uint8_t AUTH_OK=0xA5;
 
 //rxBuffer is the USART buffer
 uint8_t rxBuffer[RXBUFFERLENGTH] = {};
+#ifndef VARIANT_PQC
+#ifndef PINATA_HOST_SIMULATOR
+//Only the CPU touches the batch blocks, so they can live in the core coupled memory and leave SRAM to the DMA buffers
+#define BATCH_BUFFER_SECTION __attribute__((section(".ccmram")))
+#else
+#define BATCH_BUFFER_SECTION
+#endif
+//batchBuffer holds the blocks of a CMD_BATCH request, which are replaced by their outputs
+uint8_t batchBuffer[BATCHBUFFERLENGTH] BATCH_BUFFER_SECTION;
+#endif
 const uint8_t zeros[20]={'0','0','0','0','0','0','0','0','0','0','0','0','0','0','0','0','0','0','0','0'};
 const uint8_t glitched[] = { 0xFA, 0xCC };
 const uint8_t cmdByteIsWrong[] = { 'B','a','d','C','m','d','\n',0x00};
-const uint8_t codeVersion[] = { 'V','e','r',' ','4','.','0',0x00};
+const uint8_t codeVersion[] = { 'V','e','r',' ','0'+FIRMWARE_VERSION_MAJOR,'.','0'+FIRMWARE_VERSION_MINOR,0x00};
+
+volatile uint8_t usbSerialEnabled=0;
+volatile int busyWait1;
+volatile uint8_t clockspeed=168;
+volatile uint8_t clockSource=0;
+volatile uint32_t usartBaudRate=USART_DEFAULT_BAUDRATE;
+#ifdef PINATA_CYCLE_COUNT
+volatile uint32_t triggerCycles=0; //Set by the trigger macros, see trigger.h
+#endif
+
+unsigned char etxBuf[256] ={};
+
+#ifdef VARIANT_PQC
+MlDsaState g_mldsa;
+MlKemState g_mlkem;
+void handle_mldsa_sign_start() {
+	BEGIN_INTERESTING_STUFF;
+}
+void handle_mldsa_sign_finish() {
+	END_INTERESTING_STUFF;
+}
+#endif
+
+#ifndef VARIANT_PQC
+//Cryptographic keys and state used by the command handlers, loaded with the defaults at boot
+//We will need ROUNDS + 1 keys to be generated by the key schedule (multiplied by 4 because we can only store 32 bits at a time).
+//The T-tables AES key schedules are prepared whenever keyAES changes (see setup_aes128_key_schedules())
+static uint32_t keyScheduleAESEnc[(MAXAESROUNDS + 1) * 4] = { };
+static uint32_t keyScheduleAESDec[(MAXAESROUNDS + 1) * 4] = { };
+static uint32_t keyScheduleAESFixsliced[AES128_FIXSLICED_ROUND_KEY_WORDS] = { };
+static uint8_t keyDES[8];
+static uint8_t keyTDES[24];
+static uint8_t keyAES[16];
+static uint8_t keyLoadingAES[16];
+static uint8_t keyAES256[32];
+static uint8_t keySM4[16];
+static uint8_t password[4];
+static uint8_t keyPRESENT80[10];
+static uint8_t keyPRESENT128[16];
+static aes256_context ctx;
+static sm4_ctx ctx_sm4;
+static SM4_KEY ctx_sm4_ossl;
+static uint32_t keyTEAXTEA[4];
+static int glitchedBoot, authenticated;
+//ANSSI AES support structures
+//volatile STRUCT_AES aes_struct,aes_struct_2; //Allocated another structure just in case there is some ASM overflow (seems like it)
+//volatile uint8_t randoms_keyScheduling[20];
+//volatile uint8_t randoms_AESoperations[20];
+#endif // VARIANT_PQC
+
+///////////////////////////////////////////////////
+//COMMAND HANDLERS: registered in commands[] below//
+///////////////////////////////////////////////////
+
+/////////Software crypto commands/////////
+
+#ifdef VARIANT_PQC
+
+static void cmd_sw_mldsa_get_variant(uint8_t cmd) {
+	// Return the response.
+	send_char(getMlDsaAlgorithmVariant());
+}
+
+static void cmd_sw_mldsa_set_public_and_private_key(uint8_t cmd) {
+	// Receive the input parameters and handle the request.
+	get_bytes(MLDSA_PUBLIC_KEY_SIZE, MlDsaState_getPublicKey(&g_mldsa));
+	get_bytes(MLDSA_PRIVATE_KEY_SIZE, MlDsaState_getPrivateKey(&g_mldsa));
+
+	// Return the response.
+	send_char(0);
+}
+
+static void cmd_sw_mldsa_verify(uint8_t cmd) {
+	// Receive the input parameters.
+	uint8_t* signedMessageBuffer = MlDsaState_getScratchPad(&g_mldsa);
+	get_bytes(MLDSA_SIGNED_MESSAGE_SIZE, signedMessageBuffer);
+
+	// Handle the request.
+	BEGIN_INTERESTING_STUFF;
+	int result = MlDsaState_verify(&g_mldsa, signedMessageBuffer);
+	END_INTERESTING_STUFF;
+
+	// Return the response.
+	send_char(result == 0 ? 0 : 1);
+}
+
+static void cmd_sw_mldsa_sign(uint8_t cmd) {
+	// Receive the input parameters.
+	uint8_t* signedMessageBuffer = MlDsaState_getScratchPad(&g_mldsa);
+	get_bytes(MLDSA_MESSAGE_SIZE, signedMessageBuffer + MLDSA_SIGNATURE_SIZE);
+
+	// Handle the request.
+	// Note: GPIO Pin 2 is set to high somewhere inside the sign function with callbacks.
+	int result = MlDsaState_sign(&g_mldsa, signedMessageBuffer, signedMessageBuffer + MLDSA_SIGNATURE_SIZE);
+
+	if (result == 0) {
+		// OK: The message is now signed, let's send the signature of the message back.
+		send_char(0);
+		send_bytes(MLDSA_SIGNATURE_SIZE, signedMessageBuffer);
+	} else {
+		// ERROR: Signing the message failed.
+		send_char(1);
+	}
+}
+
+static void cmd_sw_mldsa_get_key_sizes(uint8_t cmd) {
+	const uint16_t publicKeySize = MLDSA_PUBLIC_KEY_SIZE;
+	const uint16_t privateKeySize = MLDSA_PRIVATE_KEY_SIZE;
+	// Send the response; MUST be in little-endian order!
+	send_bytes(sizeof(publicKeySize), (const uint8_t*)&publicKeySize);
+	send_bytes(sizeof(privateKeySize), (const uint8_t*)&privateKeySize);
+}
+
+static void cmd_sw_mldsa_ntt(uint8_t cmd) {
+	int32_t polynomialBuffer[MLDSA_N];
+	// Receive the polynomial coefficients.
+	get_bytes(sizeof(int32_t)*MLDSA_N, (uint8_t*)polynomialBuffer);
+	BEGIN_INTERESTING_STUFF;
+	MlDsa_ntt(polynomialBuffer);
+	END_INTERESTING_STUFF;
+	// No reply is sent.
+}
+
+static void cmd_sw_mlkem_set_public_and_private_key(uint8_t cmd) {
+	// Receive the input parameters and handle the request.
+	get_bytes(MLKEM_PUBLIC_KEY_SIZE, MlKemState_getPublicKey(&g_mlkem));
+	get_bytes(MLKEM_PRIVATE_KEY_SIZE, MlKemState_getPrivateKey(&g_mlkem));
+	// Return the response.
+	send_char(0);
+}
+
+static void cmd_sw_mlkem_generate(uint8_t cmd) {
+	// Generate a shared secret and an accompanying key encapsulation message.
+	BEGIN_INTERESTING_STUFF;
+	int result = MlKemState_generate(&g_mlkem);
+	END_INTERESTING_STUFF;
+	if (result == 0) {
+		// OK: The shared secret is now generated and encapsulated, let's send that back.
+		send_char(0);
+		send_bytes(MLKEM_SHARED_SECRET_SIZE, MlKemState_getSharedSecretBuffer(&g_mlkem));
+		send_bytes(MLKEM_CIPHERTEXT_SIZE, MlKemState_getKeyEncapsulationMessageBuffer(&g_mlkem));
+	} else {
+		// ERROR: Generation failed.
+		send_char(1);
+	}
+}
+
+static void cmd_sw_mlkem_dec(uint8_t cmd) {
+	// Receive the key encapsulation message that we are supposed to decode.
+	get_bytes(MLKEM_CIPHERTEXT_SIZE, MlKemState_getKeyEncapsulationMessageBuffer(&g_mlkem));
+	memset(MlKemState_getSharedSecretBuffer(&g_mlkem), 0, MLKEM_SHARED_SECRET_SIZE);
+	// Decode the key encapsulation message into a shared secret.
+	BEGIN_INTERESTING_STUFF;
+	int result = MlKemState_decode(&g_mlkem);
+	END_INTERESTING_STUFF;
+	if (result == 0) {
+		// OK: The shared secret is decoded, let's send that back.
+		send_char(0);
+		send_bytes(MLKEM_SHARED_SECRET_SIZE, MlKemState_getSharedSecretBuffer(&g_mlkem));
+	} else {
+		// ERROR: Decoding the shared secret failed.
+		send_char(1);
+	}
+}
+
+static void cmd_sw_mlkem_get_key_sizes(uint8_t cmd) {
+	const uint16_t publicKeySize = MLKEM_PUBLIC_KEY_SIZE;
+	const uint16_t privateKeySize = MLKEM_PRIVATE_KEY_SIZE;
+	// Send the response; MUST be in little-endian order!
+	send_bytes(sizeof(publicKeySize), (const uint8_t*)&publicKeySize);
+	send_bytes(sizeof(privateKeySize), (const uint8_t*)&privateKeySize);
+}
+
+#else // VARIANT_PQC
+
+//Block cipher commands: receive one block, run the block operation of the registry on it and send back the output
+static void cmd_block(uint8_t cmd) {
+	const command_t *command = &commands[cmd];
+	uint8_t *output = (command->flags & COMMAND_IN_PLACE) ? rxBuffer : rxBuffer + command->inputLength;
+
+	get_bytes(command->inputLength, rxBuffer);
+	command->block(rxBuffer, rxBuffer + command->inputLength);
+	send_bytes(command->outputLength, output);
+}
+
+//Software DES - encrypt
+static void block_swdes_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	des(keyDES, block, ENCRYPT); // Perform software DES encryption
+	END_INTERESTING_STUFF;
+}
+
+//Software DES - decrypt
+static void block_swdes_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	des(keyDES, block, DECRYPT); // Perform software DES decryption
+	END_INTERESTING_STUFF;
+}
+
+//Software TDES - encrypt
+static void block_swtdes_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	des(keyTDES,   block, ENCRYPT); // Perform software DES encryption, key1
+	des(keyTDES+8, block, DECRYPT); // Perform software DES decryption, key2
+	des(keyTDES+16,block, ENCRYPT); // Perform software DES encryption, key3
+	END_INTERESTING_STUFF;
+}
+
+//Software TDES - decrypt
+static void block_swtdes_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	des(keyTDES,   block, DECRYPT); // Perform software DES decryption, key1
+	des(keyTDES+8, block, ENCRYPT); // Perform software DES encryption, key2
+	des(keyTDES+16,block, DECRYPT); // Perform software DES decryption, key3
+	END_INTERESTING_STUFF;
+}
+
+//Software AES128 - encrypt
+static void block_swaes128_enc(uint8_t *block, uint8_t *output) {
+	AES128_ECB_encrypt(block, keyAES, output); //Trigger is coded inside aes function after key expansion
+}
+
+//Software AES128 - encrypt with SPI transmission at beginning, NO TRIGGER ON PC2
+static void cmd_swaes128spi_enc(uint8_t cmd) {
+	get_bytes(16, rxBuffer); // Receive AES plaintext
+	//4 byte SPI transmission to simulate access to e.g. external FLASH; sending 0xDECAFFED
+	send_OLEDcmd_SPI(0xDE);
+	send_OLEDcmd_SPI(0xCA);
+	send_OLEDcmd_SPI(0xFF);
+	send_OLEDcmd_SPI(0xED);
+	AES128_ECB_encrypt_noTrigger(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES);
+	send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
+}
+
+//Software AES128 - decrypt
+static void block_swaes128_dec(uint8_t *block, uint8_t *output) {
+	AES128_ECB_decrypt(block, keyAES, output); //Trigger is coded inside aes function after key expansion
+}
+
+//Software AES128 - reuse the round keys of the last key change, or expand the key in every call again
+static void cmd_swaes128_set_key_expansion(uint8_t cmd) {
+	uint8_t tmp = 0;
+	get_char(&tmp);
+	send_char(AES128_set_key_expansion(tmp));
+}
+
+/*
+//Software AES128 ANSSI masked implementation, random numbers from TRNG - encrypt
+static void cmd_anssiaes128_enc(uint8_t cmd) {
+	get_bytes(16, rxBuffer); // Receive AES plain
+	fillBufferWithRandomNumbers(19, randoms_AESoperations);
+	fillBufferWithRandomNumbers(19, randoms_keyScheduling);
+	//Implementation seems broken; sometimes outputs wrong ciphertexts (which is weird)
+	tmp32=anssiaes(MODE_KEYINIT|MODE_AESINIT_ENC|MODE_RANDOM_AES_EXT|MODE_RANDOM_KEY_EXT, &aes_struct, keyAES, 0, 0, randoms_AESoperations, randoms_keyScheduling);
+	tmp32|=anssiaes(MODE_ENC, &aes_struct, 0, rxBuffer, rxBuffer + AES128LENGTHINBYTES, 0, 0);
+	if(tmp32!=NO_ERROR){
+		send_bytes(16, zeros); // Error: transmit zeroes
+	}
+	else {
+		send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back plaintext via UART
+	}
+}
+
+//Software AES128 ANSSI masked implementation, random numbers from TRNG - decrypt
+static void cmd_anssiaes128_dec(uint8_t cmd) {
+	get_bytes(16, rxBuffer); // Receive AES ciphertext
+	fillBufferWithRandomNumbers(19, randoms_AESoperations);
+	fillBufferWithRandomNumbers(19, randoms_keyScheduling);
+	//Implementation seems broken
+	tmp32=anssiaes(MODE_KEYINIT|MODE_AESINIT_DEC|MODE_RANDOM_AES_EXT|MODE_RANDOM_KEY_EXT, &aes_struct, keyAES, 0, 0, randoms_AESoperations, randoms_keyScheduling);
+	tmp32|=anssiaes(MODE_DEC, &aes_struct, 0, rxBuffer, rxBuffer + AES128LENGTHINBYTES, 0, 0);
+	if(tmp32!=NO_ERROR){
+		send_bytes(16, zeros); // Error: transmit zeroes
+	}
+	else {
+		send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back plaintext via UART
+	}
+}
+*/
+
+//Software AES256 - encrypt
+static void block_swaes256_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	aes256_encrypt_ecb(&ctx, block); // Perform software AES256 encryption
+	END_INTERESTING_STUFF;
+}
+
+//Software AES256 - decrypt
+static void block_swaes256_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	aes256_decrypt_ecb(&ctx, block); // Perform software AES256 encryption
+	END_INTERESTING_STUFF;
+}
+
+//Software SM4 - encrypt
+static void block_swsm4_enc(uint8_t *block, uint8_t *output) {
+	sm4_setkey(&ctx_sm4, keySM4, SM4_ENCRYPT); //Configure SM4 key schedule for encryption
+	BEGIN_INTERESTING_STUFF;
+	sm4_encrypt(&ctx_sm4,block); //Perform SM4 crypto
+	END_INTERESTING_STUFF;
+}
+
+//Software SM4 - decrypt
+static void block_swsm4_dec(uint8_t *block, uint8_t *output) {
+	sm4_setkey(&ctx_sm4, keySM4, SM4_DECRYPT); //Configure SM4 key schedule for decryption
+	BEGIN_INTERESTING_STUFF;
+	sm4_encrypt(&ctx_sm4,block); //Perform SM4 crypto
+	END_INTERESTING_STUFF;
+}
+
+//Software SM4 OpenSSL implementation- encrypt
+static void cmd_swsm4ossl_enc(uint8_t cmd) {
+	get_bytes(16, rxBuffer); // Receive SM4 plaintext
+	SM4_set_key(keySM4, &ctx_sm4_ossl); //Configure SM4 key schedule
+	BEGIN_INTERESTING_STUFF;
+	SM4_encrypt(rxBuffer,rxBuffer+SM4_BLOCK_SIZE,&ctx_sm4_ossl); //Perform SM4 encryption (openSSL code)
+	END_INTERESTING_STUFF;
+	send_bytes(16, rxBuffer+SM4_BLOCK_SIZE); // Transmit back ciphertext via UART
+}
+
+//Software SM4 OpenSSL implementation - decrypt
+static void cmd_swsm4ossl_dec(uint8_t cmd) {
+	get_bytes(16, rxBuffer); // Receive SM4 plaintext
+	SM4_set_key(keySM4, &ctx_sm4_ossl); //Configure SM4 key schedule
+	BEGIN_INTERESTING_STUFF;
+	SM4_decrypt(rxBuffer,rxBuffer+SM4_BLOCK_SIZE,&ctx_sm4_ossl); //Perform SM4 decryption (openSSL code)
+	END_INTERESTING_STUFF;
+	send_bytes(16, rxBuffer+SM4_BLOCK_SIZE); // Transmit back ciphertext via UART
+}
+
+//Software DES - encrypt with misalignment at beginning of trigger (to practice static align)
+static void cmd_swdes_enc_misaligned(uint8_t cmd) {
+	get_bytes(8, rxBuffer); // Receive DES plaintext
+	BEGIN_INTERESTING_STUFF;
+	desMisaligned(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
+	END_INTERESTING_STUFF;
+	send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
+}
+
+static void cmd_swaes128_enc_misaligned(uint8_t cmd) {
+	get_bytes(16, rxBuffer); // Receive AES plaintext
+	AES128_ECB_encrypt_misaligned(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function after key expansion
+	send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
+}
+
+//Software DES - encrypt with dummy rounds
+static void cmd_swdes_enc_dummyrounds(uint8_t cmd) {
+	get_bytes(8, rxBuffer); // Receive DES plaintext
+	BEGIN_INTERESTING_STUFF;
+	desDummy(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
+	END_INTERESTING_STUFF;
+	send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
+}
+
+static void cmd_swaes128_enc_dummyrounds(uint8_t cmd) {
+	get_bytes(16, rxBuffer); // Receive AES plaintext
+	AES128_ECB_encrypt_dummy(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function after key expansion
+	send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
+}
+
+static void cmd_swtea_enc(uint8_t cmd) {
+	uint32_t teaxteaInOut[2] = { };
+	get_bytes(8, rxBuffer); // Receive TEA plaintext
+	teaxteaInOut[0]= rxBuffer[3] | (rxBuffer[2] << 8) | (rxBuffer[1] << 16) | (rxBuffer[0] << 24);
+	teaxteaInOut[1]= rxBuffer[7] | (rxBuffer[6] << 8) | (rxBuffer[5] << 16) | (rxBuffer[4] << 24);
+	BEGIN_INTERESTING_STUFF;
+	tea_encrypt(teaxteaInOut,keyTEAXTEA); //32 rounds (32 cycles as named in TEA)
+	END_INTERESTING_STUFF;
+	send_char((teaxteaInOut[0]>>24)&0x000000FF); //MSB first
+	send_char((teaxteaInOut[0]>>16)&0x000000FF);
+	send_char((teaxteaInOut[0]>> 8)&0x000000FF);
+	send_char( teaxteaInOut[0]     &0x000000FF);
+	send_char((teaxteaInOut[1]>>24)&0x000000FF); //MSB first
+	send_char((teaxteaInOut[1]>>16)&0x000000FF);
+	send_char((teaxteaInOut[1]>> 8)&0x000000FF);
+	send_char( teaxteaInOut[1]     &0x000000FF);
+}
+
+static void cmd_swtea_dec(uint8_t cmd) {
+	uint32_t teaxteaInOut[2] = { };
+	get_bytes(8, rxBuffer); // Receive TEA plaintext
+	teaxteaInOut[0]= rxBuffer[3] | (rxBuffer[2] << 8) | (rxBuffer[1] << 16) | (rxBuffer[0] << 24);
+	teaxteaInOut[1]= rxBuffer[7] | (rxBuffer[6] << 8) | (rxBuffer[5] << 16) | (rxBuffer[4] << 24);
+	BEGIN_INTERESTING_STUFF;
+	tea_decrypt(teaxteaInOut,keyTEAXTEA); //32 rounds (32 cycles as named in TEA)
+	END_INTERESTING_STUFF;
+	send_char((teaxteaInOut[0]>>24)&0x000000FF); //MSB first
+	send_char((teaxteaInOut[0]>>16)&0x000000FF);
+	send_char((teaxteaInOut[0]>> 8)&0x000000FF);
+	send_char( teaxteaInOut[0]     &0x000000FF);
+	send_char((teaxteaInOut[1]>>24)&0x000000FF); //MSB first
+	send_char((teaxteaInOut[1]>>16)&0x000000FF);
+	send_char((teaxteaInOut[1]>> 8)&0x000000FF);
+	send_char( teaxteaInOut[1]     &0x000000FF);
+}
+
+static void cmd_swxtea_enc(uint8_t cmd) {
+	uint32_t teaxteaInOut[2] = { };
+	get_bytes(8, rxBuffer); // Receive TEA plaintext
+	teaxteaInOut[0]= rxBuffer[3] | (rxBuffer[2] << 8) | (rxBuffer[1] << 16) | (rxBuffer[0] << 24);
+	teaxteaInOut[1]= rxBuffer[7] | (rxBuffer[6] << 8) | (rxBuffer[5] << 16) | (rxBuffer[4] << 24);
+	BEGIN_INTERESTING_STUFF;
+	xtea_encrypt(teaxteaInOut,keyTEAXTEA); //32 rounds (32 cycles as named in TEA)
+	END_INTERESTING_STUFF;
+	send_char((teaxteaInOut[0]>>24)&0x000000FF); //MSB first
+	send_char((teaxteaInOut[0]>>16)&0x000000FF);
+	send_char((teaxteaInOut[0]>> 8)&0x000000FF);
+	send_char( teaxteaInOut[0]     &0x000000FF);
+	send_char((teaxteaInOut[1]>>24)&0x000000FF); //MSB first
+	send_char((teaxteaInOut[1]>>16)&0x000000FF);
+	send_char((teaxteaInOut[1]>> 8)&0x000000FF);
+	send_char( teaxteaInOut[1]     &0x000000FF);
+}
+
+static void cmd_swxtea_dec(uint8_t cmd) {
+	uint32_t teaxteaInOut[2] = { };
+	get_bytes(8, rxBuffer); // Receive TEA plaintext
+	teaxteaInOut[0]= rxBuffer[3] | (rxBuffer[2] << 8) | (rxBuffer[1] << 16) | (rxBuffer[0] << 24);
+	teaxteaInOut[1]= rxBuffer[7] | (rxBuffer[6] << 8) | (rxBuffer[5] << 16) | (rxBuffer[4] << 24);
+	BEGIN_INTERESTING_STUFF;
+	xtea_decrypt(teaxteaInOut,keyTEAXTEA); //32 rounds (32 cycles as named in TEA)
+	END_INTERESTING_STUFF;
+	send_char((teaxteaInOut[0]>>24)&0x000000FF); //MSB first
+	send_char((teaxteaInOut[0]>>16)&0x000000FF);
+	send_char((teaxteaInOut[0]>> 8)&0x000000FF);
+	send_char( teaxteaInOut[0]     &0x000000FF);
+	send_char((teaxteaInOut[1]>>24)&0x000000FF); //MSB first
+	send_char((teaxteaInOut[1]>>16)&0x000000FF);
+	send_char((teaxteaInOut[1]>> 8)&0x000000FF);
+	send_char( teaxteaInOut[1]     &0x000000FF);
+}
+
+/////Software crypto with countermeasures //////
+//Software DES - encrypt with Random S-box order
+static void cmd_swdes_enc_rnd_sbox(uint8_t cmd) {
+	get_bytes(8, rxBuffer); // Receive DES plaintext
+	BEGIN_INTERESTING_STUFF;
+	desRandomSboxes(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
+	END_INTERESTING_STUFF;
+	send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
+}
+
+//Software DES - encrypt with Random delays
+static void cmd_swdes_enc_rnd_delays(uint8_t cmd) {
+	get_bytes(8, rxBuffer); // Receive DES plaintext
+	BEGIN_INTERESTING_STUFF;
+	desRandomDelays(keyDES, rxBuffer, ENCRYPT,2); // Perform software DES encryption
+	END_INTERESTING_STUFF;
+	send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
+}
+
+//Software masked AES128 - encrypt
+static void block_swaes128_enc_masked(uint8_t *block, uint8_t *output) {
+	mAES128_ECB_encrypt(block, keyAES, output); //Trigger is coded inside aes function, includes masking process
+}
+
+//Software masked AES128 - decrypt
+static void block_swaes128_dec_masked(uint8_t *block, uint8_t *output) {
+	mAES128_ECB_decrypt(block, keyAES, output); //Trigger is coded inside aes function, includes masking process
+}
+
+//Software masked AES128 - mask refresh interval
+static void cmd_swaes128_set_mask_refresh(uint8_t cmd) {
+	uint8_t tmp = 0;
+	uint16_t blocks;
+	get_char(&tmp); // Receive the interval, MSByte first
+	blocks = tmp << 8;
+	get_char(&tmp);
+	blocks |= tmp;
+	blocks = mAES128_set_mask_refresh(blocks);
+	send_char(blocks >> 8);
+	send_char(blocks & 0xFF);
+}
+
+//Software AES128 - random delays
+static void block_swaes128_enc_rnddelays(uint8_t *block, uint8_t *output) {
+	AES128_ECB_encrypt_rndDelays(block, keyAES, output); //Trigger is coded inside aes function, includes masking process
+}
+
+//Software AES128 - random sbox order
+static void block_swaes128_enc_rndsbox(uint8_t *block, uint8_t *output) {
+	AES128_ECB_encrypt_rndSbox(block, keyAES, output); //Trigger is coded inside aes function, includes masking process
+}
+
+// RSA-CRT 1024bit decryption, textbook style (non-time constant)
+static void cmd_rsacrt1024_dec(uint8_t cmd) {
+	int payload_len = 0;
+	uint8_t tmp = 0;
+	if (cmd == 0) { //Legacy support of RLV protocol
+		get_char(&cmd);
+	}
+	get_char(&tmp); // Receive payload length, expect MSByte first
+	payload_len |= tmp;
+	payload_len <<= 8;
+	get_char(&tmp);
+	payload_len |= tmp;
+	//Receive payload_len bytes from the USART (truncating plaintext length if too long)
+	get_bytes(payload_len, rxBuffer);
+	if (payload_len > RXBUFFERLENGTH) {
+		payload_len = RXBUFFERLENGTH;
+	}
+	input_cipher_text(payload_len); // Fill the cipher text buffer "c" with incoming data bytes, assuming MSByte first and 32-bit alignment
+	rsa_crt_decrypt(); // Start RSA CRT procedure, Trigger signal toggling contained within the call
+	send_clear_text(); // Send content of clear text buffer "m" back to Host PC, MSByte first 32-bit alignment
+}
+
+//Prepare all AES128 key schedules that are kept for keyAES: software AES128, both T-tables implementations and
+//fixsliced AES128
+static void setup_aes128_key_schedules(void) {
+	AES128_init(keyAES);
+	rijndaelSetupEncrypt(keyScheduleAESEnc, keyAES, 128);
+	rijndaelSetupDecrypt(keyScheduleAESDec, keyAES, 128);
+	aes128_fixsliced_key_schedule(keyScheduleAESFixsliced, keyAES);
+}
+
+//Software AES(Ttables implementation) - encrypt
+static void block_swaes128ttables_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	rijndaelEncrypt(keyScheduleAESEnc, 10, block, output); // Perform software AES encryption
+	END_INTERESTING_STUFF;
+}
+
+//Software AES(Ttables implementation) - decrypt
+static void block_swaes128ttables_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	rijndaelDecrypt(keyScheduleAESDec, 10, block, output); // Perform software AES decryption
+	END_INTERESTING_STUFF;
+}
+
+//Software AES(single T-table assembly implementation) - encrypt, with the table in flash or in SRAM
+static void block_swaes128ttablesasm_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	aes128_ttable_encrypt(keyScheduleAESEnc, &aesTTableEnc, block, output);
+	END_INTERESTING_STUFF;
+}
+
+static void block_swaes128ttablesasm_sram_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	aes128_ttable_encrypt(keyScheduleAESEnc, &aesTTableEncSram, block, output);
+	END_INTERESTING_STUFF;
+}
+
+//Software AES(single T-table assembly implementation) - decrypt, with the table in flash or in SRAM
+static void block_swaes128ttablesasm_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	aes128_ttable_decrypt(keyScheduleAESDec, &aesTTableDec, block, output);
+	END_INTERESTING_STUFF;
+}
+
+static void block_swaes128ttablesasm_sram_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	aes128_ttable_decrypt(keyScheduleAESDec, &aesTTableDecSram, block, output);
+	END_INTERESTING_STUFF;
+}
+
+//Software AES(fixsliced implementation) - encrypt two blocks
+static void block_swaes128fixsliced_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	aes128_fixsliced_encrypt(keyScheduleAESFixsliced, block, block + 16, block, block + 16);
+	END_INTERESTING_STUFF;
+}
+
+//Software AES(fixsliced implementation) - decrypt two blocks
+static void block_swaes128fixsliced_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	aes128_fixsliced_decrypt(keyScheduleAESFixsliced, block, block + 16, block, block + 16);
+	END_INTERESTING_STUFF;
+}
+
+//Software RSA-512 SFM commands
+static void cmd_rsasfm_get_hardcoded_key(uint8_t cmd) {
+	rsa_sfm_send_hardcoded_key();
+}
+
+static void cmd_rsasfm_set_d(uint8_t cmd) {
+	int payload_len = 0;
+	uint8_t tmp = 0;
+	get_char(&tmp);		// Receive payload length, expect MSByte first
+	payload_len |= tmp;
+	payload_len <<= 8;
+	get_char(&tmp);
+	payload_len |= tmp;
+	//Receive payload_len bytes from the USART (truncating plaintext length if too long)
+	if(payload_len>RXBUFFERLENGTH){
+		payload_len=RXBUFFERLENGTH;
+	}
+	get_bytes(payload_len,rxBuffer);
+	input_external_exponent(payload_len);
+	send_char(cmd);
+}
+
+static void cmd_rsasfm_dec(uint8_t cmd) {
+	int payload_len = 0;
+	uint8_t tmp = 0;
+	get_char(&tmp);		// Receive payload length, expect MSByte first
+	payload_len |= tmp;
+	payload_len <<= 8;
+	get_char(&tmp);
+	payload_len |= tmp;
+	//Receive payload_len bytes from the USART (truncating plaintext length if too long)
+	if(payload_len>RXBUFFERLENGTH){
+		payload_len=RXBUFFERLENGTH;
+	}
+	get_bytes(payload_len,rxBuffer);
+	input_cipher_text(payload_len);	// Fill the cipher text buffer "c" with incoming data bytes, assuming MSByte first and 32-bit alignment
+	rsa_sfm_decrypt();
+	send_clear_text();
+}
+
+static void cmd_rsasfm_set_key_generation_method(uint8_t cmd) {
+	uint8_t tmp = 0;
+	get_char(&tmp);
+	rsa_sfm_set_key_generation_method(tmp);
+	send_char(tmp);
+}
+
+static void cmd_rsasfm_set_implementation(uint8_t cmd) {
+	uint8_t tmp = 0;
+	get_char(&tmp);
+	rsa_sfm_set_implementation_method(tmp);
+	send_char(tmp);
+}
+
+//ECC Curve 25519 commands (the Cortex-M4 assembly is not available in the host simulator)
+#ifndef PINATA_HOST_SIMULATOR
+static void cmd_ecc25519_scalar_mult(uint8_t cmd) {
+	ecsm(rxBuffer);
+}
+
+#else
+static void cmd_ecc25519_scalar_mult(uint8_t cmd) {
+	get_bytes(96, rxBuffer); // Swallow the PRNG seed, scalar and point so they are not taken for commands
+	send_bytes(8, cmdByteIsWrong);
+}
+
+#endif
+
+//Batch of software block cipher operations: every block gets its own trigger window, the outputs are sent
+//only after the last block so that no I/O happens between the triggers. CMD_BATCH_SEEDED derives the
+//inputs from a seed instead of receiving them, and can reply with a hash of the outputs only.
+static void cmd_batch(uint8_t cmd) {
+	int i, j;
+	uint8_t tmp = 0;
+	uint8_t batchCmd, batchBlockSize, batchMode;
+	uint16_t batchCount, batchGap;
+	uint32_t batchHash;
+	uint8_t *block;
+	xoshiro128_ctx_t batchPrng;
+	get_char(&batchCmd);
+	get_char(&tmp); // Receive block count, MSByte first
+	batchCount = tmp << 8;
+	get_char(&tmp);
+	batchCount |= tmp;
+	get_char(&tmp); // Receive inter-block gap, MSByte first
+	batchGap = tmp << 8;
+	get_char(&tmp);
+	batchGap |= tmp;
+	batchMode = BATCH_MODE_OUTPUTS;
+	if (cmd == CMD_BATCH_SEEDED) {
+		get_char(&batchMode);
+		get_bytes(XOSHIRO128_SEED_LEN_BYTES, rxBuffer); // Receive the seed of the inputs
+		xoshiro128_seed(&batchPrng, rxBuffer);
+	}
+	//The registry knows the block size and the block operation of every command that can run in a batch
+	batchBlockSize = ((commands[batchCmd].flags & COMMAND_BATCHABLE) && commands[batchCmd].block) ? commands[batchCmd].inputLength : 0;
+	if (batchBlockSize == 0) { // Unknown sub-command: the length of the blocks that follow is unknown too
+		send_bytes(8, cmdByteIsWrong);
+		return;
+	}
+	if (batchMode != BATCH_MODE_OUTPUTS && batchMode != BATCH_MODE_HASH) {
+		send_bytes(8, cmdByteIsWrong);
+		return;
+	}
+	if (batchMode == BATCH_MODE_OUTPUTS && batchCount * batchBlockSize > BATCHBUFFERLENGTH) {
+		if (cmd == CMD_BATCH) {
+			for (i = 0; i < batchCount; i++) get_bytes(batchBlockSize, rxBuffer); // Swallow the blocks to stay in sync with the host
+		}
+		send_bytes(8, cmdByteIsWrong);
+		return;
+	}
+	if (cmd == CMD_BATCH) {
+		get_bytes(batchCount * batchBlockSize, batchBuffer); // Receive all input blocks
+	}
+	batchHash = FNV1A_OFFSET_BASIS;
+	for (i = 0; i < batchCount; i++) {
+		// Without outputs to send, every block reuses the start of the buffer
+		block = batchMode == BATCH_MODE_HASH ? batchBuffer : batchBuffer + i * batchBlockSize;
+		if (cmd == CMD_BATCH_SEEDED) {
+			xoshiro128_get_bytes(&batchPrng, block, batchBlockSize);
+		}
+		commands[batchCmd].block(block, rxBuffer);
+		if (!(commands[batchCmd].flags & COMMAND_IN_PLACE)) {
+			memcpy(block, rxBuffer, batchBlockSize); // The operation left its output in rxBuffer
+		}
+		if (batchMode == BATCH_MODE_HASH) {
+			for (j = 0; j < batchBlockSize; j++) {
+				batchHash = (batchHash ^ block[j]) * FNV1A_PRIME;
+			}
+		}
+		if (i + 1 < batchCount) {
+			busyWait1 = 0;
+			while (busyWait1 < batchGap) busyWait1++; //Inter-block gap
+		}
+	}
+	if (batchMode == BATCH_MODE_HASH) {
+		for (i = 0; i < 4; i++) rxBuffer[i] = batchHash >> (24 - 8 * i); // Transmit back the hash, MSByte first
+		send_bytes(4, rxBuffer);
+	} else {
+		send_bytes(batchCount * batchBlockSize, batchBuffer); // Transmit back all output blocks
+	}
+}
+
+//PRESENT
+static void block_present80_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	present80_encrypt(block, keyPRESENT80, output);
+	END_INTERESTING_STUFF;
+}
+
+static void block_present80_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	present80_decrypt(block, keyPRESENT80, output);
+	END_INTERESTING_STUFF;
+}
+
+static void block_present128_enc(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	present128_encrypt(block, keyPRESENT128, output);
+	END_INTERESTING_STUFF;
+}
+
+static void block_present128_dec(uint8_t *block, uint8_t *output) {
+	BEGIN_INTERESTING_STUFF;
+	present128_decrypt(block, keyPRESENT128, output);
+	END_INTERESTING_STUFF;
+}
+
+#endif // VARIANT_PQC
+
+/////////Hardware crypto commands/////////
+
+#ifndef HW_CRYPTO_PRESENT
+
+//Fallback for Pinata boards without HW crypto processor: board will reply zeroes without any trigger instead of BADCMD to quickly identify the issue
+static void cmd_hwaes_unavailable(uint8_t cmd) {
+	get_bytes(16, rxBuffer);
+	//HW crypto is not supported: send zeroes back
+	send_bytes(16, zeros);
+}
+
+static void cmd_hwdes_unavailable(uint8_t cmd) {
+	get_bytes(8, rxBuffer);
+	//HW crypto is not supported: send zeroes back
+	send_bytes(8, zeros);
+}
+
+static void cmd_sha1_hash(uint8_t cmd) {
+	get_bytes(sizeof(uint32_t), rxBuffer);
+	get_bytes(16, rxBuffer);
+	//HW hashing is not supported: send zeroes back
+	send_bytes(20, zeros);
+}
+
+static void cmd_hmac_sha1(uint8_t cmd) {
+	get_bytes(sizeof(uint32_t), rxBuffer);
+	get_bytes(20, rxBuffer);
+	//HW hashing is not supported: send zeroes back
+	send_bytes(20, zeros);
+}
+
+static void cmd_md5_hash(uint8_t cmd) {
+	uint8_t len=0;
+	// Length of message to hash, up to 16 bytes
+	get_bytes(1, rxBuffer);
+	len=rxBuffer[0];
+	if(len>0x10){
+		len=0x10;
+	}
+	//Read message up to 16 bytes
+	get_bytes(len, rxBuffer);
+	send_bytes(16, zeros);
+}
+
+#endif
+
+#ifdef HW_CRYPTO_PRESENT
+
+//Hardware AES128 - encrypt
+static void cmd_hwaes128_enc(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(16, rxBuffer);
+	//Trigger pin handling moved to CRYP_AES_ECB function
+	cryptoCompletedOK = CRYP_AES_ECB(MODE_ENCRYPT, keyAES, 128,	rxBuffer, (uint32_t) AES128LENGTHINBYTES, rxBuffer + AES128LENGTHINBYTES);
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(16, rxBuffer + AES128LENGTHINBYTES);
+	} else {
+		send_bytes(16, zeros);
+	}
+}
+
+//Hardware AES128 - decrypt
+static void cmd_hwaes128_dec(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(16, rxBuffer);
+	//Trigger pin handling moved to CRYP_AES_ECB function
+	cryptoCompletedOK = CRYP_AES_ECB(MODE_DECRYPT, keyAES, 128,	rxBuffer, (uint32_t) AES128LENGTHINBYTES, rxBuffer + AES128LENGTHINBYTES);
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(16, rxBuffer + AES128LENGTHINBYTES);
+	} else {
+		send_bytes(16, zeros);
+	}
+}
+
+//Hardware AES256 - encrypt
+static void cmd_hwaes256_enc(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(16, rxBuffer);
+	//Trigger pin handling moved to CRYP_AES_ECB function
+	cryptoCompletedOK = CRYP_AES_ECB(MODE_ENCRYPT, keyAES256, 256,	rxBuffer, (uint32_t) 16, rxBuffer + 16);
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(16, rxBuffer + 16);
+	} else {
+		send_bytes(16, zeros);
+	}
+}
+
+//Hardware AES256 - decrypt
+static void cmd_hwaes256_dec(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(16, rxBuffer);
+	//Trigger pin handling moved to CRYP_AES_ECB function
+	cryptoCompletedOK = CRYP_AES_ECB(MODE_DECRYPT, keyAES256, 256,	rxBuffer, (uint32_t) 16, rxBuffer + 16);
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(16, rxBuffer + 16);
+	} else {
+		send_bytes(16, zeros);
+	}
+}
+
+//Hardware DES - encrypt
+static void cmd_hwdes_enc(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(8, rxBuffer);
+	//Trigger pin handling moved to CRYP_DES_ECB function
+	cryptoCompletedOK=CRYP_DES_ECB(MODE_ENCRYPT,keyDES,rxBuffer,(uint32_t)8,rxBuffer+8);
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(8, rxBuffer + 8);
+	} else {
+		send_bytes(8, zeros);
+	}
+}
+
+//Hardware DES - decrypt
+static void cmd_hwdes_dec(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(8, rxBuffer);
+	//Trigger pin handling moved to CRYP_DES_ECB function
+	cryptoCompletedOK=CRYP_DES_ECB(MODE_DECRYPT,keyDES,rxBuffer,(uint32_t)8,rxBuffer+8);
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(8, rxBuffer + 8);
+	} else {
+		send_bytes(8, zeros);
+	}
+}
+
+//Hardware TDES - encrypt
+static void cmd_hwtdes_enc(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(8, rxBuffer);
+	//Trigger pin handling moved to CRYP_DES_ECB function
+	cryptoCompletedOK=CRYP_TDES_ECB(MODE_ENCRYPT,keyTDES,rxBuffer,(uint32_t)8,rxBuffer+8);
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(8, rxBuffer + 8);
+	} else {
+		send_bytes(8, zeros);
+	}
+}
+
+//Hardware TDES - decrypt
+static void cmd_hwtdes_dec(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(8, rxBuffer);
+	//Trigger pin handling moved to CRYP_DES_ECB function
+	cryptoCompletedOK=CRYP_TDES_ECB(MODE_DECRYPT,keyTDES,rxBuffer,(uint32_t)8,rxBuffer+8);
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(8, rxBuffer + 8);
+	} else {
+		send_bytes(8, zeros);
+	}
+}
+
+//Hardware HMAC SHA1 (key is the same as the TDES key)
+static void cmd_hmac_sha1(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	get_bytes(sizeof(uint32_t), rxBuffer);
+	uint32_t rxBuffer32 = (uint32_t)rxBuffer;
+	uint32_t iterations = __REV(*(uint32_t*)rxBuffer32);
+
+	get_bytes(20, rxBuffer);
+	RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, ENABLE);
+	// 24 byte key used is the same as the TDES key!!
+	cryptoCompletedOK = HMAC_SHA1(keyTDES, sizeof(keyTDES), rxBuffer+sizeof(uint32_t), 20, rxBuffer+24, iterations);
+	RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, DISABLE);
+
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(20, rxBuffer+24);
+	} else {
+		send_bytes(20, zeros);
+	}
+}
+
+//Hardware SHA1
+static void cmd_sha1_hash(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	// Length of message to hash fixed to 16 bytes
+	get_bytes(sizeof(uint32_t), rxBuffer);
+	uint32_t rxBuffer32 = (uint32_t)rxBuffer;
+	uint32_t iterations = __REV(*(uint32_t*)rxBuffer32);
+
+	get_bytes(16, rxBuffer);
+
+	RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, ENABLE);
+	BEGIN_INTERESTING_STUFF;
+	cryptoCompletedOK = HASH_SHA1(rxBuffer+sizeof(uint32_t), 16, rxBuffer+20, iterations);
+	END_INTERESTING_STUFF;
+	RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, DISABLE);
+
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(20, rxBuffer+20);
+	} else {
+		send_bytes(20, zeros);
+	}
+}
+
+//Hardware MD5 (up to 16 bytes)
+//CMD format: CMD_MD5_HASH (1 byte) + message length (1 byte, possible values 0x01 to 0x10) + message
+//output: 16 byte hash
+static void cmd_md5_hash(uint8_t cmd) {
+	ErrorStatus cryptoCompletedOK = ERROR;
+	uint8_t len=0;
+	// Length of message to hash, up to 16 bytes
+	get_bytes(1, rxBuffer);
+	len=rxBuffer[0];
+	if(len>0x10){
+		len=0x10;
+	}
+	//Read message up to 16 bytes
+	get_bytes(len, rxBuffer);
+
+	RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, ENABLE);
+	BEGIN_INTERESTING_STUFF;
+	cryptoCompletedOK = HASH_MD5(rxBuffer,len, rxBuffer+16);
+	END_INTERESTING_STUFF;
+	RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, DISABLE);
+
+	if (cryptoCompletedOK == SUCCESS) {
+		send_bytes(16, rxBuffer+16);
+	} else {
+		send_bytes(16, zeros);
+	}
+}
+
+#endif
+
+//////Cryptographic keys management//////
+
+#ifndef VARIANT_PQC
+
+//TDES key change
+static void cmd_tdes_keychange(uint8_t cmd) {
+	int i;
+	get_bytes(24, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	for (i = 0; i < 24; i++) keyTDES[i] = rxBuffer[i];
+	END_INTERESTING_STUFF;
+	send_bytes(24,keyTDES);
+}
+
+//DES key change
+static void cmd_des_keychange(uint8_t cmd) {
+	int i;
+	get_bytes(8, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	for (i = 0; i < 8; i++) keyDES[i] = rxBuffer[i];
+	END_INTERESTING_STUFF;
+	send_bytes(8,keyDES);
+}
+
+//TEA / XTEA key change
+static void cmd_tea_xtea_keychange(uint8_t cmd) {
+	int i;
+	get_bytes(16, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	for (i = 0; i < 4; i++){ //Copy input key to keyArray swapping endianness on-the-fly
+		keyTEAXTEA[i] = rxBuffer[4*i+3] | (rxBuffer[4*i+2] << 8) | (rxBuffer[4*i+1] << 16) | (rxBuffer[4*i+0] << 24);
+	}
+	END_INTERESTING_STUFF;
+	send_char((keyTEAXTEA[0]>>24)&0x000000FF); //MSB first
+	send_char((keyTEAXTEA[0]>>16)&0x000000FF);
+	send_char((keyTEAXTEA[0]>> 8)&0x000000FF);
+	send_char( keyTEAXTEA[0]     &0x000000FF);
+	send_char((keyTEAXTEA[1]>>24)&0x000000FF); //MSB first
+	send_char((keyTEAXTEA[1]>>16)&0x000000FF);
+	send_char((keyTEAXTEA[1]>> 8)&0x000000FF);
+	send_char( keyTEAXTEA[1]     &0x000000FF);
+	send_char((keyTEAXTEA[2]>>24)&0x000000FF); //MSB first
+	send_char((keyTEAXTEA[2]>>16)&0x000000FF);
+	send_char((keyTEAXTEA[2]>> 8)&0x000000FF);
+	send_char( keyTEAXTEA[2]     &0x000000FF);
+	send_char((keyTEAXTEA[3]>>24)&0x000000FF); //MSB first
+	send_char((keyTEAXTEA[3]>>16)&0x000000FF);
+	send_char((keyTEAXTEA[3]>> 8)&0x000000FF);
+	send_char( keyTEAXTEA[3]     &0x000000FF);
+}
+
+//AES128 key change
+static void cmd_aes128_keychange(uint8_t cmd) {
+	int i;
+	get_bytes(16, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	for (i = 0; i < 16; i++) keyAES[i] = rxBuffer[i];
+	END_INTERESTING_STUFF;
+	setup_aes128_key_schedules();
+	send_bytes(16,keyAES);
+}
+
+//AES256 key change
+static void cmd_aes256_keychange(uint8_t cmd) {
+	int i;
+	get_bytes(32, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	for (i = 0; i < 32; i++) keyAES256[i] = rxBuffer[i];
+	//Recompute again aes256 key schedule
+	aes256_init(&ctx,keyAES256); //Prepare AES key schedule for software AES256
+	END_INTERESTING_STUFF;
+	send_bytes(32,keyAES256);
+}
+
+//Password change (4 bytes long, used for password check commands & FI)
+static void cmd_pwd_change(uint8_t cmd) {
+	int i;
+	authenticated=0;
+	get_bytes(4, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	for (i = 0; i < 4; i++) password[i] = rxBuffer[i];
+	END_INTERESTING_STUFF;
+	send_bytes(4,password);
+}
+
+//SM4 key change
+static void cmd_sm4_keychange(uint8_t cmd) {
+	int i;
+	get_bytes(16, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	for (i = 0; i < 16; i++) keySM4[i] = rxBuffer[i];
+	END_INTERESTING_STUFF;
+	send_bytes(16,keySM4);
+}
+
+/////Template analysis commands/////
+
+//Software key copy (byte-wise)
+static void cmd_software_key_copy(uint8_t cmd) {
+	int i;
+	get_bytes(16, rxBuffer); // Receive AES128 key (16 byte)
+	for (i = 0; i < 16; i++) keyLoadingAES[i] = 0; //Initialize key array
+	BEGIN_INTERESTING_STUFF; //Trigger on PC2 for key loading
+	busyWait1=0;
+	while (busyWait1 < 500) busyWait1++; //For avoiding ringing on GPIO toggling
+
+	//Key copy, byte-wise, with a delay between key bytes copy to make it even more evident where key copy happens
+	keyLoadingAES[0] = rxBuffer[0];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[1] = rxBuffer[1];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[2] = rxBuffer[2];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[3] = rxBuffer[3];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[4] = rxBuffer[4];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[5] = rxBuffer[5];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[6] = rxBuffer[6];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[7] = rxBuffer[7];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[8] = rxBuffer[8];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[9] = rxBuffer[9];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[10] = rxBuffer[10];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[11] = rxBuffer[11];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[12] = rxBuffer[12];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[13] = rxBuffer[13];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[14] = rxBuffer[14];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	keyLoadingAES[15] = rxBuffer[15];
+	busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
+	//End of key-copy
+
+	END_INTERESTING_STUFF; //Trigger off PC2 end of key loading
+	send_bytes(16, keyLoadingAES); // Transmit back loaded key via UART
+}
+
+/////Fault Injection commands/////
+
+//Infinite loop for FI (has a NOP sled after the infinite loop)
+static void cmd_infinite_fi_loop(uint8_t cmd) {
+	BEGIN_INTERESTING_STUFF;
+	while (1) {
+		oled_sendchar('.');
+		busyWait1 = 0;
+		while (busyWait1 < 84459459) busyWait1++; //Roughly 0.5 seconds @ 168MHz
+		oled_sendchar(' ');
+		busyWait1 = 0;
+		while (busyWait1 < 84459459) busyWait1++; //Roughly 0.5 seconds @ 168MHz
+	}
+	//Small NOP sled
+#ifndef PINATA_HOST_SIMULATOR //ARM NOP sled
+	__asm __volatile__("mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			);
+#endif
+	END_INTERESTING_STUFF;
+	send_char('G');send_char('l');send_char('i');send_char('t');send_char('c');send_char('e');send_char('d');send_char('!');
+}
 
-volatile uint8_t usbSerialEnabled=0;
-volatile int busyWait1;
-volatile uint8_t clockspeed=168;
-volatile uint8_t clockSource=0;
+//Loop test command for FI
+static void cmd_loop_test_fi(uint8_t cmd) {
+	int payload_len = 0;
+	uint8_t tmp = 0;
+	volatile int upCounter = 0;
+	payload_len = 0;
+	get_char(&tmp); // Receive payload length, expect MSByte first, 16bit counter max
+	payload_len |= tmp;
+	payload_len <<= 8;
+	get_char(&tmp);
+	payload_len |= tmp;
+	BEGIN_INTERESTING_STUFF;
+	while (payload_len) {
+		payload_len--;
+		upCounter++;
+	}
+	END_INTERESTING_STUFF;
+	send_char(0xA5);
+	send_char((payload_len>>8)&0x000000FF); //MSB first
+	send_char( payload_len    &0x000000FF);
+	send_char((upCounter>>8)  &0x000000FF);
+	send_char( upCounter      &0x000000FF);
+	send_char(0xA5);
+}
 
-unsigned char etxBuf[256] ={};
+//Password check - single check for Fault Injection
+static void cmd_single_pwd_check_fi(uint8_t cmd) {
+	int i;
+	volatile int charsOK = 0;
+	authenticated = 0;
+	get_bytes(4, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	//Small delay to have a bit of time between trigger to glitch
+#ifndef PINATA_HOST_SIMULATOR //ARM NOP sled
+	__asm __volatile__("mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			);
+#endif
+	for (i = 0;i < 4; i++) {
+		if (rxBuffer[i] == password[i]) {
+			charsOK = charsOK + 1;
+		}
+	}
+	if (charsOK == 4) {
+		authenticated=AUTH_OK;
+		send_char(0x90);send_char(0x00);
+	} else {
+		send_char(0x69);send_char(0x86);
+	}
+	END_INTERESTING_STUFF;
+}
+
+//Password check - double check for Fault Injection
+static void cmd_double_pwd_check_fi(uint8_t cmd) {
+	int i;
+	volatile int charsOK = 11; //Changed the default value of zero to make it a bit harder to glitch
+	authenticated = 0;
+	get_bytes(4, rxBuffer);
+	BEGIN_INTERESTING_STUFF;
+	//Small delay to have a bit of time between trigger to glitch
+#ifndef PINATA_HOST_SIMULATOR //ARM NOP sled
+	__asm __volatile__("mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			"mov r0,r0\n"
+			);
+#endif
+	for (i = 0; i < 4; i++) {
+		if (rxBuffer[i] == password[i]) {
+			charsOK = charsOK + 11;
+		}
+	}
+	if (charsOK == 55) {
+		//Spacing to avoid that a single glitch does not bypass the two checks
+#ifndef PINATA_HOST_SIMULATOR //ARM NOP sled
+		__asm __volatile__("mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				"mov r0,r0\n"
+				);
+#endif
+
+		if ( ((*(uint32_t*)(rxBuffer))^(*(uint32_t*)(password))) != 0) { //Second check is a different one (uses a XOR of the 2 passwords of 4 chars)
+			authenticated=0;
+			send_char(0x69);send_char(0x86);
+		} else {
+			authenticated=AUTH_OK;
+			send_char(0x90);send_char(0x00);
+		}
+	} else {
+		send_char(0x69);send_char(0x00);
+	}
+	END_INTERESTING_STUFF;
+}
+
+//Software DES encryption with a double check (for Advanced FI DFA scenarios)
+static void cmd_swdes_encrypt_doublecheck(uint8_t cmd) {
+	int i;
+	get_bytes(8, rxBuffer); // Receive DES plaintext
+	//Copy the plaintext twice to perform two encryptions
+	for(i=0;i<8;i++){
+		rxBuffer[8+i]=rxBuffer[i];
+	}
+	BEGIN_INTERESTING_STUFF;
+	des(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
+	des(keyDES, rxBuffer+8, ENCRYPT); // Perform second software DES encryption
+	END_INTERESTING_STUFF;
+	//Compare the two encrypted texts; if same, transmit them, otherwise send nothing
+	if(memcmp(rxBuffer,rxBuffer+8, (unsigned int) 8)==0){
+		send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
+	}
+	else{
+		//Do not transmit anything
+	}
+}
 
-// Set GPIO Pin 2 to high.
-#define BEGIN_INTERESTING_STUFF GPIOC->BSRRL = GPIO_Pin_2
+//AES128 SW encryption with a double check (for Advanced FI DFA scenarios)
+static void cmd_swaes128_encrypt_doublecheck(uint8_t cmd) {
+	uint8_t decrypted_input[16];
+	get_bytes(16, rxBuffer); // Receive AES plaintext
 
-// Set GPIO Pin 2 to low.
-#define END_INTERESTING_STUFF GPIOC->BSRRH = GPIO_Pin_2
+	//Encrypt with textbook AES128 for easing the glitch
+	AES128_ECB_encrypt(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function after key expansion
+	//Decrypt with T-Tables AES for speed
+	rijndaelDecrypt(keyScheduleAESDec, 10, rxBuffer + AES128LENGTHINBYTES, decrypted_input); // Perform software AES decryption
 
-#ifdef VARIANT_PQC
-MlDsaState g_mldsa;
-MlKemState g_mlkem;
-void handle_mldsa_sign_start() {
+	//If decrypted txt is the same as the original txt, send the ciphertext; otherwise send nothing
+	if(memcmp(decrypted_input, rxBuffer, (unsigned int) 16)==0){
+		send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
+	}
+	else{
+		//Do not transmit anything
+	}
+}
+
+///// TRNG //////
+static void cmd_get_random_from_trng(uint8_t cmd) {
+	volatile uint32_t randomNumber;
+	//Get a random number
 	BEGIN_INTERESTING_STUFF;
+	randomNumber=entropy_get_word();
+	END_INTERESTING_STUFF;
+	send_char((randomNumber>>24)&0x000000FF); //MSB first
+	send_char((randomNumber>>16)&0x000000FF);
+	send_char((randomNumber>> 8)&0x000000FF);
+	send_char( randomNumber     &0x000000FF);
 }
-void handle_mldsa_sign_finish() {
+
+//Send stm32f4 chip UID via I/O interface
+static void cmd_uid_via_io(uint8_t cmd) {
+	BEGIN_INTERESTING_STUFF;
+	uint32_t uidBlock1 = STM32F4ID[0];
+	uint32_t uidBlock2 = STM32F4ID[1];
+	uint32_t uidBlock3 = STM32F4ID[2];
+	END_INTERESTING_STUFF;
+	send_char((uidBlock1>>24)&0x000000FF); //MSB first
+	send_char((uidBlock1>>16)&0x000000FF);
+	send_char((uidBlock1>> 8)&0x000000FF);
+	send_char( uidBlock1     &0x000000FF);
+	send_char((uidBlock2>>24)&0x000000FF); //MSB first
+	send_char((uidBlock2>>16)&0x000000FF);
+	send_char((uidBlock2>> 8)&0x000000FF);
+	send_char( uidBlock2     &0x000000FF);
+	send_char((uidBlock3>>24)&0x000000FF); //MSB first
+	send_char((uidBlock3>>16)&0x000000FF);
+	send_char((uidBlock3>> 8)&0x000000FF);
+	send_char( uidBlock3     &0x000000FF);
+}
+
+#endif // VARIANT_PQC
+
+//Code version command: returns code version string (8 bytes, "Ver x.x" ASCII encoded) on code revision 2.0 or higher, "BadCmd" on code revision 1.0
+static void cmd_get_code_rev(uint8_t cmd) {
+	send_bytes(8, codeVersion);
+}
+
+//Change clock speed on-the-fly and restart peripherals; predefined speeds are 16, 30, 84 and 168MHz. If parameter is not in this list, speed will be set to 168MHz by default.
+static void cmd_change_clk_speed(uint8_t cmd) {
+	uint8_t tmp = 0;
+	get_char(&tmp);
+	setClockSpeed(tmp);
+	send_char(clockspeed);
+}
+
+//Change clock source to external. The argument specifies whether the clock is used directly (value = 0), or through the PLL (value != 0)
+static void cmd_set_external_clock(uint8_t cmd) {
+	uint8_t tmp = 0;
+	get_char(&tmp);
+	setExternalClock(tmp);
+	send_char(clockSource);
+}
+
+//Switch the USART3 baud rate: acknowledge at the old rate, then keep the new rate only if the host confirms it in time
+static void cmd_set_baud_rate(uint8_t cmd) {
+	uint8_t tmp = 0;
+	uint32_t baudRate, achievedBaudRate;
+	get_bytes(4, rxBuffer); // Receive the baud rate, MSByte first
+	baudRate = ((uint32_t)rxBuffer[0] << 24) | ((uint32_t)rxBuffer[1] << 16) | ((uint32_t)rxBuffer[2] << 8) | rxBuffer[3];
+	achievedBaudRate = usart_achievable_baud_rate(baudRate);
+	rxBuffer[0] = achievedBaudRate >> 24; // Transmit back the rate USART3 will generate, MSByte first
+	rxBuffer[1] = achievedBaudRate >> 16;
+	rxBuffer[2] = achievedBaudRate >> 8;
+	rxBuffer[3] = achievedBaudRate;
+	send_bytes(4, rxBuffer);
+	flush_output();
+	if (achievedBaudRate == 0) {
+		return;
+	}
+	usart_set_baud_rate(baudRate);
+	if (!get_char_timeout(&tmp, BAUD_CONFIRM_TIMEOUT_MS) || tmp != BAUD_CONFIRM) {
+		usart_set_baud_rate(USART_DEFAULT_BAUDRATE); // The host did not follow: go back to where it starts
+		return;
+	}
+	send_char(BAUD_CONFIRM);
+}
+
+//Switch between the legacy protocol and framed mode, once this response is out
+static void cmd_set_protocol(uint8_t cmd) {
+	uint8_t tmp = 0;
+	get_char(&tmp);
+	set_protocol(tmp);
+	send_char(get_protocol());
+}
+
+//Raw TRNG output for statistical tests on the host, MSByte of every word first (see CMD_DUMP_TRNG)
+static void cmd_dump_trng(uint8_t cmd) {
+	uint8_t tmp = 0;
+	uint16_t nbytes = 0;
+	uint32_t randomNumber;
+	uint8_t word[4];
+	uint8_t n;
+
+	get_char(&tmp); // Receive the number of bytes, MSByte first
+	nbytes = tmp << 8;
+	get_char(&tmp);
+	nbytes |= tmp;
+	while (nbytes > 0) {
+		randomNumber = entropy_get_word();
+		word[0] = randomNumber >> 24;
+		word[1] = randomNumber >> 16;
+		word[2] = randomNumber >> 8;
+		word[3] = randomNumber;
+		n = nbytes < 4 ? nbytes : 4;
+		send_bytes(n, word);
+		nbytes -= n;
+	}
+}
+
+//List the commands of this build with their lengths and flags, in opcode order (see CMD_GET_COMMANDS)
+static void cmd_get_commands(uint8_t cmd) {
+	int i;
+	uint16_t count = 0;
+	uint8_t entry[6];
+
+	for (i = 0; i < 256; i++) {
+		if (commands[i].handler) {
+			count++;
+		}
+	}
+	send_char(count >> 8); // Transmit back the number of commands, MSByte first
+	send_char(count);
+	for (i = 0; i < 256; i++) {
+		if (!commands[i].handler) {
+			continue;
+		}
+		entry[0] = i;
+		entry[1] = commands[i].flags;
+		entry[2] = commands[i].inputLength >> 8;
+		entry[3] = commands[i].inputLength;
+		entry[4] = commands[i].outputLength >> 8;
+		entry[5] = commands[i].outputLength;
+		send_bytes(6, entry);
+	}
+}
+
+#ifdef PINATA_CYCLE_COUNT
+//CPU cycles of the last trigger window and the clock speed they were counted at
+static void cmd_get_last_cycles(uint8_t cmd) {
+	uint32_t cycles = triggerCycles;
+	uint8_t reply[5];
+
+	reply[0] = cycles >> 24; // MSByte first
+	reply[1] = cycles >> 16;
+	reply[2] = cycles >> 8;
+	reply[3] = cycles;
+	reply[4] = clockspeed;
+	send_bytes(5, reply);
+}
+#endif
+
+//The keys the host can set and their lengths: key or public key, and private key (0 for symmetric keys)
+typedef struct {
+	uint8_t cmd;
+	uint16_t keyLength;
+	uint16_t privateKeyLength;
+} key_size_t;
+
+static const key_size_t keySizes[] = {
+#ifdef VARIANT_PQC
+	{ CMD_SW_MLDSA_SET_PUBLIC_AND_PRIVATE_KEY, MLDSA_PUBLIC_KEY_SIZE, MLDSA_PRIVATE_KEY_SIZE },
+	{ CMD_SW_MLKEM_SET_PUBLIC_AND_PRIVATE_KEY, MLKEM_PUBLIC_KEY_SIZE, MLKEM_PRIVATE_KEY_SIZE },
+#else
+	{ CMD_SM4_KEYCHANGE, 16, 0 },
+	{ CMD_TEA_XTEA_KEYCHANGE, 16, 0 },
+	{ CMD_TDES_KEYCHANGE, 24, 0 },
+	{ CMD_DES_KEYCHANGE, 8, 0 },
+	{ CMD_AES128_KEYCHANGE, 16, 0 },
+	{ CMD_AES256_KEYCHANGE, 32, 0 },
+#endif
+};
+
+//Describe this firmware build in one reply: version, build flags, buffer limits, commands and key sizes (see CMD_GET_CAPABILITIES)
+static void cmd_get_capabilities(uint8_t cmd) {
+	int i;
+	uint16_t flags = 0;
+	uint8_t reply[CAPABILITIES_HEADER_LENGTH] = {};
+	uint8_t entry[5];
+
+#ifdef VARIANT_PQC
+	flags |= CAPABILITY_VARIANT_PQC;
+#endif
+#ifdef HW_CRYPTO_PRESENT
+	flags |= CAPABILITY_HW_CRYPTO;
+#endif
+#ifdef DILITHIUM_RANDOMIZED_SIGNING
+	flags |= CAPABILITY_RANDOM_SIGNING;
+#endif
+#ifdef PINATA_CYCLE_COUNT
+	flags |= CAPABILITY_CYCLE_COUNT;
+#endif
+#ifdef PINATA_HOST_SIMULATOR
+	flags |= CAPABILITY_HOST_SIMULATOR;
+#endif
+	reply[0] = FIRMWARE_VERSION_MAJOR;
+	reply[1] = FIRMWARE_VERSION_MINOR;
+	reply[2] = flags >> 8; // MSByte first, like all lengths below
+	reply[3] = flags;
+	reply[4] = USARTRXRINGLENGTH >> 8;
+	reply[5] = USARTRXRINGLENGTH & 0xFF;
+	reply[6] = FRAME_REQUEST_PAYLOAD_LENGTH >> 8;
+	reply[7] = FRAME_REQUEST_PAYLOAD_LENGTH & 0xFF;
+#ifndef VARIANT_PQC
+	reply[8] = BATCHBUFFERLENGTH >> 8;
+	reply[9] = BATCHBUFFERLENGTH & 0xFF;
+#endif
+	for (i = 0; i < 256; i++) {
+		if (commands[i].handler) {
+			reply[10 + i / 8] |= 1 << (i % 8);
+		}
+	}
+	reply[42] = sizeof(keySizes) / sizeof(keySizes[0]);
+	send_bytes(CAPABILITIES_HEADER_LENGTH, reply);
+	for (i = 0; i < reply[42]; i++) {
+		entry[0] = keySizes[i].cmd;
+		entry[1] = keySizes[i].keyLength >> 8;
+		entry[2] = keySizes[i].keyLength;
+		entry[3] = keySizes[i].privateKeyLength >> 8;
+		entry[4] = keySizes[i].privateKeyLength;
+		send_bytes(5, entry);
+	}
+}
+
+//Unknown command byte: return error or 4 times (0x90 0x00) if board was glitched during boot or an hex sequence if authenticated is set to AUTH_OK
+static void cmd_unknown(uint8_t cmd) {
+#ifdef VARIANT_PQC
+	send_bytes(8, cmdByteIsWrong);
+#else
+	int i;
+	BEGIN_INTERESTING_STUFF;
+	if (glitchedBoot) {
+		for (i = 0; i < 4; i++){
+			send_char(0x90);
+			send_char(0x00);
+		}
+	}
+	else if(authenticated==AUTH_OK){ //This will be the answer if the authenticated flag is set to AUTH_OK
+		send_char(0xC0);
+		send_char(0xBF);
+		send_char(0xEF);
+		send_char(0xEE);
+		send_char(0xBA);
+		send_char(0xDB);
+		send_char(0xAB);
+		send_char(0xEE);
+	}
+	else{
+		send_bytes(8, cmdByteIsWrong);
+	}
 	END_INTERESTING_STUFF;
+#endif // VARIANT_PQC
 }
+
+////////////////////////////////////////////////////////
+//COMMAND REGISTRY: handler, lengths and flags per byte//
+////////////////////////////////////////////////////////
+
+#define VAR COMMAND_LENGTH_VARIABLE
+#define TRIG COMMAND_TRIGGER
+#define BATCH (COMMAND_TRIGGER | COMMAND_BATCHABLE)
+#define BATCH_IN_PLACE (COMMAND_TRIGGER | COMMAND_BATCHABLE | COMMAND_IN_PLACE)
+
+const command_t commands[256] = {
+#ifdef VARIANT_PQC
+	[CMD_SW_MLDSA_GET_VARIANT]                = { cmd_sw_mldsa_get_variant, 0, 1, 0 },
+	[CMD_SW_MLDSA_SET_PUBLIC_AND_PRIVATE_KEY] = { cmd_sw_mldsa_set_public_and_private_key, MLDSA_PUBLIC_KEY_SIZE + MLDSA_PRIVATE_KEY_SIZE, 1, 0 },
+	[CMD_SW_MLDSA_VERIFY]                     = { cmd_sw_mldsa_verify, MLDSA_SIGNED_MESSAGE_SIZE, 1, TRIG },
+	[CMD_SW_MLDSA_SIGN]                       = { cmd_sw_mldsa_sign, MLDSA_MESSAGE_SIZE, VAR, TRIG },
+	[CMD_SW_MLDSA_GET_KEY_SIZES]              = { cmd_sw_mldsa_get_key_sizes, 0, 4, 0 },
+	[CMD_SW_MLDSA_NTT]                        = { cmd_sw_mldsa_ntt, 4 * MLDSA_N, 0, TRIG },
+	[CMD_SW_MLKEM_SET_PUBLIC_AND_PRIVATE_KEY] = { cmd_sw_mlkem_set_public_and_private_key, MLKEM_PUBLIC_KEY_SIZE + MLKEM_PRIVATE_KEY_SIZE, 1, 0 },
+	[CMD_SW_MLKEM_GENERATE]                   = { cmd_sw_mlkem_generate, 0, VAR, TRIG },
+	[CMD_SW_MLKEM_DEC]                        = { cmd_sw_mlkem_dec, MLKEM_CIPHERTEXT_SIZE, VAR, TRIG },
+	[CMD_SW_MLKEM_GET_KEY_SIZES]              = { cmd_sw_mlkem_get_key_sizes, 0, 4, 0 },
+#else // VARIANT_PQC
+	[CMD_SWDES_ENC]                    = { cmd_block, 8, 8, BATCH_IN_PLACE, block_swdes_enc },
+	[CMD_SWDES_DEC]                    = { cmd_block, 8, 8, BATCH_IN_PLACE, block_swdes_dec },
+	[CMD_SWTDES_ENC]                   = { cmd_block, 8, 8, BATCH_IN_PLACE, block_swtdes_enc },
+	[CMD_SWTDES_DEC]                   = { cmd_block, 8, 8, BATCH_IN_PLACE, block_swtdes_dec },
+	[CMD_SWAES128_ENC]                 = { cmd_block, 16, 16, BATCH, block_swaes128_enc },
+	[CMD_SWAES128SPI_ENC]              = { cmd_swaes128spi_enc, 16, 16, 0 },
+	[CMD_SWAES128_DEC]                 = { cmd_block, 16, 16, BATCH, block_swaes128_dec },
+	[CMD_SWAES128_SET_KEY_EXPANSION]   = { cmd_swaes128_set_key_expansion, 1, 1, 0 },
+	[CMD_SWAES256_ENC]                 = { cmd_block, 16, 16, BATCH_IN_PLACE, block_swaes256_enc },
+	[CMD_SWAES256_DEC]                 = { cmd_block, 16, 16, BATCH_IN_PLACE, block_swaes256_dec },
+	[CMD_SWSM4_ENC]                    = { cmd_block, 16, 16, BATCH_IN_PLACE, block_swsm4_enc },
+	[CMD_SWSM4_DEC]                    = { cmd_block, 16, 16, BATCH_IN_PLACE, block_swsm4_dec },
+	[CMD_SWSM4OSSL_ENC]                = { cmd_swsm4ossl_enc, 16, 16, TRIG },
+	[CMD_SWSM4OSSL_DEC]                = { cmd_swsm4ossl_dec, 16, 16, TRIG },
+	[CMD_SWDES_ENC_MISALIGNED]         = { cmd_swdes_enc_misaligned, 8, 8, TRIG },
+	[CMD_SWAES128_ENC_MISALIGNED]      = { cmd_swaes128_enc_misaligned, 16, 16, TRIG },
+	[CMD_SWDES_ENC_DUMMYROUNDS]        = { cmd_swdes_enc_dummyrounds, 8, 8, TRIG },
+	[CMD_SWAES128_ENC_DUMMYROUNDS]     = { cmd_swaes128_enc_dummyrounds, 16, 16, TRIG },
+	[CMD_SWTEA_ENC]                    = { cmd_swtea_enc, 8, 8, TRIG },
+	[CMD_SWTEA_DEC]                    = { cmd_swtea_dec, 8, 8, TRIG },
+	[CMD_SWXTEA_ENC]                   = { cmd_swxtea_enc, 8, 8, TRIG },
+	[CMD_SWXTEA_DEC]                   = { cmd_swxtea_dec, 8, 8, TRIG },
+	[CMD_SWDES_ENC_RND_SBOX]           = { cmd_swdes_enc_rnd_sbox, 8, 8, TRIG },
+	[CMD_SWDES_ENC_RND_DELAYS]         = { cmd_swdes_enc_rnd_delays, 8, 8, TRIG },
+	[CMD_SWAES128_ENC_MASKED]          = { cmd_block, 16, 16, BATCH, block_swaes128_enc_masked },
+	[CMD_SWAES128_DEC_MASKED]          = { cmd_block, 16, 16, BATCH, block_swaes128_dec_masked },
+	[CMD_SWAES128_SET_MASK_REFRESH]    = { cmd_swaes128_set_mask_refresh, 2, 2, 0 },
+	[CMD_SWAES128_ENC_RNDDELAYS]       = { cmd_block, 16, 16, BATCH, block_swaes128_enc_rnddelays },
+	[CMD_SWAES128_ENC_RNDSBOX]         = { cmd_block, 16, 16, BATCH, block_swaes128_enc_rndsbox },
+	[CMD_RSACRT1024_DEC]               = { cmd_rsacrt1024_dec, VAR, VAR, TRIG },
+	[CMD_SWAES128TTABLES_ENC]          = { cmd_block, 16, 16, BATCH, block_swaes128ttables_enc },
+	[CMD_SWAES128TTABLES_DEC]          = { cmd_block, 16, 16, BATCH, block_swaes128ttables_dec },
+	[CMD_SWAES128TTABLESASM_ENC]       = { cmd_block, 16, 16, BATCH, block_swaes128ttablesasm_enc },
+	[CMD_SWAES128TTABLESASM_SRAM_ENC]  = { cmd_block, 16, 16, BATCH, block_swaes128ttablesasm_sram_enc },
+	[CMD_SWAES128TTABLESASM_DEC]       = { cmd_block, 16, 16, BATCH, block_swaes128ttablesasm_dec },
+	[CMD_SWAES128TTABLESASM_SRAM_DEC]  = { cmd_block, 16, 16, BATCH, block_swaes128ttablesasm_sram_dec },
+	[CMD_SWAES128FIXSLICED_ENC]        = { cmd_block, 32, 32, BATCH_IN_PLACE, block_swaes128fixsliced_enc },
+	[CMD_SWAES128FIXSLICED_DEC]        = { cmd_block, 32, 32, BATCH_IN_PLACE, block_swaes128fixsliced_dec },
+	[CMD_RSASFM_GET_HARDCODED_KEY]     = { cmd_rsasfm_get_hardcoded_key, 0, VAR, 0 },
+	[CMD_RSASFM_SET_D]                 = { cmd_rsasfm_set_d, VAR, 1, 0 },
+	[CMD_RSASFM_DEC]                   = { cmd_rsasfm_dec, VAR, VAR, TRIG },
+	[CMD_RSASFM_SET_KEY_GENERATION_METHOD] = { cmd_rsasfm_set_key_generation_method, 1, 1, 0 },
+	[CMD_RSASFM_SET_IMPLEMENTATION]    = { cmd_rsasfm_set_implementation, 1, 1, 0 },
+#ifndef PINATA_HOST_SIMULATOR
+	[CMD_ECC25519_SCALAR_MULT]         = { cmd_ecc25519_scalar_mult, 96, 32, TRIG },
+#else
+	[CMD_ECC25519_SCALAR_MULT]         = { cmd_ecc25519_scalar_mult, 96, 8, 0 },
+#endif
+	[CMD_BATCH]                        = { cmd_batch, VAR, VAR, TRIG },
+	[CMD_BATCH_SEEDED]                 = { cmd_batch, 5 + 1 + XOSHIRO128_SEED_LEN_BYTES, VAR, TRIG },
+	[CMD_PRESENT80_ENC]                = { cmd_block, 8, 8, BATCH, block_present80_enc },
+	[CMD_PRESENT80_DEC]                = { cmd_block, 8, 8, BATCH, block_present80_dec },
+	[CMD_PRESENT128_ENC]               = { cmd_block, 8, 8, BATCH, block_present128_enc },
+	[CMD_PRESENT128_DEC]               = { cmd_block, 8, 8, BATCH, block_present128_dec },
+#endif // VARIANT_PQC
+
+#ifndef HW_CRYPTO_PRESENT
+	//Without the HW crypto processor these reply zeroes, without a trigger
+	[CMD_HWAES128_ENC]                 = { cmd_hwaes_unavailable, 16, 16, 0 },
+	[CMD_HWAES128_DEC]                 = { cmd_hwaes_unavailable, 16, 16, 0 },
+	[CMD_HWAES256_ENC]                 = { cmd_hwaes_unavailable, 16, 16, 0 },
+	[CMD_HWAES256_DEC]                 = { cmd_hwaes_unavailable, 16, 16, 0 },
+	[CMD_HWDES_ENC]                    = { cmd_hwdes_unavailable, 8, 8, 0 },
+	[CMD_HWDES_DEC]                    = { cmd_hwdes_unavailable, 8, 8, 0 },
+	[CMD_HWTDES_ENC]                   = { cmd_hwdes_unavailable, 8, 8, 0 },
+	[CMD_HWTDES_DEC]                   = { cmd_hwdes_unavailable, 8, 8, 0 },
+	[CMD_SHA1_HASH]                    = { cmd_sha1_hash, 20, 20, 0 },
+	[CMD_HMAC_SHA1]                    = { cmd_hmac_sha1, 24, 20, 0 },
+	[CMD_MD5_HASH]                     = { cmd_md5_hash, VAR, 16, 0 },
+#else
+	[CMD_HWAES128_ENC]                 = { cmd_hwaes128_enc, 16, 16, TRIG },
+	[CMD_HWAES128_DEC]                 = { cmd_hwaes128_dec, 16, 16, TRIG },
+	[CMD_HWAES256_ENC]                 = { cmd_hwaes256_enc, 16, 16, TRIG },
+	[CMD_HWAES256_DEC]                 = { cmd_hwaes256_dec, 16, 16, TRIG },
+	[CMD_HWDES_ENC]                    = { cmd_hwdes_enc, 8, 8, TRIG },
+	[CMD_HWDES_DEC]                    = { cmd_hwdes_dec, 8, 8, TRIG },
+	[CMD_HWTDES_ENC]                   = { cmd_hwtdes_enc, 8, 8, TRIG },
+	[CMD_HWTDES_DEC]                   = { cmd_hwtdes_dec, 8, 8, TRIG },
+	[CMD_HMAC_SHA1]                    = { cmd_hmac_sha1, 24, 20, TRIG },
+	[CMD_SHA1_HASH]                    = { cmd_sha1_hash, 20, 20, TRIG },
+	[CMD_MD5_HASH]                     = { cmd_md5_hash, VAR, 16, TRIG },
+#endif
+
+#ifndef VARIANT_PQC
+	[CMD_TDES_KEYCHANGE]               = { cmd_tdes_keychange, 24, 24, TRIG },
+	[CMD_DES_KEYCHANGE]                = { cmd_des_keychange, 8, 8, TRIG },
+	[CMD_TEA_XTEA_KEYCHANGE]           = { cmd_tea_xtea_keychange, 16, 16, TRIG },
+	[CMD_AES128_KEYCHANGE]             = { cmd_aes128_keychange, 16, 16, TRIG },
+	[CMD_AES256_KEYCHANGE]             = { cmd_aes256_keychange, 32, 32, TRIG },
+	[CMD_PWD_CHANGE]                   = { cmd_pwd_change, 4, 4, TRIG },
+	[CMD_SM4_KEYCHANGE]                = { cmd_sm4_keychange, 16, 16, TRIG },
+	[CMD_SOFTWARE_KEY_COPY]            = { cmd_software_key_copy, 16, 16, TRIG },
+	[CMD_INFINITE_FI_LOOP]             = { cmd_infinite_fi_loop, 0, 8, TRIG },
+	[CMD_LOOP_TEST_FI]                 = { cmd_loop_test_fi, 2, 6, TRIG },
+	[CMD_SINGLE_PWD_CHECK_FI]          = { cmd_single_pwd_check_fi, 4, 2, TRIG },
+	[CMD_DOUBLE_PWD_CHECK_FI]          = { cmd_double_pwd_check_fi, 4, 2, TRIG },
+	[CMD_SWDES_ENCRYPT_DOUBLECHECK]    = { cmd_swdes_encrypt_doublecheck, 8, VAR, TRIG },
+	[CMD_SWAES128_ENCRYPT_DOUBLECHECK] = { cmd_swaes128_encrypt_doublecheck, 16, VAR, TRIG },
+	[CMD_GET_RANDOM_FROM_TRNG]         = { cmd_get_random_from_trng, 0, 4, TRIG },
+	[CMD_UID_VIA_IO]                   = { cmd_uid_via_io, 0, 12, TRIG },
+#endif // VARIANT_PQC
+
+	[CMD_GET_CODE_REV]                 = { cmd_get_code_rev, 0, 8, 0 },
+	[CMD_CHANGE_CLK_SPEED]             = { cmd_change_clk_speed, 1, 1, 0 },
+	[CMD_SET_EXTERNAL_CLOCK]           = { cmd_set_external_clock, 1, 1, 0 },
+	[CMD_SET_BAUD_RATE]                = { cmd_set_baud_rate, 4, VAR, 0 },
+	[CMD_SET_PROTOCOL]                 = { cmd_set_protocol, 1, 1, 0 },
+	[CMD_GET_COMMANDS]                 = { cmd_get_commands, 0, VAR, 0 },
+	[CMD_DUMP_TRNG]                    = { cmd_dump_trng, 2, VAR, 0 },
+	[CMD_GET_CAPABILITIES]             = { cmd_get_capabilities, 0, VAR, 0 },
+#ifdef PINATA_CYCLE_COUNT
+	[CMD_GET_LAST_CYCLES]              = { cmd_get_last_cycles, 0, 5, 0 },
 #endif
+};
+
+#undef VAR
+#undef TRIG
+#undef BATCH
+#undef BATCH_IN_PLACE
 
 ////////////////////////////////////////////////////
 //MAIN FUNCTION: entry point for the board program//
 ////////////////////////////////////////////////////
 int main(void) {
 	uint8_t cmd;
-	uint8_t tmp;
 
 #ifdef VARIANT_PQC
 	PINATA_PATCH_mldsa_set_sign_start_callback(&handle_mldsa_sign_start);
 	PINATA_PATCH_mldsa_set_sign_finish_callback(&handle_mldsa_sign_finish);
 #else
-	int payload_len, i, glitchedBoot, authenticated, counter=0;
-	ErrorStatus cryptoCompletedOK=ERROR;
-	//We will need ROUNDS + 1 keys to be generated by the key schedule (multiplied by 4 because we can only store 32 bits at a time).
-	uint32_t keyScheduleAES[(MAXAESROUNDS + 1) * 4] = { };
-	uint8_t keyDES[8];
-	uint8_t keyTDES[24];
-	uint8_t keyAES[16];
-	uint8_t keyLoadingAES[16];
-	uint8_t keyAES256[32];
-	uint8_t keySM4[16];
-	uint8_t password[4];
-	uint8_t keyPRESENT80[10];
-	uint8_t keyPRESENT128[16];
-	aes256_context ctx;
-	sm4_ctx ctx_sm4;
-	SM4_KEY ctx_sm4_ossl;
-	uint32_t keyTEAXTEA[4];
-	uint32_t teaxteaInOut[2];
-	//ANSSI AES support structures
-	//volatile STRUCT_AES aes_struct,aes_struct_2; //Allocated another structure just in case there is some ASM overflow (seems like it)
-	//volatile uint8_t randoms_keyScheduling[20];
-	//volatile uint8_t randoms_AESoperations[20];
-
+	int i, counter=0;
 #endif // VARIANT_PQC
 
 	//Set up the system clocks
@@ -226,1309 +1970,42 @@ int main(void) {
 	//Ver 2.0 and later: init code updates after initial code (to keep similar timing for boot glitching from code version 1.0)
 	for (i = 0; i < 32; i++) keyAES256[i] = defaultKeyAES256[i];
 	aes256_init(&ctx,keyAES256); //Prepare AES key schedule for software AES256
+	setup_aes128_key_schedules(); //Prepare the AES128 key schedules of the software implementations
+	aes_ttable_init(); //Copy the single T-table AES tables to SRAM
 	for (i = 0; i < 16; i++) keySM4[i] = defaultKeySM4[i];
 	for (i = 0; i < 4; i++) keyTEAXTEA[i] = defaultKeyTEAXTEA[i];
+	for (i = 0; i < 10; i++) keyPRESENT80[i] = defaultKeyPRESENT80[i];
+	for (i = 0; i < 16; i++) keyPRESENT128[i] = defaultKeyPRESENT128[i];
 
 #endif
 
+	//Start filling the entropy pool of the countermeasures, after the boot-glitch loop so that its interrupts do not
+	//land in there
+	entropy_init();
+
 	//////////////////////
 	//MAIN FUNCTION LOOP//
 	//////////////////////
 
 	while (1) {
 		cmd=0;
-		tmp=0;
 
 #ifndef VARIANT_PQC
 
 		//Main loop variable (re)initialization
 		for (i = 0; i < RXBUFFERLENGTH; i++) rxBuffer[i] = 0; //Zero the rxBuffer
-		for (i = 0; i < MAXAESROUNDS; i++) keyScheduleAES[i] = 0; //Zero the AES key schedule (T-tables AES implementation)
-		payload_len = 0x0000; //RSA: Length of the ciphertext; init to zero, expected values for 1024bit RSA=128byte, 512bit RSA=64byte
-		teaxteaInOut[0]=0x00000000;teaxteaInOut[1]=0x00000000;
-
-#endif // VARIANT_PQC
-
-		//Main processing section: select and execute cipher&mode
-		get_char(&cmd);
-		switch (cmd) {
-			/////////Software crypto commands/////////
-
-#ifdef VARIANT_PQC
-
-			case CMD_SW_MLDSA_GET_VARIANT:
-				// Return the response.
-				send_char(getMlDsaAlgorithmVariant());
-				break;
-
-			case CMD_SW_MLDSA_SET_PUBLIC_AND_PRIVATE_KEY: {
-				// Receive the input parameters and handle the request.
-				get_bytes(MLDSA_PUBLIC_KEY_SIZE, MlDsaState_getPublicKey(&g_mldsa));
-				get_bytes(MLDSA_PRIVATE_KEY_SIZE, MlDsaState_getPrivateKey(&g_mldsa));
-
-				// Return the response.
-				send_char(0);
-				break;
-			}
-
-			case CMD_SW_MLDSA_VERIFY: {
-				// Receive the input parameters.
-				uint8_t* signedMessageBuffer = MlDsaState_getScratchPad(&g_mldsa);
-				get_bytes(MLDSA_SIGNED_MESSAGE_SIZE, signedMessageBuffer);
-
-				// Handle the request.
-				BEGIN_INTERESTING_STUFF;
-				int result = MlDsaState_verify(&g_mldsa, signedMessageBuffer);
-				END_INTERESTING_STUFF;
-
-				// Return the response.
-				send_char(result == 0 ? 0 : 1);
-				break;	
-			}
-
-			case CMD_SW_MLDSA_SIGN: {
-				// Receive the input parameters.
-				uint8_t* signedMessageBuffer = MlDsaState_getScratchPad(&g_mldsa);
-				get_bytes(MLDSA_MESSAGE_SIZE, signedMessageBuffer + MLDSA_SIGNATURE_SIZE);
-
-				// Handle the request.
-				// Note: GPIO Pin 2 is set to high somewhere inside the sign function with callbacks.
-				int result = MlDsaState_sign(&g_mldsa, signedMessageBuffer, signedMessageBuffer + MLDSA_SIGNATURE_SIZE);
-
-				if (result == 0) {
-					// OK: The message is now signed, let's send the signature of the message back.
-					send_char(0);
-					send_bytes(MLDSA_SIGNATURE_SIZE, signedMessageBuffer);
-				} else {
-					// ERROR: Signing the message failed.
-					send_char(1);
-				}
-				break;
-			}
-
-			case CMD_SW_MLDSA_GET_KEY_SIZES: {
-				const uint16_t publicKeySize = MLDSA_PUBLIC_KEY_SIZE;
-				const uint16_t privateKeySize = MLDSA_PRIVATE_KEY_SIZE;
-				// Send the response; MUST be in little-endian order!
-				send_bytes(sizeof(publicKeySize), (const uint8_t*)&publicKeySize);
-				send_bytes(sizeof(privateKeySize), (const uint8_t*)&privateKeySize);
-				break;
-			}
-
-			case CMD_SW_MLDSA_NTT: {
-				int32_t polynomialBuffer[MLDSA_N];
-				// Receive the polynomial coefficients.
-				get_bytes(sizeof(int32_t)*MLDSA_N, (uint8_t*)polynomialBuffer);
-				BEGIN_INTERESTING_STUFF;
-				MlDsa_ntt(polynomialBuffer);
-				END_INTERESTING_STUFF;
-				// No reply is sent.
-				break;
-			}
-
-			case CMD_SW_MLKEM_SET_PUBLIC_AND_PRIVATE_KEY: {
-				// Receive the input parameters and handle the request.
-				get_bytes(MLKEM_PUBLIC_KEY_SIZE, MlKemState_getPublicKey(&g_mlkem));
-				get_bytes(MLKEM_PRIVATE_KEY_SIZE, MlKemState_getPrivateKey(&g_mlkem));
-				// Return the response.
-				send_char(0);
-				break;
-			}
-
-			case CMD_SW_MLKEM_GENERATE: {
-				// Generate a shared secret and an accompanying key encapsulation message.
-				BEGIN_INTERESTING_STUFF;
-				int result = MlKemState_generate(&g_mlkem);
-				END_INTERESTING_STUFF;
-				if (result == 0) {
-					// OK: The shared secret is now generated and encapsulated, let's send that back.
-					send_char(0);
-					send_bytes(MLKEM_SHARED_SECRET_SIZE, MlKemState_getSharedSecretBuffer(&g_mlkem));
-					send_bytes(MLKEM_CIPHERTEXT_SIZE, MlKemState_getKeyEncapsulationMessageBuffer(&g_mlkem));
-				} else {
-					// ERROR: Generation failed.
-					send_char(1);
-				}
-				break;
-			}
-
-			case CMD_SW_MLKEM_DEC: {
-				// Receive the key encapsulation message that we are supposed to decode.
-				get_bytes(MLKEM_CIPHERTEXT_SIZE, MlKemState_getKeyEncapsulationMessageBuffer(&g_mlkem));
-				memset(MlKemState_getSharedSecretBuffer(&g_mlkem), 0, MLKEM_SHARED_SECRET_SIZE);
-				// Decode the key encapsulation message into a shared secret.
-				BEGIN_INTERESTING_STUFF;
-				int result = MlKemState_decode(&g_mlkem);
-				END_INTERESTING_STUFF;
-				if (result == 0) {
-					// OK: The shared secret is decoded, let's send that back.
-					send_char(0);
-					send_bytes(MLKEM_SHARED_SECRET_SIZE, MlKemState_getSharedSecretBuffer(&g_mlkem));
-				} else {
-					// ERROR: Decoding the shared secret failed.
-					send_char(1);
-				}
-				break;
-			}
-
-			case CMD_SW_MLKEM_GET_KEY_SIZES: {
-				const uint16_t publicKeySize = MLKEM_PUBLIC_KEY_SIZE;
-				const uint16_t privateKeySize = MLKEM_PRIVATE_KEY_SIZE;
-				// Send the response; MUST be in little-endian order!
-				send_bytes(sizeof(publicKeySize), (const uint8_t*)&publicKeySize);
-				send_bytes(sizeof(privateKeySize), (const uint8_t*)&privateKeySize);
-				break;
-			}
-
-#else // VARIANT_PQC
-
-			//Software DES - encrypt
-			case CMD_SWDES_ENC:
-				get_bytes(8, rxBuffer); // Receive DES plaintext
-				BEGIN_INTERESTING_STUFF;
-				des(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			//Software DES - decrypt
-			case CMD_SWDES_DEC:
-				get_bytes(8, rxBuffer); // Receive DES ciphertext
-				BEGIN_INTERESTING_STUFF;
-				des(keyDES, rxBuffer, DECRYPT); // Perform software DES decryption
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer); // TransmiDt back plaintext via UART
-				break;
-
-			//Software TDES - encrypt
-			case CMD_SWTDES_ENC:
-				get_bytes(8, rxBuffer); // Receive TDES plaintext
-				BEGIN_INTERESTING_STUFF;
-				des(keyTDES,   rxBuffer, ENCRYPT); // Perform software DES encryption, key1
-				des(keyTDES+8, rxBuffer, DECRYPT); // Perform software DES decryption, key2
-				des(keyTDES+16,rxBuffer, ENCRYPT); // Perform software DES encryption, key3
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			//Software TDES - decrypt
-			case CMD_SWTDES_DEC:
-				get_bytes(8, rxBuffer); // Receive TDES ciphertext
-				BEGIN_INTERESTING_STUFF;
-				des(keyTDES,   rxBuffer, DECRYPT); // Perform software DES decryption, key1
-				des(keyTDES+8, rxBuffer, ENCRYPT); // Perform software DES encryption, key2
-				des(keyTDES+16,rxBuffer, DECRYPT); // Perform software DES decryption, key3
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer); // Transmit back plaintext via UART
-				break;
-
-			//Software AES128 - encrypt
-			case CMD_SWAES128_ENC:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				AES128_ECB_encrypt(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function after key expansion
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				break;
-
-			//Software AES128 - encrypt with SPI transmission at beginning, NO TRIGGER ON PC2
-			case CMD_SWAES128SPI_ENC:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				//4 byte SPI transmission to simulate access to e.g. external FLASH; sending 0xDECAFFED
-				send_OLEDcmd_SPI(0xDE);
-				send_OLEDcmd_SPI(0xCA);
-				send_OLEDcmd_SPI(0xFF);
-				send_OLEDcmd_SPI(0xED);
-				AES128_ECB_encrypt_noTrigger(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES);
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				break;
-
-			//Software AES128 - decrypt
-			case CMD_SWAES128_DEC:
-				get_bytes(16, rxBuffer); // Receive AES ciphertext
-				AES128_ECB_decrypt(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function after key expansion
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back plaintext via UART
-				break;
-			/*
-			//Software AES128 ANSSI masked implementation, random numbers from TRNG - encrypt
-			case CMD_ANSSIAES128_ENC:
-				get_bytes(16, rxBuffer); // Receive AES plain
-				RNG_Enable();
-				fillBufferWithRandomNumbers(19, randoms_AESoperations);
-				fillBufferWithRandomNumbers(19, randoms_keyScheduling);
-				RNG_Disable();
-				//Implementation seems broken; sometimes outputs wrong ciphertexts (which is weird)
-				tmp32=anssiaes(MODE_KEYINIT|MODE_AESINIT_ENC|MODE_RANDOM_AES_EXT|MODE_RANDOM_KEY_EXT, &aes_struct, keyAES, 0, 0, randoms_AESoperations, randoms_keyScheduling);
-				tmp32|=anssiaes(MODE_ENC, &aes_struct, 0, rxBuffer, rxBuffer + AES128LENGTHINBYTES, 0, 0);
-				if(tmp32!=NO_ERROR){
-					send_bytes(16, zeros); // Error: transmit zeroes
-				}
-				else {
-					send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back plaintext via UART
-				}
-
-				break;
-
-			//Software AES128 ANSSI masked implementation, random numbers from TRNG - decrypt
-			case CMD_ANSSIAES128_DEC:
-				get_bytes(16, rxBuffer); // Receive AES ciphertext
-				RNG_Enable();
-				fillBufferWithRandomNumbers(19, randoms_AESoperations);
-				fillBufferWithRandomNumbers(19, randoms_keyScheduling);
-				RNG_Disable();
-				//Implementation seems broken
-				tmp32=anssiaes(MODE_KEYINIT|MODE_AESINIT_DEC|MODE_RANDOM_AES_EXT|MODE_RANDOM_KEY_EXT, &aes_struct, keyAES, 0, 0, randoms_AESoperations, randoms_keyScheduling);
-				tmp32|=anssiaes(MODE_DEC, &aes_struct, 0, rxBuffer, rxBuffer + AES128LENGTHINBYTES, 0, 0);
-				if(tmp32!=NO_ERROR){
-					send_bytes(16, zeros); // Error: transmit zeroes
-				}
-				else {
-					send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back plaintext via UART
-				}
-				break;
-			*/
-			//Software AES256 - encrypt
-			case CMD_SWAES256_ENC:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				BEGIN_INTERESTING_STUFF;
-				aes256_encrypt_ecb(&ctx, rxBuffer); // Perform software AES256 encryption
-				END_INTERESTING_STUFF;
-				send_bytes(16, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			//Software AES256 - decrypt
-			case CMD_SWAES256_DEC:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				BEGIN_INTERESTING_STUFF;
-				aes256_decrypt_ecb(&ctx, rxBuffer); // Perform software AES256 encryption
-				END_INTERESTING_STUFF;
-				send_bytes(16, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			//Software SM4 - encrypt
-			case CMD_SWSM4_ENC:
-				get_bytes(16, rxBuffer); // Receive SM4 plaintext
-				sm4_setkey(&ctx_sm4, keySM4, SM4_ENCRYPT); //Configure SM4 key schedule for encryption
-				BEGIN_INTERESTING_STUFF;
-				sm4_encrypt(&ctx_sm4,rxBuffer); //Perform SM4 crypto
-				END_INTERESTING_STUFF;
-				send_bytes(16, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			//Software SM4 - decrypt
-			case CMD_SWSM4_DEC:
-				get_bytes(16, rxBuffer); // Receive SM4 ciphertext
-				sm4_setkey(&ctx_sm4, keySM4, SM4_DECRYPT); //Configure SM4 key schedule for decryption
-				BEGIN_INTERESTING_STUFF;
-				sm4_encrypt(&ctx_sm4,rxBuffer); //Perform SM4 crypto
-				END_INTERESTING_STUFF;
-				send_bytes(16, rxBuffer); // Transmit back plaintext via UART
-				break;
-
-			//Software SM4 OpenSSL implementation- encrypt
-			case CMD_SWSM4OSSL_ENC:
-				get_bytes(16, rxBuffer); // Receive SM4 plaintext
-				SM4_set_key(keySM4, &ctx_sm4_ossl); //Configure SM4 key schedule
-				BEGIN_INTERESTING_STUFF;
-				SM4_encrypt(rxBuffer,rxBuffer+SM4_BLOCK_SIZE,&ctx_sm4_ossl); //Perform SM4 encryption (openSSL code)
-				END_INTERESTING_STUFF;
-				send_bytes(16, rxBuffer+SM4_BLOCK_SIZE); // Transmit back ciphertext via UART
-				break;
-
-			//Software SM4 OpenSSL implementation - decrypt
-			case CMD_SWSM4OSSL_DEC:
-				get_bytes(16, rxBuffer); // Receive SM4 plaintext
-				SM4_set_key(keySM4, &ctx_sm4_ossl); //Configure SM4 key schedule
-				BEGIN_INTERESTING_STUFF;
-				SM4_decrypt(rxBuffer,rxBuffer+SM4_BLOCK_SIZE,&ctx_sm4_ossl); //Perform SM4 decryption (openSSL code)
-				END_INTERESTING_STUFF;
-				send_bytes(16, rxBuffer+SM4_BLOCK_SIZE); // Transmit back ciphertext via UART
-				break;
-
-			//Software DES - encrypt with misalignment at beginning of trigger (to practice static align)
-			case CMD_SWDES_ENC_MISALIGNED:
-				get_bytes(8, rxBuffer); // Receive DES plaintext
-				BEGIN_INTERESTING_STUFF;
-				desMisaligned(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			case CMD_SWAES128_ENC_MISALIGNED:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				AES128_ECB_encrypt_misaligned(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function after key expansion
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				break;
-
-			//Software DES - encrypt with dummy rounds
-			case CMD_SWDES_ENC_DUMMYROUNDS:
-				get_bytes(8, rxBuffer); // Receive DES plaintext
-				BEGIN_INTERESTING_STUFF;
-				desDummy(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			case CMD_SWAES128_ENC_DUMMYROUNDS:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				AES128_ECB_encrypt_dummy(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function after key expansion
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				break;
-
-			case CMD_SWTEA_ENC:
-				get_bytes(8, rxBuffer); // Receive TEA plaintext
-				teaxteaInOut[0]= rxBuffer[3] | (rxBuffer[2] << 8) | (rxBuffer[1] << 16) | (rxBuffer[0] << 24);
-				teaxteaInOut[1]= rxBuffer[7] | (rxBuffer[6] << 8) | (rxBuffer[5] << 16) | (rxBuffer[4] << 24);
-				BEGIN_INTERESTING_STUFF;
-				tea_encrypt(teaxteaInOut,keyTEAXTEA); //32 rounds (32 cycles as named in TEA)
-				END_INTERESTING_STUFF;
-				send_char((teaxteaInOut[0]>>24)&0x000000FF); //MSB first
-				send_char((teaxteaInOut[0]>>16)&0x000000FF);
-				send_char((teaxteaInOut[0]>> 8)&0x000000FF);
-				send_char( teaxteaInOut[0]     &0x000000FF);
-				send_char((teaxteaInOut[1]>>24)&0x000000FF); //MSB first
-				send_char((teaxteaInOut[1]>>16)&0x000000FF);
-				send_char((teaxteaInOut[1]>> 8)&0x000000FF);
-				send_char( teaxteaInOut[1]     &0x000000FF);
-				break;
-
-			case CMD_SWTEA_DEC:
-				get_bytes(8, rxBuffer); // Receive TEA plaintext
-				teaxteaInOut[0]= rxBuffer[3] | (rxBuffer[2] << 8) | (rxBuffer[1] << 16) | (rxBuffer[0] << 24);
-				teaxteaInOut[1]= rxBuffer[7] | (rxBuffer[6] << 8) | (rxBuffer[5] << 16) | (rxBuffer[4] << 24);
-				BEGIN_INTERESTING_STUFF;
-				tea_decrypt(teaxteaInOut,keyTEAXTEA); //32 rounds (32 cycles as named in TEA)
-				END_INTERESTING_STUFF;
-				send_char((teaxteaInOut[0]>>24)&0x000000FF); //MSB first
-				send_char((teaxteaInOut[0]>>16)&0x000000FF);
-				send_char((teaxteaInOut[0]>> 8)&0x000000FF);
-				send_char( teaxteaInOut[0]     &0x000000FF);
-				send_char((teaxteaInOut[1]>>24)&0x000000FF); //MSB first
-				send_char((teaxteaInOut[1]>>16)&0x000000FF);
-				send_char((teaxteaInOut[1]>> 8)&0x000000FF);
-				send_char( teaxteaInOut[1]     &0x000000FF);
-				break;
-
-			case CMD_SWXTEA_ENC:
-				get_bytes(8, rxBuffer); // Receive TEA plaintext
-				teaxteaInOut[0]= rxBuffer[3] | (rxBuffer[2] << 8) | (rxBuffer[1] << 16) | (rxBuffer[0] << 24);
-				teaxteaInOut[1]= rxBuffer[7] | (rxBuffer[6] << 8) | (rxBuffer[5] << 16) | (rxBuffer[4] << 24);
-				BEGIN_INTERESTING_STUFF;
-				xtea_encrypt(teaxteaInOut,keyTEAXTEA); //32 rounds (32 cycles as named in TEA)
-				END_INTERESTING_STUFF;
-				send_char((teaxteaInOut[0]>>24)&0x000000FF); //MSB first
-				send_char((teaxteaInOut[0]>>16)&0x000000FF);
-				send_char((teaxteaInOut[0]>> 8)&0x000000FF);
-				send_char( teaxteaInOut[0]     &0x000000FF);
-				send_char((teaxteaInOut[1]>>24)&0x000000FF); //MSB first
-				send_char((teaxteaInOut[1]>>16)&0x000000FF);
-				send_char((teaxteaInOut[1]>> 8)&0x000000FF);
-				send_char( teaxteaInOut[1]     &0x000000FF);
-				break;
-
-			case CMD_SWXTEA_DEC:
-				get_bytes(8, rxBuffer); // Receive TEA plaintext
-				teaxteaInOut[0]= rxBuffer[3] | (rxBuffer[2] << 8) | (rxBuffer[1] << 16) | (rxBuffer[0] << 24);
-				teaxteaInOut[1]= rxBuffer[7] | (rxBuffer[6] << 8) | (rxBuffer[5] << 16) | (rxBuffer[4] << 24);
-				BEGIN_INTERESTING_STUFF;
-				xtea_decrypt(teaxteaInOut,keyTEAXTEA); //32 rounds (32 cycles as named in TEA)
-				END_INTERESTING_STUFF;
-				send_char((teaxteaInOut[0]>>24)&0x000000FF); //MSB first
-				send_char((teaxteaInOut[0]>>16)&0x000000FF);
-				send_char((teaxteaInOut[0]>> 8)&0x000000FF);
-				send_char( teaxteaInOut[0]     &0x000000FF);
-				send_char((teaxteaInOut[1]>>24)&0x000000FF); //MSB first
-				send_char((teaxteaInOut[1]>>16)&0x000000FF);
-				send_char((teaxteaInOut[1]>> 8)&0x000000FF);
-				send_char( teaxteaInOut[1]     &0x000000FF);
-				break;
-
-			/////Software crypto with countermeasures //////
-			//Software DES - encrypt with Random S-box order
-			case CMD_SWDES_ENC_RND_SBOX:
-				get_bytes(8, rxBuffer); // Receive DES plaintext
-				BEGIN_INTERESTING_STUFF;
-				desRandomSboxes(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			//Software DES - encrypt with Random delays
-			case CMD_SWDES_ENC_RND_DELAYS:
-				get_bytes(8, rxBuffer); // Receive DES plaintext
-				BEGIN_INTERESTING_STUFF;
-				desRandomDelays(keyDES, rxBuffer, ENCRYPT,2); // Perform software DES encryption
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
-				break;
-
-			//Software masked AES128 - encrypt
-			case CMD_SWAES128_ENC_MASKED:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				mAES128_ECB_encrypt(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function, includes masking process
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				break;
-
-			//Software masked AES128 - decrypt
-			case CMD_SWAES128_DEC_MASKED:
-				get_bytes(16, rxBuffer); // Receive AES ciphertext
-				mAES128_ECB_decrypt(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function, includes masking process
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back plaintext via UART
-				break;
-
-			//Software AES128 - random delays
-			case CMD_SWAES128_ENC_RNDDELAYS:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				AES128_ECB_encrypt_rndDelays(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function, includes masking process
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				break;
-
-			//Software AES128 - random sbox order
-			case CMD_SWAES128_ENC_RNDSBOX:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				AES128_ECB_encrypt_rndSbox(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function, includes masking process
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				break;
-
-			// RSA-CRT 1024bit decryption, textbook style (non-time constant)
-			case CMD_RSACRT1024_DEC:
-				if (cmd == 0) { //Legacy support of RLV protocol
-					get_char(&cmd);
-				}
-				get_char(&tmp); // Receive payload length, expect MSByte first
-				payload_len |= tmp;
-				payload_len <<= 8;
-				get_char(&tmp);
-				payload_len |= tmp;
-				//Receive payload_len bytes from the USART (truncating plaintext length if too long)
-				get_bytes(payload_len, rxBuffer);
-				if (payload_len > RXBUFFERLENGTH) {
-					payload_len = RXBUFFERLENGTH;
-				}
-				input_cipher_text(payload_len); // Fill the cipher text buffer "c" with incoming data bytes, assuming MSByte first and 32-bit alignment
-				rsa_crt_decrypt(); // Start RSA CRT procedure, Trigger signal toggling contained within the call
-				send_clear_text(); // Send content of clear text buffer "m" back to Host PC, MSByte first 32-bit alignment
-				break;
-
-			//Software AES(Ttables implementation) - encrypt
-			case CMD_SWAES128TTABLES_ENC:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				rijndaelSetupEncrypt(keyScheduleAES, keyAES, 128); //Prepare AES key schedule
-				BEGIN_INTERESTING_STUFF;
-				rijndaelEncrypt(keyScheduleAES, 10, rxBuffer, rxBuffer + AES128LENGTHINBYTES); // Perform software AES encryption
-				END_INTERESTING_STUFF;
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				break;
-
-			//Software AES(Ttables implementation) - decrypt
-			case CMD_SWAES128TTABLES_DEC:
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				rijndaelSetupDecrypt(keyScheduleAES, keyAES, 128); //Prepare AES key schedule
-				BEGIN_INTERESTING_STUFF;
-				rijndaelDecrypt(keyScheduleAES, 10, rxBuffer, rxBuffer + AES128LENGTHINBYTES); // Perform software AES decryption
-				END_INTERESTING_STUFF;
-				send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back plaintext via UART
-				break;
-
-			//Software RSA-512 SFM commands
-			case CMD_RSASFM_GET_HARDCODED_KEY:
-				rsa_sfm_send_hardcoded_key();
-				break;
-			case CMD_RSASFM_SET_D:
-				get_char(&tmp);		// Receive payload length, expect MSByte first
-				payload_len |= tmp;
-				payload_len <<= 8;
-				get_char(&tmp);
-				payload_len |= tmp;
-				//Receive payload_len bytes from the USART (truncating plaintext length if too long)
-				if(payload_len>RXBUFFERLENGTH){
-					payload_len=RXBUFFERLENGTH;
-				}
-				get_bytes(payload_len,rxBuffer);
-				input_external_exponent(payload_len);
-				send_char(cmd);
-				break;
-			case CMD_RSASFM_DEC:
-				get_char(&tmp);		// Receive payload length, expect MSByte first
-				payload_len |= tmp;
-				payload_len <<= 8;
-				get_char(&tmp);
-				payload_len |= tmp;
-				//Receive payload_len bytes from the USART (truncating plaintext length if too long)
-				if(payload_len>RXBUFFERLENGTH){
-					payload_len=RXBUFFERLENGTH;
-				}
-				get_bytes(payload_len,rxBuffer);
-				input_cipher_text(payload_len);	// Fill the cipher text buffer "c" with incoming data bytes, assuming MSByte first and 32-bit alignment
-				rsa_sfm_decrypt();
-				send_clear_text();
-				break;
-			case CMD_RSASFM_SET_KEY_GENERATION_METHOD:
-				get_char(&tmp);
-				rsa_sfm_set_key_generation_method(tmp);
-				send_char(tmp);
-				break;
-			case CMD_RSASFM_SET_IMPLEMENTATION:
-				get_char(&tmp);
-				rsa_sfm_set_implementation_method(tmp);
-				send_char(tmp);
-				break;
-
-			//ECC Curve 25519 commands
-			case CMD_ECC25519_SCALAR_MULT:
-				ecsm(rxBuffer);
-				break;
-
-			//PRESENT
-			case CMD_PRESENT80_ENC:
-				get_bytes(8, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				present80_encrypt(rxBuffer, keyPRESENT80, rxBuffer + 8);
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer + 8);
-				break;
-			case CMD_PRESENT80_DEC:
-				get_bytes(8, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				present80_decrypt(rxBuffer, keyPRESENT80, rxBuffer + 8);
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer + 8);
-				break;
-			case CMD_PRESENT128_ENC:
-				get_bytes(8, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				present128_encrypt(rxBuffer, keyPRESENT128, rxBuffer + 8);
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer + 8);
-				break;
-			case CMD_PRESENT128_DEC:
-				get_bytes(8, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				present128_decrypt(rxBuffer, keyPRESENT128, rxBuffer + 8);
-				END_INTERESTING_STUFF;
-				send_bytes(8, rxBuffer + 8);
-				break;
-
-#endif // VARIANT_PQC
-
-			/////////Hardware crypto commands/////////
-
-#ifndef HW_CRYPTO_PRESENT
-
-			//Fallback for Pinata boards without HW crypto processor: board will reply zeroes without any trigger instead of BADCMD to quickly identify the issue
-			case CMD_HWAES128_ENC:
-			case CMD_HWAES128_DEC:
-			case CMD_HWAES256_ENC:
-			case CMD_HWAES256_DEC:
-				get_bytes(16, rxBuffer);
-				//HW crypto is not supported: send zeroes back
-				send_bytes(16, zeros);
-				break;
-			case CMD_HWDES_ENC:
-			case CMD_HWDES_DEC:
-			case CMD_HWTDES_ENC:
-			case CMD_HWTDES_DEC:
-				get_bytes(8, rxBuffer);
-				//HW crypto is not supported: send zeroes back
-				send_bytes(8, zeros);
-				break;
-			case CMD_SHA1_HASH:
-				get_bytes(sizeof(uint32_t), rxBuffer);
-				get_bytes(16, rxBuffer);
-				//HW hashing is not supported: send zeroes back
-				send_bytes(20, zeros);
-				break;
-			case CMD_HMAC_SHA1:
-				get_bytes(sizeof(uint32_t), rxBuffer);
-				get_bytes(20, rxBuffer);
-				//HW hashing is not supported: send zeroes back
-				send_bytes(20, zeros);
-				break;
-			case CMD_MD5_HASH:
-				{
-				uint8_t len=0;
-				// Length of message to hash, up to 16 bytes
-				get_bytes(1, rxBuffer);
-				len=rxBuffer[0];
-				if(len>0x10){
-					len=0x10;
-				}
-				//Read message up to 16 bytes
-				get_bytes(len, rxBuffer);
-				}
-				send_bytes(16, zeros);
-				break;
-
-#endif
-
-#ifdef HW_CRYPTO_PRESENT
-
-			//Hardware AES128 - encrypt
-			case CMD_HWAES128_ENC:
-				get_bytes(16, rxBuffer);
-				//Trigger pin handling moved to CRYP_AES_ECB function
-				cryptoCompletedOK = CRYP_AES_ECB(MODE_ENCRYPT, keyAES, 128,	rxBuffer, (uint32_t) AES128LENGTHINBYTES, rxBuffer + AES128LENGTHINBYTES);
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(16, rxBuffer + AES128LENGTHINBYTES);
-				} else {
-					send_bytes(16, zeros);
-				}
-				break;
-
-			//Hardware AES128 - decrypt
-			case CMD_HWAES128_DEC:
-				get_bytes(16, rxBuffer);
-				//Trigger pin handling moved to CRYP_AES_ECB function
-				cryptoCompletedOK = CRYP_AES_ECB(MODE_DECRYPT, keyAES, 128,	rxBuffer, (uint32_t) AES128LENGTHINBYTES, rxBuffer + AES128LENGTHINBYTES);
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(16, rxBuffer + AES128LENGTHINBYTES);
-				} else {
-					send_bytes(16, zeros);
-				}
-				break;
-
-			//Hardware AES256 - encrypt
-			case CMD_HWAES256_ENC:
-				get_bytes(16, rxBuffer);
-				//Trigger pin handling moved to CRYP_AES_ECB function
-				cryptoCompletedOK = CRYP_AES_ECB(MODE_ENCRYPT, keyAES256, 256,	rxBuffer, (uint32_t) 16, rxBuffer + 16);
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(16, rxBuffer + 16);
-				} else {
-					send_bytes(16, zeros);
-				}
-				break;
-
-			//Hardware AES256 - decrypt
-			case CMD_HWAES256_DEC:
-				get_bytes(16, rxBuffer);
-				//Trigger pin handling moved to CRYP_AES_ECB function
-				cryptoCompletedOK = CRYP_AES_ECB(MODE_DECRYPT, keyAES256, 256,	rxBuffer, (uint32_t) 16, rxBuffer + 16);
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(16, rxBuffer + 16);
-				} else {
-					send_bytes(16, zeros);
-				}
-				break;
-
-			//Hardware DES - encrypt
-			case CMD_HWDES_ENC:
-				get_bytes(8, rxBuffer);
-				//Trigger pin handling moved to CRYP_DES_ECB function
-				cryptoCompletedOK=CRYP_DES_ECB(MODE_ENCRYPT,keyDES,rxBuffer,(uint32_t)8,rxBuffer+8);
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(8, rxBuffer + 8);
-				} else {
-					send_bytes(8, zeros);
-				}
-				break;
-
-			//Hardware DES - decrypt
-			case CMD_HWDES_DEC:
-				get_bytes(8, rxBuffer);
-				//Trigger pin handling moved to CRYP_DES_ECB function
-				cryptoCompletedOK=CRYP_DES_ECB(MODE_DECRYPT,keyDES,rxBuffer,(uint32_t)8,rxBuffer+8);
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(8, rxBuffer + 8);
-				} else {
-					send_bytes(8, zeros);
-				}
-				break;
-
-			//Hardware TDES - encrypt
-			case CMD_HWTDES_ENC:
-				get_bytes(8, rxBuffer);
-				//Trigger pin handling moved to CRYP_DES_ECB function
-				cryptoCompletedOK=CRYP_TDES_ECB(MODE_ENCRYPT,keyTDES,rxBuffer,(uint32_t)8,rxBuffer+8);
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(8, rxBuffer + 8);
-				} else {
-					send_bytes(8, zeros);
-				}
-				break;
-
-			//Hardware TDES - decrypt
-			case CMD_HWTDES_DEC:
-				get_bytes(8, rxBuffer);
-				//Trigger pin handling moved to CRYP_DES_ECB function
-				cryptoCompletedOK=CRYP_TDES_ECB(MODE_DECRYPT,keyTDES,rxBuffer,(uint32_t)8,rxBuffer+8);
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(8, rxBuffer + 8);
-				} else {
-					send_bytes(8, zeros);
-				}
-				break;
-
-
-				//Hardware HMAC SHA1 (key is the same as the TDES key)
-			case CMD_HMAC_SHA1:
-				{
-				get_bytes(sizeof(uint32_t), rxBuffer);
-				uint32_t rxBuffer32 = (uint32_t)rxBuffer;
-				uint32_t iterations = __REV(*(uint32_t*)rxBuffer32);
-
-				get_bytes(20, rxBuffer);
-				RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, ENABLE);
-				// 24 byte key used is the same as the TDES key!!
-				cryptoCompletedOK = HMAC_SHA1(keyTDES, sizeof(keyTDES), rxBuffer+sizeof(uint32_t), 20, rxBuffer+24, iterations);
-				RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, DISABLE);
-
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(20, rxBuffer+24);
-				} else {
-					send_bytes(20, zeros);
-				}
-				}
-				break;
-
-				//Hardware SHA1
-			case CMD_SHA1_HASH:
-				{
-				// Length of message to hash fixed to 16 bytes
-				get_bytes(sizeof(uint32_t), rxBuffer);
-				uint32_t rxBuffer32 = (uint32_t)rxBuffer;
-				uint32_t iterations = __REV(*(uint32_t*)rxBuffer32);
-
-				get_bytes(16, rxBuffer);
-
-				RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, ENABLE);
-				BEGIN_INTERESTING_STUFF;
-				cryptoCompletedOK = HASH_SHA1(rxBuffer+sizeof(uint32_t), 16, rxBuffer+20, iterations);
-				END_INTERESTING_STUFF;
-				RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, DISABLE);
-
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(20, rxBuffer+20);
-				} else {
-					send_bytes(20, zeros);
-				}
-				}
-				break;
-
-				//Hardware MD5 (up to 16 bytes)
-				//CMD format: CMD_MD5_HASH (1 byte) + message length (1 byte, possible values 0x01 to 0x10) + message
-				//output: 16 byte hash
-			case CMD_MD5_HASH:
-				{
-				uint8_t len=0;
-				// Length of message to hash, up to 16 bytes
-				get_bytes(1, rxBuffer);
-				len=rxBuffer[0];
-				if(len>0x10){
-					len=0x10;
-				}
-				//Read message up to 16 bytes
-				get_bytes(len, rxBuffer);
-
-				RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, ENABLE);
-				BEGIN_INTERESTING_STUFF;
-				cryptoCompletedOK = HASH_MD5(rxBuffer,len, rxBuffer+16);
-				END_INTERESTING_STUFF;
-				RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_HASH, DISABLE);
-
-				if (cryptoCompletedOK == SUCCESS) {
-					send_bytes(16, rxBuffer+16);
-				} else {
-					send_bytes(16, zeros);
-				}
-				}
-				break;
-
-#endif
-			//////Cryptographic keys management//////
-
-#ifndef VARIANT_PQC
-
-			//TDES key change
-			case CMD_TDES_KEYCHANGE:
-				get_bytes(24, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				for (i = 0; i < 24; i++) keyTDES[i] = rxBuffer[i];
-				END_INTERESTING_STUFF;
-				send_bytes(24,keyTDES);
-				break;
-
-			//DES key change
-			case CMD_DES_KEYCHANGE:
-				get_bytes(8, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				for (i = 0; i < 8; i++) keyDES[i] = rxBuffer[i];
-				END_INTERESTING_STUFF;
-				send_bytes(8,keyDES);
-				break;
-
-			//TEA / XTEA key change
-			case CMD_TEA_XTEA_KEYCHANGE:
-				get_bytes(16, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				for (i = 0; i < 4; i++){ //Copy input key to keyArray swapping endianness on-the-fly
-					keyTEAXTEA[i] = rxBuffer[4*i+3] | (rxBuffer[4*i+2] << 8) | (rxBuffer[4*i+1] << 16) | (rxBuffer[4*i+0] << 24);
-				}
-				END_INTERESTING_STUFF;
-				send_char((keyTEAXTEA[0]>>24)&0x000000FF); //MSB first
-				send_char((keyTEAXTEA[0]>>16)&0x000000FF);
-				send_char((keyTEAXTEA[0]>> 8)&0x000000FF);
-				send_char( keyTEAXTEA[0]     &0x000000FF);
-				send_char((keyTEAXTEA[1]>>24)&0x000000FF); //MSB first
-				send_char((keyTEAXTEA[1]>>16)&0x000000FF);
-				send_char((keyTEAXTEA[1]>> 8)&0x000000FF);
-				send_char( keyTEAXTEA[1]     &0x000000FF);
-				send_char((keyTEAXTEA[2]>>24)&0x000000FF); //MSB first
-				send_char((keyTEAXTEA[2]>>16)&0x000000FF);
-				send_char((keyTEAXTEA[2]>> 8)&0x000000FF);
-				send_char( keyTEAXTEA[2]     &0x000000FF);
-				send_char((keyTEAXTEA[3]>>24)&0x000000FF); //MSB first
-				send_char((keyTEAXTEA[3]>>16)&0x000000FF);
-				send_char((keyTEAXTEA[3]>> 8)&0x000000FF);
-				send_char( keyTEAXTEA[3]     &0x000000FF);
-				break;
-
-			//AES128 key change
-			case CMD_AES128_KEYCHANGE:
-				get_bytes(16, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				for (i = 0; i < 16; i++) keyAES[i] = rxBuffer[i];
-				END_INTERESTING_STUFF;
-				send_bytes(16,keyAES);
-				break;
-
-			//AES256 key change
-			case CMD_AES256_KEYCHANGE:
-				get_bytes(32, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				for (i = 0; i < 32; i++) keyAES256[i] = rxBuffer[i];
-				//Recompute again aes256 key schedule
-				aes256_init(&ctx,keyAES256); //Prepare AES key schedule for software AES256
-				END_INTERESTING_STUFF;
-				send_bytes(32,keyAES256);
-				break;
-
-			//Password change (4 bytes long, used for password check commands & FI)
-			case CMD_PWD_CHANGE:
-				authenticated=0;
-				get_bytes(4, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				for (i = 0; i < 4; i++) password[i] = rxBuffer[i];
-				END_INTERESTING_STUFF;
-				send_bytes(4,password);
-				break;
-
-			//SM4 key change
-			case CMD_SM4_KEYCHANGE:
-				get_bytes(16, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				for (i = 0; i < 16; i++) keySM4[i] = rxBuffer[i];
-				END_INTERESTING_STUFF;
-				send_bytes(16,keySM4);
-				break;
-
-
-			/////Template analysis commands/////
-
-			//Software key copy (byte-wise)
-			case CMD_SOFTWARE_KEY_COPY:
-				get_bytes(16, rxBuffer); // Receive AES128 key (16 byte)
-				for (i = 0; i < 16; i++) keyLoadingAES[i] = 0; //Initialize key array
-				GPIOC->BSRRL = GPIO_Pin_2; //Trigger on PC2 for key loading
-				busyWait1=0;
-				while (busyWait1 < 500) busyWait1++; //For avoiding ringing on GPIO toggling
-
-				//Key copy, byte-wise, with a delay between key bytes copy to make it even more evident where key copy happens
-				keyLoadingAES[0] = rxBuffer[0];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[1] = rxBuffer[1];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[2] = rxBuffer[2];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[3] = rxBuffer[3];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[4] = rxBuffer[4];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[5] = rxBuffer[5];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[6] = rxBuffer[6];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[7] = rxBuffer[7];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[8] = rxBuffer[8];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[9] = rxBuffer[9];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[10] = rxBuffer[10];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[11] = rxBuffer[11];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[12] = rxBuffer[12];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[13] = rxBuffer[13];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[14] = rxBuffer[14];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				keyLoadingAES[15] = rxBuffer[15];
-				busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;busyWait1++;
-				//End of key-copy
-
-				GPIOC->BSRRH = GPIO_Pin_2; //Trigger off PC2 end of key loading
-				send_bytes(16, keyLoadingAES); // Transmit back loaded key via UART
-				break;
-
-
-			/////Fault Injection commands/////
-
-			//Infinite loop for FI (has a NOP sled after the infinite loop)
-			case CMD_INFINITE_FI_LOOP:
-				BEGIN_INTERESTING_STUFF;
-				while (1) {
-					oled_sendchar('.');
-					busyWait1 = 0;
-					while (busyWait1 < 84459459) busyWait1++; //Roughly 0.5 seconds @ 168MHz
-					oled_sendchar(' ');
-					busyWait1 = 0;
-					while (busyWait1 < 84459459) busyWait1++; //Roughly 0.5 seconds @ 168MHz
-				}
-				//Small NOP sled
-				__asm __volatile__("mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						);
-				END_INTERESTING_STUFF;
-				send_char('G');send_char('l');send_char('i');send_char('t');send_char('c');send_char('e');send_char('d');send_char('!');
-				break;
-
-			//Loop test command for FI
-			case CMD_LOOP_TEST_FI: {
-				volatile int upCounter = 0;
-				payload_len = 0;
-				get_char(&tmp); // Receive payload length, expect MSByte first, 16bit counter max
-				payload_len |= tmp;
-				payload_len <<= 8;
-				get_char(&tmp);
-				payload_len |= tmp;
-				BEGIN_INTERESTING_STUFF;
-				while (payload_len) {
-					payload_len--;
-					upCounter++;
-				}
-				END_INTERESTING_STUFF;
-				send_char(0xA5);
-				send_char((payload_len>>8)&0x000000FF); //MSB first
-				send_char( payload_len    &0x000000FF);
-				send_char((upCounter>>8)  &0x000000FF);
-				send_char( upCounter      &0x000000FF);
-				send_char(0xA5);
-				break;
-			}
-
-			//Password check - single check for Fault Injection
-			case CMD_SINGLE_PWD_CHECK_FI: {
-				volatile int charsOK = 0;
-				authenticated = 0;
-				get_bytes(4, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				//Small delay to have a bit of time between trigger to glitch
-				__asm __volatile__("mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						);
-				for (i = 0;i < 4; i++) {
-					if (rxBuffer[i] == password[i]) {
-						charsOK = charsOK + 1;
-					}
-				}
-				if (charsOK == 4) {
-					authenticated=AUTH_OK;
-					send_char(0x90);send_char(0x00);
-				} else {
-					send_char(0x69);send_char(0x86);
-				}
-				END_INTERESTING_STUFF;
-				break;
-			}
-
-			//Password check - double check for Fault Injection
-			case CMD_DOUBLE_PWD_CHECK_FI: {
-				volatile int charsOK = 11; //Changed the default value of zero to make it a bit harder to glitch
-				authenticated = 0;
-				get_bytes(4, rxBuffer);
-				BEGIN_INTERESTING_STUFF;
-				//Small delay to have a bit of time between trigger to glitch
-				__asm __volatile__("mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						"mov r0,r0\n"
-						);
-				for (i = 0; i < 4; i++) {
-					if (rxBuffer[i] == password[i]) {
-						charsOK = charsOK + 11;
-					}
-				}
-				if (charsOK == 55) {
-					//Spacing to avoid that a single glitch does not bypass the two checks
-					__asm __volatile__("mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							"mov r0,r0\n"
-							);
-
-					if ( ((*(uint32_t*)(rxBuffer))^(*(uint32_t*)(password))) != 0) { //Second check is a different one (uses a XOR of the 2 passwords of 4 chars)
-						authenticated=0;
-						send_char(0x69);send_char(0x86);
-					} else {
-						authenticated=AUTH_OK;
-						send_char(0x90);send_char(0x00);
-					}
-				} else {
-					send_char(0x69);send_char(0x00);
-				}
-				END_INTERESTING_STUFF;
-				break;
-			}
-
-			//Software DES encryption with a double check (for Advanced FI DFA scenarios)
-			case CMD_SWDES_ENCRYPT_DOUBLECHECK:
-				get_bytes(8, rxBuffer); // Receive DES plaintext
-				//Copy the plaintext twice to perform two encryptions
-				for(i=0;i<8;i++){
-					rxBuffer[8+i]=rxBuffer[i];
-				}
-				BEGIN_INTERESTING_STUFF;
-				des(keyDES, rxBuffer, ENCRYPT); // Perform software DES encryption
-				des(keyDES, rxBuffer+8, ENCRYPT); // Perform second software DES encryption
-				END_INTERESTING_STUFF;
-				//Compare the two encrypted texts; if same, transmit them, otherwise send nothing
-				if(memcmp(rxBuffer,rxBuffer+8, (unsigned int) 8)==0){
-					send_bytes(8, rxBuffer); // Transmit back ciphertext via UART
-				}
-				else{
-					//Do not transmit anything
-				}
-				break;
-
-			//AES128 SW encryption with a double check (for Advanced FI DFA scenarios)
-			case CMD_SWAES128_ENCRYPT_DOUBLECHECK:{
-				uint8_t decrypted_input[16];
-				get_bytes(16, rxBuffer); // Receive AES plaintext
-				rijndaelSetupDecrypt(keyScheduleAES, keyAES, 128); //Prepare T-Tables AES key schedule for double check
-
-				//Encrypt with textbook AES128 for easing the glitch
-				AES128_ECB_encrypt(rxBuffer, keyAES, rxBuffer + AES128LENGTHINBYTES); //Trigger is coded inside aes function after key expansion
-				//Decrypt with T-Tables AES for speed
-				rijndaelDecrypt(keyScheduleAES, 10, rxBuffer + AES128LENGTHINBYTES, decrypted_input); // Perform software AES decryption
-
-				//If decrypted txt is the same as the original txt, send the ciphertext; otherwise send nothing
-				if(memcmp(decrypted_input, rxBuffer, (unsigned int) 16)==0){
-					send_bytes(16, rxBuffer + AES128LENGTHINBYTES); // Transmit back ciphertext via UART
-				}
-				else{
-					//Do not transmit anything
-				}
-				break;
-			}
-
-			///// TRNG //////
-			case CMD_GET_RANDOM_FROM_TRNG:{
-				volatile uint32_t randomNumber;
-				RNG_Enable();
-				//Get a random number
-				BEGIN_INTERESTING_STUFF;
-				while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-				randomNumber=RNG_GetRandomNumber();
-				END_INTERESTING_STUFF;
-				RNG_Disable();
-				send_char((randomNumber>>24)&0x000000FF); //MSB first
-				send_char((randomNumber>>16)&0x000000FF);
-				send_char((randomNumber>> 8)&0x000000FF);
-				send_char( randomNumber     &0x000000FF);
-				break;
-				}
-
-			//Send stm32f4 chip UID via I/O interface
-			case CMD_UID_VIA_IO:
-				BEGIN_INTERESTING_STUFF;
-				uint32_t uidBlock1 = STM32F4ID[0];
-				uint32_t uidBlock2 = STM32F4ID[1];
-				uint32_t uidBlock3 = STM32F4ID[2];
-				END_INTERESTING_STUFF;
-				send_char((uidBlock1>>24)&0x000000FF); //MSB first
-				send_char((uidBlock1>>16)&0x000000FF);
-				send_char((uidBlock1>> 8)&0x000000FF);
-				send_char( uidBlock1     &0x000000FF);
-				send_char((uidBlock2>>24)&0x000000FF); //MSB first
-				send_char((uidBlock2>>16)&0x000000FF);
-				send_char((uidBlock2>> 8)&0x000000FF);
-				send_char( uidBlock2     &0x000000FF);
-				send_char((uidBlock3>>24)&0x000000FF); //MSB first
-				send_char((uidBlock3>>16)&0x000000FF);
-				send_char((uidBlock3>> 8)&0x000000FF);
-				send_char( uidBlock3     &0x000000FF);
-				break;
-
-#endif // VARIANT_PQC
-
-			//Code version command: returns code version string (8 bytes, "Ver x.x" ASCII encoded) on code revision 2.0 or higher, "BadCmd" on code revision 1.0
-			case CMD_GET_CODE_REV:
-				send_bytes(8, codeVersion);
-				break;
-
-			//Change clock speed on-the-fly and restart peripherals; predefined speeds are 16, 30, 84 and 168MHz. If parameter is not in this list, speed will be set to 168MHz by default.
-			case CMD_CHANGE_CLK_SPEED:
-				get_char(&tmp);
-				setClockSpeed(tmp);
-				send_char(clockspeed);
-				break;
-
-			//Change clock source to external. The argument specifies whether the clock is used directly (value = 0), or through the PLL (value != 0)
-			case CMD_SET_EXTERNAL_CLOCK:
-				get_char(&tmp);
-				setExternalClock(tmp);
-				send_char(clockSource);
-				break;
-
-			//Unknown command byte: return error or 4 times (0x90 0x00) if board was glitched during boot or an hex sequence if authenticated is set to AUTH_OK
-			default:
-
-#ifdef VARIANT_PQC
-				send_bytes(8, cmdByteIsWrong);
-				break;
-
-#else
-				BEGIN_INTERESTING_STUFF;
-				if (glitchedBoot) {
-					for (i = 0; i < 4; i++){
-						send_char(0x90);
-						send_char(0x00);
-					}
-				}
-				else if(authenticated==AUTH_OK){ //This will be the answer if the authenticated flag is set to AUTH_OK
-					send_char(0xC0);
-					send_char(0xBF);
-					send_char(0xEF);
-					send_char(0xEE);
-					send_char(0xBA);
-					send_char(0xDB);
-					send_char(0xAB);
-					send_char(0xEE);
-				}
-				else{
-					send_bytes(8, cmdByteIsWrong);
-				}
-				END_INTERESTING_STUFF;
-				break;
 
 #endif // VARIANT_PQC
 
+		//Main processing section: look the command up in the registry and run its handler
+		get_command(&cmd);
+		if (commands[cmd].handler) {
+			commands[cmd].handler(cmd);
+		} else {
+			cmd_unknown(cmd);
 		}
+		//The response is complete: hand it to the host now instead of when the USB frame timer next fires
+		finish_response();
 	}
 
 	//If we glitch the board out of the main loop, it will end up here (target will loop forever sending bytes 0xFA, 0xCC)
@@ -1548,6 +2025,18 @@ int main(void) {
 //FUNCTION IMPLEMENTATION//
 ///////////////////////////
 
+//Board bring-up, I/O and clock handling below drive the STM32F4 peripherals directly.
+//The host simulator (PinataSimulator/board.c) provides its own versions of these functions.
+#ifndef PINATA_HOST_SIMULATOR
+
+//USART3 DMA buffers: DMA1 Stream1 fills usartRxRing in circular mode and usartRxTail is the next byte to hand out;
+//DMA1 Stream3 transmits from usartTxBuffer, so that callers may reuse their buffer as soon as send_bytes returns.
+//The ring is volatile: the DMA writes it behind the compiler's back, and every byte must be loaded only after
+//usart_rx_available() has seen it arrive.
+volatile uint8_t usartRxRing[USARTRXRINGLENGTH];
+uint32_t usartRxTail = 0;
+uint8_t usartTxBuffer[USARTTXBUFFERLENGTH];
+
 //init(): system initialization, pin configuration and system tick configuration for timers
 void init() {
 	/* STM32F4 GPIO ports */
@@ -1591,6 +2080,12 @@ void init() {
 	if (SysTick_Config(SystemCoreClock / 1000)) {
 		CrashGracefully();
 	}
+#ifdef PINATA_CYCLE_COUNT
+	/* Start the DWT cycle counter for the trigger macros */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+#endif
 
 	/* Enable CRYP clock for hardware crypto; */
 #ifdef HW_CRYPTO_PRESENT
@@ -1612,7 +2107,7 @@ void init() {
 //usart_init: configures the usart3 interface
 void usart_init(void) {
 	/* USART3 configured as follows:
-	 - BaudRate = 115200 baud
+	 - BaudRate = usartBaudRate (115200 baud unless changed with CMD_SET_BAUD_RATE)
 	 - Word Length = 8 Bits
 	 - One Stop Bit
 	 - No parity
@@ -1622,6 +2117,7 @@ void usart_init(void) {
 	 */
 	GPIO_InitTypeDef GPIO_InitStructure;
 	USART_InitTypeDef USART_InitStructure;
+	RCC_ClocksTypeDef clocks;
 
 	/* Enable GPIO clock */
 	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOC, ENABLE);
@@ -1649,7 +2145,17 @@ void usart_init(void) {
 	GPIO_InitStructure.GPIO_Pin = GPIO_Pin_11;
 	GPIO_Init(GPIOC, &GPIO_InitStructure);
 
-	USART_InitStructure.USART_BaudRate = 115200;
+	/* Keep the baud rate across clock changes if the new APB1 clock can still generate it, otherwise go back to the default */
+	if (usart_achievable_baud_rate(usartBaudRate) == 0) {
+		usartBaudRate = USART_DEFAULT_BAUDRATE;
+	}
+
+	/* Oversampling by 8 doubles the highest baud rate at the cost of noise immunity: only use it when needed */
+	USART_Cmd(USART3, DISABLE);
+	RCC_GetClocksFreq(&clocks);
+	USART_OverSampling8Cmd(USART3, clocks.PCLK1_Frequency / usartBaudRate < 16 ? ENABLE : DISABLE);
+
+	USART_InitStructure.USART_BaudRate = usartBaudRate;
 	USART_InitStructure.USART_WordLength = USART_WordLength_8b;
 	USART_InitStructure.USART_StopBits = USART_StopBits_1;
 	USART_InitStructure.USART_Parity = USART_Parity_No;
@@ -1660,11 +2166,79 @@ void usart_init(void) {
 	/* USART configuration */
 	USART_Init(USART3, &USART_InitStructure);
 
+	/* Receive through DMA1 Stream1 Channel 4 into the circular usartRxRing: bytes are never lost to an overrun while
+	   the firmware is busy, so the host can pipeline requests */
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+	DMA1_Stream1->CR &= ~DMA_SxCR_EN;
+	while (DMA1_Stream1->CR & DMA_SxCR_EN);
+	DMA1->LIFCR = DMA_LIFCR_CTCIF1 | DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTEIF1 | DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1;
+	DMA1_Stream1->PAR = (uint32_t)&USART3->DR;
+	DMA1_Stream1->M0AR = (uint32_t)usartRxRing;
+	DMA1_Stream1->NDTR = USARTRXRINGLENGTH;
+	DMA1_Stream1->FCR = 0; //Direct mode, byte by byte
+	DMA1_Stream1->CR = DMA_SxCR_CHSEL_2 | DMA_SxCR_PL_1 | DMA_SxCR_MINC | DMA_SxCR_CIRC; //Peripheral to memory, high priority
+	DMA1_Stream1->CR |= DMA_SxCR_EN;
+	usartRxTail = 0;
+
+	/* Transmit through DMA1 Stream3 Channel 4; send_bytes_uart() starts every transfer */
+	DMA1_Stream3->CR &= ~DMA_SxCR_EN;
+	while (DMA1_Stream3->CR & DMA_SxCR_EN);
+	DMA1->LIFCR = DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3;
+	DMA1_Stream3->PAR = (uint32_t)&USART3->DR;
+	DMA1_Stream3->FCR = 0;
+	DMA1_Stream3->CR = DMA_SxCR_CHSEL_2 | DMA_SxCR_PL_0 | DMA_SxCR_MINC | DMA_SxCR_DIR_0; //Memory to peripheral, medium priority
+
+	USART_DMACmd(USART3, USART_DMAReq_Rx | USART_DMAReq_Tx, ENABLE);
+
 	/* Enable USART */
 	USART_Cmd(USART3, ENABLE);
 
 }
 
+//usart_achievable_baud_rate: the baud rate USART3 generates for baudRate from the current APB1 clock, or 0 if that is more than 2% off
+uint32_t usart_achievable_baud_rate(uint32_t baudRate) {
+	RCC_ClocksTypeDef clocks;
+	uint32_t divider, achieved;
+
+	if (baudRate == 0) {
+		return 0;
+	}
+	RCC_GetClocksFreq(&clocks);
+	//The divider is in 1/16 bit (1/8 bit when oversampling by 8), in either case at least 8 and at most 16 bits long
+	divider = (clocks.PCLK1_Frequency + baudRate / 2) / baudRate;
+	if (divider < 8 || divider > 0xFFFF) {
+		return 0;
+	}
+	achieved = clocks.PCLK1_Frequency / divider;
+	if ((achieved > baudRate ? achieved - baudRate : baudRate - achieved) > baudRate / 50) {
+		return 0;
+	}
+	return achieved;
+}
+
+//usart_set_baud_rate: switch USART3 to baudRate once everything that is being sent has left
+void usart_set_baud_rate(uint32_t baudRate) {
+	usartBaudRate = baudRate;
+	if (!usbSerialEnabled) {
+		usart_tx_drain();
+		usart_init();
+	}
+}
+
+//usart_tx_drain: wait until the last DMA transmission has completely left USART3, e.g. before raising the trigger
+void usart_tx_drain(void) {
+	if (usbSerialEnabled) {
+		return;
+	}
+	while (DMA1_Stream3->CR & DMA_SxCR_EN);
+	while (!(USART3->SR & USART_SR_TC));
+}
+
+//usart_rx_available: whether the receive DMA has put bytes in usartRxRing that were not handed out yet
+static int usart_rx_available(void) {
+	return ((USARTRXRINGLENGTH - DMA1_Stream1->NDTR) & (USARTRXRINGLENGTH - 1)) != usartRxTail;
+}
+
 //oled_init: configures the SPI2 interface with associated GPIO pins for SS, data/cmd# and reset lines
 void oled_init(){
 	/* Pins used by SPI2 & GPIOs for SSD1306 OLED display
@@ -1709,6 +2283,8 @@ void oled_init(){
 	oled_reset();
 }
 
+#endif //PINATA_HOST_SIMULATOR
+
 //////Interrupt Handlers/////////
 
 void SysTick_Handler(void) {
@@ -1728,9 +2304,11 @@ void UsageFault_Handler(void) {CrashGracefully();}
 
 //System functions: disable/enable
 
-//Wrapper functions for UART / serial over USB
-//get_bytes: get an amount of nbytes bytes from IO interface into byte array ba
-void get_bytes(uint32_t nbytes, uint8_t* ba) {
+#ifndef PINATA_HOST_SIMULATOR
+
+//Link functions for UART / serial over USB; the commands use the wrappers in frame.c
+//link_get_bytes: get an amount of nbytes bytes from IO interface into byte array ba
+void link_get_bytes(uint32_t nbytes, uint8_t* ba) {
 	if (usbSerialEnabled) {
 		get_bytes_usb(nbytes,ba);
 	} else {
@@ -1738,8 +2316,8 @@ void get_bytes(uint32_t nbytes, uint8_t* ba) {
 	}
 }
 
-//send_bytes: send an amount of nbytes bytes from byte array ba via IO interface
-void send_bytes(uint32_t nbytes, const uint8_t *ba) {
+//link_send_bytes: send an amount of nbytes bytes from byte array ba via IO interface
+void link_send_bytes(uint32_t nbytes, const uint8_t *ba) {
 	if (usbSerialEnabled) {
 		send_bytes_usb(nbytes,ba);
 	} else {
@@ -1747,15 +2325,38 @@ void send_bytes(uint32_t nbytes, const uint8_t *ba) {
 	}
 }
 
-//get_char: receive a byte via IO interface
-void get_char(uint8_t *ch) {
+//link_flush: send whatever the IO interface still buffers without further delay
+void link_flush(void) {
 	if (usbSerialEnabled) {
-		get_char_usb(ch);
-	} else {
-		get_char_uart(ch);
+		VCP_flush();
+	}
+	//USART3: link_send_bytes already started the DMA transfer
+}
+
+//link_get_char_timeout: receive a byte via IO interface, waiting at most timeoutMs milliseconds; returns 0 on timeout
+int link_get_char_timeout(uint8_t *ch, uint32_t timeoutMs) {
+	uint32_t elapsed = 0;
+
+	(void)SysTick->CTRL; //Clear COUNTFLAG, so that only whole milliseconds from now are counted
+	while (elapsed < timeoutMs) {
+		if (usbSerialEnabled) {
+			if (VCP_get_char(ch)) {
+				return 1;
+			}
+		} else if (usart_rx_available()) {
+			get_char_uart(ch);
+			return 1;
+		}
+		//SysTick wraps every millisecond (see init()), but its interrupt is disabled: poll the wrap flag instead
+		if (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk) {
+			elapsed++;
+		}
 	}
+	return 0;
 }
 
+#endif //PINATA_HOST_SIMULATOR
+
 // read_char: receive a byte via IO interface
 uint8_t read_char() {
 	uint8_t result;
@@ -1763,47 +2364,45 @@ uint8_t read_char() {
 	return result;
 }
 
-//send_char: send a byte via IO interface
-void send_char(uint8_t ch) {
-	if (usbSerialEnabled) {
-		send_char_usb(ch);
-	} else {
-		send_char_uart(ch);
-	}
-}
+#ifndef PINATA_HOST_SIMULATOR
 
 //UART IO
 //get_bytes: get an amount of nbytes bytes from uart into byte array ba
 void get_bytes_uart(uint32_t nbytes, uint8_t *ba) {
 	int i;
 	for (i = 0; i < nbytes; i++) {
-		while ((USART3->SR & USART_SR_RXNE) == 0);
+		while (!usart_rx_available());
 
-		ba[i] = (uint8_t) USART_ReceiveData(USART3);
+		ba[i] = usartRxRing[usartRxTail];
+		usartRxTail = (usartRxTail + 1) & (USARTRXRINGLENGTH - 1);
 	}
 }
-//send_bytes: send an amount of nbytes bytes from byte array ba via uart
+//send_bytes: send an amount of nbytes bytes from byte array ba via uart; returns as soon as the last piece is handed to the DMA
 void send_bytes_uart(uint32_t nbytes, const uint8_t *ba) {
-	int i;
-	for (i = 0; i < nbytes; i++) {
-		while (!(USART3->SR & USART_SR_TXE));
-
-		USART_SendData(USART3, ba[i]);
+	uint32_t chunk;
+	while (nbytes > 0) {
+		chunk = nbytes < USARTTXBUFFERLENGTH ? nbytes : USARTTXBUFFERLENGTH;
+		while (DMA1_Stream3->CR & DMA_SxCR_EN); //The previous transfer still owns usartTxBuffer
+
+		memcpy(usartTxBuffer, ba, chunk);
+		DMA1->LIFCR = DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3;
+		DMA1_Stream3->M0AR = (uint32_t)usartTxBuffer;
+		DMA1_Stream3->NDTR = chunk;
+		USART_ClearFlag(USART3, USART_FLAG_TC); //usart_tx_drain() waits for it to be set again by the last byte
+		DMA1_Stream3->CR |= DMA_SxCR_EN;
+		ba += chunk;
+		nbytes -= chunk;
 	}
 }
 
 //get_char: receive a byte via uart
 void get_char_uart(uint8_t *ch) {
-	while ((USART3->SR & USART_SR_RXNE) == 0);
-
-	*ch = (uint8_t) USART_ReceiveData(USART3);
+	get_bytes_uart(1, ch);
 }
 
 //send_char: send a byte via uart
 void send_char_uart(uint8_t ch) {
-	while (!(USART3->SR & USART_SR_TXE));
-
-	USART_SendData(USART3, ch);
+	send_bytes_uart(1, &ch);
 }
 
 //Serial over USB communication functions
@@ -1818,13 +2417,9 @@ void get_bytes_usb(uint32_t nbytes, uint8_t *ba) {
 		ba[i] = tmp;
 	}
 }
-//send_bytes: send an amount of nbytes bytes from byte array ba via usb com port
+//send_bytes: send an amount of nbytes bytes from byte array ba via usb com port; they go out with the next flush_output()
 void send_bytes_usb(uint32_t nbytes, const uint8_t *ba) {
-	int i;
-	for (i = 0; i < nbytes; i++) {
-		VCP_put_char(ba[i]);
-	}
-
+	VCP_send_buffer((uint8_t *)ba, nbytes);
 }
 //get_char: receive a byte over usb com port
 void get_char_usb(uint8_t *ch) {
@@ -1858,6 +2453,8 @@ void OTG_FS_WKUP_IRQHandler(void)
 	}
 }
 
+#endif //PINATA_HOST_SIMULATOR
+
 /////Debug functions for your own code (e.g. RSA implementations)////////
 void readByteFromInputBuffer(uint8_t *ch, int* charIdx) {
 	*ch = rxBuffer[*charIdx];
@@ -1870,11 +2467,15 @@ void CrashGracefully(void) {
 }
 
 /////Clock handling functions////////
+#ifndef PINATA_HOST_SIMULATOR
 
 //// Functions to change on-the-fly the clockspeed; supported speeds: 30, 84 and 168MHz ////
 void setClockSpeed(uint8_t speed) {
 	uint16_t timeout;
 
+	//Let the last reply leave before the clocks change under USART3
+	usart_tx_drain();
+
 	// Enable HSI clock and switch to it while we mess with the PLLs
 	RCC->CR |= RCC_CR_HSION;
 	timeout = 0xFFFF;
@@ -1905,7 +2506,8 @@ void setClockSpeed(uint8_t speed) {
 	//Update system core clockspeed for peripherals to set configurations properly
 	SystemCoreClockUpdate();
 
-	//Reinitialize peripherals because changing the RCC_PLLConfig has messed up all the clocking
+	//Reinitialize peripherals because changing the RCC_PLLConfig has messed up all the clocking; usart_init() recomputes the
+	//baud rate divider for the new APB1 clock
 	init();
 	if (!usbSerialEnabled) {
 		usart_init();
@@ -1921,6 +2523,9 @@ void setClockSpeed(uint8_t speed) {
 void setExternalClock(uint8_t source) {
 	uint16_t timeout;
 
+	//Let the last reply leave before the clocks change under USART3
+	usart_tx_drain();
+
 	// Enable HSI clock and switch to it while we mess with the PLLs
 	RCC->CR |= RCC_CR_HSION;
 	timeout = 0xFFFF;
@@ -2006,13 +2611,14 @@ void enable_clocks() {
 	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOC, ENABLE);
 }
 
+#endif //PINATA_HOST_SIMULATOR
+
 void fillBufferWithRandomNumbers(uint32_t nbytes, uint8_t* ba){
 	uint32_t randomNumber;
 	uint32_t i;
 	for(i=0;i<nbytes;i+=4){
 		//Get a random number
-		while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-		randomNumber= RNG_GetRandomNumber();
+		randomNumber= entropy_get_word();
 		ba[i]=((randomNumber>>24)&0x000000FF); //MSB first
 		if((i+1)<nbytes){
 			ba[i+1]=((randomNumber>>16)&0x000000FF);
@@ -2027,8 +2633,7 @@ void fillBufferWithRandomNumbers(uint32_t nbytes, uint8_t* ba){
 	//Extra check so that byte 19 is not zeroes (otherwise anssi aes breaks!!)
 	if(nbytes>18){
 		if(ba[18]==0x00){
-			while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-			randomNumber= RNG_GetRandomNumber();
+			randomNumber= entropy_get_word();
 			ba[18]=(randomNumber&0x000000FF);
 		}
 	}
@@ -19,12 +19,14 @@
 #include "stm32f4xx_spi.h"
 #include "stm32f4xx_hash.h"
 
-//USB libraries
+//USB libraries (the host simulator only talks over its pty/socket)
+#ifndef PINATA_HOST_SIMULATOR
 #include "usbd_cdc_core.h"
 #include "usbd_usr.h"
 #include "usbd_desc.h"
 #include "usbd_cdc_vcp.h"
 #include "usb_dcd_int.h"
+#endif
 
 //Crypto libraries - software implementations
 #ifndef VARIANT_PQC
@@ -35,10 +37,13 @@
 #include "swAES/aes.h"
 #include "swmAES/maes.h"
 #include "swAES_Ttables/rijndael.h"
+#include "swAES_TtablesAsm/aes_ttable.h"
+#include "swAES_Fixsliced/aes_fixsliced.h"
 #include "swAES256/aes256.h"
 #include "sm4/sm4.h"
 #include "tea/tea.h"
 #include "present/present.h"
+#include "prng/xoshiro.h"
 #include "mldsa/wrapper.h"
 #endif
 
@@ -64,6 +69,7 @@
 #include "debug.h"
 #include "support.h"
 #include "io.h"
+#include "frame.h"
 
 //builtins
 #include <string.h>
@@ -71,11 +77,21 @@
 
 //Definitions for crypto operations
 #define RXBUFFERLENGTH 168 //USART rx buffer for rsa plaintext, up to 168 byte
+#define BATCHBUFFERLENGTH 4096 //Blocks of one CMD_BATCH request, e.g. 256 AES or 512 DES blocks
+#define USARTRXRINGLENGTH 1024 //USART3 DMA receive ring: how far the host may send ahead of the firmware; a power of 2
+#define USARTTXBUFFERLENGTH 256 //USART3 DMA transmit buffer; longer replies are sent in pieces
+#define FIRMWARE_VERSION_MAJOR 4 //Reported by CMD_GET_CODE_REV and CMD_GET_CAPABILITIES
+#define FIRMWARE_VERSION_MINOR 0
 #define AES128LENGTHINBYTES 16 //128 bit == 16byte
 #define MAXAESROUNDS 14 //AES256 does 14 rounds, AES 128 does 10 rounds
 
 // Useful definitions
+#ifdef PINATA_HOST_SIMULATOR
+extern const uint32_t simulatorChipID[3];
+#define STM32F4ID simulatorChipID //The host simulator reports a fixed UID
+#else
 #define STM32F4ID ((uint32_t *)0x1FFF7A10) //Address for reading the STM32F4 unique chip ID (UID)
+#endif
 #ifndef max
 #define max(a,b)            (((a) > (b)) ? (a) : (b))
 #endif
@@ -142,12 +158,35 @@
 #define CMD_SWAES128_ENC 0xAE
 #define CMD_SWAES128_DEC 0xEA
 #define CMD_SWAES128SPI_ENC 0xCE
+
+/// Choose how the software AES128 commands (swAES: CMD_SWAES128_ENC, _DEC, _ENC_MISALIGNED, _ENC_DUMMYROUNDS,
+/// CMD_SWAES128SPI_ENC and CMD_SWAES128_ENCRYPT_DOUBLECHECK) get their round keys. By default they reuse the round
+/// keys computed by CMD_AES128_KEYCHANGE (and at boot); per-call expansion runs the key schedule again before every
+/// block, outside the trigger window, for attacks on the key schedule.
+///
+/// Expected Input:
+///   mode (1 byte): AES128_KEY_EXPANSION_CACHED or AES128_KEY_EXPANSION_PER_CALL (see swAES/aes.h)
+///
+/// Output:
+///   the mode in use (1 byte); unknown modes leave it unchanged
+#define CMD_SWAES128_SET_KEY_EXPANSION 0xE8
 #define CMD_SWAES256_ENC 0x60
 #define CMD_SWAES256_DEC 0x61
 #define CMD_SWDES_ENC_RND_DELAYS 0x4A
 #define CMD_SWDES_ENC_RND_SBOX 0x4B
 #define CMD_SWAES128_ENC_MASKED 0x73
 #define CMD_SWAES128_DEC_MASKED 0x83
+
+/// Choose how often the masked AES128 commands (swmAES: CMD_SWAES128_ENC_MASKED and _DEC_MASKED) draw new masks
+/// and compute a new masked S-box. The masks for the next blocks are always prepared after a block, outside the
+/// trigger window, so the trigger window only holds the masked cipher. By default every block gets new masks.
+///
+/// Expected Input:
+///   interval in blocks (2 bytes, MSByte first); 0 keeps the interval in use
+///
+/// Output:
+///   the interval in use (2 bytes, MSByte first)
+#define CMD_SWAES128_SET_MASK_REFRESH 0xE9
 #define CMD_SWAES128_ENC_RNDDELAYS 0x75
 #define CMD_SWAES128_ENC_RNDSBOX 0x85
 #define CMD_SWSM4_ENC 0x54
@@ -248,6 +287,31 @@
 #define CMD_SWAES128TTABLES_ENC 0x41
 #define CMD_SWAES128TTABLES_DEC 0x50
 
+/// Software AES128 with a single T-table in Thumb-2 assembly (swAES_TtablesAsm), with the key of CMD_AES128_KEYCHANGE.
+/// The _SRAM_ variants look the table up in SRAM, which has no cache, so their timing does not depend on the data.
+/// The others look it up in flash through the data cache of the ART accelerator: a cache-timing target.
+///
+/// Expected Input:
+///   16 bytes of plaintext (_ENC) or ciphertext (_DEC)
+///
+/// Output:
+///   16 bytes of ciphertext (_ENC) or plaintext (_DEC)
+#define CMD_SWAES128TTABLESASM_ENC 0x42
+#define CMD_SWAES128TTABLESASM_SRAM_ENC 0x43
+#define CMD_SWAES128TTABLESASM_DEC 0x51
+#define CMD_SWAES128TTABLESASM_SRAM_DEC 0x52
+
+/// Software AES128 in constant time, fixsliced (swAES_Fixsliced): two blocks per command and per trigger window,
+/// with the key of CMD_AES128_KEYCHANGE. Also two blocks per block of CMD_BATCH.
+///
+/// Expected Input:
+///   two blocks of plaintext (_ENC) or ciphertext (_DEC), 16 bytes each
+///
+/// Output:
+///   the two blocks of ciphertext (_ENC) or plaintext (_DEC)
+#define CMD_SWAES128FIXSLICED_ENC 0x62
+#define CMD_SWAES128FIXSLICED_DEC 0x63
+
 #define CMD_HWDES_ENC 0xBE
 #define CMD_HWDES_DEC 0xEF
 #define CMD_HWTDES_ENC 0xC0
@@ -262,8 +326,47 @@
 
 #define CMD_CRYPTOLOOP 0xB1
 
+/// Run a software block cipher on a batch of blocks, each in its own trigger window.
+///
+/// Expected Input:
+///   sub-command byte (CMD_SWDES_*, CMD_SWTDES_*, CMD_SWAES128_*, CMD_SWAES128TTABLES_*, CMD_SWAES128TTABLESASM_*,
+///   CMD_SWAES128FIXSLICED_*, CMD_SWAES256_*, CMD_SWSM4_*, CMD_PRESENT*: the commands flagged COMMAND_BATCHABLE by
+///   CMD_GET_COMMANDS), block count (2 bytes, MSByte first), inter-block gap in busy-wait iterations (2 bytes, MSByte
+///   first), then the input blocks (at most BATCHBUFFERLENGTH bytes)
+///
+/// Output:
+///   the output blocks, once all blocks are done; "BadCmd" for an unknown sub-command or too many blocks
+#define CMD_BATCH 0xB0
+
+/// Like CMD_BATCH, but the input blocks are generated on the board from a seed with xoshiro128**
+/// (see prng/xoshiro.h), so the host can regenerate them instead of sending them.
+///
+/// Expected Input:
+///   sub-command byte, block count (2 bytes, MSByte first), inter-block gap (2 bytes, MSByte first),
+///   mode byte (BATCH_MODE_*), seed (16 bytes)
+///
+/// Output:
+///   BATCH_MODE_OUTPUTS: the output blocks, once all blocks are done (at most BATCHBUFFERLENGTH bytes)
+///   BATCH_MODE_HASH: the 32-bit FNV-1a hash of all output blocks in order (4 bytes, MSByte first)
+///   "BadCmd" for an unknown sub-command or mode, or too many blocks
+#define CMD_BATCH_SEEDED 0xB2
+#define BATCH_MODE_OUTPUTS 0x00
+#define BATCH_MODE_HASH 0x01
+#define FNV1A_OFFSET_BASIS 0x811C9DC5
+#define FNV1A_PRIME 0x01000193
+
 #define CMD_GET_RANDOM_FROM_TRNG 0x11
 
+/// Dump raw TRNG output for statistical tests on the host (e.g. NIST SP 800-22 or dieharder). The bytes are the words
+/// of the entropy pool that feeds the countermeasures (see rng.h), MSByte first, without any conditioning.
+///
+/// Expected Input:
+///   number of bytes (2 bytes, MSByte first)
+///
+/// Output:
+///   that many random bytes
+#define CMD_DUMP_TRNG 0x12
+
 #define CMD_TDES_KEYCHANGE 0xC7
 #define CMD_DES_KEYCHANGE 0xD7
 #define CMD_AES128_KEYCHANGE 0xE7
@@ -286,13 +389,101 @@
 #define CMD_CHANGE_CLK_SPEED 0xF2
 #define CMD_SET_EXTERNAL_CLOCK 0xF3
 
+/// Switch the baud rate of USART3.
+///
+/// Expected Input:
+///   baud rate (4 bytes, MSByte first)
+///
+/// Output:
+///   at the old rate: the baud rate USART3 generates for it (4 bytes, MSByte first), or 0 if the APB1 clock cannot
+///   generate it within 2%, in which case nothing changes. The board then switches and waits
+///   BAUD_CONFIRM_TIMEOUT_MS for a BAUD_CONFIRM byte at the new rate, which it answers with BAUD_CONFIRM.
+///   Without it, the board goes back to USART_DEFAULT_BAUDRATE. Over USB the baud rate is meaningless, but the
+///   board takes the same steps.
+#define CMD_SET_BAUD_RATE 0xF4
+#define USART_DEFAULT_BAUDRATE 115200
+#define BAUD_CONFIRM 0x55
+#define BAUD_CONFIRM_TIMEOUT_MS 500
+
+/// Switch between the legacy protocol and framed mode (see frame.h). The board starts in PROTOCOL_LEGACY.
+///
+/// Expected Input:
+///   protocol (1 byte): PROTOCOL_LEGACY or PROTOCOL_FRAMED
+///
+/// Output:
+///   the protocol in use for the next command (1 byte), still in the protocol of this command; unknown protocols
+///   leave it unchanged. In framed mode, CMD_SET_BAUD_RATE takes its BAUD_CONFIRM byte outside any frame and sends
+///   its answer as a second response frame.
+#define CMD_SET_PROTOCOL 0xF5
+
+/// List the commands this firmware build implements, from its command registry.
+///
+/// Expected Input:
+///   None
+///
+/// Output:
+///   number of commands (2 bytes, MSByte first), then 6 bytes per command in opcode order: command byte, flags
+///   (COMMAND_*), input length (2 bytes, MSByte first) and output length (2 bytes, MSByte first). Lengths that
+///   depend on the request are COMMAND_LENGTH_VARIABLE; lengths exclude the command byte.
+#define CMD_GET_COMMANDS 0xF6
+
+/// Report the CPU cycles between the rising and falling trigger edge of the last triggered operation, sampled from
+/// the DWT cycle counter by BEGIN/END_INTERESTING_STUFF (see trigger.h). Only in builds with PINATA_CYCLE_COUNT
+/// (cmake -DCYCLE_COUNT=ON); other builds answer it like an unknown command.
+///
+/// Expected Input:
+///   None
+///
+/// Output:
+///   cycle count (4 bytes, MSByte first), then the clock speed it was counted at in MHz (1 byte)
+#define CMD_GET_LAST_CYCLES 0xF8
+
+/// Describe this firmware build in a single reply, so that a host can tell what a board supports in one round trip.
+///
+/// Expected Input:
+///   None
+///
+/// Output (lengths and flags MSByte first):
+///   firmware version: major (1 byte) and minor (1 byte), like CMD_GET_CODE_REV
+///   build flags (2 bytes, CAPABILITY_*)
+///   receive limits: USART3 receive ring (2 bytes, how far the host may send ahead over USART3), largest request
+///   frame payload (2 bytes, see frame.h) and CMD_BATCH buffer (2 bytes, 0 without CMD_BATCH)
+///   command bitmap (32 bytes): bit (cmd % 8) of byte (cmd / 8) is set for each command in the registry
+///   number of keys the host can set (1 byte), then 5 bytes per key: the command that sets it, key length (2 bytes)
+///   and private key length (2 bytes; the key length is the public key length then, 0 for symmetric keys)
+#define CMD_GET_CAPABILITIES 0xF9
+#define CAPABILITIES_HEADER_LENGTH 43 //Everything up to the key sizes
+#define CAPABILITY_VARIANT_PQC 0x0001
+#define CAPABILITY_HW_CRYPTO 0x0002
+#define CAPABILITY_RANDOM_SIGNING 0x0004 //ML-DSA signs with randomness (cmake -DRANDOM_SIGNING=ON)
+#define CAPABILITY_CYCLE_COUNT 0x0008 //CMD_GET_LAST_CYCLES is available (cmake -DCYCLE_COUNT=ON)
+#define CAPABILITY_HOST_SIMULATOR 0x0010 //The firmware runs in PinataSimulator, not on a board
+
 
 #define CMD_UNKNOWN 0xFF
 
+//Command registry: the main loop runs command byte cmd with commands[cmd].handler; empty entries are unknown commands
+#define COMMAND_LENGTH_VARIABLE 0xFFFF //The length depends on the request, e.g. on a length prefix or a sub-command
+#define COMMAND_TRIGGER 0x01 //The command raises the trigger around its operation
+#define COMMAND_BATCHABLE 0x02 //The command can be a sub-command of CMD_BATCH and CMD_BATCH_SEEDED; its input length is the block size
+#define COMMAND_IN_PLACE 0x04 //The block operation leaves its output in the input block instead of in output
+
+typedef struct {
+	void (*handler)(uint8_t cmd); //Reads the input, runs the command and sends the output
+	uint16_t inputLength; //Bytes the command reads after its command byte
+	uint16_t outputLength; //Bytes the command sends back
+	uint8_t flags; //COMMAND_*
+	void (*block)(uint8_t *block, uint8_t *output); //Batchable commands: the operation on one block, trigger included
+} command_t;
+
+extern const command_t commands[256];
+
 //extern STRUCT_AES aes_struct;
 
+#ifndef PINATA_HOST_SIMULATOR
 // USB data must be 4 byte aligned if DMA is enabled. This macro handles the alignment, if necessary
 __ALIGN_BEGIN USB_OTG_CORE_HANDLE  USB_OTG_dev_main __ALIGN_END;
+#endif
 
 //Additional helper functions
 void fillBufferWithRandomNumbers(uint32_t nbytes, uint8_t* ba);
@@ -300,5 +491,7 @@ void fillBufferWithRandomNumbers(uint32_t nbytes, uint8_t* ba);
 // Implicit declarations
 void setExternalClock(uint8_t source);
 void setClockSpeed(uint8_t speed);
+uint32_t usart_achievable_baud_rate(uint32_t baudRate);
+void usart_set_baud_rate(uint32_t baudRate);
 
 #endif
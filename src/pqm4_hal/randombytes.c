@@ -2,24 +2,19 @@
 #include "../rng.h" // implement pqm randombytes in terms of our own random functions
 #include <string.h>
 
-static uint32_t rng_get_random_internal() {
-    while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-    return RNG_GetRandomNumber();
-}
-
 int randombytes(uint8_t *output, size_t n) {
     uint32_t randomness;
-    RNG_Enable();
-    while (n >= sizeof(uint32_t)) {
-        randomness = rng_get_random_internal();
-        memcpy(output, &randomness, sizeof(uint32_t));
-        n -= sizeof(uint32_t);
-        output += sizeof(uint32_t);
-    }
-    if (n > 0) {
-        randomness = rng_get_random_internal();
-        memcpy(output, &randomness, n);
+    size_t taken;
+    while (n > 0) {
+        // Whatever the entropy pool holds first; wait for the TRNG only once it has run dry
+        taken = entropy_get(output, n);
+        if (taken == 0) {
+            randomness = entropy_get_word();
+            taken = n < sizeof(uint32_t) ? n : sizeof(uint32_t);
+            memcpy(output, &randomness, taken);
+        }
+        n -= taken;
+        output += taken;
     }
-    RNG_Disable();
     return 0;
 }
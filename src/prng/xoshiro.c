@@ -0,0 +1,56 @@
+#include "xoshiro.h"
+
+static inline uint32_t rotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+void xoshiro128_seed(xoshiro128_ctx_t *ctx, const uint8_t seed[XOSHIRO128_SEED_LEN_BYTES])
+{
+	int i;
+
+	// The seed is four little-endian words
+	for (i = 0; i < 4; i++)
+	{
+		ctx->s[i] = (uint32_t)seed[4 * i] | ((uint32_t)seed[4 * i + 1] << 8) |
+		            ((uint32_t)seed[4 * i + 2] << 16) | ((uint32_t)seed[4 * i + 3] << 24);
+	}
+	// The all-zero state is a fixed point of the generator
+	if ((ctx->s[0] | ctx->s[1] | ctx->s[2] | ctx->s[3]) == 0)
+	{
+		ctx->s[0] = 1;
+	}
+}
+
+uint32_t xoshiro128_next(xoshiro128_ctx_t *ctx)
+{
+	uint32_t *s = ctx->s;
+	const uint32_t result = rotl(s[1] * 5, 7) * 9;
+	const uint32_t t = s[1] << 9;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 11);
+
+	return result;
+}
+
+void xoshiro128_get_bytes(xoshiro128_ctx_t *ctx, uint8_t *out_buf, int n_bytes)
+{
+	int i;
+	uint32_t word = 0;
+
+	// Every output word is used least significant byte first
+	for (i = 0; i < n_bytes; i++)
+	{
+		if ((i & 3) == 0)
+		{
+			word = xoshiro128_next(ctx);
+		}
+		out_buf[i] = (uint8_t)word;
+		word >>= 8;
+	}
+}
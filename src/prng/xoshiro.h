@@ -0,0 +1,20 @@
+#ifndef _XOSHIRO_H_
+#define _XOSHIRO_H_
+
+#include <stdint.h>
+
+#define XOSHIRO128_SEED_LEN_BYTES 16
+
+//
+// xoshiro128** (Blackman and Vigna): a small and fast generator for reproducible test inputs. Not for secrets: the
+// whole sequence follows from the seed, which is exactly what lets the host regenerate it.
+//
+typedef struct {
+	uint32_t s[4];
+} xoshiro128_ctx_t;
+
+void xoshiro128_seed(xoshiro128_ctx_t *ctx, const uint8_t seed[XOSHIRO128_SEED_LEN_BYTES]);
+uint32_t xoshiro128_next(xoshiro128_ctx_t *ctx);
+void xoshiro128_get_bytes(xoshiro128_ctx_t *ctx, uint8_t *out_buf, int n_bytes);
+
+#endif //_XOSHIRO_H_
@@ -1,11 +1,139 @@
 #include "rng.h"
+#include <string.h>
+#ifndef PINATA_HOST_SIMULATOR
+#include "misc.h"
+#endif
 
-void RNG_Enable(void) {
-    RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_RNG, ENABLE);
-    /* RNG Peripheral enable */
-    RNG_Cmd(ENABLE);
+//Written by the refill only (entropyHead) and by the draws only (entropyTail); both run freely and wrap together
+static uint32_t entropyPool[ENTROPY_POOL_WORDS];
+static volatile uint32_t entropyHead = 0;
+static volatile uint32_t entropyTail = 0;
+
+//Move the words the TRNG has ready into the pool, as long as there is room
+static void entropy_refill(void) {
+	while ((uint32_t)(entropyHead - entropyTail) < ENTROPY_POOL_WORDS && RNG_GetFlagStatus(RNG_FLAG_DRDY) == SET) {
+		entropyPool[entropyHead & (ENTROPY_POOL_WORDS - 1)] = RNG_GetRandomNumber();
+		entropyHead++;
+	}
+}
+
+#ifdef PINATA_HOST_SIMULATOR
+
+//There are no interrupts on the host: the pool is topped up whenever it is drawn from
+static void entropy_resume(void) {
+	entropy_refill();
+}
+
+void entropy_init(void) {
+	RNG_Cmd(ENABLE);
+	entropy_refill();
+}
+
+void entropy_fill(void) {
+	entropy_refill();
+}
+
+#else
+
+//Restart the generator after a seed error (RM0090, RNG error management); returns 1 if there was one
+static int entropy_seed_error(void) {
+	if (RNG_GetITStatus(RNG_IT_SEI) == RESET) {
+		return 0;
+	}
+	RNG_ClearITPendingBit(RNG_IT_SEI);
+	RNG_Cmd(DISABLE);
+	RNG_Cmd(ENABLE);
+	return 1;
+}
+
+//Start the generator and let the RNG interrupt top the pool up again
+static void entropy_resume(void) {
+	RNG_Cmd(ENABLE);
+	RNG_ITConfig(ENABLE);
+}
+
+void entropy_fill(void) {
+	if ((uint32_t)(entropyHead - entropyTail) == ENTROPY_POOL_WORDS) {
+		return;
+	}
+	RNG_ITConfig(DISABLE);
+	RNG_Cmd(ENABLE);
+	while ((uint32_t)(entropyHead - entropyTail) < ENTROPY_POOL_WORDS) {
+		entropy_seed_error();
+		entropy_refill();
+	}
+	RNG_Cmd(DISABLE);
+	//A word may have become ready before the interrupt was masked
+	NVIC_ClearPendingIRQ(HASH_RNG_IRQn);
+}
+
+void entropy_init(void) {
+	NVIC_InitTypeDef NVIC_InitStructure;
+
+	RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_RNG, ENABLE);
+	//Lowest priority: the pool must never hold up the USB or USART interrupts
+	NVIC_InitStructure.NVIC_IRQChannel = HASH_RNG_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 3;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 3;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+	RNG_ITConfig(ENABLE);
+	RNG_Cmd(ENABLE);
+}
+
+//RNG IRQ handler: a word is ready (DRDY) or the generator reported an error
+void HASH_RNG_IRQHandler(void) {
+	if (entropy_seed_error()) {
+		return;
+	}
+	if (RNG_GetITStatus(RNG_IT_CEI) == SET) {
+		//Clock error: the RNG clock was too slow for a moment; the generator carries on by itself
+		RNG_ClearITPendingBit(RNG_IT_CEI);
+	}
+	entropy_refill();
+	if ((uint32_t)(entropyHead - entropyTail) == ENTROPY_POOL_WORDS) {
+		//Full: stop the generator too, so that its noise source is quiet until the next draw
+		RNG_ITConfig(DISABLE);
+		RNG_Cmd(DISABLE);
+	}
+}
+
+#endif //PINATA_HOST_SIMULATOR
+
+size_t entropy_get(uint8_t *buf, size_t len) {
+	size_t copied = 0;
+	uint32_t word;
+	size_t n;
+
+	while (copied < len && entropyHead != entropyTail) {
+		word = entropyPool[entropyTail & (ENTROPY_POOL_WORDS - 1)];
+		entropyTail++;
+		n = (len - copied) < sizeof(word) ? (len - copied) : sizeof(word);
+		memcpy(buf + copied, &word, n);
+		copied += n;
+	}
+	entropy_resume();
+	return copied;
 }
 
-void RNG_Disable(void) {
-    RCC_AHB2PeriphClockCmd(RCC_AHB2Periph_RNG, DISABLE);
+uint32_t entropy_get_word(void) {
+	uint32_t word;
+
+	while (entropyHead == entropyTail) {
+		entropy_resume();
+	}
+	word = entropyPool[entropyTail & (ENTROPY_POOL_WORDS - 1)];
+	entropyTail++;
+	entropy_resume();
+	return word;
+}
+
+void entropy_delay(uint32_t range) {
+	volatile uint32_t i;
+
+	if (range == 0) {
+		return;
+	}
+	for (i = entropy_get_word() % range; i > 0; i--) {
+	}
 }
@@ -4,8 +4,33 @@
 #include "stm32f4xx_rng.h"
 #include "stm32f4xx_rcc.h"
 #include <stddef.h>
+#include <stdint.h>
 
-void RNG_Enable(void);
-void RNG_Disable(void);
+//Entropy pool: a ring of TRNG words that the RNG interrupt keeps full in the background, so that the countermeasures
+//(masks, random delays and S-box shuffling, RSA blinding, ML-DSA signing) draw randomness without waiting for the
+//peripheral. While the pool is full the generator is stopped and its interrupt masked; every draw starts both again.
+//BEGIN_INTERESTING_STUFF tops the pool up first (entropy_fill()), so a trigger window only sees RNG activity once
+//the operation itself draws from the pool. The words are raw TRNG output, in the order the peripheral produced them.
+#define ENTROPY_POOL_WORDS 64 //A power of 2
+
+//entropy_init: start the TRNG and its interrupt; the pool fills while the rest of the board boots
+void entropy_init(void);
+
+//entropy_fill: wait for the TRNG until the pool is full, then stop it; returns at once when the pool is full
+void entropy_fill(void);
+
+//entropy_get: copy up to len bytes from the pool into buf without waiting for the TRNG; returns the number of bytes
+//copied, 0 when the pool is empty. A word is used up even when only part of it is copied.
+size_t entropy_get(uint8_t *buf, size_t len);
+
+//entropy_get_word: the next word of the pool; waits for the TRNG only when the pool has run dry
+uint32_t entropy_get_word(void);
+
+//Loop iterations of entropy_delay for each unit of delay of the random delay countermeasures. They used to draw TRNG
+//words until one was divisible by the unit count, a mean of that many words of about 140 CPU cycles each at 168 MHz.
+#define RANDOM_DELAY_ITERATIONS 48
+
+//entropy_delay: busy-wait a random number of loop iterations between 0 and range - 1
+void entropy_delay(uint32_t range);
 
 #endif //PINATABOARD_RNG_H
@@ -1,4 +1,6 @@
 #include "rsa.h"
+#include "trigger.h"
+#include "rng.h"
 
 struct private_key_t {
 
@@ -208,12 +210,11 @@ static rsa_sfm_implementation_type_t implementationType;
 
 static DIGIT_T rand_between(DIGIT_T lower, DIGIT_T upper);
 static DIGIT_T rand_between(DIGIT_T lower, DIGIT_T upper)
-/* Returns a single pseudo-random digit between lower and upper.
-   Uses rand(). Assumes srand() already called. */
+/* Returns a single random digit between lower and upper.
+   Uses the TRNG entropy pool. */
 {
 	DIGIT_T d, range;
-	unsigned char *bp;
-	int i, nbits;
+	int nbits;
 	DIGIT_T mask;
 
 	if (upper <= lower) return lower;
@@ -221,12 +222,8 @@ static DIGIT_T rand_between(DIGIT_T lower, DIGIT_T upper)
 
 	do
 	{
-		/* Generate a random DIGIT byte-by-byte using rand() */
-		bp = (unsigned char *)&d;
-		for (i = 0; i < sizeof(DIGIT_T); i++)
-		{
-			bp[i] = (unsigned char)(rand() & 0xFF);
-		}
+		/* Draw a random DIGIT from the entropy pool */
+		d = entropy_get_word();
 
 		/* Trim to next highest bit above required range */
 		mask = HIBITMASK;
@@ -493,7 +490,7 @@ void rsa_sfm_decrypt(){
 		mpAdd(d_temp,d_rand,d_temp,max_len+1); //d_temp = D + d_rand
 	}
 
-	GPIOC->BSRRL = GPIO_Pin_2; //Trigger on
+	BEGIN_INTERESTING_STUFF; //Trigger on
 	disable_clocks();
 
 	// decrypt m1 = c^(D+r.phi(N)) mod N (modular exponentiation)
@@ -503,7 +500,7 @@ void rsa_sfm_decrypt(){
 		m[i] = plaintext[i];
 	}
 	enable_clocks();
-	GPIOC->BSRRH = GPIO_Pin_2; //Trigger off
+	END_INTERESTING_STUFF; //Trigger off
 }
 
 
@@ -521,7 +518,7 @@ void rsa_decrypt(){
 	mpSetZero(m, MAX_FIXED_DIGITS/2);
 
 	// Trigger goes high on trigger pin (PC2) and PH2
-	GPIOC->BSRRL = GPIO_Pin_2;
+	BEGIN_INTERESTING_STUFF;
 	GPIOH->BSRRL = GPIO_Pin_2;
 
 	// m1 = c^dP mod p (Exponentiation with dP)
@@ -535,7 +532,7 @@ void rsa_decrypt(){
 	mpModExpL2R(m2, c, priv_key.dq, priv_key.q, max_len);
 
 	//Triggers goes down on trigger pin and also on PH3
-	GPIOC->BSRRH = GPIO_Pin_2;
+	END_INTERESTING_STUFF;
 	GPIOH->BSRRH = GPIO_Pin_3;
 
 	// tmp = m1 + p - m2 TODO: What if m2 > m1 ????
@@ -1,4 +1,5 @@
 #include "rsacrt.h"
+#include "trigger.h"
 
 struct private_key_t {
 	// Parameters need for ExpMod operation
@@ -255,7 +256,7 @@ void rsa_crt_decrypt(){
 	mpSetZero(m, MAX_FIXED_DIGITS/2);
 
 	// Trigger goes high on trigger pin (PC2) and PH2
-	GPIOC->BSRRL = GPIO_Pin_2;
+	BEGIN_INTERESTING_STUFF;
 	GPIOH->BSRRL = GPIO_Pin_2;
 
 	// m1 = c^dP mod p_crt (Exponentiation with dP)
@@ -269,7 +270,7 @@ void rsa_crt_decrypt(){
 	mpModExpL2R(m2, c, priv_key_crt.dq_crt, priv_key_crt.q_crt, max_len);
 
 	//Triggers goes down on trigger pin and also on PH3
-	GPIOC->BSRRH = GPIO_Pin_2;
+	END_INTERESTING_STUFF;
 	GPIOH->BSRRH = GPIO_Pin_3;
 
 	// tmp = m1 + p_crt - m2 TODO: What if m2 > m1 ????
@@ -9,6 +9,7 @@
 #include "aes.h"
 #include "stm32f4xx.h" //For GPIO pins addressing (trigger signal)
 #include "stm32f4xx_gpio.h"//For GPIO pins addressing (trigger signal)
+#include "trigger.h"
 #include "stm32f4xx_rng.h"
 #include "rng.h"
 
@@ -38,9 +39,12 @@ static uint8_t* in, *out, state[4][4], stated[4][4];
 // The array that stores the round keys.
 static uint8_t RoundKey[176];
 
-// The Key input to the AES Program
+// The Key input to the AES Program: the key RoundKey was expanded from
 static uint8_t* Key;
 
+// AES128_KEY_EXPANSION_CACHED reuses RoundKey across calls, see AES128_set_key_expansion()
+static uint8_t keyExpansion = AES128_KEY_EXPANSION_CACHED;
+
 // The lookup-tables are marked const so they can be placed in read-only storage instead of RAM
 // The numbers below can be computed dynamically trading ROM for RAM - 
 // This can be useful in (embedded) bootloader applications, where ROM is often limited.
@@ -586,48 +590,73 @@ static void InvCipher()
 }
 
 
+// The round keys must be ready before encryption: expanding them is left out of the trigger window either way.
+// In the cached mode, they are only expanded again when the key comes from another buffer than the last time.
+static void PrepareRoundKeys(uint8_t* key)
+{
+  if (keyExpansion == AES128_KEY_EXPANSION_PER_CALL || key != Key)
+  {
+    Key = key;
+    KeyExpansion();
+  }
+}
+
+
 /*****************************************************************************/
 /* Public functions:                                                         */
 /*****************************************************************************/
 
-void AES128_ECB_encrypt(uint8_t* input, uint8_t* key, uint8_t *output)
+void AES128_init(uint8_t* key)
 {
-  // Copy the Key and CipherText
   Key = key;
+  KeyExpansion();
+}
+
+uint8_t AES128_set_key_expansion(uint8_t mode)
+{
+  switch (mode)
+  {
+    case AES128_KEY_EXPANSION_CACHED:
+    case AES128_KEY_EXPANSION_PER_CALL:
+      keyExpansion = mode;
+      break;
+    default:
+      // Leave unchanged
+      break;
+  }
+  return keyExpansion;
+}
+
+void AES128_ECB_encrypt(uint8_t* input, uint8_t* key, uint8_t *output)
+{
+  // Copy the CipherText and get the round keys of Key
   in = input;
   out = output;
-
-  // The KeyExpansion routine must be called before encryption.
-  KeyExpansion();
+  PrepareRoundKeys(key);
 
   // The next function call encrypts the PlainText with the Key using AES algorithm.
-  GPIOC->BSRRL = GPIO_Pin_2; // Trigger goes high in pin PC2
+  BEGIN_INTERESTING_STUFF; // Trigger goes high in pin PC2
   Cipher();
-  GPIOC->BSRRH = GPIO_Pin_2; // Trigger goes low in pin PC2
+  END_INTERESTING_STUFF; // Trigger goes low in pin PC2
 }
 
 void AES128_ECB_decrypt(uint8_t* input, uint8_t* key, uint8_t *output)
 {
-  Key = key;
   in = input;
   out = output;
+  PrepareRoundKeys(key);
 
-  KeyExpansion();
-
-  GPIOC->BSRRL = GPIO_Pin_2; // Trigger goes high in pin PC2
+  BEGIN_INTERESTING_STUFF; // Trigger goes high in pin PC2
   InvCipher();
-  GPIOC->BSRRH = GPIO_Pin_2; // Trigger goes low in pin PC2
+  END_INTERESTING_STUFF; // Trigger goes low in pin PC2
 }
 
 void AES128_ECB_encrypt_noTrigger(uint8_t* input, uint8_t* key, uint8_t *output)
 {
-  // Copy the Key and CipherText
-  Key = key;
+  // Copy the CipherText and get the round keys of Key
   in = input;
   out = output;
-
-  // The KeyExpansion routine must be called before encryption.
-  KeyExpansion();
+  PrepareRoundKeys(key);
 
   // The next function call encrypts the PlainText with the Key using AES algorithm.
   Cipher();
@@ -636,45 +665,32 @@ void AES128_ECB_encrypt_noTrigger(uint8_t* input, uint8_t* key, uint8_t *output)
 
 
 void AES128_ECB_encrypt_misaligned(uint8_t* input, uint8_t* key, uint8_t *output){
-	uint32_t randomNumber;
-	// Copy the Key and CipherText
-	Key = key;
+	// Copy the CipherText and get the round keys of Key
 	in = input;
 	out = output;
-
-	// The KeyExpansion routine must be called before encryption.
-	KeyExpansion();
+	PrepareRoundKeys(key);
 
 	//Random delay
-	RNG_Enable();
-	GPIOC->BSRRL = GPIO_Pin_2; // Trigger goes high in pin PC2
-	do{
-		//Get a random number
-		while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-		randomNumber= RNG_GetRandomNumber();
-	} while((randomNumber%5)!=0);
-	RNG_Disable();
+	BEGIN_INTERESTING_STUFF; // Trigger goes high in pin PC2
+	entropy_delay(5 * RANDOM_DELAY_ITERATIONS);
 
 	// The next function call encrypts the PlainText with the Key using AES algorithm.
 
 	Cipher();
-	GPIOC->BSRRH = GPIO_Pin_2; // Trigger goes low in pin PC2
+	END_INTERESTING_STUFF; // Trigger goes low in pin PC2
 
 }
 
 void AES128_ECB_encrypt_dummy(uint8_t* input, uint8_t* key, uint8_t *output){
-	  // Copy the Key and CipherText
-	  Key = key;
+	  // Copy the CipherText and get the round keys of Key
 	  in = input;
 	  out = output;
-
-	  // The KeyExpansion routine must be called before encryption.
-	  KeyExpansion();
+	  PrepareRoundKeys(key);
 
 	  // The next function call encrypts the PlainText with the Key using AES algorithm.
-	  GPIOC->BSRRL = GPIO_Pin_2; // Trigger goes high in pin PC2
+	  BEGIN_INTERESTING_STUFF; // Trigger goes high in pin PC2
 	  CipherDummy();
-	  GPIOC->BSRRH = GPIO_Pin_2; // Trigger goes low in pin PC2
+	  END_INTERESTING_STUFF; // Trigger goes low in pin PC2
 
 }
 
@@ -683,11 +699,8 @@ uint8_t addDummyOp(uint8_t remainingDummyRounds){
 	uint32_t randomNumber;
 	uint8_t doDummyRound=0;
 	uint8_t safetycheck=0;
-	RNG_Enable();
 	//Get a random number
-	while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-	randomNumber= RNG_GetRandomNumber();
-	RNG_Disable();
+	randomNumber= entropy_get_word();
 	//Dirty check for if number of remainingDummyRounds underflowed
 	safetycheck--;
 	if(remainingDummyRounds==safetycheck){
@@ -3,6 +3,15 @@
 
 #include <stdint.h>
 
+// Key expansion modes, see AES128_set_key_expansion()
+#define AES128_KEY_EXPANSION_CACHED 0x00 //Reuse the round keys of AES128_init()
+#define AES128_KEY_EXPANSION_PER_CALL 0x01 //Expand the key again in every call, e.g. to attack the key schedule
+
+// AES128_init: expand key into the round keys that the functions below reuse; call it again whenever the contents
+// of key change. The functions below expand their key argument themselves when it is another buffer.
+void AES128_init(uint8_t* key);
+// AES128_set_key_expansion: switch between the AES128_KEY_EXPANSION_* modes; returns the mode in use
+uint8_t AES128_set_key_expansion(uint8_t mode);
 void AES128_ECB_encrypt(uint8_t* input, uint8_t* key, uint8_t *output);
 void AES128_ECB_decrypt(uint8_t* input, uint8_t* key, uint8_t *output);
 void AES128_ECB_encrypt_noTrigger(uint8_t* input, uint8_t* key, uint8_t *output);
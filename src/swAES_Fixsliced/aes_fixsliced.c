@@ -0,0 +1,388 @@
+//Fixsliced AES-128 (see aes_fixsliced.h)
+//
+//The state of two blocks is q[0..7]: q[j] holds bit 7 - j of all 32 bytes, row r of the state in byte r of the word
+//and column c at bits 7 - 2c (first block) and 6 - 2c (second block) of that byte. Rotating a word by 8 bits moves
+//every row up by one; rotating the bytes of a word by 2 bits moves every column by one.
+//ShiftRows is left out of every round. After k rounds, row r of the state sits k * r columns away from its place:
+//the MixColumns of that round gathers each column from there, and round key k is stored with the same offsets.
+//After the last round the rows are two columns off (10 = 2 mod 4), which one fix-up of rows 1 and 3 undoes.
+
+#include "aes_fixsliced.h"
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define BYTE_ROR_2(x) ((((x) >> 2) & 0x3f3f3f3fU) | (((x) & 0x03030303U) << 6))
+#define BYTE_ROR_4(x) ((((x) >> 4) & 0x0f0f0f0fU) | (((x) & 0x0f0f0f0fU) << 4))
+#define BYTE_ROR_6(x) ((((x) >> 6) & 0x03030303U) | (((x) & 0x3f3f3f3fU) << 2))
+
+#define GETU32_LE(p) ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+#define PUTU32_LE(p, v) { (p)[0] = (v); (p)[1] = (v) >> 8; (p)[2] = (v) >> 16; (p)[3] = (v) >> 24; }
+
+//SWAPMOVE: swap the bits of b under mask with the bits of a under mask << n
+#define SWAPMOVE(a, b, mask, n) { \
+	uint32_t tmp = ((b) ^ ((a) >> (n))) & (mask); \
+	(b) ^= tmp; \
+	(a) ^= tmp << (n); \
+}
+
+//transpose: the bit transposition between the bytes of 8 words and the bitsliced state (its own inverse when the
+//steps run backwards)
+static void transpose(uint32_t *q, int inverse) {
+	static const uint32_t masks[3] = { 0x55555555U, 0x33333333U, 0x0f0f0f0fU };
+	int step, i, n;
+
+	for (step = 0; step < 3; step++) {
+		n = inverse ? 2 - step : step;
+		for (i = 0; i < 8; i++) {
+			if (!(i & (1 << n))) SWAPMOVE(q[i | (1 << n)], q[i], masks[n], 1 << n);
+		}
+	}
+}
+
+//packing: the two blocks into the bitsliced state
+static void packing(uint32_t *q, const uint8_t *in0, const uint8_t *in1) {
+	int c;
+
+	for (c = 0; c < 4; c++) {
+		q[2 * c] = GETU32_LE(in0 + 4 * c);
+		q[2 * c + 1] = GETU32_LE(in1 + 4 * c);
+	}
+	transpose(q, 0);
+}
+
+//unpacking: the bitsliced state back into two blocks
+static void unpacking(uint32_t *q, uint8_t *out0, uint8_t *out1) {
+	int c;
+
+	transpose(q, 1);
+	for (c = 0; c < 4; c++) {
+		PUTU32_LE(out0 + 4 * c, q[2 * c]);
+		PUTU32_LE(out1 + 4 * c, q[2 * c + 1]);
+	}
+}
+
+//sbox: the AES S-box on all 32 bytes, with the 113-gate circuit of Boyar and Peralta
+static void sbox(uint32_t *q) {
+	uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+	uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17;
+	uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19, t20, t21, t22;
+	uint32_t t23, t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38, t39, t40, t41, t42, t43;
+	uint32_t t44, t45, t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59, t60, t61, t62, t63, t64;
+	uint32_t t65, t66, t67;
+
+	x0 = q[0]; x1 = q[1]; x2 = q[2]; x3 = q[3]; x4 = q[4]; x5 = q[5]; x6 = q[6]; x7 = q[7];
+
+	//Top linear transformation
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	//Non-linear section
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	//Bottom linear transformation
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	q[0] = t59 ^ t63;
+	q[6] = t56 ^ ~t62;
+	q[7] = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	q[3] = t53 ^ t66;
+	q[4] = t51 ^ t66;
+	q[5] = t47 ^ t65;
+	q[1] = t64 ^ ~q[3];
+	q[2] = t55 ^ ~t67;
+}
+
+//inv_affine: the inverse of the affine map of the S-box, on the bytes xored with 0x63; the inverse S-box is
+//inv_affine(sbox(inv_affine(x))) because the inversion in GF(2^8) is its own inverse
+static void inv_affine(uint32_t *q) {
+	uint32_t b0 = ~q[7], b1 = ~q[6], b2 = q[5], b3 = q[4], b4 = q[3], b5 = ~q[2], b6 = ~q[1], b7 = q[0];
+
+	q[0] = b1 ^ b4 ^ b6;
+	q[1] = b0 ^ b3 ^ b5;
+	q[2] = b7 ^ b2 ^ b4;
+	q[3] = b6 ^ b1 ^ b3;
+	q[4] = b5 ^ b0 ^ b2;
+	q[5] = b4 ^ b7 ^ b1;
+	q[6] = b3 ^ b6 ^ b0;
+	q[7] = b2 ^ b5 ^ b7;
+}
+
+static void inv_sbox(uint32_t *q) {
+	inv_affine(q);
+	sbox(q);
+	inv_affine(q);
+}
+
+//xtime: multiply all bytes by x in GF(2^8)
+static void xtime(uint32_t *q) {
+	uint32_t b7 = q[0];
+
+	q[0] = q[1];
+	q[1] = q[2];
+	q[2] = q[3];
+	q[3] = q[4] ^ b7;
+	q[4] = q[5] ^ b7;
+	q[5] = q[6];
+	q[6] = q[7] ^ b7;
+	q[7] = b7;
+}
+
+//MixColumns after k rounds with k = i mod 4: SHIFT1 brings row r + 1 of every column to row r, SHIFT2 row r + 2.
+//The column of row r + 1 sits i columns further, that of row r + 2 2i columns further.
+//Each column becomes 2(a ^ b) ^ b ^ (c ^ d) with b, c and d the rows shifted by 1, 2 and 3, and c ^ d = SHIFT2(a ^ b).
+#define SHIFT1_0(x) ROR(x, 8)
+#define SHIFT2_0(x) ROR(x, 16)
+#define SHIFT1_1(x) BYTE_ROR_6(ROR(x, 8))
+#define SHIFT2_1(x) BYTE_ROR_4(ROR(x, 16))
+#define SHIFT1_2(x) BYTE_ROR_4(ROR(x, 8))
+#define SHIFT2_2(x) ROR(x, 16)
+#define SHIFT1_3(x) BYTE_ROR_2(ROR(x, 8))
+#define SHIFT2_3(x) BYTE_ROR_4(ROR(x, 16))
+
+#define MIXCOLUMNS(i) \
+static void mixcolumns_##i(uint32_t *q) { \
+	uint32_t b[8], t[8]; \
+	int j; \
+	for (j = 0; j < 8; j++) { \
+		b[j] = SHIFT1_##i(q[j]); \
+		t[j] = q[j] ^ b[j]; \
+		q[j] = b[j] ^ SHIFT2_##i(t[j]); \
+	} \
+	xtime(t); \
+	for (j = 0; j < 8; j++) q[j] ^= t[j]; \
+} \
+\
+/*InvMixColumns is MixColumns after a ^= 4(a ^ c)*/ \
+static void inv_mixcolumns_##i(uint32_t *q) { \
+	uint32_t u[8]; \
+	int j; \
+	for (j = 0; j < 8; j++) u[j] = q[j] ^ SHIFT2_##i(q[j]); \
+	xtime(u); \
+	xtime(u); \
+	for (j = 0; j < 8; j++) q[j] ^= u[j]; \
+	mixcolumns_##i(q); \
+}
+
+MIXCOLUMNS(0)
+MIXCOLUMNS(1)
+MIXCOLUMNS(2)
+MIXCOLUMNS(3)
+
+static void add_round_key(uint32_t *q, const uint32_t *rk) {
+	int j;
+
+	for (j = 0; j < 8; j++) q[j] ^= rk[j];
+}
+
+//double_shiftrows: move rows 1 and 3 by two columns, to and from the layout of the last round
+static void double_shiftrows(uint32_t *q) {
+	int j;
+
+	for (j = 0; j < 8; j++) q[j] = (q[j] & 0x00ff00ffU) | (BYTE_ROR_4(q[j]) & 0xff00ff00U);
+}
+
+//sub_word: the S-box on 4 bytes, with the same circuit as the rounds
+static void sub_word(uint8_t *w) {
+	uint32_t q[8];
+	int j, p;
+
+	for (j = 0; j < 8; j++) {
+		q[j] = 0;
+		for (p = 0; p < 4; p++) q[j] |= (uint32_t)((w[p] >> (7 - j)) & 1) << p;
+	}
+	sbox(q);
+	for (p = 0; p < 4; p++) {
+		w[p] = 0;
+		for (j = 0; j < 8; j++) w[p] |= ((q[j] >> p) & 1) << (7 - j);
+	}
+}
+
+void aes128_fixsliced_key_schedule(uint32_t rk[AES128_FIXSLICED_ROUND_KEY_WORDS], const uint8_t key[16]) {
+	uint8_t w[176], shifted[16];
+	uint8_t rcon = 1;
+	int i, k, r, c;
+
+	for (i = 0; i < 16; i++) w[i] = key[i];
+	for (i = 16; i < 176; i += 4) {
+		if (i % 16 == 0) {
+			for (k = 0; k < 4; k++) w[i + k] = w[i - 4 + (k + 1) % 4]; //RotWord
+			sub_word(w + i);
+			w[i] ^= rcon;
+			rcon = (uint8_t)((rcon << 1) ^ (0x1b & -(rcon >> 7)));
+		} else {
+			for (k = 0; k < 4; k++) w[i + k] = w[i - 4 + k];
+		}
+		for (k = 0; k < 4; k++) w[i + k] ^= w[i - 16 + k];
+	}
+	//Round key k with row r moved k * r columns, like the state it is added to
+	for (k = 0; k <= 10; k++) {
+		for (r = 0; r < 4; r++) {
+			for (c = 0; c < 4; c++) shifted[4 * c + r] = w[16 * k + 4 * ((c - (k % 4) * r) & 3) + r];
+		}
+		packing(rk + 8 * k, shifted, shifted);
+	}
+}
+
+void aes128_fixsliced_encrypt(const uint32_t rk[AES128_FIXSLICED_ROUND_KEY_WORDS], const uint8_t in0[16],
+	const uint8_t in1[16], uint8_t out0[16], uint8_t out1[16]) {
+	uint32_t q[8];
+	int k;
+
+	packing(q, in0, in1);
+	add_round_key(q, rk);
+	for (k = 1; k < 9; k += 4) {
+		sbox(q);
+		mixcolumns_1(q);
+		add_round_key(q, rk + 8 * k);
+		sbox(q);
+		mixcolumns_2(q);
+		add_round_key(q, rk + 8 * (k + 1));
+		sbox(q);
+		mixcolumns_3(q);
+		add_round_key(q, rk + 8 * (k + 2));
+		sbox(q);
+		mixcolumns_0(q);
+		add_round_key(q, rk + 8 * (k + 3));
+	}
+	sbox(q);
+	mixcolumns_1(q);
+	add_round_key(q, rk + 8 * 9);
+	sbox(q);
+	add_round_key(q, rk + 8 * 10);
+	double_shiftrows(q);
+	unpacking(q, out0, out1);
+}
+
+void aes128_fixsliced_decrypt(const uint32_t rk[AES128_FIXSLICED_ROUND_KEY_WORDS], const uint8_t in0[16],
+	const uint8_t in1[16], uint8_t out0[16], uint8_t out1[16]) {
+	uint32_t q[8];
+	int k;
+
+	packing(q, in0, in1);
+	double_shiftrows(q);
+	add_round_key(q, rk + 8 * 10);
+	inv_sbox(q);
+	add_round_key(q, rk + 8 * 9);
+	inv_mixcolumns_1(q);
+	inv_sbox(q);
+	for (k = 8; k > 0; k -= 4) {
+		add_round_key(q, rk + 8 * k);
+		inv_mixcolumns_0(q);
+		inv_sbox(q);
+		add_round_key(q, rk + 8 * (k - 1));
+		inv_mixcolumns_3(q);
+		inv_sbox(q);
+		add_round_key(q, rk + 8 * (k - 2));
+		inv_mixcolumns_2(q);
+		inv_sbox(q);
+		add_round_key(q, rk + 8 * (k - 3));
+		inv_mixcolumns_1(q);
+		inv_sbox(q);
+	}
+	add_round_key(q, rk);
+	unpacking(q, out0, out1);
+}
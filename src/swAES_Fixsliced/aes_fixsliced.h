@@ -0,0 +1,21 @@
+#ifndef AES_FIXSLICED_H
+#define AES_FIXSLICED_H
+
+#include <stdint.h>
+
+//Fixsliced AES-128 (Adomnicai and Peyrin, "Fixslicing AES-like Ciphers", TCHES 2021/1): two blocks at a time in
+//eight 32-bit words, one per bit of every byte. The S-box is a boolean circuit and ShiftRows is never computed on
+//the state (MixColumns and the round keys follow the columns instead), so there are no table lookups and no
+//data-dependent branches or memory accesses.
+#define AES128_FIXSLICED_ROUND_KEY_WORDS 88
+
+//aes128_fixsliced_key_schedule: prepare the round keys of key, in the bitsliced layout of the state
+void aes128_fixsliced_key_schedule(uint32_t rk[AES128_FIXSLICED_ROUND_KEY_WORDS], const uint8_t key[16]);
+
+//aes128_fixsliced_encrypt/decrypt: two blocks, in0 and in1 to out0 and out1; the inputs and outputs may overlap
+void aes128_fixsliced_encrypt(const uint32_t rk[AES128_FIXSLICED_ROUND_KEY_WORDS], const uint8_t in0[16],
+	const uint8_t in1[16], uint8_t out0[16], uint8_t out1[16]);
+void aes128_fixsliced_decrypt(const uint32_t rk[AES128_FIXSLICED_ROUND_KEY_WORDS], const uint8_t in0[16],
+	const uint8_t in1[16], uint8_t out0[16], uint8_t out1[16]);
+
+#endif //AES_FIXSLICED_H
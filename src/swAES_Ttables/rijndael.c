@@ -3,7 +3,7 @@
 
 #include "rijndael.h"
 
-typedef unsigned long u32;
+typedef uint32_t u32;
 typedef unsigned char u8;
 
 static const u32 Te0[256] = { 0xc66363a5U, 0xf87c7c84U, 0xee777799U,
@@ -0,0 +1,30 @@
+#ifndef AES_TTABLE_H
+#define AES_TTABLE_H
+
+#include <stdint.h>
+
+//AES-128 with a single T-table, in Thumb-2 assembly (aes_ttable.S): the four table lookups of a column all go to
+//the same 256-word table, and the barrel shifter rotates them into place (Te1..Te3 are rotations of Te0). The last
+//round uses the byte table s: the S-box, or the inverse S-box for decryption.
+typedef struct {
+	uint32_t t[256];
+	uint8_t s[256];
+} aes_ttable_t;
+
+//The tables in flash: reads go through the data cache of the ART accelerator, so their timing depends on the index
+extern const aes_ttable_t aesTTableEnc;
+extern const aes_ttable_t aesTTableDec;
+//Copies of the tables in SRAM, which has no cache: every lookup takes the same time (see aes_ttable_init()). They
+//are in the core coupled memory, the zero wait state SRAM that only the CPU can reach.
+extern aes_ttable_t aesTTableEncSram;
+extern aes_ttable_t aesTTableDecSram;
+
+//aes_ttable_init: copy the tables to SRAM
+void aes_ttable_init(void);
+
+//aes128_ttable_encrypt/decrypt: one block with the key schedule of rijndaelSetupEncrypt/Decrypt(rk, key, 128)
+//(swAES_Ttables) and aesTTableEnc/Dec or their SRAM copies
+void aes128_ttable_encrypt(const uint32_t *rk, const aes_ttable_t *table, const uint8_t in[16], uint8_t out[16]);
+void aes128_ttable_decrypt(const uint32_t *rk, const aes_ttable_t *table, const uint8_t in[16], uint8_t out[16]);
+
+#endif //AES_TTABLE_H
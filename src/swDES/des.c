@@ -330,10 +330,7 @@ void desRandomSboxes(unsigned char key[] , unsigned char data[], DES_MODE mode){
 	uint8_t currSbox=0;
 
 	//Get a random number
-	RNG_Enable();
-	while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-	currSbox=(uint8_t) (RNG_GetRandomNumber() & 0x07);
-	RNG_Disable();
+	currSbox=(uint8_t) (entropy_get_word() & 0x07);
 
 	// left and right halves
 
@@ -690,14 +687,7 @@ void shiftRight( unsigned char k[]){
 }
 
 void randomDelay(unsigned char painLevel){
-	uint32_t randomNumber;
-	RNG_Enable();
-	do{
-		//Get a random number
-		while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-		randomNumber= RNG_GetRandomNumber();
-	} while((randomNumber%painLevel)!=0);
-	RNG_Disable();
+	entropy_delay(painLevel * RANDOM_DELAY_ITERATIONS);
 }
 
 
@@ -706,11 +696,8 @@ uint8_t addDummy(uint8_t remainingDummyRounds){
 	uint32_t randomNumber;
 	uint8_t doDummyRound=0;
 	uint8_t safetycheck=0;
-	RNG_Enable();
 	//Get a random number
-	while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-	randomNumber= RNG_GetRandomNumber();
-	RNG_Disable();
+	randomNumber= entropy_get_word();
 	//Dirty check for if number of remainingDummyRounds underflowed
 	safetycheck--;
 	if(remainingDummyRounds==safetycheck){
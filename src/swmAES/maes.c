@@ -9,6 +9,7 @@
 #include "maes.h"
 #include "stm32f4xx.h" //For GPIO pins addressing (trigger signal)
 #include "stm32f4xx_gpio.h"//For GPIO pins addressing (trigger signal)
+#include "trigger.h"
 #include "stm32f4xx_rng.h"
 #include "rng.h"
 
@@ -22,7 +23,7 @@
 #define NROUNDS 10
 
 uint8_t pick_rand();
-void sbox_lookup(uint8_t [][4],uint8_t *);
+void sbox_lookup(uint8_t [][4],const uint8_t *);
 void key_schedule(uint8_t *,uint8_t);
 void inv_key_schedule(uint8_t *, uint8_t);
 void mix_columns(uint8_t [][4]);
@@ -137,7 +138,37 @@ uint8_t Alogtable[]  = {
 
 //Masks for the data masking implementation
 unsigned char mask1[4],mask2[4];
-uint8_t pgm_read_byte (uint8_t *in)
+
+//One set of masks for maes_encrypt or maes_decrypt, with the S-box masked by them
+typedef struct {
+	uint8_t mask1; //S-box input mask
+	uint8_t mask2; //S-box output mask
+	uint8_t m1[4][4]; //state mask before mixColumns
+	uint8_t m2[4][4]; //state mask after mixColumns (inverse mixColumns for decryption)
+	uint8_t Smasked[256];
+} mask_set_t;
+
+//Double-buffered mask sets of one direction: the cipher uses the active set while the other one is ready to take
+//over, so a refresh never has to compute a masked S-box within the trigger window
+typedef struct {
+	mask_set_t *sets; //two sets
+	uint8_t active; //index of the set in use
+	uint8_t ready; //both sets have been prepared
+	uint16_t uses; //blocks done with the active set
+} mask_engine_t;
+
+#ifndef PINATA_HOST_SIMULATOR
+//The mask sets take more than 1 KB: keep them in the core coupled memory. It is not zeroed at startup, which is
+//fine as every set is prepared before its first use (mask_engine_t.ready).
+#define MASK_SET_SECTION __attribute__((section(".ccmram")))
+#else
+#define MASK_SET_SECTION
+#endif
+
+static mask_set_t encMaskSets[2] MASK_SET_SECTION, decMaskSets[2] MASK_SET_SECTION;
+static mask_engine_t encMaskEngine = { encMaskSets }, decMaskEngine = { decMaskSets };
+static uint16_t maskRefreshBlocks = 1; //see mAES128_set_mask_refresh()
+uint8_t pgm_read_byte (const uint8_t *in)
 {
 	return *in;
 }
@@ -162,7 +193,7 @@ void array_copy (uint8_t *out, uint8_t *in, int len)
 }
 
 //Masked AES
-void maes_encrypt(uint8_t *a, uint8_t *key){
+void maes_encrypt(uint8_t *a, uint8_t *key, const mask_set_t *masks){
 	uint8_t r;
 	uint8_t d[4][4];
 	uint8_t k[4][4];
@@ -170,40 +201,13 @@ void maes_encrypt(uint8_t *a, uint8_t *key){
 	uint8_t i,j;
 
 	array_copy(roundkey,key,16);
-	//Masks
-	uint8_t mask1=0,mask2=0;
-	uint8_t m1[4][4]; //This is the state mask before mixColumns
-	uint8_t m2[4][4]; //state mask after mixColumns
-
-
-	mask1 = pick_rand();
-	mask2 = pick_rand();
-
-	for(i=0;i<4;i++) {
-		for(j=0;j<4;j++)
-		{
-			m2[i][j]=m1[i][j]=pick_rand();
-		}
-	}
+	//Masks, prepared outside the trigger window (see prepare_mask_set())
+	const uint8_t mask1=masks->mask1,mask2=masks->mask2;
+	const uint8_t (*m1)[4]=masks->m1; //This is the state mask before mixColumns
+	const uint8_t (*m2)[4]=masks->m2; //state mask after mixColumns
+	const uint8_t *Smasked=masks->Smasked;
 
-	sbox_mask(Smasked,S,mask1,mask2);
-
-	//Apply mixColumns to mask2
-	mix_columns(m2);
-
-	set_state(d,a);
-	set_state(k,roundkey);
-
-	for(i=0;i<4;i++){
-		for(j=0;j<4;j++){
-
-			d[i][j] ^= m2[i][j];
-			k[i][j] ^= m2[i][j] ^ mask1;
-		}
-	}
-
-
-	//And apply masks everywhere
+	//Apply masks everywhere
 	set_state(d,a);
 	set_state(k,roundkey);
 
@@ -363,13 +367,15 @@ void aes_encrypt(uint8_t *a, uint8_t *key){
 }
 
 //Only masked AES decrypt (no rnd delays or rnd order of sboxes)
-void maes_decrypt(uint8_t *a, uint8_t *key){
+void maes_decrypt(uint8_t *a, uint8_t *key, const mask_set_t *masks){
 	uint8_t r;
 	uint8_t i,j;
 
-	uint8_t mask1=0,mask2=0;
-	uint8_t m1[4][4]; //This is the state mask before mixColumns
-	uint8_t m2[4][4]; //state mask after mixColumns
+	//Masks, prepared outside the trigger window (see prepare_mask_set())
+	const uint8_t mask1=masks->mask1,mask2=masks->mask2;
+	const uint8_t (*m1)[4]=masks->m1; //This is the state mask before mixColumns
+	const uint8_t (*m2)[4]=masks->m2; //state mask after mixColumns
+	const uint8_t *Smasked=masks->Smasked;
 
 	uint8_t d[4][4];
 	uint8_t k[4][4];
@@ -377,19 +383,6 @@ void maes_decrypt(uint8_t *a, uint8_t *key){
 	set_state(d,a);
 	set_state(k,key);
 
-
-	//Prepare masks
-	mask1=pick_rand();
-	mask2=pick_rand();
-	sbox_mask(Smasked, Si ,mask1, mask2);
-
-	for (i=0; i<4; i++) {
-		for (j=0; j<4;j++) {
-				m2[i][j] = m1[i][j]=pick_rand();
-		}
-	}
-	inv_mix_columns(m2);
-
 	//Prepare key for inverse scheduling by running the full direct schedule
 	for(i=1;i<=10;i++)
 	  key_schedule(key,i);
@@ -456,7 +449,7 @@ void maes_decrypt(uint8_t *a, uint8_t *key){
  */
 
 
-void sbox_lookup(uint8_t a[][4], uint8_t *myS){
+void sbox_lookup(uint8_t a[][4], const uint8_t *myS){
 	uint8_t i,j;
 
 	for(i=0;i<4;i++)
@@ -602,13 +595,7 @@ void get_state(uint8_t *a, uint8_t d[][4]){
 }
 
 uint8_t pick_rand(){
-	unsigned char ret;
-	RNG_Enable();
-	while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET)
-	{}
-	ret=(uint8_t) (RNG_GetRandomNumber() & 0xFF);
-	RNG_Disable();
-	return ret;
+	return (uint8_t) (entropy_get_word() & 0xFF);
 }
 
 void sbox_mask(uint8_t* Sm, uint8_t* So, uint8_t mask_in, uint8_t mask_out)
@@ -621,14 +608,7 @@ void sbox_mask(uint8_t* Sm, uint8_t* So, uint8_t mask_in, uint8_t mask_out)
 }
 
 void rndDelay(uint8_t painLevel){
-	uint32_t randomNumber;
-	RNG_Enable();
-	do{
-		//Get a random number
-		while (RNG_GetFlagStatus(RNG_FLAG_DRDY) == RESET){}
-		randomNumber= RNG_GetRandomNumber();
-	} while((randomNumber%painLevel)!=0);
-	RNG_Disable();
+	entropy_delay(painLevel * RANDOM_DELAY_ITERATIONS);
 }
 
 static void BlockCopy(uint8_t* output, uint8_t* input)
@@ -640,27 +620,90 @@ static void BlockCopy(uint8_t* output, uint8_t* input)
   }
 }
 
+//Draw a new set of masks and compute its masked S-box
+static void prepare_mask_set(mask_set_t *masks, uint8_t decrypt)
+{
+	uint8_t i,j;
+
+	masks->mask1 = pick_rand();
+	masks->mask2 = pick_rand();
+	for(i=0;i<4;i++) {
+		for(j=0;j<4;j++) {
+			masks->m2[i][j] = masks->m1[i][j] = pick_rand();
+		}
+	}
+	if(decrypt){
+		sbox_mask(masks->Smasked, Si, masks->mask1, masks->mask2);
+		inv_mix_columns(masks->m2);
+	} else {
+		sbox_mask(masks->Smasked, S, masks->mask1, masks->mask2);
+		mix_columns(masks->m2);
+	}
+}
+
+//The masks for the next block; the first block prepares both sets, before the trigger window
+static const mask_set_t *current_masks(mask_engine_t *engine, uint8_t decrypt)
+{
+	if(!engine->ready){
+		prepare_mask_set(&engine->sets[0], decrypt);
+		prepare_mask_set(&engine->sets[1], decrypt);
+		engine->active = 0;
+		engine->uses = 0;
+		engine->ready = 1;
+	}
+	return &engine->sets[engine->active];
+}
+
+//After a block, outside the trigger window: every maskRefreshBlocks blocks, switch to the other set and prepare new
+//masks in the one that was just used
+static void refresh_masks(mask_engine_t *engine, uint8_t decrypt)
+{
+	if(++engine->uses < maskRefreshBlocks){
+		return;
+	}
+	engine->active ^= 1;
+	engine->uses = 0;
+	prepare_mask_set(&engine->sets[engine->active ^ 1], decrypt);
+}
+
 /*****************************************************************************/
 /* Public functions:                                                         */
 /*****************************************************************************/
 
+uint16_t mAES128_set_mask_refresh(uint16_t blocks)
+{
+	if(blocks != 0){
+		maskRefreshBlocks = blocks;
+		encMaskEngine.uses = 0;
+		decMaskEngine.uses = 0;
+	}
+	return maskRefreshBlocks;
+}
+
 void mAES128_ECB_encrypt(uint8_t* input, uint8_t* key, uint8_t *output)
 {
+	const mask_set_t *masks;
 	cmflags=MASKED_SBOX;
+	masks = current_masks(&encMaskEngine, 0);
 	// The next function call encrypts the PlainText with the Key using AES algorithm.
-	GPIOC->BSRRL = GPIO_Pin_2; // Trigger goes high in pin PC2
-	maes_encrypt(input, key);
-	GPIOC->BSRRH = GPIO_Pin_2; // Trigger goes low in pin PC2
+	BEGIN_INTERESTING_STUFF; // Trigger goes high in pin PC2
+	maes_encrypt(input, key, masks);
+	END_INTERESTING_STUFF; // Trigger goes low in pin PC2
+	refresh_masks(&encMaskEngine, 0);
 	array_copy(output,input,16);
 
 }
 
 void mAES128_ECB_decrypt(uint8_t* input, uint8_t* key, uint8_t *output)
 {
+	const mask_set_t *masks;
+	cmflags=MASKED_SBOX;
+	masks = current_masks(&decMaskEngine, 1);
 	BlockCopy(output, input);
-	GPIOC->BSRRL = GPIO_Pin_2; // Trigger goes high in pin PC2
-	maes_decrypt(input, key);
-	GPIOC->BSRRH = GPIO_Pin_2; // Trigger goes low in pin PC2
+	BEGIN_INTERESTING_STUFF; // Trigger goes high in pin PC2
+	maes_decrypt(input, key, masks);
+	END_INTERESTING_STUFF; // Trigger goes low in pin PC2
+	refresh_masks(&decMaskEngine, 1);
 	array_copy(output,input,16);
 }
 
@@ -668,9 +711,9 @@ void AES128_ECB_encrypt_rndDelays(uint8_t* input, uint8_t* key, uint8_t *output)
 {
 	cmflags=RANDOM_DELAYS;
 	// The next function call encrypts the PlainText with the Key using AES algorithm.
-	GPIOC->BSRRL = GPIO_Pin_2; // Trigger goes high in pin PC2
+	BEGIN_INTERESTING_STUFF; // Trigger goes high in pin PC2
 	aes_encrypt(input, key);
-	GPIOC->BSRRH = GPIO_Pin_2; // Trigger goes low in pin PC2
+	END_INTERESTING_STUFF; // Trigger goes low in pin PC2
 	array_copy(output,input,16);
 }
 
@@ -678,9 +721,9 @@ void AES128_ECB_encrypt_rndSbox(uint8_t* input, uint8_t* key, uint8_t *output)
 {
 	cmflags=RANDOM_SBOX;
 	// The next function call encrypts the PlainText with the Key using AES algorithm.
-	GPIOC->BSRRL = GPIO_Pin_2; // Trigger goes high in pin PC2
+	BEGIN_INTERESTING_STUFF; // Trigger goes high in pin PC2
 	aes_encrypt(input, key);
-	GPIOC->BSRRH = GPIO_Pin_2; // Trigger goes low in pin PC2
+	END_INTERESTING_STUFF; // Trigger goes low in pin PC2
 	array_copy(output,input,16);
 }
 
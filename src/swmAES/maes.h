@@ -8,4 +8,9 @@ void mAES128_ECB_decrypt(uint8_t* input, uint8_t* key, uint8_t *output);
 void AES128_ECB_encrypt_rndDelays(uint8_t* input, uint8_t* key, uint8_t *output);
 void AES128_ECB_encrypt_rndSbox(uint8_t* input, uint8_t* key, uint8_t *output);
 
+//mAES128_set_mask_refresh: draw new masks (and a new masked S-box) for mAES128_ECB_encrypt/decrypt every blocks
+//blocks instead of for every block (1, the default). New masks are always prepared after a block, outside its trigger
+//window. Returns the interval in use; 0 leaves it unchanged.
+uint16_t mAES128_set_mask_refresh(uint16_t blocks);
+
 #endif //_MAES_H_
@@ -0,0 +1,54 @@
+#ifndef PINATABOARD_TRIGGER_H
+#define PINATABOARD_TRIGGER_H
+
+//Trigger signal on PC2: goes high right before the interesting operation and low right after it.
+//The host simulator (PinataSimulator) has no pins to toggle and turns both edges into event hooks instead.
+//On the board, the rising edge waits for a pending USART3 DMA transmission to leave and for the entropy pool to be
+//full again (see rng.h), so that the line and the TRNG are quiet during the operation.
+//Built with PINATA_CYCLE_COUNT (cmake -DCYCLE_COUNT=ON), the edges also sample the DWT cycle counter: right after
+//the rising edge and right before the falling one. triggerCycles then holds the CPU cycles of the last trigger
+//window (see CMD_GET_LAST_CYCLES).
+
+#ifdef PINATA_CYCLE_COUNT
+#include <stdint.h>
+extern volatile uint32_t triggerCycles;
+#endif
+
+#ifdef PINATA_HOST_SIMULATOR
+
+void simulator_trigger_begin(void);
+void simulator_trigger_end(void);
+
+#define BEGIN_INTERESTING_STUFF simulator_trigger_begin()
+#define END_INTERESTING_STUFF simulator_trigger_end()
+
+#else
+
+#include "stm32f4xx.h"
+#include "stm32f4xx_gpio.h"
+
+void usart_tx_drain(void);
+void entropy_fill(void);
+
+#ifdef PINATA_CYCLE_COUNT
+//The DWT registers are missing from this version of core_cm4.h
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+#define DWT_CTRL_CYCCNTENA 0x00000001
+#define TRIGGER_CYCLES_BEGIN triggerCycles = DWT_CYCCNT
+#define TRIGGER_CYCLES_END triggerCycles = DWT_CYCCNT - triggerCycles
+#else
+#define TRIGGER_CYCLES_BEGIN
+#define TRIGGER_CYCLES_END
+#endif
+
+// Set GPIO Pin 2 to high, once USART3 has sent everything and the entropy pool is full.
+#define BEGIN_INTERESTING_STUFF \
+	do { usart_tx_drain(); entropy_fill(); GPIOC->BSRRL = GPIO_Pin_2; TRIGGER_CYCLES_BEGIN; } while (0)
+
+// Set GPIO Pin 2 to low.
+#define END_INTERESTING_STUFF do { TRIGGER_CYCLES_END; GPIOC->BSRRH = GPIO_Pin_2; } while (0)
+
+#endif
+
+#endif //PINATABOARD_TRIGGER_H
@@ -625,6 +625,10 @@ static uint8_t  usbd_cdc_DataIn (void *pdev, uint8_t epnum)
     if (APP_Rx_length == 0) 
     {
       USB_Tx_State = 0;
+
+      /* Send what was written (or wrapped around) meanwhile right away instead
+         of waiting for the next CDC_IN_FRAME_INTERVAL */
+      Handle_USBAsynchXfer(pdev);
     }
     else 
     {
@@ -671,7 +675,12 @@ static uint8_t  usbd_cdc_DataOut (void *pdev, uint8_t epnum)
   
   /* USB data will be immediately processed, this allow next USB traffic being 
      NAKed till the end of the application Xfer */
-  APP_FOPS.pIf_DataRx(USB_Rx_Buffer, USB_Rx_Cnt);
+  if (APP_FOPS.pIf_DataRx(USB_Rx_Buffer, USB_Rx_Cnt) == USBD_BUSY)
+  {
+    /* The application has no room for another packet: leave the endpoint
+       unprepared, so that the host is NAKed until usbd_cdc_ResumeRx() */
+    return USBD_OK;
+  }
   
   /* Prepare Out endpoint to receive next packet */
   DCD_EP_PrepareRx(pdev,
@@ -682,6 +691,24 @@ static uint8_t  usbd_cdc_DataOut (void *pdev, uint8_t epnum)
   return USBD_OK;
 }
 
+/**
+  * @brief  usbd_cdc_ResumeRx
+  *         Prepare the Out endpoint again after pIf_DataRx returned USBD_BUSY
+  * @param  pdev: device instance
+  * @retval None
+  */
+void usbd_cdc_ResumeRx (void *pdev)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  DCD_EP_PrepareRx(pdev,
+                   CDC_OUT_EP,
+                   (uint8_t*)(USB_Rx_Buffer),
+                   CDC_DATA_OUT_PACKET_SIZE);
+  __set_PRIMASK(primask);
+}
+
 /**
   * @brief  usbd_audio_SOF
   *         Start Of Frame event management
@@ -705,6 +732,29 @@ static uint8_t  usbd_cdc_SOF (void *pdev)
   return USBD_OK;
 }
 
+/**
+  * @brief  usbd_cdc_Flush
+  *         Start sending the data in APP_Rx_Buffer now, without waiting for
+  *         the SOF handler. Does nothing while a transfer is in progress: its
+  *         DataIn handler picks up the remaining data.
+  * @param  pdev: instance
+  * @retval None
+  */
+void usbd_cdc_Flush (void *pdev)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  if (((USB_OTG_CORE_HANDLE*)pdev)->dev.device_status != USB_OTG_CONFIGURED)
+  {
+    return;
+  }
+
+  /* The SOF and DataIn interrupts run Handle_USBAsynchXfer too */
+  __disable_irq();
+  Handle_USBAsynchXfer(pdev);
+  __set_PRIMASK(primask);
+}
+
 /**
   * @brief  Handle_USBAsynchXfer
   *         Send data to USB
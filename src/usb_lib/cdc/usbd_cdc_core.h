@@ -121,6 +121,8 @@ extern USBD_Class_cb_TypeDef  USBD_CDC_cb;
 /** @defgroup USB_CORE_Exported_Functions
   * @{
   */
+void usbd_cdc_Flush (void *pdev);
+void usbd_cdc_ResumeRx (void *pdev);
 /**
   * @}
   */ 
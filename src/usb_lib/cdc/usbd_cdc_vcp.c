@@ -27,6 +27,8 @@
 #include "usbd_cdc_vcp.h"
 #include "stm32f4xx_conf.h"
 #include "stm32f4xx_usart.h"
+#include "usb_dcd.h"
+#include <string.h>
 
 /* Private variables ---------------------------------------------------------*/
 LINE_CODING linecoding = {
@@ -46,6 +48,21 @@ extern uint8_t APP_Rx_Buffer[]; /* Write CDC received data in this buffer.
 extern uint32_t APP_Rx_ptr_in; /* Increment this pointer or roll it back to
  start address when writing received data
  in the buffer APP_Rx_Buffer. */
+extern uint32_t APP_Rx_ptr_out; /* Advanced by the CDC core as the data is
+ handed to the IN endpoint. */
+
+/* The device handle, defined in main.h */
+extern USB_OTG_CORE_HANDLE USB_OTG_dev_main;
+
+/* Large enough for a whole ML-DSA key upload (5984 bytes). It lives in the
+ otherwise unused CCM RAM: the OTG FS core is not using DMA, so the CPU copies
+ every packet in. */
+#define APP_TX_BUF_SIZE 8192
+uint8_t APP_Tx_Buffer[APP_TX_BUF_SIZE] __attribute__((section(".ccmram")));
+volatile uint32_t APP_tx_ptr_head;
+volatile uint32_t APP_tx_ptr_tail;
+/* Set while the OUT endpoint is left unprepared because the buffer is full */
+volatile uint8_t APP_tx_paused;
 
 /* Private function prototypes -----------------------------------------------*/
 static uint16_t VCP_Init(void);
@@ -65,6 +82,11 @@ CDC_IF_Prop_TypeDef VCP_fops = { VCP_Init, VCP_DeInit, VCP_Ctrl, VCP_DataTx,
  * @retval Result of the opeartion (USBD_OK in all cases)
  */
 static uint16_t VCP_Init(void) {
+	/* The CDC core prepares the OUT endpoint for a new configuration: start
+	 with an empty receive buffer */
+	APP_tx_ptr_head = 0;
+	APP_tx_ptr_tail = 0;
+	APP_tx_paused = 0;
 	return USBD_OK;
 }
 
@@ -169,20 +191,59 @@ void VCP_send_buffer(uint8_t* buf, int len) {
  * @retval Result of the opeartion: USBD_OK if all operations are OK else VCP_FAIL
  */
 static uint16_t VCP_DataTx(uint8_t* Buf, uint32_t Len) {
-	uint32_t i = 0;
-	while (i < Len) {
-		APP_Rx_Buffer[APP_Rx_ptr_in] = *(Buf + i);
-		APP_Rx_ptr_in++;
-		i++;
+	uint32_t in, out, chunk;
+
+	while (Len > 0) {
+		in = APP_Rx_ptr_in;
+		out = *(volatile uint32_t *) &APP_Rx_ptr_out % APP_RX_DATA_SIZE;
+		/* Free space, keeping clear of the packet that may still be on its way
+		 to the IN endpoint just before APP_Rx_ptr_out */
+		chunk = (out + APP_RX_DATA_SIZE - in - 1) % APP_RX_DATA_SIZE;
+		chunk = chunk > CDC_DATA_MAX_PACKET_SIZE ? chunk - CDC_DATA_MAX_PACKET_SIZE : 0;
+		if (chunk == 0) {
+			if (USB_OTG_dev_main.dev.device_status != USB_OTG_CONFIGURED) {
+				/* Nobody will ever read it: overwrite the oldest data */
+				chunk = Len;
+			} else {
+				/* Wait for the host to take some of the buffered data */
+				usbd_cdc_Flush(&USB_OTG_dev_main);
+				continue;
+			}
+		}
+		if (chunk > Len) {
+			chunk = Len;
+		}
+		/* Copy up to the end of the buffer; the rest goes in the next round */
+		if (chunk > APP_RX_DATA_SIZE - in) {
+			chunk = APP_RX_DATA_SIZE - in;
+		}
+		memcpy(&APP_Rx_Buffer[in], Buf, chunk);
+		Buf += chunk;
+		Len -= chunk;
+		in += chunk;
 		/* To avoid buffer overflow */
-		if (APP_Rx_ptr_in == APP_RX_DATA_SIZE) {
-			APP_Rx_ptr_in = 0;
+		if (in == APP_RX_DATA_SIZE) {
+			in = 0;
 		}
+		/* The data must be in place before the CDC core can see it */
+		__DMB();
+		APP_Rx_ptr_in = in;
 	}
 
 	return USBD_OK;
 }
 
+/**
+ * @brief  VCP_flush
+ *         Hands the data written so far to the USB IN endpoint right away,
+ *         instead of waiting for up to CDC_IN_FRAME_INTERVAL frames.
+ * @param  None
+ * @retval None
+ */
+void VCP_flush(void) {
+	usbd_cdc_Flush(&USB_OTG_dev_main);
+}
+
 /**
  * @brief  VCP_DataRx
  *         Data received over USB OUT endpoint are sent over CDC interface
@@ -199,24 +260,39 @@ static uint16_t VCP_DataTx(uint8_t* Buf, uint32_t Len) {
  * @retval Result of the opeartion: USBD_OK if all operations are OK else VCP_FAIL
  */
 
-#define APP_TX_BUF_SIZE 128
-uint8_t APP_Tx_Buffer[APP_TX_BUF_SIZE];
-uint32_t APP_tx_ptr_head;
-uint32_t APP_tx_ptr_tail;
+/* Bytes that can still be stored in APP_Tx_Buffer */
+static uint32_t VCP_rx_space(void) {
+	return (APP_tx_ptr_tail + APP_TX_BUF_SIZE - APP_tx_ptr_head - 1)
+			% APP_TX_BUF_SIZE;
+}
+
+/* Let the host send again once the buffer can take a whole packet */
+static void VCP_rx_resume(void) {
+	if (APP_tx_paused && VCP_rx_space() >= CDC_DATA_MAX_PACKET_SIZE) {
+		APP_tx_paused = 0;
+		usbd_cdc_ResumeRx(&USB_OTG_dev_main);
+	}
+}
 
 static uint16_t VCP_DataRx(uint8_t* Buf, uint32_t Len) {
 	uint32_t i;
+	uint32_t head = APP_tx_ptr_head;
 
+	/* The endpoint is only prepared while there is room for a whole packet */
 	for (i = 0; i < Len; i++) {
-		APP_Tx_Buffer[APP_tx_ptr_head] = *(Buf + i);
-		APP_tx_ptr_head++;
-		if (APP_tx_ptr_head == APP_TX_BUF_SIZE)
-			APP_tx_ptr_head = 0;
-
-		if (APP_tx_ptr_head == APP_tx_ptr_tail)
-			return USBD_FAIL;
+		APP_Tx_Buffer[head] = *(Buf + i);
+		head++;
+		if (head == APP_TX_BUF_SIZE)
+			head = 0;
 	}
+	APP_tx_ptr_head = head;
 
+	/* Not enough room for the next packet: NAK the host until
+	 VCP_get_char() has made some */
+	if (VCP_rx_space() < CDC_DATA_MAX_PACKET_SIZE) {
+		APP_tx_paused = 1;
+		return USBD_BUSY;
+	}
 	return USBD_OK;
 }
 
@@ -225,10 +301,12 @@ int VCP_get_char(uint8_t *buf) {
 		return 0;
 
 	*buf = APP_Tx_Buffer[APP_tx_ptr_tail];
-	APP_tx_ptr_tail++;
-	if (APP_tx_ptr_tail == APP_TX_BUF_SIZE)
+	if (APP_tx_ptr_tail + 1 == APP_TX_BUF_SIZE)
 		APP_tx_ptr_tail = 0;
+	else
+		APP_tx_ptr_tail++;
 
+	VCP_rx_resume();
 	return 1;
 }
 
@@ -261,9 +339,11 @@ int VCP_get_string(uint8_t *buf) {
 			&& APP_Tx_Buffer[APP_tx_ptr_tail + i] != '\r');
 
 	*(buf + i) = 0;
-	APP_tx_ptr_tail += i;
-	if (APP_tx_ptr_tail >= APP_TX_BUF_SIZE)
-		APP_tx_ptr_tail -= APP_TX_BUF_SIZE;
+	if (APP_tx_ptr_tail + i >= APP_TX_BUF_SIZE)
+		APP_tx_ptr_tail += i - APP_TX_BUF_SIZE;
+	else
+		APP_tx_ptr_tail += i;
+	VCP_rx_resume();
 	return i;
 }
 
@@ -56,6 +56,7 @@ void VCP_send_str(uint8_t* buf);
 int VCP_get_char(uint8_t *buf);
 int VCP_get_string(uint8_t *buf);
 void VCP_send_buffer(uint8_t* buf, int len);
+void VCP_flush(void);
 
 #define DEFAULT_CONFIG                  0
 #define OTHER_CONFIG                    1